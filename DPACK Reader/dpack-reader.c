@@ -10,9 +10,48 @@
 #include <string.h>
 
 #include <stdint.h>
+#include <errno.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/ioctl.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+#endif
 
 #define MAGIC_CODE 1146110283
 
+/* Las entradas hasta este tamaño se leen completas a memoria: si ya están en el almacén no se escribe nada */
+#define DEDUP_MEMORY (16 * 1024 * 1024)
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+/* Cómo quedó cada ruta del paquete enlazada a su blob */
+enum {
+	LINK_HARD = 0,
+	LINK_REFLINK,
+	LINK_COPY,
+
+	LINK_NUM
+};
+
+typedef struct {
+	int entries;
+	int unique;
+	int repeated;
+	int errors;
+	int collisions;
+
+	uint64_t bytes;
+	uint64_t bytes_stored;
+	uint64_t bytes_saved;
+
+	int links[LINK_NUM];
+} DedupStats;
+
 uint32_t endian_32 (uint32_t num) {
 	unsigned char a[4];
 	unsigned char b[4];
@@ -54,7 +93,322 @@ void get_basename (char *file, char *basename) {
 	basename[g] = 0;
 }
 
-int main (int argc, char *argv[]) {
+/* FNV-1a de 64 bits, por partes mientras se lee la entrada */
+uint64_t hash_update (uint64_t hash, const unsigned char *data, size_t len) {
+	size_t g;
+
+	for (g = 0; g < len; g++) {
+		hash = (hash ^ data[g]) * FNV_PRIME;
+	}
+
+	return hash;
+}
+
+void make_dir (const char *path) {
+#ifdef _WIN32
+	mkdir (path);
+#else
+	mkdir (path, 0755);
+#endif
+}
+
+int write_all (int fd, const unsigned char *data, size_t len) {
+	ssize_t w;
+	size_t pos;
+
+	for (pos = 0; pos < len; pos += w) {
+		w = write (fd, data + pos, len - pos);
+		if (w < 0 && errno == EINTR) {
+			w = 0;
+		} else if (w <= 0) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+int copy_file (const char *from, const char *to) {
+	unsigned char buffer[65536];
+	ssize_t r;
+	int in, out;
+
+	in = open (from, _O_BINARY | _O_RDONLY);
+	if (in < 0) return -1;
+
+	out = open (to, _O_BINARY | O_WRONLY | O_CREAT | O_TRUNC, 0640);
+	if (out < 0) {
+		close (in);
+		return -1;
+	}
+
+	while ((r = read (in, buffer, sizeof (buffer))) > 0) {
+		if (write_all (out, buffer, r) < 0) {
+			r = -1;
+			break;
+		}
+	}
+
+	close (in);
+	if (close (out) < 0 || r < 0) {
+		unlink (to);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Lee len bytes salvo fin de archivo o error; devuelve cuántos leyó */
+ssize_t read_all (int fd, unsigned char *data, size_t len) {
+	ssize_t r;
+	size_t pos;
+
+	for (pos = 0; pos < len; pos += r) {
+		r = read (fd, data + pos, len - pos);
+		if (r < 0 && errno == EINTR) {
+			r = 0;
+		} else if (r <= 0) {
+			break;
+		}
+	}
+
+	return pos;
+}
+
+/* El mismo hash y tamaño no garantiza el mismo contenido: se compara byte por byte con el blob.
+ * La entrada está en data o, si no cupo en memoria, en el archivo tmp */
+int same_content (const char *blob, const unsigned char *data, const char *tmp, int len) {
+	unsigned char a[65536], b[65536];
+	ssize_t n;
+	int in, other, pos, same;
+
+	in = open (blob, _O_BINARY | _O_RDONLY);
+	if (in < 0) return 0;
+
+	other = -1;
+	if (data == NULL) {
+		other = open (tmp, _O_BINARY | _O_RDONLY);
+		if (other < 0) {
+			close (in);
+			return 0;
+		}
+	}
+
+	same = 1;
+	for (pos = 0; same && pos < len; pos += n) {
+		n = (len - pos < (int) sizeof (a) ? len - pos : (int) sizeof (a));
+		if (read_all (in, a, n) != n) {
+			same = 0;
+		} else if (data != NULL) {
+			same = (memcmp (a, data + pos, n) == 0);
+		} else {
+			same = (read_all (other, b, n) == n && memcmp (a, b, n) == 0);
+		}
+	}
+
+	/* El blob tampoco puede ser más largo */
+	if (same && read_all (in, a, 1) != 0) same = 0;
+
+	close (in);
+	if (other >= 0) close (other);
+
+	return same;
+}
+
+/* Un reflink es una copia independiente que comparte los bloques del blob (Btrfs, XFS) */
+int reflink_file (const char *from, const char *to) {
+#ifdef FICLONE
+	int in, out, g;
+
+	in = open (from, O_RDONLY);
+	if (in < 0) return -1;
+
+	out = open (to, O_WRONLY | O_CREAT | O_TRUNC, 0640);
+	if (out < 0) {
+		close (in);
+		return -1;
+	}
+
+	g = ioctl (out, FICLONE, in);
+	close (in);
+	close (out);
+
+	if (g < 0) {
+		unlink (to);
+		return -1;
+	}
+
+	return 0;
+#else
+	return -1;
+#endif
+}
+
+/* Deja "dest" apuntando al contenido del blob. Un enlace duro comparte el archivo;
+ * con reflink primero se intenta una copia que se puede modificar sin tocar el almacén */
+int link_entry (const char *blob, const char *dest, int reflink) {
+	/* Nunca escribir encima: la ruta puede ser ya un enlace a otro blob */
+	unlink (dest);
+
+	if (reflink && reflink_file (blob, dest) == 0) return LINK_REFLINK;
+
+#ifdef _WIN32
+	if (CreateHardLinkA (dest, blob, NULL)) return LINK_HARD;
+#else
+	if (link (blob, dest) == 0) return LINK_HARD;
+#endif
+
+	if (!reflink && reflink_file (blob, dest) == 0) return LINK_REFLINK;
+
+	if (copy_file (blob, dest) == 0) return LINK_COPY;
+
+	return -1;
+}
+
+/* Lee una entrada de len bytes calculando su hash mientras llega. El contenido se guarda una sola vez
+ * en store/xx/<hash>-<bytes>; si ya estaba no se escribe nada. Al final la ruta del paquete se enlaza al blob */
+int extract_dedup (int fd, int len, const char *store, const char *dest_file, int reflink, DedupStats *stats) {
+	static int counter = 0;
+	unsigned char chunk[65536];
+	unsigned char *data;
+	char blob[4096], tmp[4096];
+	uint64_t hash;
+	ssize_t bytes_read;
+	int pos, tmp_fd, stored, collision, method;
+
+	snprintf (tmp, sizeof (tmp), "%s/tmp-%li-%i", store, (long) getpid (), counter++);
+
+	hash = FNV_OFFSET;
+	data = NULL;
+	tmp_fd = -1;
+	pos = 0;
+	if (len <= DEDUP_MEMORY) {
+		/* Sin memoria la entrada sigue por el camino del temporal, no hay que dejarla a medias en el paquete */
+		data = (unsigned char *) malloc (len + 1);
+		if (data == NULL) printf ("Sin memoria para la entrada %s (%i bytes), se usa un temporal\n", dest_file, len);
+	}
+
+	if (data != NULL) {
+		while (pos < len) {
+			bytes_read = read (fd, data + pos, (len - pos < (int) sizeof (chunk) ? len - pos : (int) sizeof (chunk)));
+			if (bytes_read <= 0) break;
+
+			hash = hash_update (hash, data + pos, bytes_read);
+			pos += bytes_read;
+		}
+	} else {
+		/* Muy grande para memoria: va a un temporal del almacén mientras se calcula el hash */
+		tmp_fd = open (tmp, _O_BINARY | O_WRONLY | O_CREAT | O_TRUNC, 0640);
+		while (pos < len) {
+			bytes_read = read (fd, chunk, (len - pos < (int) sizeof (chunk) ? len - pos : (int) sizeof (chunk)));
+			if (bytes_read <= 0) break;
+
+			hash = hash_update (hash, chunk, bytes_read);
+			if (tmp_fd >= 0 && write_all (tmp_fd, chunk, bytes_read) < 0) {
+				close (tmp_fd);
+				tmp_fd = -1;
+			}
+			pos += bytes_read;
+		}
+		if (tmp_fd >= 0 && close (tmp_fd) < 0) tmp_fd = -1;
+		if (tmp_fd < 0) unlink (tmp);
+	}
+
+	if (pos < len || (data == NULL && tmp_fd < 0)) {
+		printf ("No se pudo leer la entrada %s\n", dest_file);
+		free (data);
+		stats->errors++;
+
+		return -1;
+	}
+
+	snprintf (blob, sizeof (blob), "%s/%02x", store, (unsigned int) (hash >> 56));
+	make_dir (blob);
+	snprintf (blob, sizeof (blob), "%s/%02x/%016llx-%i", store, (unsigned int) (hash >> 56), (unsigned long long) hash, len);
+
+	stats->entries++;
+	stats->bytes += len;
+
+	stored = 0;
+	collision = (access (blob, F_OK) == 0 && !same_content (blob, data, tmp, len));
+	if (collision || access (blob, F_OK) < 0) {
+		if (data != NULL) {
+			tmp_fd = open (tmp, _O_BINARY | O_WRONLY | O_CREAT | O_TRUNC, 0640);
+			if (tmp_fd < 0 || write_all (tmp_fd, data, len) < 0 || close (tmp_fd) < 0) {
+				perror ("Almacén");
+				unlink (tmp);
+				free (data);
+				stats->errors++;
+
+				return -1;
+			}
+		}
+
+		/* El blob aparece completo o no aparece; si otro proceso ganó, el suyo es igual */
+		if (!collision && rename (tmp, blob) == 0) {
+#ifndef _WIN32
+			/* De solo lectura: con enlaces duros, modificar una ruta extraída cambiaría todas */
+			chmod (blob, 0444);
+#endif
+			stored = 1;
+		}
+	}
+
+	if (collision) {
+		/* Otro contenido con el mismo nombre: esta entrada se extrae sola, sin pasar por el almacén */
+		printf ("Colisión de hash en %s, %s se extrae sin deduplicar\n", blob, dest_file);
+		method = link_entry (tmp, dest_file, 0);
+		unlink (tmp);
+		free (data);
+
+		stats->collisions++;
+		if (method < 0) {
+			perror ("Extraer");
+			stats->errors++;
+
+			return -1;
+		}
+		stats->links[LINK_COPY]++;
+
+		return 0;
+	}
+
+	unlink (tmp);
+	free (data);
+
+	if (stored) {
+		stats->unique++;
+		stats->bytes_stored += len;
+	} else {
+		stats->repeated++;
+		stats->bytes_saved += len;
+	}
+
+	method = link_entry (blob, dest_file, reflink);
+	if (method < 0) {
+		perror ("Enlazar");
+		printf ("No se pudo enlazar %s a %s\n", dest_file, blob);
+		stats->errors++;
+
+		return -1;
+	}
+	stats->links[method]++;
+
+	return 0;
+}
+
+void print_dedup_report (const char *store, DedupStats *stats) {
+	printf ("Almacén %s: %i entradas, %i nuevas, %i repetidas", store, stats->entries, stats->unique, stats->repeated);
+	if (stats->collisions > 0) printf (", %i colisiones de hash", stats->collisions);
+	if (stats->errors > 0) printf (", %i errores", stats->errors);
+	printf ("\n");
+
+	printf ("Bytes en los paquetes: %llu, escritos al almacén: %llu, ahorrados: %llu (%.1f%%)\n", (unsigned long long) stats->bytes, (unsigned long long) stats->bytes_stored, (unsigned long long) stats->bytes_saved, (stats->bytes > 0 ? 100.0 * stats->bytes_saved / stats->bytes : 0.0));
+	printf ("Rutas: %i enlaces duros, %i reflinks, %i copias\n", stats->links[LINK_HARD], stats->links[LINK_REFLINK], stats->links[LINK_COPY]);
+}
+
+/* Con store, cada entrada se guarda en el almacén y su ruta se enlaza, en vez de escribirla */
+int extract_dpack (char *archivo, int verbose, const char *store, int reflink, DedupStats *stats) {
 	int fd, subfd;
 
 	uint32_t temp;
@@ -70,13 +424,8 @@ int main (int argc, char *argv[]) {
 	size_t nbytes, wbytes;
 
 	int *lens;
-	if (argc < 2) {
-		printf ("Uso: %s [archivo]\n", argv[0]);
-
-		return 0;
-	}
 
-	get_basename (argv[1], basename);
+	get_basename (archivo, basename);
 
 #ifdef _WIN32
 	if (mkdir (basename) < 0) {
@@ -87,10 +436,10 @@ int main (int argc, char *argv[]) {
 		//return EXIT_FAILURE;
 	}
 
-	fd = open (argv[1], _O_BINARY | _O_RDONLY);
+	fd = open (archivo, _O_BINARY | _O_RDONLY);
 
 	if (fd < 0) {
-		printf ("Falló al abrir el archivo \"%s\"\n", argv[1]);
+		printf ("Falló al abrir el archivo \"%s\"\n", archivo);
 		return EXIT_FAILURE;
 	}
 
@@ -136,6 +485,15 @@ int main (int argc, char *argv[]) {
 	off_t post;
 	for (g = 0; g < archivos; g++) {
 		sprintf (dest_file, "%s/%s", basename, nombre[g]);
+
+		if (store != NULL) {
+			if (verbose) printf ("Leyendo el archivo %s al almacén. Total = %i\n", nombre[g], lens[g]);
+			extract_dedup (fd, lens[g], store, dest_file, reflink, stats);
+			continue;
+		}
+
+		/* La ruta puede ser un enlace al almacén de una extracción anterior: se reemplaza, no se trunca */
+		unlink (dest_file);
 		subfd = open (dest_file, _O_BINARY | O_WRONLY | O_CREAT | O_TRUNC, 0640);
 
 		if (subfd < 0) {
@@ -145,7 +503,7 @@ int main (int argc, char *argv[]) {
 		}
 
 		printf ("Leyendo el archivo %s. Total = %i\n", nombre[g], lens[g]);
-		r = lens[g];
+		r = lens[g];
 
 		while (r > 0) {
 			if (r < 1024) {
@@ -153,9 +511,9 @@ int main (int argc, char *argv[]) {
 			} else {
 				nbytes = 1024;
 			}
-			bytes_read = read (fd, buffer, nbytes);
+			bytes_read = read (fd, buffer, nbytes);
 
-			printf ("%i bytes leidos, restan %i\n", bytes_read, r);
+			if (verbose) printf ("%i bytes leidos, restan %i\n", bytes_read, r);
 			/*if (bytes_read <= 0) {
 				printf ("Deteniendo\n");
 				exit (2);
@@ -168,6 +526,67 @@ int main (int argc, char *argv[]) {
 		close (subfd);
 	}
 
+	for (g = 0; g < archivos; g++) {
+		free (nombre[g]);
+	}
+	free (nombre);
+	free (lens);
+
 	close (fd);
 	return 0;
 }
+
+int main (int argc, char *argv[]) {
+	DedupStats stats;
+	char *store;
+	char **paquetes;
+	int g, verbose, reflink, archivos, failed;
+
+	/* Con -v se imprime cada bloque leído, como antes */
+	verbose = 0;
+	reflink = 0;
+	store = NULL;
+	archivos = 0;
+	paquetes = (char **) malloc (argc * sizeof (char *));
+	for (g = 1; g < argc; g++) {
+		if (strcmp (argv[g], "-v") == 0) {
+			verbose = 1;
+		} else if (strncmp (argv[g], "--dedup=", 8) == 0) {
+			store = &argv[g][8];
+		} else if (strcmp (argv[g], "--reflink") == 0) {
+			reflink = 1;
+		} else {
+			paquetes[archivos++] = argv[g];
+		}
+	}
+
+	if (archivos == 0 || (store != NULL && store[0] == 0)) {
+		printf ("Uso: %s [-v] [--dedup=almacén [--reflink]] archivo...\n", argv[0]);
+		printf ("  -v               imprime cada bloque de 1 KB que se lee (sin --dedup)\n");
+		printf ("  --dedup=almacén  guarda cada contenido una sola vez en el almacén y enlaza las rutas\n");
+		printf ("  --reflink        con --dedup, usa reflinks en vez de enlaces duros si se puede\n");
+
+		free (paquetes);
+		return 0;
+	}
+
+	memset (&stats, 0, sizeof (stats));
+	if (store != NULL) {
+		make_dir (store);
+	}
+
+	/* Varios paquetes en una sola corrida comparten el almacén y el reporte */
+	failed = 0;
+	for (g = 0; g < archivos; g++) {
+		if (extract_dpack (paquetes[g], verbose, store, reflink, &stats) != 0) {
+			failed++;
+		}
+	}
+	free (paquetes);
+
+	if (store != NULL) {
+		print_dedup_report (store, &stats);
+	}
+
+	return (failed > 0 ? EXIT_FAILURE : 0);
+}
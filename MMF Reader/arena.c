@@ -0,0 +1,242 @@
+/*
+ * arena.c
+ * This file is part of BKV Reader
+ *
+ * Copyright (C) 2022 - Félix Arreola Rodríguez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <pthread.h>
+
+#include "arena.h"
+#include "stats.h"
+
+/* Cada bloque lleva su tamaño en los bytes anteriores, para poder copiarlo en mmf_realloc */
+#define ARENA_ALIGN 16
+
+typedef struct _ArenaChunk {
+	struct _ArenaChunk *next;
+	size_t size;
+	size_t used;
+	unsigned char *data;
+} ArenaChunk;
+
+struct _Arena {
+	ArenaChunk *chunks;
+
+	/* Los hilos del pool piden memoria a la vez mientras se lee un modelo */
+	pthread_mutex_t lock;
+
+	size_t high_water;
+	int system_allocs;
+};
+
+static __thread Arena *current_arena = NULL;
+
+static ArenaChunk *arena_chunk_new (Arena *arena, size_t size) {
+	ArenaChunk *chunk;
+
+	chunk = (ArenaChunk *) malloc (sizeof (ArenaChunk) + size + ARENA_ALIGN);
+	if (chunk == NULL) return NULL;
+
+	chunk->size = size;
+	chunk->used = 0;
+	chunk->data = (unsigned char *) (((uintptr_t) (chunk + 1) + ARENA_ALIGN - 1) & ~(uintptr_t) (ARENA_ALIGN - 1));
+	chunk->next = arena->chunks;
+	arena->chunks = chunk;
+	arena->system_allocs++;
+
+	return chunk;
+}
+
+Arena *arena_new (size_t initial) {
+	Arena *arena;
+
+	arena = (Arena *) malloc (sizeof (Arena));
+	memset (arena, 0, sizeof (Arena));
+	pthread_mutex_init (&arena->lock, NULL);
+
+	if (initial > 0) {
+		arena_chunk_new (arena, initial);
+	}
+
+	return arena;
+}
+
+static void arena_free_chunks (Arena *arena) {
+	ArenaChunk *chunk, *next;
+
+	for (chunk = arena->chunks; chunk != NULL; chunk = next) {
+		next = chunk->next;
+		free (chunk);
+	}
+	arena->chunks = NULL;
+}
+
+void arena_destroy (Arena *arena) {
+	if (arena == NULL) return;
+
+	if (current_arena == arena) current_arena = NULL;
+
+	arena_free_chunks (arena);
+	pthread_mutex_destroy (&arena->lock);
+	free (arena);
+}
+
+/* Olvida todo lo pedido. Si la última vuelta necesitó varios bloques, se cambian por uno solo
+ * del tamaño total, así la siguiente del mismo tamaño ya no llama a malloc */
+void arena_reset (Arena *arena) {
+	ArenaChunk *chunk;
+	size_t total;
+
+	total = 0;
+	for (chunk = arena->chunks; chunk != NULL; chunk = chunk->next) {
+		total += chunk->used;
+	}
+	if (total > arena->high_water) arena->high_water = total;
+
+	if (arena->chunks != NULL && arena->chunks->next == NULL && arena->chunks->size >= arena->high_water) {
+		arena->chunks->used = 0;
+		return;
+	}
+
+	arena_free_chunks (arena);
+	if (arena->high_water > 0) {
+		arena_chunk_new (arena, arena->high_water + arena->high_water / 4);
+	}
+}
+
+void *arena_alloc (Arena *arena, size_t size) {
+	ArenaChunk *chunk;
+	unsigned char *p;
+	size_t need, grow;
+
+	/* Un espacio alineado para el tamaño y luego los datos */
+	need = ARENA_ALIGN + ((size + ARENA_ALIGN - 1) / ARENA_ALIGN) * ARENA_ALIGN;
+
+	pthread_mutex_lock (&arena->lock);
+	chunk = arena->chunks;
+	if (chunk == NULL || chunk->size - chunk->used < need) {
+		/* Los bloques nuevos crecen al doble para no pedir muchos pequeños */
+		grow = (chunk != NULL ? chunk->size * 2 : 65536);
+		chunk = arena_chunk_new (arena, (need > grow ? need : grow));
+		if (chunk == NULL) {
+			pthread_mutex_unlock (&arena->lock);
+			return NULL;
+		}
+	}
+
+	p = chunk->data + chunk->used + ARENA_ALIGN;
+	((size_t *) p)[-1] = size;
+	chunk->used += need;
+	pthread_mutex_unlock (&arena->lock);
+
+	return p;
+}
+
+int arena_owns (Arena *arena, const void *ptr) {
+	ArenaChunk *chunk;
+	const unsigned char *p = (const unsigned char *) ptr;
+	int owns;
+
+	owns = 0;
+	pthread_mutex_lock (&arena->lock);
+	for (chunk = arena->chunks; chunk != NULL; chunk = chunk->next) {
+		if (p >= chunk->data && p < chunk->data + chunk->size) {
+			owns = 1;
+			break;
+		}
+	}
+	pthread_mutex_unlock (&arena->lock);
+
+	return owns;
+}
+
+size_t arena_get_capacity (Arena *arena) {
+	ArenaChunk *chunk;
+	size_t total;
+
+	total = 0;
+	for (chunk = arena->chunks; chunk != NULL; chunk = chunk->next) {
+		total += chunk->size;
+	}
+
+	return total;
+}
+
+int arena_get_system_allocs (Arena *arena) {
+	return arena->system_allocs;
+}
+
+void arena_set_current (Arena *arena) {
+	current_arena = arena;
+}
+
+Arena *arena_get_current (void) {
+	return current_arena;
+}
+
+void *mmf_malloc (size_t size) {
+	STATS_ALLOC ();
+
+	if (current_arena != NULL) {
+		return arena_alloc (current_arena, size);
+	}
+
+	return malloc (size);
+}
+
+void *mmf_realloc (void *ptr, size_t size) {
+	void *new_ptr;
+	size_t old_size;
+
+	STATS_ALLOC ();
+
+	if (current_arena == NULL || (ptr != NULL && !arena_owns (current_arena, ptr))) {
+		return realloc (ptr, size);
+	}
+
+	new_ptr = arena_alloc (current_arena, size);
+	if (ptr != NULL && new_ptr != NULL) {
+		old_size = ((size_t *) ptr)[-1];
+		memcpy (new_ptr, ptr, (old_size < size ? old_size : size));
+	}
+
+	return new_ptr;
+}
+
+char *mmf_strdup (const char *str) {
+	char *copy;
+	size_t len;
+
+	len = strlen (str) + 1;
+	copy = (char *) mmf_malloc (len);
+	if (copy != NULL) memcpy (copy, str, len);
+
+	return copy;
+}
+
+/* La memoria de la arena se recupera toda junta en arena_reset */
+void mmf_free (void *ptr) {
+	if (ptr == NULL) return;
+
+	if (current_arena != NULL && arena_owns (current_arena, ptr)) return;
+
+	free (ptr);
+}
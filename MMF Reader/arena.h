@@ -0,0 +1,25 @@
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <stddef.h>
+
+typedef struct _Arena Arena;
+
+Arena *arena_new (size_t initial);
+void arena_destroy (Arena *arena);
+void arena_reset (Arena *arena);
+void *arena_alloc (Arena *arena, size_t size);
+int arena_owns (Arena *arena, const void *ptr);
+size_t arena_get_capacity (Arena *arena);
+int arena_get_system_allocs (Arena *arena);
+
+void arena_set_current (Arena *arena);
+Arena *arena_get_current (void);
+
+/* Como malloc/free, pero toman memoria de la arena del hilo si hay una */
+void *mmf_malloc (size_t size);
+void *mmf_realloc (void *ptr, size_t size);
+char *mmf_strdup (const char *str);
+void mmf_free (void *ptr);
+
+#endif /* __ARENA_H__ */
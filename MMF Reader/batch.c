@@ -0,0 +1,282 @@
+/*
+ * batch.c
+ * This file is part of BKV Reader
+ *
+ * Copyright (C) 2022 - Félix Arreola Rodríguez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <unistd.h>
+
+#include "mmf.h"
+#include "pool.h"
+#include "batch.h"
+#include "arena.h"
+
+typedef struct {
+	char *folder;
+	char *output;
+	off_t size;
+
+	double ms;
+	int result;
+	int cached;
+} BatchJob;
+
+struct _Batch {
+	int threads;
+
+	/* Pool ya creado (el del daemon), NULL para crear uno solo para esta corrida */
+	ThreadPool *pool;
+
+	BatchJob *jobs;
+	int n_jobs;
+	int size;
+};
+
+static double now_ms (void) {
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static char *path_join (const char *a, const char *b, const char *ext) {
+	size_t len;
+	char *path;
+
+	len = strlen (a) + strlen (b) + (ext != NULL ? strlen (ext) + 1 : 0) + 2;
+	path = (char *) malloc (len);
+
+	if (ext != NULL) {
+		snprintf (path, len, "%s/%s.%s", a, b, ext);
+	} else {
+		snprintf (path, len, "%s/%s", a, b);
+	}
+
+	return path;
+}
+
+/* Crea todos los directorios que faltan antes del archivo de salida */
+static void make_parent_dirs (const char *file) {
+	char *path;
+	int g;
+
+	path = strdup (file);
+	for (g = 1; path[g] != 0; g++) {
+		if (path[g] != '/' && path[g] != '\\') continue;
+
+		path[g] = 0;
+#ifdef _WIN32
+		mkdir (path);
+#else
+		mkdir (path, 0755);
+#endif
+		path[g] = '/';
+	}
+
+	free (path);
+}
+
+static void batch_add_job (Batch *batch, const char *folder, const char *output, off_t size) {
+	BatchJob *job;
+
+	if (batch->n_jobs == batch->size) {
+		batch->size = (batch->size == 0 ? 64 : batch->size * 2);
+		batch->jobs = (BatchJob *) realloc (batch->jobs, sizeof (BatchJob) * batch->size);
+	}
+
+	job = &batch->jobs[batch->n_jobs];
+	memset (job, 0, sizeof (BatchJob));
+	job->folder = strdup (folder);
+	job->output = strdup (output);
+	job->size = size;
+
+	batch->n_jobs++;
+}
+
+/* Una carpeta con archivo "desc" es un modelo; las demás se recorren buscando modelos */
+static void batch_walk (Batch *batch, const char *dir, const char *output_base, const char *extension) {
+	DIR *d;
+	struct dirent *entry;
+	struct stat st;
+	char *path, *sub_output, *output;
+	off_t size;
+	int is_model;
+
+	d = opendir (dir);
+	if (d == NULL) {
+		fprintf (stderr, "%s: %s\n", dir, strerror (errno));
+		return;
+	}
+
+	is_model = 0;
+	size = 0;
+	while ((entry = readdir (d)) != NULL) {
+		if (strcmp (entry->d_name, ".") == 0 || strcmp (entry->d_name, "..") == 0) continue;
+
+		path = path_join (dir, entry->d_name, NULL);
+		if (stat (path, &st) == 0) {
+			if (S_ISDIR (st.st_mode)) {
+				sub_output = path_join (output_base, entry->d_name, NULL);
+				batch_walk (batch, path, sub_output, extension);
+				free (sub_output);
+			} else {
+				size += st.st_size;
+				if (strcmp (entry->d_name, "desc") == 0) is_model = 1;
+			}
+		}
+		free (path);
+	}
+	closedir (d);
+
+	if (is_model) {
+		output = (char *) malloc (strlen (output_base) + strlen (extension) + 2);
+		sprintf (output, "%s.%s", output_base, extension);
+		batch_add_job (batch, dir, output, size);
+		free (output);
+	}
+}
+
+static int job_compare_size (const void *a, const void *b) {
+	const BatchJob *ja = (const BatchJob *) a;
+	const BatchJob *jb = (const BatchJob *) b;
+
+	if (ja->size < jb->size) return -1;
+	if (ja->size > jb->size) return 1;
+
+	return 0;
+}
+
+static void batch_job_run (void *data) {
+	BatchJob *job = (BatchJob *) data;
+	Arena *prev_arena;
+	double start;
+
+	start = now_ms ();
+
+	/* Cada trabajo usa malloc normal aunque lo corra un hilo que ayuda desde un contexto con arena */
+	prev_arena = arena_get_current ();
+	arena_set_current (NULL);
+
+	make_parent_dirs (job->output);
+
+	/* Si las entradas no cambiaron, la salida anterior se reusa sin leer el modelo */
+	job->result = model_convert (job->folder, job->output);
+	if (job->result == 1) {
+		job->cached = 1;
+		job->result = 0;
+	}
+
+	arena_set_current (prev_arena);
+	job->ms = now_ms () - start;
+}
+
+Batch *batch_new (int threads) {
+	Batch *batch;
+
+	batch = (Batch *) malloc (sizeof (Batch));
+	memset (batch, 0, sizeof (Batch));
+
+	batch->threads = threads;
+
+	return batch;
+}
+
+void batch_add_tree (Batch *batch, const char *root, const char *output_base, const char *extension) {
+	batch_walk (batch, root, output_base, extension);
+}
+
+void batch_set_pool (Batch *batch, ThreadPool *pool) {
+	batch->pool = pool;
+}
+
+int batch_get_count (Batch *batch) {
+	return batch->n_jobs;
+}
+
+const char *batch_get_folder (Batch *batch, int job) {
+	return batch->jobs[job].folder;
+}
+
+const char *batch_get_output (Batch *batch, int job) {
+	return batch->jobs[job].output;
+}
+
+int batch_run (Batch *batch) {
+	ThreadPool *pool;
+	TaskGroup group;
+	double start, total;
+	int g, failed, cached;
+
+	/* Los más grandes se meten al final: cada hilo saca de la cola de su lista y empieza por ellos,
+	 * mientras los hilos libres roban los pequeños por la cabeza */
+	qsort (batch->jobs, batch->n_jobs, sizeof (BatchJob), job_compare_size);
+
+	pool = batch->pool;
+	if (pool == NULL) {
+		pool = pool_create (batch->threads);
+
+		/* Los archivos de cada modelo también se leen en el mismo pool */
+		load_model_set_pool (pool);
+	}
+	pool_group_init (&group);
+
+	start = now_ms ();
+	for (g = 0; g < batch->n_jobs; g++) {
+		pool_submit (pool, &group, batch_job_run, &batch->jobs[g]);
+	}
+	pool_wait (pool, &group);
+	total = now_ms () - start;
+
+	if (batch->pool == NULL) {
+		load_model_set_pool (NULL);
+		pool_destroy (pool);
+	}
+
+	failed = cached = 0;
+	for (g = 0; g < batch->n_jobs; g++) {
+		if (batch->jobs[g].result < 0) failed++;
+		if (batch->jobs[g].cached) cached++;
+
+		fprintf (stderr, "%10.1f ms  %s  %s\n", batch->jobs[g].ms, (batch->jobs[g].result < 0 ? "FAILED" : (batch->jobs[g].cached ? "cached" : "ok    ")), batch->jobs[g].folder);
+	}
+
+	fprintf (stderr, "%i models in %.2f s (%.1f models/s), %i from cache, %i failed\n", batch->n_jobs, total / 1000.0, (total > 0 ? batch->n_jobs * 1000.0 / total : 0.0), cached, failed);
+
+	return failed;
+}
+
+void batch_free (Batch *batch) {
+	int g;
+
+	for (g = 0; g < batch->n_jobs; g++) {
+		free (batch->jobs[g].folder);
+		free (batch->jobs[g].output);
+	}
+
+	free (batch->jobs);
+	free (batch);
+}
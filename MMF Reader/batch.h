@@ -0,0 +1,17 @@
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+#include "pool.h"
+
+typedef struct _Batch Batch;
+
+Batch *batch_new (int threads);
+void batch_add_tree (Batch *batch, const char *root, const char *output_base, const char *extension);
+void batch_set_pool (Batch *batch, ThreadPool *pool);
+int batch_get_count (Batch *batch);
+const char *batch_get_folder (Batch *batch, int job);
+const char *batch_get_output (Batch *batch, int job);
+int batch_run (Batch *batch);
+void batch_free (Batch *batch);
+
+#endif /* __BATCH_H__ */
@@ -0,0 +1,317 @@
+/*
+ * bench.c
+ * This file is part of BKV Reader
+ *
+ * Copyright (C) 2022 - Félix Arreola Rodríguez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+
+#include "mmf.h"
+#include "libmmf.h"
+#include "loader.h"
+#include "arena.h"
+#include "synth.h"
+#include "log.h"
+
+/* Mide por separado cada parte del lector sobre un modelo sintético, para comparar entre versiones */
+
+static const char *encoding_names[9] = {
+	"float",
+	"byte",
+	"byte signed",
+	"short",
+	"short signed",
+	"unencoded byte",
+	"unencoded byte signed",
+	"unencoded short",
+	"unencoded short signed"
+};
+
+static int iterations = 20;
+
+
+static double now_sec (void) {
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static off_t path_size (const char *folder, const char *name) {
+	char path[8192];
+	struct stat st;
+
+	if (name != NULL) {
+		snprintf (path, sizeof (path), "%s/%s", folder, name);
+	} else {
+		snprintf (path, sizeof (path), "%s", folder);
+	}
+
+	if (stat (path, &st) < 0) return 0;
+
+	return st.st_size;
+}
+
+/* El mejor tiempo de todas las vueltas, el menos afectado por el resto del sistema */
+static void bench_report (const char *name, double best, double bytes, double elements) {
+	printf ("%-32s %10.3f ms %10.1f MB/s %14.0f elem/s\n", name, best * 1000.0, bytes / best / (1024.0 * 1024.0), elements / best);
+}
+
+static void bench_read_bkv (char *folder) {
+	BKVDesc desc;
+	double start, t, best;
+	int g, tables;
+
+	best = 1e30;
+	tables = 0;
+	for (g = 0; g < iterations; g++) {
+		start = now_sec ();
+		read_bkv (&desc, folder, "desc");
+		t = now_sec () - start;
+
+		tables = desc.n_tables;
+		bkv_free (&desc);
+		if (t < best) best = t;
+	}
+
+	bench_report ("read_bkv", best, path_size (folder, "desc"), tables);
+}
+
+static void bench_vector (char *folder, int big_endian) {
+	MMFStream stream;
+	char path[8192 + 64], name[64];
+	float *array;
+	double start, t, best;
+	int g, encoding, count;
+
+	do_endian = big_endian;
+	for (encoding = 0; encoding < 9; encoding++) {
+		/* El VertexData N del modelo sintético usa la codificación N */
+		snprintf (path, sizeof (path), "%s/vertex-%i", folder, encoding);
+		if (stream_open (&stream, path) < 0) continue;
+
+		best = 1e30;
+		count = 0;
+		for (g = 0; g < iterations; g++) {
+			start = now_sec ();
+			count = read_vector_of_numbers (&array, &stream, encoding);
+			t = now_sec () - start;
+
+			mmf_free (array);
+			if (t < best) best = t;
+		}
+
+		snprintf (name, sizeof (name), "vector %s", encoding_names[encoding]);
+		bench_report (name, best, stream_size (&stream), count);
+		stream_close (&stream);
+	}
+}
+
+static void bench_indices (char *folder, int big_endian) {
+	char file[64], name[64];
+	uint32_t *index;
+	double start, t, best;
+	int g, mesh, count;
+
+	/* En el modo mezclado el index-0 es literal y el index-1 es RLE */
+	do_endian = big_endian;
+	for (mesh = 0; mesh < 2; mesh++) {
+		snprintf (file, sizeof (file), "index-%i", mesh);
+
+		best = 1e30;
+		count = 0;
+		for (g = 0; g < iterations; g++) {
+			index = NULL;
+			count = 0;
+
+			start = now_sec ();
+			read_indices (folder, file, &index, &count);
+			t = now_sec () - start;
+
+			mmf_free (index);
+			if (t < best) best = t;
+		}
+
+		snprintf (name, sizeof (name), "read_indices %s", (mesh == 0 ? "literal" : "RLE"));
+		bench_report (name, best, path_size (folder, file), count);
+	}
+}
+
+static void bench_open (MMFContext *context, char *folder, const char *dpack_path) {
+	double start, t, best_folder, best_dpack;
+	int g, files;
+
+	best_folder = best_dpack = 1e30;
+	files = 0;
+	for (g = 0; g < iterations; g++) {
+		start = now_sec ();
+		mmf_open_folder (context, folder);
+		t = now_sec () - start;
+		if (t < best_folder) best_folder = t;
+
+		start = now_sec ();
+		mmf_open_dpack (context, dpack_path);
+		t = now_sec () - start;
+		if (t < best_dpack) best_dpack = t;
+
+		files = mmf_get_vertex_data_count (context) + mmf_get_mesh_count (context);
+	}
+	mmf_close (context);
+
+	bench_report ("open folder", best_folder, path_size (dpack_path, NULL), files);
+	bench_report ("open dpack", best_dpack, path_size (dpack_path, NULL), files);
+}
+
+static void bench_export (MMFContext *context, char *folder, const char *dir, const char *ext) {
+	char output[8192 + 64], name[64];
+	double start, t, best;
+	int g, mesh, triangles;
+
+	if (mmf_open_folder (context, folder) < 0) return;
+
+	triangles = 0;
+	for (mesh = 0; mesh < mmf_get_mesh_count (context); mesh++) {
+		triangles += mmf_get_mesh (context, mesh)->num_index / 3;
+	}
+
+	snprintf (output, sizeof (output), "%s/bench.%s", dir, ext);
+
+	best = 1e30;
+	for (g = 0; g < iterations; g++) {
+		start = now_sec ();
+		mmf_export (context, output);
+		t = now_sec () - start;
+		if (t < best) best = t;
+	}
+	mmf_close (context);
+
+	snprintf (name, sizeof (name), "export %s", ext);
+	bench_report (name, best, path_size (output, NULL), triangles);
+	unlink (output);
+}
+
+static void remove_tree (const char *dir) {
+	DIR *d;
+	struct dirent *entry;
+	struct stat st;
+	char path[8192];
+
+	d = opendir (dir);
+	if (d == NULL) return;
+
+	while ((entry = readdir (d)) != NULL) {
+		if (strcmp (entry->d_name, ".") == 0 || strcmp (entry->d_name, "..") == 0) continue;
+
+		snprintf (path, sizeof (path), "%s/%s", dir, entry->d_name);
+		if (stat (path, &st) == 0 && S_ISDIR (st.st_mode)) {
+			remove_tree (path);
+		} else {
+			unlink (path);
+		}
+	}
+	closedir (d);
+
+	rmdir (dir);
+}
+
+int main (int argc, char *argv[]) {
+	SynthOptions options;
+	MMFContext *context;
+	char dir_template[] = "/tmp/mmf_bench.XXXXXX";
+	char folder[8192], dpack_path[8192];
+	const char *dir;
+	int g, keep;
+
+	synth_default_options (&options);
+	dir = NULL;
+	keep = 0;
+
+	for (g = 1; g < argc; g++) {
+		if (strncmp (argv[g], "--size=", 7) == 0) {
+			options.grid = atoi (&argv[g][7]);
+		} else if (strncmp (argv[g], "--meshes=", 9) == 0) {
+			options.meshes = atoi (&argv[g][9]);
+		} else if (strncmp (argv[g], "--iterations=", 13) == 0) {
+			iterations = atoi (&argv[g][13]);
+		} else if (strcmp (argv[g], "--big-endian") == 0) {
+			options.big_endian = 1;
+		} else if (strncmp (argv[g], "--dir=", 6) == 0) {
+			dir = &argv[g][6];
+			keep = 1;
+		} else {
+			fprintf (stderr, "Usage: %s [--size=N] [--meshes=N] [--iterations=N] [--big-endian] [--dir=DIR]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (options.grid < 3) options.grid = 3;
+	if (options.meshes < 2) options.meshes = 2;
+	if (iterations < 1) iterations = 1;
+
+	if (dir == NULL) {
+		dir = mkdtemp (dir_template);
+		if (dir == NULL) {
+			perror ("mkdtemp");
+			return EXIT_FAILURE;
+		}
+	} else {
+#ifdef _WIN32
+		mkdir (dir);
+#else
+		mkdir (dir, 0755);
+#endif
+	}
+
+	snprintf (folder, sizeof (folder), "%s/model", dir);
+	snprintf (dpack_path, sizeof (dpack_path), "%s/model.dpack", dir);
+
+	if (synth_model (folder, &options) < 0 || synth_dpack (folder, dpack_path) < 0) {
+		perror ("Synthetic model");
+		if (!keep) remove_tree (dir);
+		return EXIT_FAILURE;
+	}
+
+	/* Solo advertencias mientras se mide: los diagnósticos del lector no cuentan en los tiempos */
+	log_set_level (LOG_WARN);
+
+	printf ("Synthetic model: %ix%i grid, %i vertex datas, %i meshes, %s, %i iterations (best)\n", options.grid, options.grid, options.vertex_datas, options.meshes, (options.big_endian ? "big endian" : "little endian"), iterations);
+
+	context = mmf_context_create ();
+
+	bench_read_bkv (folder);
+	bench_vector (folder, options.big_endian);
+	bench_indices (folder, options.big_endian);
+	bench_open (context, folder, dpack_path);
+	bench_export (context, folder, dir, "obj");
+	bench_export (context, folder, dir, "glb");
+
+	mmf_context_destroy (context);
+
+	if (!keep) remove_tree (dir);
+
+	return 0;
+}
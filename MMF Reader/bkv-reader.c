@@ -21,95 +21,54 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <fcntl.h>
 #include <stdint.h>
 #include <unistd.h>
-
-#include "ui.h"
-
-typedef struct {
-	uint16_t pos;
-	char *word;
-} DictWord;
-
-typedef struct _Table Table;
-
-typedef struct {
-	uint32_t name_pos;
-	char *name;
-
-	uint8_t type;
-
-	union {
-		uint8_t boolean;
-		uint8_t byte;
-		float flotante;
-		uint16_t short_int;
-		uint32_t integer;
-		char *string;
-
-		Table *table;
-	} value;
-} TableEntry;
-
-struct _Table {
-	uint16_t pos;
-	int n_entries;
-	TableEntry *entries;
-};
-
-typedef struct {
-	float translation[3];
-
-	float rotation[4];
-
-	float scale;
-} Transform;
-
-typedef struct {
-	int n_words;
-	DictWord *words;
-
-	int n_tables;
-	Table *tables;
-
-	Table *root_table;
-
-	int n_transforms;
-	Transform *transforms;
-} BKVDesc;
-
-typedef struct {
-	int id;
-	char *name;
-	int vertex_data_id;
-	int renderable;
-	int material;
-	int back_face_culling;
-	int max_influences;
-
-	uint32_t *index;
-	int num_index;
-} MeshData;
-
-typedef struct {
-	float *vertex;
-	int num;
-} VertexData;
-
-enum {
-	ENCODING_NONE = 0,
-	ENCODING_BYTE = 1,
-	ENCODING_BYTE_SIGNED = 2,
-	ENCODING_SHORT = 3,
-	ENCODING_SHORT_SIGNED = 4,
-	UNENCODED_BYTE = 5,
-	UNENCODED_BYTE_SIGNED = 6,
-	UNENCODED_SHORT = 7,
-	UNENCODED_SHORT_SIGNED = 8
-};
-
-int do_endian = 0;
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+
+#include "mmf.h"
+#include "gltf.h"
+#include "optimize.h"
+#include "normals.h"
+#include "bounds.h"
+#include "bvh.h"
+#include "lod.h"
+#include "blend.h"
+#include "material.h"
+#include "scene.h"
+#include "bundle.h"
+#include "pool.h"
+#include "loader.h"
+#include "arena.h"
+#include "streaming.h"
+#include "cache.h"
+#include "stats.h"
+#include "log.h"
+
+/* Cada hilo convierte su propio modelo */
+__thread int do_endian = 0;
+int keep_quantized = 0;
+int compact = 0;
+int weld = 0;
+float weld_tolerance = 0.0;
+int optimize_cache = 0;
+int generate_normals = 1;
+int write_bvh = 0;
+int lod_levels = 0;
+float lod_ratio = 0.5;
+int preload_method = PRELOAD_NONE;
+
+/* Con --stream, memoria máxima para los vertex e index decodificados a la vez; 0 sin streaming */
+size_t stream_budget = 0;
+
+/* Salidas ya convertidas, por hash de las entradas; NULL sin caché */
+Cache *cache = NULL;
+
+/* Hilos para leer en paralelo los vertex-N e index-N de un modelo, NULL para leerlos en serie */
+ThreadPool *load_pool = NULL;
 
 uint32_t endian_32 (uint32_t num) {
 	unsigned char a[4];
@@ -167,20 +126,20 @@ Table *bkv_get_table (BKVDesc *bkv_desc, int pos) {
 	return NULL;
 }
 
-#define TRY_READ_OR_GOTO(fd, buffer, bytes, location) \
+#define TRY_READ_OR_GOTO(stream, buffer, bytes, location) \
 	do { \
-	if (read (fd, buffer, bytes) < bytes) { \
-		printf ("Could not read %i bytes from file\n", bytes); \
+	if (stream_read (stream, buffer, bytes) < bytes) { \
+		log_warn ("Could not read %i bytes from file\n", (int) (bytes)); \
 		goto location; \
 	} \
 	} while (0)
 
-int read_bkv (BKVDesc *bkv_desc, char *folder, char *filename) {
+/* Lee el BKV de un archivo ya abierto; el stream siempre se cierra */
+int read_bkv_stream (BKVDesc *bkv_desc, MMFStream *stream) {
 	uint32_t t32, *p32;
 	uint16_t t16, *p16;
 	uint8_t t8, *p8;
 	float *pf;
-	int fd_desc;
 
 	int g, h;
 
@@ -191,8 +150,6 @@ int read_bkv (BKVDesc *bkv_desc, char *folder, char *filename) {
 	int bytes_tables;
 	unsigned char *tables;
 
-	unsigned char buffer[8192];
-
 	int *string_places;
 
 	int values_count;
@@ -200,19 +157,9 @@ int read_bkv (BKVDesc *bkv_desc, char *folder, char *filename) {
 
 	Table *current_table;
 
-	snprintf (buffer, sizeof (buffer), "%s/%s", folder, filename);
+	memset (bkv_desc, 0, sizeof (BKVDesc));
 
-	fd_desc = open (buffer, O_RDONLY
-#ifdef _WIN32
-	| _O_BINARY
-#endif
-	);
-
-	if (fd_desc < 0) {
-		return -1;
-	}
-
-	TRY_READ_OR_GOTO (fd_desc, &t32, 4, error_desc);
+	TRY_READ_OR_GOTO (stream, &t32, 4, error_desc);
 
 	p8 = (uint8_t *) &t32;
 
@@ -221,44 +168,45 @@ int read_bkv (BKVDesc *bkv_desc, char *folder, char *filename) {
 	} else if (p8[0] == '$' && p8[1] == 'B' && p8[2] == 'K' && p8[3] == 'V') {
 		do_endian = 0;
 	} else {
-		printf ("No good $BKV/VKB$ signature header\n");
+		log_warn ("No good $BKV/VKB$ signature header\n");
 		goto error_desc;
 	}
+	bkv_desc->do_endian = do_endian;
 
-	TRY_READ_OR_GOTO (fd_desc, &t8, 1, error_desc);
+	TRY_READ_OR_GOTO (stream, &t8, 1, error_desc);
 	if (t8 != 0) {
-		printf ("Version error\n");
+		log_warn ("Version error\n");
 
 		goto error_desc;
 	}
 
 	/* Omitir un byte */
-	TRY_READ_OR_GOTO (fd_desc, &t8, 1, error_desc);
+	TRY_READ_OR_GOTO (stream, &t8, 1, error_desc);
 
 	/* Leer la cantidad de bytes en las cadenas */
-	TRY_READ_OR_GOTO (fd_desc, &t32, 4, error_desc);
+	TRY_READ_OR_GOTO (stream, &t32, 4, error_desc);
 
 	bytes_strings = t32;
-	strings = (unsigned char *) malloc (bytes_strings);
-	TRY_READ_OR_GOTO (fd_desc, strings, bytes_strings, error_desc);
+	strings = (unsigned char *) mmf_malloc (bytes_strings);
+	TRY_READ_OR_GOTO (stream, strings, bytes_strings, error_desc);
 
 	/* Leer la cantidad de bytes en los arreglos */
-	TRY_READ_OR_GOTO (fd_desc, &t32, 4, error_desc);
+	TRY_READ_OR_GOTO (stream, &t32, 4, error_desc);
 
 	bytes_arrays = t32;
-	arrays = (unsigned char *) malloc (bytes_arrays);
-	TRY_READ_OR_GOTO (fd_desc, arrays, bytes_arrays, error_desc);
+	arrays = (unsigned char *) mmf_malloc (bytes_arrays);
+	TRY_READ_OR_GOTO (stream, arrays, bytes_arrays, error_desc);
 
 	/* Leer la cantidad de bytes de las tablas */
-	TRY_READ_OR_GOTO (fd_desc, &t32, 4, error_desc);
+	TRY_READ_OR_GOTO (stream, &t32, 4, error_desc);
 
 	bytes_tables = t32;
-	tables = (unsigned char *) malloc (bytes_tables);
-	TRY_READ_OR_GOTO (fd_desc, tables, bytes_tables, error_desc);
+	tables = (unsigned char *) mmf_malloc (bytes_tables);
+	TRY_READ_OR_GOTO (stream, tables, bytes_tables, error_desc);
 
-	close (fd_desc);
+	stream_close (stream);
 
-	string_places = (int *) malloc (sizeof (int) * bytes_strings);
+	string_places = (int *) mmf_malloc (sizeof (int) * bytes_strings);
 	memset (string_places, 0, sizeof (int) * bytes_strings);
 
 	/* Empezar a contar primero la cantidad de cadenas, y buscar en las tablas por referencias "secundarias" */
@@ -309,7 +257,7 @@ int read_bkv (BKVDesc *bkv_desc, char *folder, char *filename) {
 					break;
 				case 8:
 				case 9:
-					printf ("Error.\n");
+					log_warn ("Error.\n");
 					break;
 			}
 		}
@@ -323,21 +271,21 @@ int read_bkv (BKVDesc *bkv_desc, char *folder, char *filename) {
 		}
 	}
 
-	bkv_desc->words = (DictWord *) malloc (sizeof (DictWord) * bkv_desc->n_words);
+	bkv_desc->words = (DictWord *) mmf_malloc (sizeof (DictWord) * bkv_desc->n_words);
 	h = 0;
 	for (g = 0; g < bytes_strings; g++) {
 		if (string_places[g] == 1) {
 			bkv_desc->words[h].pos = g;
-			bkv_desc->words[h].word = (char *) strdup (&strings[g]);
+			bkv_desc->words[h].word = (char *) mmf_strdup (&strings[g]);
 			h++;
 		}
 	}
 
-	free (string_places);
+	mmf_free (string_places);
 
 	/* Siguiente paso, leer las tablas */
 	bkv_desc->n_tables = tables_count;
-	bkv_desc->tables = (Table *) malloc (sizeof (Table) * tables_count);
+	bkv_desc->tables = (Table *) mmf_malloc (sizeof (Table) * tables_count);
 
 	/* bkv_get_word */
 	g = 0;
@@ -350,7 +298,7 @@ int read_bkv (BKVDesc *bkv_desc, char *folder, char *filename) {
 		g += 2;
 
 		current_table->n_entries = *p16;
-		current_table->entries = (TableEntry *) malloc (sizeof (TableEntry) * current_table->n_entries);
+		current_table->entries = (TableEntry *) mmf_malloc (sizeof (TableEntry) * current_table->n_entries);
 
 		for (h = 0; h < current_table->n_entries; h++) {
 			p16 = (uint16_t *) &tables[g];
@@ -418,19 +366,34 @@ int read_bkv (BKVDesc *bkv_desc, char *folder, char *filename) {
 		}
 	}
 
-	free (strings);
-	free (arrays);
-	free (tables);
+	mmf_free (strings);
+	mmf_free (arrays);
+	mmf_free (tables);
 
-	bkv_desc->root_table = &bkv_desc->root_table[0];
+	bkv_desc->root_table = &bkv_desc->tables[0];
 
 	return 0;
 error_desc:
-	close (fd_desc);
+	stream_close (stream);
 
 	return -1;
 }
 
+int read_bkv (BKVDesc *bkv_desc, char *folder, char *filename) {
+	MMFStream stream;
+	char path[8192];
+
+	memset (bkv_desc, 0, sizeof (BKVDesc));
+
+	snprintf (path, sizeof (path), "%s/%s", folder, filename);
+
+	if (stream_open (&stream, path) < 0) {
+		return -1;
+	}
+
+	return read_bkv_stream (bkv_desc, &stream);
+}
+
 void print_table (Table *table, char *tab) {
 	char buffer_tab[512];
 	int g;
@@ -443,41 +406,41 @@ void print_table (Table *table, char *tab) {
 
 		if (entry->name_pos & 0x8000) {
 			/* Es un arreglo */
-			printf ("%s[%i] => ", tab, entry->name_pos - 0x8000);
+			log_debug ("%s[%i] => ", tab, entry->name_pos - 0x8000);
 		} else {
-			printf ("%s'%s' => ", tab, entry->name);
+			log_debug ("%s'%s' => ", tab, entry->name);
 		}
 
 		switch (entry->type) {
 			case 0:
-				printf ("FALSE,\n");
+				log_debug ("FALSE,\n");
 				break;
 			case 1:
-				printf ("TRUE,\n");
+				log_debug ("TRUE,\n");
 				break;
 			case 2:
-				printf ("%.2f,\n", entry->value.flotante);
+				log_debug ("%.2f,\n", entry->value.flotante);
 				break;
 			case 3:
-				printf ("%i,\n", entry->value.byte);
+				log_debug ("%i,\n", entry->value.byte);
 				break;
 			case 4:
-				printf ("%i,\n", entry->value.short_int);
+				log_debug ("%i,\n", entry->value.short_int);
 				break;
 			case 5:
-				printf ("%i,\n", entry->value.integer);
+				log_debug ("%i,\n", entry->value.integer);
 				break;
 			case 6:
-				printf ("\"%s\",\n", entry->value.string);
+				log_debug ("\"%s\",\n", entry->value.string);
 				break;
 			case 7:
-				printf ("{\n");
+				log_debug ("{\n");
 				print_table (entry->value.table, buffer_tab);
-				printf ("%s},\n", tab);
+				log_debug ("%s},\n", tab);
 				break;
 			case 8:
 			case 9:
-				printf ("UNKNOWN,\n");
+				log_debug ("UNKNOWN,\n");
 				break;
 		}
 	}
@@ -485,7 +448,7 @@ void print_table (Table *table, char *tab) {
 
 void read_transform (BKVDesc *bkv_desc, char *folder) {
 	unsigned char buffer[8192];
-	int fd_trans;
+	MMFStream stream_trans;
 	uint8_t t8, byte_loc2, *p8;
 	uint16_t t16, cant, *p16;
 	uint32_t t32, *p32;
@@ -502,17 +465,11 @@ void read_transform (BKVDesc *bkv_desc, char *folder) {
 
 	snprintf (buffer, sizeof (buffer), "%s/transform", folder);
 
-	fd_trans = open (buffer, O_RDONLY
-#ifdef _WIN32
-	| _O_BINARY
-#endif
-	);
-
-	if (fd_trans < 0) {
+	if (stream_open (&stream_trans, buffer) < 0) {
 		return;
 	}
 
-	TRY_READ_OR_GOTO (fd_trans, &t8, 1, error_trans);
+	TRY_READ_OR_GOTO (&stream_trans, &t8, 1, error_trans);
 	byte_loc2 = t8;
 
 	if (byte_loc2 == ENCODING_BYTE) {
@@ -529,15 +486,16 @@ void read_transform (BKVDesc *bkv_desc, char *folder) {
 		element_size = 2;
 		/* SIGNED Short / 32767 */
 	} else {
-		printf ("---> Unhandled Transform type: %i\n", byte_loc2);
+		log_warn ("---> Unhandled Transform type: %i\n", byte_loc2);
 	}
 
-	TRY_READ_OR_GOTO (fd_trans, &t16, 2, error_trans);
+	TRY_READ_OR_GOTO (&stream_trans, &t16, 2, error_trans);
 	cant = endian_16 (t16);
 
-	printf ("Cant of transform pool: %i\n", cant);
+	log_debug ("Cant of transform pool: %i\n", cant);
 	bkv_desc->n_transforms = cant;
-	bkv_desc->transforms = (Transform *) malloc (sizeof (Transform) * cant);
+	bkv_desc->transforms = (Transform *) mmf_malloc (sizeof (Transform) * cant);
+	memset (bkv_desc->transforms, 0, sizeof (Transform) * cant);
 
 	for (g = 0; g < cant; g++) {
 		/* Leer:
@@ -547,9 +505,9 @@ void read_transform (BKVDesc *bkv_desc, char *folder) {
 		 */
 		current_t = &bkv_desc->transforms[g];
 
-		printf ("Transformation [%i] =\n", g);
+		log_debug ("Transformation [%i] =\n", g);
 
-		TRY_READ_OR_GOTO (fd_trans, buffer, (3 * sizeof (float)), error_trans);
+		TRY_READ_OR_GOTO (&stream_trans, buffer, (3 * sizeof (float)), error_trans);
 		/* Voltear el endianess */
 		p32 = (uint32_t *) buffer;
 		p32[0] = endian_32 (p32[0]);
@@ -557,12 +515,12 @@ void read_transform (BKVDesc *bkv_desc, char *folder) {
 		p32[2] = endian_32 (p32[2]);
 		pf = (float *) buffer;
 
-		printf ("\tTranslation: %.2f, %.2f, %.2f\n", pf[0], pf[1], pf[2]);
+		log_debug ("\tTranslation: %.2f, %.2f, %.2f\n", pf[0], pf[1], pf[2]);
 		current_t->translation[0] = pf[0];
 		current_t->translation[1] = pf[1];
 		current_t->translation[2] = pf[2];
 
-		TRY_READ_OR_GOTO (fd_trans, buffer, 4 * element_size, error_trans);
+		TRY_READ_OR_GOTO (&stream_trans, buffer, 4 * element_size, error_trans);
 		if (byte_loc2 == 1) {
 			p8 = (int8_t *) buffer;
 			floats[0] = ((float) p8[0]) / 255.0;
@@ -596,31 +554,31 @@ void read_transform (BKVDesc *bkv_desc, char *folder) {
 			floats[2] = ((float) s16[2]) / 32767.0;
 			floats[3] = ((float) s16[3]) / 32767.0;
 		}
-		printf ("\tRotation: %.4f, %.4f, %.4f, %.4f\n", floats[0], floats[1], floats[2], floats[3]);
-		current_t->rotation[0] = pf[0];
-		current_t->rotation[1] = pf[1];
-		current_t->rotation[2] = pf[2];
-		current_t->rotation[3] = pf[3];
+		log_debug ("\tRotation: %.4f, %.4f, %.4f, %.4f\n", floats[0], floats[1], floats[2], floats[3]);
+		current_t->rotation[0] = floats[0];
+		current_t->rotation[1] = floats[1];
+		current_t->rotation[2] = floats[2];
+		current_t->rotation[3] = floats[3];
 
-		TRY_READ_OR_GOTO (fd_trans, buffer, sizeof (float), error_trans);
+		TRY_READ_OR_GOTO (&stream_trans, buffer, sizeof (float), error_trans);
 
 		p32 = (uint32_t *) buffer;
 		p32[0] = endian_32 (p32[0]);
 		pf = (float *) buffer;
-		printf ("\tScale: %.2f\n", pf[0]);
+		log_debug ("\tScale: %.2f\n", pf[0]);
 		current_t->scale = pf[0];
 	}
 
-	close (fd_trans);
+	stream_close (&stream_trans);
 
 	return;
 error_trans:
-	printf ("Skipping....\n");
-	close (fd_trans);
+	log_warn ("Skipping....\n");
+	stream_close (&stream_trans);
 }
 
 void read_skeleton (BKVDesc *bkv_desc, char *folder) {
-	int fd_skel;
+	MMFStream stream_skel;
 	unsigned char buffer[8192];
 	uint8_t u8, *p8;
 	uint16_t u16, *p16;
@@ -628,57 +586,68 @@ void read_skeleton (BKVDesc *bkv_desc, char *folder) {
 	int bones;
 	int g, h;
 	char name[512];
+	Bone *current_b;
 
 	snprintf (buffer, sizeof (buffer), "%s/skeleton", folder);
 
-	fd_skel = open (buffer, O_RDONLY
-#ifdef _WIN32
-	| _O_BINARY
-#endif
-	);
-
-	if (fd_skel < 0) {
+	if (stream_open (&stream_skel, buffer) < 0) {
 		return;
 	}
 
-	TRY_READ_OR_GOTO (fd_skel, &u8, 1, error_skeleton);
+	TRY_READ_OR_GOTO (&stream_skel, &u8, 1, error_skeleton);
 	bones = u8;
 
+	bkv_desc->bones = (Bone *) mmf_malloc (sizeof (Bone) * bones);
+	memset (bkv_desc->bones, 0, sizeof (Bone) * bones);
+
 	for (g = 0; g < bones; g++) {
-		TRY_READ_OR_GOTO (fd_skel, &u16, 2, error_skeleton);
+		current_b = &bkv_desc->bones[g];
+
+		TRY_READ_OR_GOTO (&stream_skel, &u16, 2, error_skeleton);
 		u16 = endian_16 (u16);
-		TRY_READ_OR_GOTO (fd_skel, name, u16, error_skeleton);
+		if (u16 >= sizeof (name)) {
+			log_warn ("Bone name too long\n");
+			goto error_skeleton;
+		}
+		TRY_READ_OR_GOTO (&stream_skel, name, u16, error_skeleton);
 		name[u16] = 0;
-		printf ("Skeleton[%i]: %s\n", g, name);
+		log_debug ("Skeleton[%i]: %s\n", g, name);
 
-		TRY_READ_OR_GOTO (fd_skel, &u8, 1, error_skeleton);
-		printf (" -> Parent: %i\n", u8);
+		current_b->name = mmf_strdup (name);
+		/* Contar el hueso hasta que tenga nombre, así un archivo truncado no deja huesos vacíos */
+		bkv_desc->n_bones = g + 1;
 
-		TRY_READ_OR_GOTO (fd_skel, &u8, 1, error_skeleton);
-		printf ("Childs count: %i\n", u8);
+		TRY_READ_OR_GOTO (&stream_skel, &u8, 1, error_skeleton);
+		log_debug (" -> Parent: %i\n", u8);
+		current_b->parent = u8;
+
+		TRY_READ_OR_GOTO (&stream_skel, &u8, 1, error_skeleton);
+		log_debug ("Childs count: %i\n", u8);
 		uint8_t childs = u8;
 
 		if (childs > 0) {
 			for (h = 0; h < childs; h++) {
-				TRY_READ_OR_GOTO (fd_skel, &u8, 1, error_skeleton);
-				printf ("\tChild: %i\n", u8);
+				TRY_READ_OR_GOTO (&stream_skel, &u8, 1, error_skeleton);
+				log_debug ("\tChild: %i\n", u8);
 			}
 		}
 
-		TRY_READ_OR_GOTO (fd_skel, &u16, 2, error_skeleton);
+		TRY_READ_OR_GOTO (&stream_skel, &u16, 2, error_skeleton);
 		u16 = endian_16 (u16);
-		printf ("Use tranform: %i\n", u16);
+		log_debug ("Use tranform: %i\n", u16);
+		current_b->transform = u16;
 
-		TRY_READ_OR_GOTO (fd_skel, &u16, 2, error_skeleton);
+		TRY_READ_OR_GOTO (&stream_skel, &u16, 2, error_skeleton);
 		u16 = endian_16 (u16);
-		printf ("Use INV tranform: %i\n", u16);
+		log_debug ("Use INV tranform: %i\n", u16);
+		current_b->inv_transform = u16;
 	}
 
-	close (fd_skel);
+	stream_close (&stream_skel);
 	return;
 error_skeleton:
-	printf ("Skipping....\n");
-	close (fd_skel);
+	log_warn ("Skipping....\n");
+	stream_close (&stream_skel);
 }
 
 Table *get_key_as_table (Table *table, char *key) {
@@ -690,7 +659,7 @@ Table *get_key_as_table (Table *table, char *key) {
 
 		if (entry->name_pos & 0x8000) {
 			/* Es un arreglo */
-			//printf ("%s[%i] => ", tab, entry->name_pos - 0x8000);
+			//log_debug ("%s[%i] => ", tab, entry->name_pos - 0x8000);
 		} else {
 			if (strcmp (key, entry->name) == 0) {
 				return entry->value.table;
@@ -710,7 +679,7 @@ uint32_t get_key_as_int (Table *table, char *key) {
 
 		if (entry->name_pos & 0x8000) {
 			/* Es un arreglo */
-			//printf ("%s[%i] => ", tab, entry->name_pos - 0x8000);
+			//log_debug ("%s[%i] => ", tab, entry->name_pos - 0x8000);
 		} else {
 			if (strcmp (key, entry->name) == 0) {
 				return entry->value.integer;
@@ -730,7 +699,7 @@ uint8_t get_key_as_boolean (Table *table, char *key) {
 
 		if (entry->name_pos & 0x8000) {
 			/* Es un arreglo */
-			//printf ("%s[%i] => ", tab, entry->name_pos - 0x8000);
+			//log_debug ("%s[%i] => ", tab, entry->name_pos - 0x8000);
 		} else {
 			if (strcmp (key, entry->name) == 0) {
 				return entry->value.boolean;
@@ -750,7 +719,7 @@ char *get_key_as_string (Table *table, char *key) {
 
 		if (entry->name_pos & 0x8000) {
 			/* Es un arreglo */
-			//printf ("%s[%i] => ", tab, entry->name_pos - 0x8000);
+			//log_debug ("%s[%i] => ", tab, entry->name_pos - 0x8000);
 		} else {
 			if (strcmp (key, entry->name) == 0) {
 				return entry->value.string;
@@ -761,6 +730,32 @@ char *get_key_as_string (Table *table, char *key) {
 	return NULL;
 }
 
+int get_key_as_number (Table *table, char *key, int def) {
+	int g;
+	TableEntry *entry;
+
+	for (g = 0; g < table->n_entries; g++) {
+		entry = (TableEntry *) &table->entries[g];
+
+		if (entry->name_pos & 0x8000) continue;
+
+		if (strcmp (key, entry->name) == 0) {
+			switch (entry->type) {
+				case 3: /* Type Byte */
+					return entry->value.byte;
+				case 4: /* Type Short */
+					return entry->value.short_int;
+				case 5: /* Type INT */
+					return entry->value.integer;
+			}
+
+			return def;
+		}
+	}
+
+	return def;
+}
+
 Table *get_index_as_table (Table *table, int pos) {
 	int g;
 	TableEntry *entry;
@@ -792,7 +787,7 @@ int get_num_values (Table *table) {
 			/* Es un arreglo */
 			c++;
 		} else {
-			printf ("Warning: Valor no arreglo en la tabla\n");
+			log_warn ("Warning: Valor no arreglo en la tabla\n");
 		}
 	}
 
@@ -801,7 +796,7 @@ int get_num_values (Table *table) {
 
 void read_indices (char *folder, char *filename, uint32_t **index_arr, int *num) {
 	unsigned char buffer[8192];
-	int fd_index;
+	MMFStream stream_index;
 	uint8_t u8, loc_4, loc_7;
 	int8_t s8;
 	uint16_t u16;
@@ -811,25 +806,19 @@ void read_indices (char *folder, char *filename, uint32_t **index_arr, int *num)
 
 	snprintf (buffer, sizeof (buffer), "%s/%s", folder, filename);
 
-	fd_index = open (buffer, O_RDONLY
-#ifdef _WIN32
-	| _O_BINARY
-#endif
-	);
-
-	if (fd_index < 0) {
+	if (stream_open (&stream_index, buffer) < 0) {
 		return;
 	}
 
-	TRY_READ_OR_GOTO (fd_index, &u8, 1, error_index);
+	TRY_READ_OR_GOTO (&stream_index, &u8, 1, error_index);
 
 	loc_4 = u8;
 
 	if (loc_4 == 1) {
-		TRY_READ_OR_GOTO (fd_index, &u32, 4, error_index);
+		TRY_READ_OR_GOTO (&stream_index, &u32, 4, error_index);
 		u32 = endian_32 (u32);
 	} else {
-		TRY_READ_OR_GOTO (fd_index, &u16, 2, error_index);
+		TRY_READ_OR_GOTO (&stream_index, &u16, 2, error_index);
 		u16 = endian_16 (u16);
 		u32 = u16;
 	}
@@ -837,7 +826,7 @@ void read_indices (char *folder, char *filename, uint32_t **index_arr, int *num)
 	loc_5 = u32;
 
 	/* ¿Arreglo de loc_5 * 2? */
-	TRY_READ_OR_GOTO (fd_index, &s8, 1, error_index);
+	TRY_READ_OR_GOTO (&stream_index, &s8, 1, error_index);
 
 	loc_7 = 0;
 	if (s8 > 0) {
@@ -847,47 +836,47 @@ void read_indices (char *folder, char *filename, uint32_t **index_arr, int *num)
 	if (loc_7 == 0) {
 		for (g = 0; g < loc_5; g++) {
 			if (loc_4 == 1) {
-				TRY_READ_OR_GOTO (fd_index, &u32, 4, error_index);
+				TRY_READ_OR_GOTO (&stream_index, &u32, 4, error_index);
 				u32 = endian_32 (u32);
 			} else {
-				TRY_READ_OR_GOTO (fd_index, &u16, 2, error_index);
+				TRY_READ_OR_GOTO (&stream_index, &u16, 2, error_index);
 				u16 = endian_16 (u16);
 				u32 = u16;
 			}
-			printf ("Valores de este arreglo: %i\n", u32);
+			log_trace ("Valores de este arreglo: %i\n", u32);
 		}
 
+		stream_close (&stream_index);
 		return;
 	}
 
 	*num = loc_5;
-	*index_arr = (uint32_t *) malloc (sizeof (uint32_t) * loc_5);
+	*index_arr = (uint32_t *) mmf_malloc (sizeof (uint32_t) * loc_5);
 
-	printf ("Valores de este arreglo: %i\n", loc_5);
+	log_debug ("Valores de este arreglo: %i\n", loc_5);
 	c = 0;
 	for (g = 0; g < loc_5;) {
-		TRY_READ_OR_GOTO (fd_index, &u8, 1, error_index);
+		TRY_READ_OR_GOTO (&stream_index, &u8, 1, error_index);
 
 		if (u8 == 0) {
 			/* El primer entero indica cuántos valos a leer */
 			if (loc_4 == 1) {
-				TRY_READ_OR_GOTO (fd_index, &u32, 4, error_index);
+				TRY_READ_OR_GOTO (&stream_index, &u32, 4, error_index);
 				loc_12 = endian_32 (u32);
 			} else {
-				TRY_READ_OR_GOTO (fd_index, &u16, 2, error_index);
+				TRY_READ_OR_GOTO (&stream_index, &u16, 2, error_index);
 				u16 = endian_16 (u16);
 				loc_12 = u16;
 			}
 			for (h = 0; h < loc_12; h++) {
 				if (loc_4 == 1) {
-					TRY_READ_OR_GOTO (fd_index, &u32, 4, error_index);
+					TRY_READ_OR_GOTO (&stream_index, &u32, 4, error_index);
 					u32 = endian_32 (u32);
 				} else {
-					TRY_READ_OR_GOTO (fd_index, &u16, 2, error_index);
+					TRY_READ_OR_GOTO (&stream_index, &u16, 2, error_index);
 					u16 = endian_16 (u16);
 					u32 = u16;
 				}
-				printf ("Short value: %i\n", u32);
 				(*index_arr)[c] = u32;
 				c++;
 			}
@@ -895,26 +884,25 @@ void read_indices (char *folder, char *filename, uint32_t **index_arr, int *num)
 			/* Run length encoded, valor + cantidad de valores consecutivos */
 			/* Leer la local 11 */
 			if (loc_4 == 1) {
-				TRY_READ_OR_GOTO (fd_index, &u32, 4, error_index);
+				TRY_READ_OR_GOTO (&stream_index, &u32, 4, error_index);
 				loc_11 = endian_32 (u32);
 			} else {
-				TRY_READ_OR_GOTO (fd_index, &u16, 2, error_index);
+				TRY_READ_OR_GOTO (&stream_index, &u16, 2, error_index);
 				u16 = endian_16 (u16);
 				loc_11 = u16;
 			}
 
 			/* Leer la local 12 */
 			if (loc_4 == 1) {
-				TRY_READ_OR_GOTO (fd_index, &u32, 4, error_index);
+				TRY_READ_OR_GOTO (&stream_index, &u32, 4, error_index);
 				loc_12 = endian_32 (u32);
 			} else {
-				TRY_READ_OR_GOTO (fd_index, &u16, 2, error_index);
+				TRY_READ_OR_GOTO (&stream_index, &u16, 2, error_index);
 				u16 = endian_16 (u16);
 				loc_12 = u16;
 			}
 
 			for (h = 0; h < loc_12; h++) {
-				printf ("Short value: %i\n", loc_11 + h);
 				(*index_arr)[c] = loc_11 + h;
 				c++;
 			}
@@ -923,16 +911,22 @@ void read_indices (char *folder, char *filename, uint32_t **index_arr, int *num)
 		g = g + loc_12;
 	}
 
-	close (fd_index);
+	/* Fuera del ciclo, así decodificar no paga nada por el nivel de traza */
+	if (log_enabled (LOG_TRACE)) {
+		for (h = 0; h < c; h++) {
+			log_trace ("Short value: %i\n", (*index_arr)[h]);
+		}
+	}
+
+	stream_close (&stream_index);
 	return;
 error_index:
-	printf ("Skipping read index %s....\n", filename);
-	close (fd_index);
+	log_warn ("Skipping read index %s....\n", filename);
+	stream_close (&stream_index);
 }
 
-void load_mesh_data (MeshData *mesh, Table *table, char *folder) {
-	char name[128];
-
+/* Todo lo del mesh menos sus índices */
+void load_mesh_header (MeshData *mesh, Table *table) {
 	memset (mesh, 0, sizeof (MeshData));
 
 	mesh->id = get_key_as_int (table, "id");
@@ -953,6 +947,15 @@ void load_mesh_data (MeshData *mesh, Table *table, char *folder) {
 		mesh->max_influences = get_key_as_int (table, "influences");
 	}
 
+	mesh->instance_of = -1;
+	mesh->transform = get_key_as_number (table, "transform", -1);
+}
+
+void load_mesh_data (MeshData *mesh, Table *table, char *folder) {
+	char name[128];
+
+	load_mesh_header (mesh, table);
+
 	if (mesh->renderable) {
 		/* Cargar el archivo index- */
 		snprintf (name, sizeof (name), "index-%i", mesh->id);
@@ -961,7 +964,7 @@ void load_mesh_data (MeshData *mesh, Table *table, char *folder) {
 	}
 }
 
-int read_vector_of_numbers (float **array, int fd, int encoding) {
+int read_vector_of_numbers (float **array, MMFStream *stream, int encoding) {
 	off_t len;
 	int g;
 	uint8_t u8;
@@ -974,12 +977,12 @@ int read_vector_of_numbers (float **array, int fd, int encoding) {
 
 	if (array == NULL) return 0;
 
-	len = lseek (fd, 0, SEEK_END);
+	len = stream_size (stream);
 
-	lseek (fd, 0, SEEK_SET);
+	stream_seek (stream, 0);
 
 	if (encoding == -1) {
-		TRY_READ_OR_GOTO (fd, &u8, 1, error_vector_of_number);
+		TRY_READ_OR_GOTO (stream, &u8, 1, error_vector_of_number);
 		encoding = u8;
 		len = len - 1;
 	}
@@ -1000,7 +1003,7 @@ int read_vector_of_numbers (float **array, int fd, int encoding) {
 			break;
 	}
 
-	*array = (float *) malloc (sizeof (float) * len);
+	*array = (float *) mmf_malloc (sizeof (float) * len);
 
 	if (*array == NULL) {
 		return 0;
@@ -1010,40 +1013,44 @@ int read_vector_of_numbers (float **array, int fd, int encoding) {
 		pf = &f;
 		switch (encoding) {
 			case ENCODING_NONE:
-				TRY_READ_OR_GOTO (fd, &u32, 4, error_vector_of_number);
+				TRY_READ_OR_GOTO (stream, &u32, 4, error_vector_of_number);
 				u32 = endian_32 (u32);
 				pf = (float *) &u32;
 				break;
 			case ENCODING_BYTE:
-				TRY_READ_OR_GOTO (fd, &u8, 1, error_vector_of_number);
+				TRY_READ_OR_GOTO (stream, &u8, 1, error_vector_of_number);
 				f = ((float) u8) / ((float) 255.0);
 				break;
 			case ENCODING_BYTE_SIGNED:
-				TRY_READ_OR_GOTO (fd, &s8, 1, error_vector_of_number);
+				TRY_READ_OR_GOTO (stream, &s8, 1, error_vector_of_number);
 				f = ((float) s8) / ((float) 127.0);
 				break;
 			case UNENCODED_BYTE:
-				TRY_READ_OR_GOTO (fd, &u8, 1, error_vector_of_number);
+				TRY_READ_OR_GOTO (stream, &u8, 1, error_vector_of_number);
 				f = (float) u8;
 				break;
 			case UNENCODED_BYTE_SIGNED:
-				TRY_READ_OR_GOTO (fd, &s8, 1, error_vector_of_number);
+				TRY_READ_OR_GOTO (stream, &s8, 1, error_vector_of_number);
 				f = (float) s8;
 				break;
 			case ENCODING_SHORT:
-				TRY_READ_OR_GOTO (fd, &u16, 2, error_vector_of_number);
+				TRY_READ_OR_GOTO (stream, &u16, 2, error_vector_of_number);
+				u16 = endian_16 (u16);
 				f = ((float) u16) / ((float) 65535.0);
 				break;
 			case ENCODING_SHORT_SIGNED:
-				TRY_READ_OR_GOTO (fd, &s16, 2, error_vector_of_number);
+				TRY_READ_OR_GOTO (stream, &s16, 2, error_vector_of_number);
+				s16 = (int16_t) endian_16 ((uint16_t) s16);
 				f = ((float) s16) / ((float) 32767.0);
 				break;
 			case UNENCODED_SHORT:
-				TRY_READ_OR_GOTO (fd, &u16, 2, error_vector_of_number);
+				TRY_READ_OR_GOTO (stream, &u16, 2, error_vector_of_number);
+				u16 = endian_16 (u16);
 				f = (float) u16;
 				break;
 			case UNENCODED_SHORT_SIGNED:
-				TRY_READ_OR_GOTO (fd, &s16, 2, error_vector_of_number);
+				TRY_READ_OR_GOTO (stream, &s16, 2, error_vector_of_number);
+				s16 = (int16_t) endian_16 ((uint16_t) s16);
 				f = (float) s16;
 				break;
 		}
@@ -1054,42 +1061,201 @@ int read_vector_of_numbers (float **array, int fd, int encoding) {
 	return len;
 
 error_vector_of_number:
-	if (*array != NULL) free (*array);
+	if (*array != NULL) mmf_free (*array);
+	*array = NULL;
+	return 0;
+}
+
+int encoding_element_size (int encoding) {
+	switch (encoding) {
+		case ENCODING_BYTE:
+		case ENCODING_BYTE_SIGNED:
+		case UNENCODED_BYTE:
+		case UNENCODED_BYTE_SIGNED:
+			return 1;
+		case ENCODING_SHORT:
+		case ENCODING_SHORT_SIGNED:
+		case UNENCODED_SHORT:
+		case UNENCODED_SHORT_SIGNED:
+			return 2;
+	}
+
+	return 4;
+}
+
+int encoding_is_signed (int encoding) {
+	return (encoding == ENCODING_BYTE_SIGNED || encoding == ENCODING_SHORT_SIGNED || encoding == UNENCODED_BYTE_SIGNED || encoding == UNENCODED_SHORT_SIGNED);
+}
+
+int encoding_is_normalized (int encoding) {
+	return (encoding >= ENCODING_BYTE && encoding <= ENCODING_SHORT_SIGNED);
+}
+
+/* Igual que read_vector_of_numbers, pero conserva los bytes o shorts originales.
+ * Solo se corrige el endianess para que el arreglo quede en el orden del host */
+int read_vector_raw (void **array, MMFStream *stream, int *encoding) {
+	off_t len;
+	int g, size;
+	uint8_t u8;
+	uint16_t *p16;
+
+	if (array == NULL) return 0;
+
+	*array = NULL;
+	len = stream_size (stream);
+
+	stream_seek (stream, 0);
+
+	if (*encoding == -1) {
+		TRY_READ_OR_GOTO (stream, &u8, 1, error_vector_raw);
+		*encoding = u8;
+		len = len - 1;
+	}
+
+	size = encoding_element_size (*encoding);
+	len = len / size;
+
+	*array = mmf_malloc (size * len);
+
+	if (*array == NULL) {
+		return 0;
+	}
+
+	TRY_READ_OR_GOTO (stream, *array, (int) (size * len), error_vector_raw);
+
+	if (size == 2) {
+		p16 = (uint16_t *) *array;
+		for (g = 0; g < len; g++) {
+			p16[g] = endian_16 (p16[g]);
+		}
+	} else if (size == 4) {
+		for (g = 0; g < len; g++) {
+			((uint32_t *) *array)[g] = endian_32 (((uint32_t *) *array)[g]);
+		}
+	}
+
+	return len;
+
+error_vector_raw:
+	if (*array != NULL) mmf_free (*array);
+	*array = NULL;
 	return 0;
 }
 
+/* Dividir entre esto da exactamente los mismos valores que read_vector_of_numbers */
+float encoding_divisor (int encoding) {
+	switch (encoding) {
+		case ENCODING_BYTE:
+			return 255.0;
+		case ENCODING_BYTE_SIGNED:
+			return 127.0;
+		case ENCODING_SHORT:
+			return 65535.0;
+		case ENCODING_SHORT_SIGNED:
+			return 32767.0;
+	}
+
+	return 1.0;
+}
+
+/* Los flotantes del flujo cuantizado, en un arreglo nuevo; el VertexData no cambia */
+static float *vertex_data_expand_copy (const VertexData *vertex_data) {
+	float *out;
+	float divisor;
+	int g;
+
+	divisor = encoding_divisor (vertex_data->encoding);
+
+	out = (float *) mmf_malloc (sizeof (float) * vertex_data->num);
+
+	for (g = 0; g < vertex_data->num; g++) {
+		switch (vertex_data->encoding) {
+			case ENCODING_BYTE:
+			case UNENCODED_BYTE:
+				out[g] = ((uint8_t *) vertex_data->raw)[g];
+				break;
+			case ENCODING_BYTE_SIGNED:
+			case UNENCODED_BYTE_SIGNED:
+				out[g] = ((int8_t *) vertex_data->raw)[g];
+				break;
+			case ENCODING_SHORT:
+			case UNENCODED_SHORT:
+				out[g] = ((uint16_t *) vertex_data->raw)[g];
+				break;
+			case ENCODING_SHORT_SIGNED:
+			case UNENCODED_SHORT_SIGNED:
+				out[g] = ((int16_t *) vertex_data->raw)[g];
+				break;
+		}
+		out[g] /= divisor;
+	}
+
+	return out;
+}
+
+/* Convierte a float un VertexData leído en modo cuantizado */
+void vertex_data_expand (VertexData *vertex_data) {
+	if (vertex_data->raw == NULL) return;
+
+	vertex_data->vertex = vertex_data_expand_copy (vertex_data);
+
+	mmf_free (vertex_data->raw);
+	vertex_data->raw = NULL;
+	vertex_data->encoding = ENCODING_NONE;
+	vertex_data->scale = 1.0;
+}
+
 void read_vertex_data (Table *table, char *folder, VertexData *vertex_data) {
 	unsigned char buffer[8192];
-	int fd_vertex;
+	MMFStream stream_vertex;
 	uint8_t u8;
 	int8_t s8;
 	uint16_t u16;
 	uint32_t u32;
 	int g, h;
 
-	int id;
+	int id, encoding;
 	float *vertex;
+	void *raw;
 
 	vertex_data->vertex = NULL;
 	vertex_data->num = 0;
+	vertex_data->raw = NULL;
+	vertex_data->encoding = ENCODING_NONE;
+	vertex_data->scale = 1.0;
 
 	id = get_key_as_int (table, "id");
+
+	/* Los vertex-N no llevan byte de codificación: los originales son siempre flotantes, y solo
+	 * un desc que declara "encoding" (como los de synth.c) trae otro formato */
+	encoding = get_key_as_number (table, "encoding", ENCODING_NONE);
 	snprintf (buffer, sizeof (buffer), "%s/vertex-%i", folder, id);
 
-	fd_vertex = open (buffer, O_RDONLY
-#ifdef _WIN32
-	| _O_BINARY
-#endif
-	);
+	if (stream_open (&stream_vertex, buffer) < 0) {
+		return;
+	}
+
+	if (keep_quantized && encoding != ENCODING_NONE) {
+		/* Conservar el flujo cuantizado, la escala queda aparte */
+		u32 = read_vector_raw (&raw, &stream_vertex, &encoding);
+
+		log_debug ("Vertex data %i: %i quantized values (encoding %i, %i bytes)\n", id, u32, encoding, u32 * encoding_element_size (encoding));
 
-	if (fd_vertex < 0) {
+		vertex_data->raw = raw;
+		vertex_data->num = u32;
+		vertex_data->encoding = encoding;
+		vertex_data->scale = 1.0 / encoding_divisor (encoding);
+
+		stream_close (&stream_vertex);
 		return;
 	}
 
-	u32 = read_vector_of_numbers (&vertex, fd_vertex, ENCODING_NONE);
+	u32 = read_vector_of_numbers (&vertex, &stream_vertex, encoding);
 
-	for (g = 0; g < u32; g = g + 3) {
-		printf ("Vertex: %.8f, %.8f, %.8f\n", vertex[g], vertex[g + 1], vertex[g + 2]);
+	if (log_enabled (LOG_TRACE)) {
+		for (g = 0; g < u32; g = g + 3) {
+			log_trace ("Vertex: %.8f, %.8f, %.8f\n", vertex[g], vertex[g + 1], vertex[g + 2]);
+		}
 	}
 
 	if (vertex_data != NULL) {
@@ -1097,143 +1263,806 @@ void read_vertex_data (Table *table, char *folder, VertexData *vertex_data) {
 		vertex_data->num = u32;
 	}
 
-	close (fd_vertex);
+	stream_close (&stream_vertex);
 	return;
 error_index:
-	printf ("Skipping read vertex %i....\n", id);
-	close (fd_vertex);
+	log_warn ("Skipping read vertex %i....\n", id);
+	stream_close (&stream_vertex);
+}
+
+int has_extension (const char *path, const char *ext) {
+	size_t len_path, len_ext;
+
+	len_path = strlen (path);
+	len_ext = strlen (ext);
+
+	if (len_path < len_ext) return 0;
+
+	return strcasecmp (&path[len_path - len_ext], ext) == 0;
+}
+
+void bkv_free (BKVDesc *bkv_desc) {
+	int g;
+
+	for (g = 0; g < bkv_desc->n_words; g++) {
+		mmf_free (bkv_desc->words[g].word);
+	}
+	mmf_free (bkv_desc->words);
+
+	for (g = 0; g < bkv_desc->n_tables; g++) {
+		mmf_free (bkv_desc->tables[g].entries);
+	}
+	mmf_free (bkv_desc->tables);
+
+	mmf_free (bkv_desc->transforms);
+
+	for (g = 0; g < bkv_desc->n_bones; g++) {
+		mmf_free (bkv_desc->bones[g].name);
+	}
+	mmf_free (bkv_desc->bones);
+
+	memset (bkv_desc, 0, sizeof (BKVDesc));
+}
+
+void model_free (MMFModel *model) {
+	int g;
+
+	for (g = 0; g < model->num_vertex; g++) {
+		mmf_free (model->vertex[g].vertex);
+		mmf_free (model->vertex[g].raw);
+		mmf_free (model->vertex[g].normal);
+	}
+	mmf_free (model->vertex);
+
+	for (g = 0; g < model->num_meshes; g++) {
+		mmf_free (model->mesh[g].index);
+	}
+	mmf_free (model->mesh);
+
+	blend_shapes_free (model->shapes, model->num_shapes);
+	materials_free (model->materials, model->num_materials);
+	scene_free (model->nodes);
+
+	bkv_free (&model->desc);
+
+	memset (model, 0, sizeof (MMFModel));
 }
 
-int main (int argc, char *argv[]) {
-	BKVDesc bkv_desc, color_0;
+/* El modelo es de solo lectura: los flotantes expandidos y las normales van en copias de los VertexData */
+int obj_write (const char *file_path, VertexData *model_vertex, int num_vertex, MeshData *mesh, int num_meshes, Material *materials, int num_materials) {
+	FILE *fd_obj;
+	MeshData *geometry;
+	VertexData *vertex;
+	int *vertex_base;
+	uint32_t t32;
+	int g, h;
+	StatScope scope;
+	char mtl_path[8192];
+
+	/* Los materiales van en un .mtl junto al OBJ */
+	if (num_materials > 0) {
+		materials_mtl_path (file_path, mtl_path, sizeof (mtl_path));
+		if (materials_write_mtl (mtl_path, materials, num_materials) < 0) {
+			return -1;
+		}
+	}
+
+	fd_obj = fopen (file_path, "wb");
+
+	if (fd_obj == NULL) {
+		return -1;
+	}
+
+	if (num_materials > 0) {
+		fprintf (fd_obj, "mtllib %s\n", materials_path_basename (mtl_path));
+	}
+
+	/* El OBJ solo admite flotantes */
+	vertex = (VertexData *) mmf_malloc (sizeof (VertexData) * (num_vertex + 1));
+	for (g = 0; g < num_vertex; g++) {
+		vertex[g] = model_vertex[g];
+		if (model_vertex[g].raw != NULL) {
+			vertex[g].vertex = vertex_data_expand_copy (&model_vertex[g]);
+			vertex[g].raw = NULL;
+			vertex[g].encoding = ENCODING_NONE;
+			vertex[g].scale = 1.0;
+		}
+
+		/* compute_normals libera las anteriores, que son del modelo */
+		if (generate_normals) vertex[g].normal = NULL;
+	}
+
+	if (generate_normals) {
+		stats_begin (&scope, STAT_NORMALS);
+		compute_normals (vertex, num_vertex, mesh, num_meshes, load_pool);
+		stats_end (&scope, NULL, NULL, 0);
+	}
+
+	/* Recorrer los vertex y generarlos en el obj */
+	vertex_base = (int *) mmf_malloc (sizeof (int) * (num_vertex + 1));
+	for (g = 0; g < num_vertex; g++) {
+		vertex_base[g] = (g == 0 ? 0 : vertex_base[g - 1] + vertex[g - 1].num / 3);
+		for (h = 0; h + 2 < vertex[g].num; h = h + 3) {
+			fprintf (fd_obj, "v %.7f %.7f %.7f\n", vertex[g].vertex[h], vertex[g].vertex[h + 1], vertex[g].vertex[h + 2]);
+		}
+	}
+
+	#if 0
+	for (g = 0; g < num_vertex; g++) {
+		/* Generar la misma cantidad de vt 0 0 */
+		for (h = 0; h < vertex[g].num; h = h + 3) {
+			fprintf (fd_obj, "vt 0 0\n");
+		}
+	}
+	#endif
+
+	if (generate_normals) {
+		/* Una normal por vértice, con el mismo número que su "v" */
+		for (g = 0; g < num_vertex; g++) {
+			for (h = 0; h + 2 < vertex[g].num; h = h + 3) {
+				if (vertex[g].normal != NULL) {
+					fprintf (fd_obj, "vn %.6f %.6f %.6f\n", vertex[g].normal[h], vertex[g].normal[h + 1], vertex[g].normal[h + 2]);
+				} else {
+					fprintf (fd_obj, "vn 0 0 0\n");
+				}
+			}
+		}
+		fprintf (fd_obj, "usemtl None\ns 1\n");
+	} else {
+		fprintf (fd_obj, "vn 0 0 0\nusemtl None\ns 1\n");
+	}
+
+	/* Generar las caras, los índices son relativos al VertexData del mesh.
+	 * El OBJ no tiene instancias: cada una repite las caras de su geometría */
+	for (g = 0; g < num_meshes; g++) {
+		geometry = mesh_geometry (mesh, num_meshes, g);
+		fprintf (fd_obj, "# g %s\n", mesh[g].name);
+		if (num_materials > 0) {
+			fprintf (fd_obj, "usemtl %s\n", (mesh[g].material >= 0 && mesh[g].material < num_materials ? materials[mesh[g].material].name : "None"));
+		}
+		t32 = 1;
+		if (geometry->vertex_data_id >= 0 && geometry->vertex_data_id < num_vertex) {
+			t32 += vertex_base[geometry->vertex_data_id];
+		}
+		for (h = 0; h + 2 < geometry->num_index; h = h + 3) {
+			if (generate_normals) {
+				fprintf (fd_obj, "f %i//%i %i//%i %i//%i\n", geometry->index[h] + t32, geometry->index[h] + t32, geometry->index[h + 1] + t32, geometry->index[h + 1] + t32, geometry->index[h + 2] + t32, geometry->index[h + 2] + t32);
+			} else {
+				fprintf (fd_obj, "f %i//1 %i//1 %i//1\n", geometry->index[h] + t32, geometry->index[h + 1] + t32, geometry->index[h + 2] + t32);
+			}
+		}
+	}
+
+	mmf_free (vertex_base);
+
+	for (g = 0; g < num_vertex; g++) {
+		if (model_vertex[g].raw != NULL) mmf_free (vertex[g].vertex);
+		if (generate_normals) mmf_free (vertex[g].normal);
+	}
+	mmf_free (vertex);
+
+	if (fclose (fd_obj) != 0) {
+		return -1;
+	}
+
+	return 0;
+}
+
+typedef struct {
+	Table *table;
+	char *folder;
+	int do_endian;
+	Preload *preload;
+	Arena *arena;
+
 	VertexData *vertex;
 	MeshData *mesh;
-	int num_vertex, num_meshes;
-	Table *vertex_table, *t;
-	int total, g, h;
+} LoadTask;
 
-	ui_init (&argc, &argv);
+void load_model_set_pool (ThreadPool *pool) {
+	load_pool = pool;
+}
 
-	char *folder = ui_get_mmf_directory ();
+/* Lee un vertex-N o un index-N, medido en su etapa */
+void load_vertex_or_mesh (Table *table, char *folder, VertexData *vertex, MeshData *mesh) {
+	StatScope scope;
+	char name[64];
 
-	if (folder == NULL) {
-		ui_show_message_error ("Canceled");
+	if (vertex != NULL) {
+		stats_begin (&scope, STAT_VERTEX);
+		read_vertex_data (table, folder, vertex);
 
-		return 0;
+		/* Con los vértices recién decodificados todavía en la caché */
+		vertex_data_bounds (vertex);
+
+		if (stats_enabled) {
+			snprintf (name, sizeof (name), "vertex-%i", get_key_as_int (table, "id"));
+			stats_end (&scope, folder, name, vertex->num);
+		}
+	} else {
+		stats_begin (&scope, STAT_INDEX);
+		load_mesh_data (mesh, table, folder);
+
+		if (stats_enabled) {
+			snprintf (name, sizeof (name), "index-%i", get_key_as_int (table, "id"));
+			stats_end (&scope, folder, name, mesh->num_index);
+		}
 	}
+}
 
-	//char *folder = "/home/gatuno/Puffles/penguin_mmf";
+void load_task_run (void *data) {
+	LoadTask *task = (LoadTask *) data;
+	Preload *prev_preload;
+	Arena *prev_arena;
+	int prev_endian;
+
+	/* El orden de bytes y la precarga son por hilo, se toman los del modelo.
+	 * Un hilo que ayuda mientras espera puede estar a medio leer otro modelo */
+	prev_endian = do_endian;
+	prev_preload = preload_get_current ();
+	prev_arena = arena_get_current ();
+	do_endian = task->do_endian;
+	preload_set_current (task->preload);
+	arena_set_current (task->arena);
+
+	load_vertex_or_mesh (task->table, task->folder, task->vertex, task->mesh);
+
+	do_endian = prev_endian;
+	preload_set_current (prev_preload);
+	arena_set_current (prev_arena);
+}
 
-	g = read_bkv (&bkv_desc, folder, "desc");
+/* Pide de una sola vez todos los archivos que nombra el desc */
+void load_model_preload (Preload *preload, BKVDesc *desc, char *folder) {
+	Table *vertex_table, *meshes_tables, *t;
+	char path[8192];
+	int g, h, total, material;
+
+	preload_init (preload);
+
+	snprintf (path, sizeof (path), "%s/transform", folder);
+	preload_add (preload, path);
+	snprintf (path, sizeof (path), "%s/skeleton", folder);
+	preload_add (preload, path);
+	vertex_table = get_key_as_table (&desc->tables[0], "vertexDatas");
+	meshes_tables = get_key_as_table (&desc->tables[0], "meshes");
+
+	total = (vertex_table != NULL ? get_num_values (vertex_table) : 0);
+	for (g = 0; g < total; g++) {
+		t = get_index_as_table (vertex_table, g);
+		snprintf (path, sizeof (path), "%s/vertex-%i", folder, get_key_as_int (t, "id"));
+		preload_add (preload, path);
+	}
 
-	if (g < 0) {
-		ui_show_message_error ("Main desc file not found");
+	total = (meshes_tables != NULL ? get_num_values (meshes_tables) : 0);
+	for (g = 0; g < total; g++) {
+		t = get_index_as_table (meshes_tables, g);
+		if (get_key_as_boolean (t, "nonrendered") || mesh_find_instance (meshes_tables, g) >= 0) continue;
 
-		return 0;
+		snprintf (path, sizeof (path), "%s/index-%i", folder, get_key_as_int (t, "id"));
+		preload_add (preload, path);
+	}
+
+	/* Un Color-N.bkv por cada material distinto */
+	for (g = 0; g < total; g++) {
+		t = get_index_as_table (meshes_tables, g);
+		if (get_key_as_boolean (t, "nonrendered")) continue;
+
+		material = get_key_as_int (t, "material");
+		for (h = 0; h < g; h++) {
+			t = get_index_as_table (meshes_tables, h);
+			if (!get_key_as_boolean (t, "nonrendered") && get_key_as_int (t, "material") == material) break;
+		}
+		if (h < g) continue;
+
+		snprintf (path, sizeof (path), "%s/Color-%i.bkv", folder, material);
+		preload_add (preload, path);
 	}
 
-	printf ("DESC: Valores tabla raíz:\n");
+	g = preload_run (preload, preload_method, load_pool);
 
-	printf ("{\n");
-	print_table (&bkv_desc.tables[0], "\t");
-	printf ("}\n");
+	log_info ("Preload: %i files (%s)\n", preload->n_files, (g == PRELOAD_AUTO ? "io_uring" : "threads"));
+}
 
-	read_transform (&bkv_desc, folder);
+int load_model (MMFModel *model, char *folder) {
+	Table *vertex_table, *meshes_tables, *t;
+	int total, g, h, n_tasks;
+	int *ids;
+	LoadTask *tasks;
+	TaskGroup group;
+	CompactStats compact_stats;
+	WeldStats weld_stats;
+	CacheStats cache_stats;
+	Preload preload, *prev_preload;
+	StatScope model_scope, scope;
+
+	memset (model, 0, sizeof (MMFModel));
+
+	stats_begin (&model_scope, STAT_MODEL);
+
+	stats_begin (&scope, STAT_DESC);
+	g = read_bkv (&model->desc, folder, "desc");
+	stats_end (&scope, folder, "desc", model->desc.n_tables);
+
+	if (g < 0 || model->desc.n_tables == 0) {
+		bkv_free (&model->desc);
+		stats_end (&model_scope, NULL, folder, 0);
+		return -1;
+	}
 
-	read_skeleton (&bkv_desc, folder);
+	if (log_enabled (LOG_DEBUG)) {
+		log_debug ("DESC: Valores tabla raíz:\n");
 
+		log_debug ("{\n");
+		print_table (&model->desc.tables[0], "\t");
+		log_debug ("}\n");
+	}
 
-	read_bkv (&color_0, folder, "Color-0.bkv");
+	/* Con una precarga ya puesta (un DPACK) todos los archivos vienen de ella */
+	prev_preload = preload_get_current ();
+	if (preload_method != PRELOAD_NONE && prev_preload == NULL) {
+		load_model_preload (&preload, &model->desc, folder);
+		do_endian = model->desc.do_endian;
+		preload_set_current (&preload);
+	}
 
-	printf ("Color-0: Valores tabla raíz:\n");
+	stats_begin (&scope, STAT_TRANSFORM);
+	read_transform (&model->desc, folder);
+	stats_end (&scope, folder, "transform", model->desc.n_transforms);
 
-	printf ("{\n");
-	print_table (&color_0.tables[0], "\t");
-	printf ("}\n");
+	stats_begin (&scope, STAT_SKELETON);
+	read_skeleton (&model->desc, folder);
+	stats_end (&scope, folder, "skeleton", 0);
 
-	/* Procesar los vextex datas */
-	vertex_table = get_key_as_table (&bkv_desc.tables[0], "vertexDatas");
+	/* Cada vertex-N e index-N es independiente: una tarea por archivo */
+	vertex_table = get_key_as_table (&model->desc.tables[0], "vertexDatas");
+	meshes_tables = get_key_as_table (&model->desc.tables[0], "meshes");
+
+	model->num_vertex = (vertex_table != NULL ? get_num_values (vertex_table) : 0);
+	model->num_meshes = (meshes_tables != NULL ? get_num_values (meshes_tables) : 0);
 
+	tasks = (LoadTask *) mmf_malloc (sizeof (LoadTask) * (model->num_vertex + model->num_meshes + 1));
+	memset (tasks, 0, sizeof (LoadTask) * (model->num_vertex + model->num_meshes + 1));
+	n_tasks = 0;
+
+	/* Procesar los vextex datas */
 	if (vertex_table != NULL) {
-		num_vertex = total = get_num_values (vertex_table);
+		total = model->num_vertex;
 
-		vertex = (VertexData *) malloc (sizeof (VertexData) * total);
+		model->vertex = (VertexData *) mmf_malloc (sizeof (VertexData) * total);
+		memset (model->vertex, 0, sizeof (VertexData) * total);
 
 		for (g = 0; g < total; g++) {
 			t = get_index_as_table (vertex_table, g);
 
-			/* TODO: Revisar si el nombre de este mesh es un "BlendShape" */
-			read_vertex_data (t, folder, &vertex[g]);
+			/* Los blend shapes se leen completos y se reducen a diferencias al terminar */
+			tasks[n_tasks].table = t;
+			tasks[n_tasks].vertex = &model->vertex[g];
+			n_tasks++;
 		}
 	}
 
 	/* Procesar los meshes */
-	Table *meshes_tables;
-
-	meshes_tables = get_key_as_table (&bkv_desc.tables[0], "meshes");
-
 	if (meshes_tables != NULL) {
-		num_meshes = total = get_num_values (meshes_tables);
+		total = model->num_meshes;
 
-		mesh = (MeshData *) malloc (sizeof (MeshData) * total);
+		model->mesh = (MeshData *) mmf_malloc (sizeof (MeshData) * total);
+		memset (model->mesh, 0, sizeof (MeshData) * total);
 
 		for (g = 0; g < total; g++) {
 			t = get_index_as_table (meshes_tables, g);
 
-			/* TODO: Revisar si el nombre de este mesh es un "BlendShape" */
-			load_mesh_data (&mesh[g], t, folder);
+			/* Otra colocación de la misma geometría: los índices se leen una sola vez */
+			h = mesh_find_instance (meshes_tables, g);
+			if (h >= 0) {
+				load_mesh_header (&model->mesh[g], t);
+				model->mesh[g].instance_of = h;
+				continue;
+			}
+
+			tasks[n_tasks].table = t;
+			tasks[n_tasks].mesh = &model->mesh[g];
+			n_tasks++;
 		}
 	}
 
-	/* Tratar de generar un obj */
-	char *file_path = ui_save_file ();
+	pool_group_init (&group);
+	for (g = 0; g < n_tasks; g++) {
+		tasks[g].folder = folder;
+		tasks[g].do_endian = model->desc.do_endian;
+		tasks[g].preload = preload_get_current ();
+		tasks[g].arena = arena_get_current ();
 
-	if (file_path[0] == 0) {
-		ui_show_message_warning ("Will skip obj file save");
+		if (load_pool != NULL && n_tasks > 1) {
+			pool_submit (load_pool, &group, load_task_run, &tasks[g]);
+		} else {
+			load_task_run (&tasks[g]);
+		}
+	}
 
-		return 0;
+	if (load_pool != NULL && n_tasks > 1) {
+		pool_wait (load_pool, &group);
+	}
+	mmf_free (tasks);
+
+	/* Solo los vertexData con "encoding" en el desc vienen cuantizados; los vertex-N de los modelos
+	 * originales son flotantes sin byte de codificación, así que ahí la opción no cambia nada */
+	if (keep_quantized && model->num_vertex > 0) {
+		h = 0;
+		for (g = 0; g < model->num_vertex; g++) {
+			if (model->vertex[g].raw != NULL) h++;
+		}
+		if (h == 0) log_info ("%s: no quantized vertex data, --keep-quantized has no effect\n", folder);
+	}
+
+	/* Cada Color-N.bkv se lee una vez aunque lo usen varios meshes */
+	ids = (int *) mmf_malloc (sizeof (int) * (model->num_meshes + 1));
+	for (g = 0; g < model->num_meshes; g++) {
+		ids[g] = (model->mesh[g].renderable ? model->mesh[g].material : -1);
+	}
+	model->num_materials = materials_load (folder, ids, model->num_meshes, &model->materials);
+	for (g = 0; g < model->num_meshes; g++) {
+		model->mesh[g].material = ids[g];
 	}
+	mmf_free (ids);
 
-	FILE * fd_obj = fopen (file_path, "wb");
+	if (preload_method != PRELOAD_NONE && prev_preload == NULL) {
+		preload_set_current (prev_preload);
+		preload_free (&preload);
+	}
 
-	if (fd_obj == NULL) {
-		ui_show_message_error ("Can't open the file for saving");
+	/* Hace falta el VertexData de la base y el del blend shape completos */
+	stats_begin (&scope, STAT_BLEND);
+	extract_blend_shapes (model, load_pool);
+	stats_end (&scope, NULL, NULL, model->num_shapes);
 
-		return -1;
+	stats_begin (&scope, STAT_POSTPROCESS);
+
+	if ((weld || compact || optimize_cache) && model->num_shapes > 0) {
+		/* Los tres renumeran los vértices y las diferencias quedarían apuntando a otros */
+		log_warn ("Dropping %i blend shapes: --weld, --compact and --optimize-cache renumber their vertices\n", model->num_shapes);
+		blend_shapes_free (model->shapes, model->num_shapes);
+		model->shapes = NULL;
+		model->num_shapes = 0;
 	}
 
-	free (file_path);
+	if (weld && model->mesh != NULL && model->vertex != NULL) {
+		/* Unir los vértices repetidos de todos los VertexData en uno solo */
+		weld_vertices (&model->vertex, &model->num_vertex, model->mesh, model->num_meshes, weld_tolerance, &weld_stats);
 
-	/* Recorrer los vertex y generarlos en el obj */
-	for (g = 0; g < num_vertex; g++) {
-		for (h = 0; h < vertex[g].num; h = h + 3) {
-			fprintf (fd_obj, "v %.7f %.7f %.7f\n", vertex[g].vertex[h], vertex[g].vertex[h + 1], vertex[g].vertex[h + 2]);
-		}
+		log_info ("Weld (tolerance %g): %i -> %i vertices\n", weld_tolerance, weld_stats.vertex_before, weld_stats.vertex_after);
 	}
 
-	#if 0
-	for (g = 0; g < num_vertex; g++) {
-		/* Generar la misma cantidad de vt 0 0 */
-		for (h = 0; h < vertex[g].num; h = h + 3) {
-			fprintf (fd_obj, "vt 0 0\n");
+	if (compact && model->mesh != NULL && model->vertex != NULL) {
+		/* Dejar en cada mesh solo los vértices que usa */
+		compact_meshes (&model->vertex, &model->num_vertex, model->mesh, model->num_meshes, &compact_stats);
+
+		log_info ("Compaction: %i -> %i vertices, %lu -> %lu bytes in memory\n", compact_stats.vertex_before, compact_stats.vertex_after, (unsigned long) compact_stats.bytes_before, (unsigned long) compact_stats.bytes_after);
+		log_info ("Per mesh export: %lu -> %lu bytes (%li saved)\n", (unsigned long) compact_stats.bytes_per_mesh_before, (unsigned long) compact_stats.bytes_after, (long) compact_stats.bytes_per_mesh_before - (long) compact_stats.bytes_after);
+	}
+
+	if (optimize_cache && model->mesh != NULL && model->vertex != NULL) {
+		/* Reordenar triángulos y vértices para la caché de vértices de la GPU */
+		optimize_vertex_cache (model->vertex, model->num_vertex, model->mesh, model->num_meshes, &cache_stats);
+
+		if (cache_stats.triangles > 0) {
+			log_info ("Vertex cache (FIFO %i): ACMR %.3f -> %.3f over %i triangles\n", VERTEX_CACHE_SIZE, (float) cache_stats.misses_before / cache_stats.triangles, (float) cache_stats.misses_after / cache_stats.triangles, cache_stats.triangles);
 		}
 	}
-	#endif
 
-	fprintf (fd_obj, "vn 0 0 0\nusemtl None\ns 1\n");
+	if (model->vertex != NULL) {
+		/* Weld y compact dejan VertexData nuevos, sin caja */
+		if (weld || compact) {
+			for (g = 0; g < model->num_vertex; g++) {
+				vertex_data_bounds (&model->vertex[g]);
+			}
+		}
 
-	/* Generar las caras */
-	for (g = 0; g < num_meshes; g++) {
-		fprintf (fd_obj, "# g %s\n", mesh[g].name);
-		for (h = 0; h < mesh[g].num_index; h = h + 3) {
-			fprintf (fd_obj, "f %i//1 %i//1 %i//1\n", mesh[g].index[h] + 1, mesh[g].index[h + 1] + 1, mesh[g].index[h + 2] + 1);
+		if (model->mesh != NULL) {
+			compute_mesh_bounds (model->vertex, model->num_vertex, model->mesh, model->num_meshes, load_pool);
 		}
 	}
 
-	fclose (fd_obj);
+	stats_end (&scope, NULL, NULL, 0);
 
-	ui_show_message_info ("OBJ File Saved");
+	/* Los huesos, las transformaciones y una instancia por cada colocación de un mesh */
+	stats_begin (&scope, STAT_SCENE);
+	build_scene (model);
+	stats_end (&scope, NULL, NULL, model->num_nodes);
+	stats_end (&model_scope, NULL, folder, model->num_vertex + model->num_meshes);
 
 	return 0;
 }
 
+/* El BVH de cada mesh va junto a la salida, con extensión .bvh */
+static int model_write_bvh (MMFModel *model, const char *file_path) {
+	MeshBvh *bvh;
+	StatScope scope;
+	char *path, *ext;
+	int g, nodes, result;
+
+	stats_begin (&scope, STAT_BVH);
+
+	path = (char *) mmf_malloc (strlen (file_path) + 5);
+	strcpy (path, file_path);
+	ext = strrchr (path, '.');
+	if (ext != NULL && strchr (ext, '/') == NULL && strchr (ext, '\\') == NULL) *ext = 0;
+	strcat (path, ".bvh");
+
+	bvh = (MeshBvh *) mmf_malloc (sizeof (MeshBvh) * (model->num_meshes + 1));
+	bvh_build_meshes (bvh, model->vertex, model->num_vertex, model->mesh, model->num_meshes, load_pool);
+
+	result = bvh_write (path, model->mesh, model->num_meshes, bvh);
+
+	nodes = 0;
+	for (g = 0; g < model->num_meshes; g++) {
+		nodes += bvh[g].n_nodes;
+	}
+	log_info ("BVH: %i meshes, %i nodes, %s\n", model->num_meshes, nodes, path);
+
+	bvh_free (bvh, model->num_meshes);
+	mmf_free (bvh);
+	mmf_free (path);
+
+	stats_end (&scope, NULL, NULL, nodes);
+
+	return result;
+}
+
+/* Todo lo que no es GLB ni un modelo compilado sale como OBJ */
+static int is_obj_output (const char *file_path) {
+	return !has_extension (file_path, ".glb") && !has_extension (file_path, ".mmfb");
+}
+
+/* Los niveles de detalle cambian los vértices y los meshes, el resto sale del modelo */
+static int model_write_file (const char *file_path, MMFModel *model, VertexData *vertex, int num_vertex, MeshData *mesh, int num_meshes, BlendShape *shapes, int num_shapes) {
+	if (has_extension (file_path, ".glb")) {
+		/* glTF binario: los buffers decodificados se escriben tal cual */
+		return gltf_write_glb (file_path, model, vertex, num_vertex, mesh, num_meshes, shapes, num_shapes);
+	}
+
+	if (has_extension (file_path, ".mmfb")) {
+		/* Modelo compilado: se abre después con un solo mmap */
+		return bundle_write (file_path, model, vertex, num_vertex, mesh, num_meshes, shapes, num_shapes);
+	}
+
+	return obj_write (file_path, vertex, num_vertex, mesh, num_meshes, model->materials, model->num_materials);
+}
+
+/* Cada nivel de detalle va junto a la salida, con _lodN antes de la extensión */
+static int model_write_lods (MMFModel *model, const char *file_path) {
+	MeshLod *lods;
+	StatScope scope;
+	const char *ext;
+	char *path;
+	size_t len;
+	int g, base, result;
+
+	stats_begin (&scope, STAT_LOD);
+
+	lods = (MeshLod *) mmf_malloc (sizeof (MeshLod) * lod_levels);
+	build_lods (model->vertex, model->num_vertex, model->mesh, model->num_meshes, lod_levels, lod_ratio, lods, load_pool);
+
+	base = 0;
+	for (g = 0; g < model->num_meshes; g++) {
+		base += model->mesh[g].num_index / 3;
+	}
+
+	ext = strrchr (file_path, '.');
+	if (ext == NULL || strchr (ext, '/') != NULL || strchr (ext, '\\') != NULL) ext = file_path + strlen (file_path);
+
+	len = strlen (file_path) + 16;
+	path = (char *) mmf_malloc (len);
+
+	result = 0;
+	for (g = 0; g < lod_levels && result == 0; g++) {
+		snprintf (path, len, "%.*s_lod%i%s", (int) (ext - file_path), file_path, g + 1, ext);
+		/* Los niveles tienen sus propios vértices, los blend shapes solo valen para la base */
+		result = model_write_file (path, model, lods[g].vertex, lods[g].num_vertex, lods[g].mesh, lods[g].num_meshes, NULL, 0);
+
+		log_info ("LOD %i: %i -> %i triangles, %s\n", g + 1, base, lods[g].triangles, path);
+	}
+
+	lod_free (lods, lod_levels);
+	mmf_free (lods);
+	mmf_free (path);
+
+	stats_end (&scope, NULL, NULL, lod_levels);
+
+	return result;
+}
+
+int export_model (MMFModel *model, const char *file_path) {
+	StatScope scope;
+	int g;
+
+	stats_begin (&scope, STAT_EXPORT);
+
+	g = model_write_file (file_path, model, model->vertex, model->num_vertex, model->mesh, model->num_meshes, model->shapes, model->num_shapes);
+
+	if (g == 0 && write_bvh) {
+		g = model_write_bvh (model, file_path);
+	}
+
+	if (g == 0 && lod_levels > 0) {
+		g = model_write_lods (model, file_path);
+	}
+
+	stats_end (&scope, NULL, file_path, model->num_vertex + model->num_meshes);
+
+	return g;
+}
+
+/* Streaming solo para OBJ sin pasos que necesitan el modelo completo */
+/* Las normales necesitan todos los meshes de un VertexData, el streaming escribe el vn de relleno */
+static int model_can_stream (const char *file_path) {
+	return stream_budget > 0 && is_obj_output (file_path) && !generate_normals && !weld && !compact && !optimize_cache && !write_bvh && lod_levels == 0;
+}
+
+/* Todo lo que cambia el archivo de salida entra en la llave de la caché.
+ * El OBJ lleva el nombre de su .mtl en el mtllib, así que también entra */
+static void model_cache_options (char *buffer, size_t len, const char *file_path) {
+	char mtl_path[8192];
+	const char *ext, *mtllib;
+
+	ext = strrchr (file_path, '.');
+	if (ext == NULL) ext = "";
+
+	mtllib = "";
+	if (is_obj_output (file_path)) {
+		materials_mtl_path (file_path, mtl_path, sizeof (mtl_path));
+		mtllib = materials_path_basename (mtl_path);
+	}
+
+	snprintf (buffer, len, "quantized=%i compact=%i weld=%i/%.9g vertex_cache=%i normals=%i ext=%s mtllib=%s", keep_quantized, compact, weld, weld_tolerance, optimize_cache, generate_normals, ext, mtllib);
+}
+
+/* 1 si la salida se restauró de la caché, 0 si hay que convertir y guardar con la llave,
+ * -1 si no hay caché o no se pudo calcular la llave */
+int model_cache_fetch (char *folder, const char *file_path, uint64_t *key) {
+	char options[8448], mtl_path[8192];
+
+	/* La caché solo guarda la salida principal, no el .bvh ni los niveles de detalle */
+	if (cache == NULL || write_bvh || lod_levels > 0) return -1;
+
+	model_cache_options (options, sizeof (options), file_path);
+	if (cache_model_key (folder, options, key) < 0) {
+		return -1;
+	}
+
+	materials_mtl_path (file_path, mtl_path, sizeof (mtl_path));
+
+	if (cache_fetch (cache, *key, file_path) == 0) {
+		/* El .mtl solo existe si el modelo tiene materiales */
+		if (is_obj_output (file_path)) cache_fetch_side (cache, *key, mtl_path);
+
+		log_info ("Cache hit %016llx: %s\n", (unsigned long long) *key, file_path);
+		return 1;
+	}
+
+	return 0;
+}
+
+void model_cache_store (uint64_t key, const char *file_path) {
+	char mtl_path[8192];
+
+	if (cache == NULL) return;
+
+	if (cache_store (cache, key, file_path) < 0) {
+		log_warn ("Could not store %s in the cache\n", file_path);
+		return;
+	}
+
+	materials_mtl_path (file_path, mtl_path, sizeof (mtl_path));
+	if (is_obj_output (file_path) && access (mtl_path, R_OK) == 0 && cache_store (cache, key, mtl_path) < 0) {
+		log_warn ("Could not store %s in the cache\n", mtl_path);
+	}
+}
+
+static int stage_counter;
+
+/* Carpeta temporal junto a la salida donde se escribe la conversión. Los nombres de los archivos
+ * no cambian (el OBJ nombra su .mtl), solo la carpeta. -1 si no se pudo crear */
+static int model_stage_begin (const char *file_path, char *stage, size_t len, char *staged_path, size_t staged_len) {
+	const char *base;
+	int counter, r;
+
+	base = materials_path_basename (file_path);
+	counter = __atomic_add_fetch (&stage_counter, 1, __ATOMIC_RELAXED);
+	snprintf (stage, len, "%.*s.mmf-stage-%li-%i", (int) (base - file_path), file_path, (long) getpid (), counter);
+
+#ifdef _WIN32
+	r = mkdir (stage);
+#else
+	r = mkdir (stage, 0700);
+#endif
+	if (r < 0) return -1;
+
+	snprintf (staged_path, staged_len, "%s/%s", stage, base);
+
+	return 0;
+}
+
+/* Con commit mueve cada archivo de la carpeta temporal junto a la salida, reemplazando los anteriores;
+ * sin commit los descarta. Luego borra la carpeta. -1 si algún archivo no se pudo mover */
+static int model_stage_end (const char *file_path, const char *stage, int commit) {
+	DIR *d;
+	struct dirent *entry;
+	char from[8192 + 64 + 256 + 2], to[8192 + 256];
+	const char *base;
+	int g;
+
+	d = opendir (stage);
+	if (d == NULL) return -1;
+
+	base = materials_path_basename (file_path);
+	g = 0;
+	while ((entry = readdir (d)) != NULL) {
+		if (strcmp (entry->d_name, ".") == 0 || strcmp (entry->d_name, "..") == 0) continue;
+
+		snprintf (from, sizeof (from), "%s/%s", stage, entry->d_name);
+		snprintf (to, sizeof (to), "%.*s%s", (int) (base - file_path), file_path, entry->d_name);
+
+		if (commit) {
+#ifdef _WIN32
+			unlink (to);
+#endif
+			if (rename (from, to) == 0) continue;
+
+			log_error ("Could not move %s to %s\n", from, to);
+			g = -1;
+		}
+		unlink (from);
+	}
+	closedir (d);
+
+	rmdir (stage);
+
+	return g;
+}
+
+/* Conversión sin interfaz: caché, lectura y exportación. 1 si la salida salió de la caché,
+ * -1 si no se pudo leer el modelo y -2 si no se pudo escribir.
+ * La salida se escribe aparte y se mueve al terminar: si la conversión falla quedan los archivos
+ * anteriores, y dos conversiones a la misma salida no escriben a la vez en el mismo archivo */
+int model_convert (char *folder, const char *file_path) {
+	MMFModel model;
+	char stage[8192 + 64], staged_path[8192 + 128];
+	const char *output;
+	uint64_t key;
+	int g, cached, staged;
+
+	cached = model_cache_fetch (folder, file_path, &key);
+	if (cached == 1) {
+		return 1;
+	}
+
+	staged = (model_stage_begin (file_path, stage, sizeof (stage), staged_path, sizeof (staged_path)) == 0);
+	output = (staged ? staged_path : file_path);
+
+	g = 1;
+	if (model_can_stream (file_path)) {
+		g = streaming_convert (folder, output, stream_budget);
+	} else if (stream_budget > 0 && generate_normals) {
+		log_info ("Not streaming %s: normals need the whole model (use --no-normals)\n", file_path);
+	}
+
+	/* Sin streaming, o un modelo que no se puede convertir así */
+	if (g == 1) {
+		g = load_model (&model, folder);
+		if (g == 0) {
+			if (export_model (&model, output) < 0) g = -2;
+			model_free (&model);
+		}
+	}
+
+	if (staged && model_stage_end (file_path, stage, g == 0) < 0 && g == 0) {
+		g = -2;
+	}
+
+	if (g == 0 && cached == 0) {
+		model_cache_store (key, file_path);
+	}
+
+	return g;
+}
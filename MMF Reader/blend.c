@@ -0,0 +1,324 @@
+/*
+ * blend.c
+ * This file is part of BKV Reader
+ *
+ * Copyright (C) 2022 - Félix Arreola Rodríguez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+#include "mmf.h"
+#include "pool.h"
+#include "arena.h"
+#include "bounds.h"
+#include "optimize.h"
+#include "log.h"
+#include "blend.h"
+
+typedef struct {
+	VertexData *base;
+	VertexData *target;
+	BlendShape *shape;
+
+	Arena *arena;
+} BlendTask;
+
+int is_blend_shape_name (const char *name) {
+	return name != NULL && strstr (name, "BlendShape") != NULL;
+}
+
+static int vertex_data_count (MMFModel *model, int id) {
+	if (id < 0 || id >= model->num_vertex) return -1;
+	if (model->vertex[id].vertex == NULL && model->vertex[id].raw == NULL) return -1;
+
+	return model->vertex[id].num / 3;
+}
+
+static int blend_shape_candidate (MMFModel *model, uint8_t *is_shape, int h, int count) {
+	return !is_shape[h] && model->mesh[h].index != NULL && vertex_data_count (model, model->mesh[h].vertex_data_id) == count;
+}
+
+/* Un mesh normal con el mismo número de vértices: el que tenga como nombre el inicio
+ * del nombre del blend shape ("cara" para "cara_BlendShape1"), si no el más cercano, primero hacia atrás */
+static int blend_shape_base (MMFModel *model, uint8_t *is_shape, int g) {
+	int count, h, len, best, best_len;
+
+	count = vertex_data_count (model, model->mesh[g].vertex_data_id);
+	if (count <= 0) return -1;
+
+	/* El prefijo más largo, para que "cara1" gane a "cara" */
+	best = -1;
+	best_len = 0;
+	for (h = 0; h < model->num_meshes; h++) {
+		if (model->mesh[h].name == NULL || !blend_shape_candidate (model, is_shape, h, count)) continue;
+
+		len = strlen (model->mesh[h].name);
+		if (len > best_len && strncmp (model->mesh[g].name, model->mesh[h].name, len) == 0) {
+			best = h;
+			best_len = len;
+		}
+	}
+	if (best >= 0) return best;
+
+	for (h = g - 1; h >= 0; h--) {
+		if (blend_shape_candidate (model, is_shape, h, count)) return h;
+	}
+
+	for (h = g + 1; h < model->num_meshes; h++) {
+		if (blend_shape_candidate (model, is_shape, h, count)) return h;
+	}
+
+	return -1;
+}
+
+/* Solo se guardan los vértices que cambian, sin tolerancia */
+static void blend_task_run (void *data) {
+	BlendTask *task = (BlendTask *) data;
+	BlendShape *shape = task->shape;
+	Arena *prev_arena;
+	float a[3], b[3];
+	uint32_t count, g;
+	int n;
+
+	prev_arena = arena_get_current ();
+	arena_set_current (task->arena);
+
+	count = task->base->num / 3;
+
+	n = 0;
+	for (g = 0; g < count; g++) {
+		vertex_data_position (task->base, g, a);
+		vertex_data_position (task->target, g, b);
+		if (a[0] != b[0] || a[1] != b[1] || a[2] != b[2]) n++;
+	}
+
+	shape->count = n;
+	shape->index = (uint32_t *) mmf_malloc (sizeof (uint32_t) * (n + 1));
+	shape->dx = (float *) mmf_malloc (sizeof (float) * (n + 1));
+	shape->dy = (float *) mmf_malloc (sizeof (float) * (n + 1));
+	shape->dz = (float *) mmf_malloc (sizeof (float) * (n + 1));
+
+	n = 0;
+	for (g = 0; g < count; g++) {
+		vertex_data_position (task->base, g, a);
+		vertex_data_position (task->target, g, b);
+		if (a[0] == b[0] && a[1] == b[1] && a[2] == b[2]) continue;
+
+		shape->index[n] = g;
+		shape->dx[n] = b[0] - a[0];
+		shape->dy[n] = b[1] - a[1];
+		shape->dz[n] = b[2] - a[2];
+		n++;
+	}
+
+	arena_set_current (prev_arena);
+}
+
+/* Los meshes con "BlendShape" en el nombre pasan a ser diferencias contra su mesh base.
+ * Su geometría ya no se exporta: el VertexData se libera si ningún otro mesh lo usa */
+int extract_blend_shapes (MMFModel *model, ThreadPool *pool) {
+	BlendTask *tasks;
+	TaskGroup group;
+	uint8_t *is_shape, *keep;
+	int *base;
+	int g, h, n_shapes, moved, total;
+	size_t bytes_before, bytes_after;
+
+	model->shapes = NULL;
+	model->num_shapes = 0;
+	if (model->mesh == NULL || model->vertex == NULL) return 0;
+
+	is_shape = (uint8_t *) mmf_malloc (model->num_meshes + 1);
+	base = (int *) mmf_malloc (sizeof (int) * (model->num_meshes + 1));
+	n_shapes = 0;
+	for (g = 0; g < model->num_meshes; g++) {
+		is_shape[g] = is_blend_shape_name (model->mesh[g].name);
+	}
+
+	for (g = 0; g < model->num_meshes; g++) {
+		base[g] = -1;
+		if (!is_shape[g]) continue;
+
+		base[g] = blend_shape_base (model, is_shape, g);
+		if (base[g] < 0) {
+			log_warn ("Blend shape %s has no base mesh with the same vertices, keeping it as geometry\n", model->mesh[g].name);
+			continue;
+		}
+		n_shapes++;
+	}
+
+	if (n_shapes == 0) {
+		mmf_free (base);
+		mmf_free (is_shape);
+		return 0;
+	}
+
+	model->shapes = (BlendShape *) mmf_malloc (sizeof (BlendShape) * n_shapes);
+	memset (model->shapes, 0, sizeof (BlendShape) * n_shapes);
+	tasks = (BlendTask *) mmf_malloc (sizeof (BlendTask) * n_shapes);
+
+	pool_group_init (&group);
+	for (g = 0; g < model->num_meshes; g++) {
+		if (base[g] < 0) continue;
+
+		h = model->num_shapes++;
+		model->shapes[h].name = model->mesh[g].name;
+		model->shapes[h].mesh = base[g];
+		model->shapes[h].vertex_data_id = model->mesh[base[g]].vertex_data_id;
+
+		tasks[h].base = &model->vertex[model->mesh[base[g]].vertex_data_id];
+		tasks[h].target = &model->vertex[model->mesh[g].vertex_data_id];
+		tasks[h].shape = &model->shapes[h];
+		tasks[h].arena = arena_get_current ();
+
+		if (pool != NULL && n_shapes > 1) {
+			pool_submit (pool, &group, blend_task_run, &tasks[h]);
+		} else {
+			blend_task_run (&tasks[h]);
+		}
+	}
+
+	if (pool != NULL && n_shapes > 1) {
+		pool_wait (pool, &group);
+	}
+	mmf_free (tasks);
+
+	/* Un VertexData se queda si lo usa algún mesh que no es blend shape */
+	keep = (uint8_t *) mmf_malloc (model->num_vertex + 1);
+	memset (keep, 0, model->num_vertex + 1);
+	for (g = 0; g < model->num_meshes; g++) {
+		if (base[g] < 0 && model->mesh[g].vertex_data_id >= 0 && model->mesh[g].vertex_data_id < model->num_vertex) {
+			keep[model->mesh[g].vertex_data_id] = 1;
+		}
+	}
+
+	bytes_before = 0;
+	for (g = 0; g < model->num_meshes; g++) {
+		if (base[g] < 0) continue;
+
+		h = model->mesh[g].vertex_data_id;
+		if (!keep[h] && model->vertex[h].num > 0) {
+			bytes_before += (model->vertex[h].num / 3) * vertex_element_size (&model->vertex[h]);
+
+			mmf_free (model->vertex[h].vertex);
+			mmf_free (model->vertex[h].raw);
+			mmf_free (model->vertex[h].normal);
+			model->vertex[h].vertex = NULL;
+			model->vertex[h].raw = NULL;
+			model->vertex[h].normal = NULL;
+			model->vertex[h].num = 0;
+		}
+
+		/* El mesh queda solo con su nombre */
+		mmf_free (model->mesh[g].index);
+		model->mesh[g].index = NULL;
+		model->mesh[g].num_index = 0;
+		model->mesh[g].renderable = 0;
+		model->mesh[g].vertex_data_id = -1;
+	}
+
+	moved = total = 0;
+	bytes_after = 0;
+	for (g = 0; g < model->num_shapes; g++) {
+		moved += model->shapes[g].count;
+		total += model->vertex[model->shapes[g].vertex_data_id].num / 3;
+		bytes_after += model->shapes[g].count * (sizeof (uint32_t) + 3 * sizeof (float));
+	}
+
+	log_info ("Blend shapes: %i, %i of %i vertices moved, %lu -> %lu bytes\n", model->num_shapes, moved, total, (unsigned long) bytes_before, (unsigned long) bytes_after);
+
+	mmf_free (keep);
+	mmf_free (base);
+	mmf_free (is_shape);
+
+	return model->num_shapes;
+}
+
+/* out = vértices de base + la suma de weights[s] por las diferencias de cada blend shape
+ * de vertex_data_id. out tiene base->num flotantes; weights uno por blend shape */
+void blend_shapes_apply (VertexData *base, int vertex_data_id, BlendShape *shapes, int num_shapes, const float *weights, float *out) {
+#ifdef __SSE__
+	__m128 w, r0, r1, r2, r3;
+	uint32_t *index;
+	float *p;
+#endif
+	BlendShape *shape;
+	uint32_t count;
+	int g, h, k;
+
+	count = base->num / 3;
+	for (g = 0; g < count; g++) {
+		vertex_data_position (base, g, &out[g * 3]);
+	}
+
+	for (g = 0; g < num_shapes; g++) {
+		shape = &shapes[g];
+		if (shape->vertex_data_id != vertex_data_id || weights[g] == 0) continue;
+
+		h = 0;
+#ifdef __SSE__
+		/* Cuatro diferencias a la vez; al trasponer queda un x y z 0 por vértice.
+		 * Se escriben 4 flotantes, así que el último vértice de out va por la parte escalar */
+		w = _mm_set1_ps (weights[g]);
+		for (; h + 4 <= shape->count && shape->index[h + 3] + 1 < count; h = h + 4) {
+			r0 = _mm_mul_ps (_mm_loadu_ps (&shape->dx[h]), w);
+			r1 = _mm_mul_ps (_mm_loadu_ps (&shape->dy[h]), w);
+			r2 = _mm_mul_ps (_mm_loadu_ps (&shape->dz[h]), w);
+			r3 = _mm_setzero_ps ();
+			_MM_TRANSPOSE4_PS (r0, r1, r2, r3);
+
+			/* Los índices van en orden creciente, cada suma ve la anterior aunque se encimen */
+			index = &shape->index[h];
+			p = &out[index[0] * 3];
+			_mm_storeu_ps (p, _mm_add_ps (_mm_loadu_ps (p), r0));
+			p = &out[index[1] * 3];
+			_mm_storeu_ps (p, _mm_add_ps (_mm_loadu_ps (p), r1));
+			p = &out[index[2] * 3];
+			_mm_storeu_ps (p, _mm_add_ps (_mm_loadu_ps (p), r2));
+			p = &out[index[3] * 3];
+			_mm_storeu_ps (p, _mm_add_ps (_mm_loadu_ps (p), r3));
+		}
+#endif
+
+		for (; h < shape->count; h++) {
+			k = shape->index[h];
+			if (k >= count) continue;
+
+			out[k * 3] += weights[g] * shape->dx[h];
+			out[k * 3 + 1] += weights[g] * shape->dy[h];
+			out[k * 3 + 2] += weights[g] * shape->dz[h];
+		}
+	}
+}
+
+void blend_shapes_free (BlendShape *shapes, int num_shapes) {
+	int g;
+
+	for (g = 0; g < num_shapes; g++) {
+		mmf_free (shapes[g].index);
+		mmf_free (shapes[g].dx);
+		mmf_free (shapes[g].dy);
+		mmf_free (shapes[g].dz);
+	}
+	mmf_free (shapes);
+}
@@ -0,0 +1,11 @@
+#ifndef __BLEND_H__
+#define __BLEND_H__
+
+#include "mmf.h"
+
+int is_blend_shape_name (const char *name);
+int extract_blend_shapes (MMFModel *model, ThreadPool *pool);
+void blend_shapes_apply (VertexData *base, int vertex_data_id, BlendShape *shapes, int num_shapes, const float *weights, float *out);
+void blend_shapes_free (BlendShape *shapes, int num_shapes);
+
+#endif /* __BLEND_H__ */
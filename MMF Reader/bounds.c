@@ -0,0 +1,223 @@
+/*
+ * bounds.c
+ * This file is part of BKV Reader
+ *
+ * Copyright (C) 2022 - Félix Arreola Rodríguez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+#include "mmf.h"
+#include "pool.h"
+#include "arena.h"
+#include "bounds.h"
+
+typedef struct {
+	VertexData *vertex;
+	int num_vertex;
+	MeshData *mesh;
+} MeshBoundsTask;
+
+/* Caja de "count" puntos xyz seguidos; sin puntos queda en ceros */
+void bounds_of_points (const float *points, int count, float *min, float *max) {
+#ifdef __SSE__
+	__m128 min0, min1, min2, max0, max1, max2, a, b, c;
+	float lanes_min[12], lanes_max[12];
+#endif
+	int g, h;
+
+	if (count <= 0) {
+		memset (min, 0, sizeof (float) * 3);
+		memset (max, 0, sizeof (float) * 3);
+		return;
+	}
+
+	for (h = 0; h < 3; h++) {
+		min[h] = max[h] = points[h];
+	}
+
+	g = 0;
+#ifdef __SSE__
+	/* Cuatro puntos son tres registros completos: x y z x | y z x y | z x y z */
+	if (count >= 4) {
+		min0 = max0 = _mm_loadu_ps (&points[0]);
+		min1 = max1 = _mm_loadu_ps (&points[4]);
+		min2 = max2 = _mm_loadu_ps (&points[8]);
+
+		for (g = 4; g + 4 <= count; g = g + 4) {
+			a = _mm_loadu_ps (&points[g * 3]);
+			b = _mm_loadu_ps (&points[g * 3 + 4]);
+			c = _mm_loadu_ps (&points[g * 3 + 8]);
+
+			min0 = _mm_min_ps (min0, a);
+			min1 = _mm_min_ps (min1, b);
+			min2 = _mm_min_ps (min2, c);
+			max0 = _mm_max_ps (max0, a);
+			max1 = _mm_max_ps (max1, b);
+			max2 = _mm_max_ps (max2, c);
+		}
+
+		_mm_storeu_ps (&lanes_min[0], min0);
+		_mm_storeu_ps (&lanes_min[4], min1);
+		_mm_storeu_ps (&lanes_min[8], min2);
+		_mm_storeu_ps (&lanes_max[0], max0);
+		_mm_storeu_ps (&lanes_max[4], max1);
+		_mm_storeu_ps (&lanes_max[8], max2);
+
+		/* Juntar los cuatro puntos de los carriles */
+		for (h = 0; h < 12; h++) {
+			if (lanes_min[h] < min[h % 3]) min[h % 3] = lanes_min[h];
+			if (lanes_max[h] > max[h % 3]) max[h % 3] = lanes_max[h];
+		}
+	}
+#endif
+
+	for (; g < count; g++) {
+		for (h = 0; h < 3; h++) {
+			if (points[g * 3 + h] < min[h]) min[h] = points[g * 3 + h];
+			if (points[g * 3 + h] > max[h]) max[h] = points[g * 3 + h];
+		}
+	}
+}
+
+/* Componente del flujo cuantizado, sin dividir */
+static float raw_component (VertexData *vertex, int pos) {
+	switch (vertex->encoding) {
+		case ENCODING_BYTE:
+		case UNENCODED_BYTE:
+			return ((uint8_t *) vertex->raw)[pos];
+		case ENCODING_BYTE_SIGNED:
+		case UNENCODED_BYTE_SIGNED:
+			return ((int8_t *) vertex->raw)[pos];
+		case ENCODING_SHORT:
+		case UNENCODED_SHORT:
+			return ((uint16_t *) vertex->raw)[pos];
+		case ENCODING_SHORT_SIGNED:
+		case UNENCODED_SHORT_SIGNED:
+			return ((int16_t *) vertex->raw)[pos];
+	}
+
+	return 0;
+}
+
+/* Posición del vértice como flotantes, esté expandido o no */
+void vertex_data_position (VertexData *vertex, uint32_t index, float *out) {
+	float divisor;
+	int h;
+
+	if (vertex->vertex != NULL) {
+		for (h = 0; h < 3; h++) {
+			out[h] = vertex->vertex[index * 3 + h];
+		}
+		return;
+	}
+
+	divisor = encoding_divisor (vertex->encoding);
+	for (h = 0; h < 3; h++) {
+		out[h] = raw_component (vertex, index * 3 + h) / divisor;
+	}
+}
+
+void vertex_data_bounds (VertexData *vertex) {
+	float f, divisor;
+	int g, count;
+
+	count = vertex->num / 3;
+	if (vertex->vertex != NULL || vertex->raw == NULL || count == 0) {
+		bounds_of_points (vertex->vertex, (vertex->vertex != NULL ? count : 0), vertex->min, vertex->max);
+		return;
+	}
+
+	/* Cuantizado: la división conserva el orden, basta con dividir los extremos */
+	for (g = 0; g < 3; g++) {
+		vertex->min[g] = vertex->max[g] = raw_component (vertex, g);
+	}
+	for (g = 3; g < count * 3; g++) {
+		f = raw_component (vertex, g);
+		if (f < vertex->min[g % 3]) vertex->min[g % 3] = f;
+		if (f > vertex->max[g % 3]) vertex->max[g % 3] = f;
+	}
+
+	divisor = encoding_divisor (vertex->encoding);
+	for (g = 0; g < 3; g++) {
+		vertex->min[g] /= divisor;
+		vertex->max[g] /= divisor;
+	}
+}
+
+/* Caja de los vértices que usan los índices del mesh */
+static void mesh_bounds_run (void *data) {
+	MeshBoundsTask *task = (MeshBoundsTask *) data;
+	MeshData *mesh = task->mesh;
+	VertexData *vertex;
+	float p[3];
+	uint32_t count;
+	int g, h, first;
+
+	memset (mesh->min, 0, sizeof (mesh->min));
+	memset (mesh->max, 0, sizeof (mesh->max));
+
+	if (mesh->index == NULL || mesh->vertex_data_id < 0 || mesh->vertex_data_id >= task->num_vertex) return;
+
+	vertex = &task->vertex[mesh->vertex_data_id];
+	count = vertex->num / 3;
+
+	first = 1;
+	for (g = 0; g < mesh->num_index; g++) {
+		if (mesh->index[g] >= count) continue;
+
+		vertex_data_position (vertex, mesh->index[g], p);
+		for (h = 0; h < 3; h++) {
+			if (first || p[h] < mesh->min[h]) mesh->min[h] = p[h];
+			if (first || p[h] > mesh->max[h]) mesh->max[h] = p[h];
+		}
+		first = 0;
+	}
+}
+
+void compute_mesh_bounds (VertexData *vertex, int num_vertex, MeshData *mesh, int num_meshes, ThreadPool *pool) {
+	MeshBoundsTask *tasks;
+	TaskGroup group;
+	int g;
+
+	tasks = (MeshBoundsTask *) mmf_malloc (sizeof (MeshBoundsTask) * (num_meshes + 1));
+
+	pool_group_init (&group);
+	for (g = 0; g < num_meshes; g++) {
+		tasks[g].vertex = vertex;
+		tasks[g].num_vertex = num_vertex;
+		tasks[g].mesh = &mesh[g];
+
+		if (pool != NULL && num_meshes > 1) {
+			pool_submit (pool, &group, mesh_bounds_run, &tasks[g]);
+		} else {
+			mesh_bounds_run (&tasks[g]);
+		}
+	}
+
+	if (pool != NULL && num_meshes > 1) {
+		pool_wait (pool, &group);
+	}
+
+	mmf_free (tasks);
+}
@@ -0,0 +1,11 @@
+#ifndef __BOUNDS_H__
+#define __BOUNDS_H__
+
+#include "mmf.h"
+
+void bounds_of_points (const float *points, int count, float *min, float *max);
+void vertex_data_position (VertexData *vertex, uint32_t index, float *out);
+void vertex_data_bounds (VertexData *vertex);
+void compute_mesh_bounds (VertexData *vertex, int num_vertex, MeshData *mesh, int num_meshes, ThreadPool *pool);
+
+#endif /* __BOUNDS_H__ */
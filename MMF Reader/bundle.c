@@ -0,0 +1,882 @@
+/*
+ * bundle.c
+ * This file is part of BKV Reader
+ *
+ * Copyright (C) 2022 - Félix Arreola Rodríguez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+#include "mmf.h"
+#include "arena.h"
+#include "hash.h"
+#include "stats.h"
+#include "log.h"
+#include "bundle.h"
+
+/* Cadena o índice ausente */
+#define BUNDLE_NONE 0xFFFFFFFF
+
+/* Todos los arreglos empiezan en múltiplo de 16 */
+#define BUNDLE_ALIGN 16
+
+/* El archivo es la cabecera, los arreglos de datos y al final una sección por tipo de registro.
+ * Todo se referencia por desplazamiento desde el inicio del archivo; abrirlo es mapearlo
+ * y convertir desplazamientos en apuntadores, los arreglos grandes se usan sin copiar */
+enum {
+	BUNDLE_STRINGS = 0,
+	BUNDLE_WORDS,
+	BUNDLE_TABLES,
+	BUNDLE_ENTRIES,
+	BUNDLE_TRANSFORMS,
+	BUNDLE_BONES,
+	BUNDLE_VERTEX,
+	BUNDLE_MESHES,
+	BUNDLE_SHAPES,
+	BUNDLE_MATERIALS,
+	BUNDLE_NODES,
+
+	BUNDLE_NUM_SECTIONS
+};
+
+typedef struct {
+	uint32_t count;
+	/* Bytes de cada registro, para no leer un archivo de otra versión de los registros */
+	uint32_t record_size;
+	uint64_t offset;
+} BundleSection;
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t size;
+
+	int32_t root_table;
+	uint32_t n_sections;
+
+	BundleSection sections[BUNDLE_NUM_SECTIONS];
+} BundleHeader;
+
+typedef struct {
+	uint32_t pos;
+	uint32_t word;
+} BundleWord;
+
+typedef struct {
+	uint32_t pos;
+	uint32_t n_entries;
+	uint32_t first_entry;
+} BundleTable;
+
+/* value según el tipo: el número tal cual, los bits del flotante, la cadena o el número de tabla */
+typedef struct {
+	uint32_t name_pos;
+	uint32_t name;
+	uint32_t type;
+	uint32_t value;
+} BundleEntry;
+
+typedef struct {
+	uint32_t name;
+	int32_t parent;
+	int32_t transform;
+	int32_t inv_transform;
+} BundleBone;
+
+typedef struct {
+	uint32_t num;
+	int32_t encoding;
+	float scale;
+	uint32_t reserved;
+
+	float min[3];
+	float max[3];
+
+	uint64_t vertex;
+	uint64_t normal;
+	uint64_t raw;
+} BundleVertex;
+
+typedef struct {
+	int32_t id;
+	uint32_t name;
+	int32_t vertex_data_id;
+	int32_t renderable;
+	int32_t material;
+	int32_t back_face_culling;
+	int32_t max_influences;
+	int32_t instance_of;
+	int32_t transform;
+	uint32_t num_index;
+
+	float min[3];
+	float max[3];
+
+	uint64_t index;
+} BundleMesh;
+
+typedef struct {
+	uint32_t name;
+	int32_t mesh;
+	int32_t vertex_data_id;
+	uint32_t count;
+
+	uint64_t index;
+	uint64_t dx;
+	uint64_t dy;
+	uint64_t dz;
+} BundleShape;
+
+typedef struct {
+	uint32_t name;
+	int32_t id;
+
+	float diffuse[4];
+	float specular[3];
+	float shininess;
+
+	uint32_t texture;
+	uint32_t reserved;
+} BundleMaterial;
+
+typedef struct {
+	uint32_t name;
+	int32_t parent;
+	int32_t transform;
+	int32_t mesh;
+} BundleNode;
+
+/* Cadenas sin repetir, con su desplazamiento + 1 por hash; 0 es un lugar libre */
+typedef struct {
+	char *data;
+	uint32_t len;
+	uint32_t size;
+
+	uint32_t *slots;
+	uint32_t n_slots;
+	uint32_t used;
+} BundleStrings;
+
+typedef struct {
+	FILE *fd;
+	uint64_t pos;
+} BundleWriter;
+
+static int host_is_little_endian (void) {
+	uint16_t t = 1;
+
+	return *((uint8_t *) &t) == 1;
+}
+
+static void bundle_strings_grow (BundleStrings *strings) {
+	uint32_t *slots, n_slots, mask, slot, g, offset;
+
+	n_slots = (strings->n_slots == 0 ? 256 : strings->n_slots * 2);
+	slots = (uint32_t *) malloc (sizeof (uint32_t) * n_slots);
+	memset (slots, 0, sizeof (uint32_t) * n_slots);
+
+	mask = n_slots - 1;
+	for (g = 0; g < strings->n_slots; g++) {
+		if (strings->slots[g] == 0) continue;
+
+		offset = strings->slots[g] - 1;
+		slot = hash64 (&strings->data[offset], strlen (&strings->data[offset]), 0) & mask;
+		while (slots[slot] != 0) {
+			slot = (slot + 1) & mask;
+		}
+		slots[slot] = strings->slots[g];
+	}
+
+	free (strings->slots);
+	strings->slots = slots;
+	strings->n_slots = n_slots;
+}
+
+static uint32_t bundle_strings_add (BundleStrings *strings, const char *str) {
+	uint32_t len, slot, mask, offset;
+
+	if (str == NULL) return BUNDLE_NONE;
+
+	if ((strings->used + 1) * 2 > strings->n_slots) {
+		bundle_strings_grow (strings);
+	}
+
+	len = strlen (str);
+	mask = strings->n_slots - 1;
+	slot = hash64 (str, len, 0) & mask;
+	while (strings->slots[slot] != 0) {
+		offset = strings->slots[slot] - 1;
+		if (strcmp (&strings->data[offset], str) == 0) return offset;
+
+		slot = (slot + 1) & mask;
+	}
+
+	while (strings->len + len + 1 > strings->size) {
+		strings->size = (strings->size == 0 ? 4096 : strings->size * 2);
+		strings->data = (char *) realloc (strings->data, strings->size);
+	}
+
+	offset = strings->len;
+	memcpy (&strings->data[offset], str, len + 1);
+	strings->len += len + 1;
+
+	strings->slots[slot] = offset + 1;
+	strings->used++;
+
+	return offset;
+}
+
+/* Escribe data en la siguiente posición alineada y devuelve su desplazamiento, 0 si no hay nada */
+static uint64_t bundle_put (BundleWriter *writer, const void *data, size_t len) {
+	static const unsigned char padding[BUNDLE_ALIGN] = {0};
+	uint64_t offset;
+
+	if (data == NULL || len == 0) return 0;
+
+	if (writer->pos % BUNDLE_ALIGN != 0) {
+		fwrite (padding, 1, BUNDLE_ALIGN - writer->pos % BUNDLE_ALIGN, writer->fd);
+		writer->pos += BUNDLE_ALIGN - writer->pos % BUNDLE_ALIGN;
+	}
+
+	offset = writer->pos;
+	fwrite (data, 1, len, writer->fd);
+	writer->pos += len;
+
+	return offset;
+}
+
+/* Las referencias fuera de rango se guardan como ausentes; al abrir, cualquier otra cosa es un error */
+static int32_t bundle_ref (int32_t index, int count) {
+	return (index >= 0 && index < count ? index : -1);
+}
+
+/* Un mesh cuyos índices no caben en su VertexData se guarda sin caras, como hacen compact y weld */
+static int bundle_mesh_indices_ok (MeshData *mesh, VertexData *vertex, int num_vertex) {
+	uint32_t count;
+	int h;
+
+	if (mesh->index == NULL || mesh->num_index <= 0) return 1;
+	if (mesh->vertex_data_id < 0 || mesh->vertex_data_id >= num_vertex) return 0;
+
+	count = vertex[mesh->vertex_data_id].num / 3;
+	for (h = 0; h < mesh->num_index; h++) {
+		if (mesh->index[h] >= count) return 0;
+	}
+
+	return 1;
+}
+
+static void bundle_put_section (BundleWriter *writer, BundleHeader *header, int type, const void *records, uint32_t count, uint32_t record_size) {
+	header->sections[type].count = count;
+	header->sections[type].record_size = record_size;
+	header->sections[type].offset = bundle_put (writer, records, (size_t) count * record_size);
+}
+
+static uint32_t bundle_entry_value (BKVDesc *bkv_desc, TableEntry *entry, BundleStrings *strings) {
+	uint32_t value;
+
+	switch (entry->type) {
+		case 0:
+		case 1:
+			return entry->value.boolean;
+		case 2:
+			memcpy (&value, &entry->value.flotante, sizeof (value));
+			return value;
+		case 3:
+			return entry->value.byte;
+		case 4:
+			return entry->value.short_int;
+		case 5:
+			return entry->value.integer;
+		case 6:
+			return bundle_strings_add (strings, entry->value.string);
+		case 7:
+			if (entry->value.table == NULL || entry->value.table < bkv_desc->tables || entry->value.table >= bkv_desc->tables + bkv_desc->n_tables) return BUNDLE_NONE;
+			return entry->value.table - bkv_desc->tables;
+	}
+
+	return 0;
+}
+
+/* Compila el modelo a un solo archivo. Los arreglos van como están en memoria, en little endian */
+int bundle_write (const char *path, MMFModel *model, VertexData *vertex, int num_vertex, MeshData *mesh, int num_meshes, BlendShape *shapes, int num_shapes) {
+	BKVDesc *bkv_desc = &model->desc;
+	BundleWriter writer;
+	BundleHeader header;
+	BundleStrings strings;
+	BundleWord *words;
+	BundleTable *tables;
+	BundleEntry *entries;
+	BundleBone *bones;
+	BundleVertex *vertex_records;
+	BundleMesh *mesh_records;
+	BundleShape *shape_records;
+	BundleMaterial *material_records;
+	BundleNode *node_records;
+	TableEntry *entry;
+	int g, h, n_entries, result;
+
+	if (!host_is_little_endian ()) {
+		log_warn ("Bundles can only be written on little-endian hosts\n");
+		return -1;
+	}
+
+	writer.fd = fopen (path, "wb");
+	if (writer.fd == NULL) {
+		return -1;
+	}
+
+	/* La cabecera se escribe otra vez al final, con las secciones ya colocadas */
+	memset (&header, 0, sizeof (header));
+	fwrite (&header, sizeof (header), 1, writer.fd);
+	writer.pos = sizeof (header);
+
+	memset (&strings, 0, sizeof (strings));
+
+	words = (BundleWord *) malloc (sizeof (BundleWord) * (bkv_desc->n_words + 1));
+	for (g = 0; g < bkv_desc->n_words; g++) {
+		words[g].pos = bkv_desc->words[g].pos;
+		words[g].word = bundle_strings_add (&strings, bkv_desc->words[g].word);
+	}
+
+	n_entries = 0;
+	for (g = 0; g < bkv_desc->n_tables; g++) {
+		n_entries += bkv_desc->tables[g].n_entries;
+	}
+
+	tables = (BundleTable *) malloc (sizeof (BundleTable) * (bkv_desc->n_tables + 1));
+	entries = (BundleEntry *) malloc (sizeof (BundleEntry) * (n_entries + 1));
+	n_entries = 0;
+	for (g = 0; g < bkv_desc->n_tables; g++) {
+		tables[g].pos = bkv_desc->tables[g].pos;
+		tables[g].n_entries = bkv_desc->tables[g].n_entries;
+		tables[g].first_entry = n_entries;
+
+		for (h = 0; h < bkv_desc->tables[g].n_entries; h++) {
+			entry = &bkv_desc->tables[g].entries[h];
+
+			entries[n_entries].name_pos = entry->name_pos;
+			entries[n_entries].name = bundle_strings_add (&strings, entry->name);
+			entries[n_entries].type = entry->type;
+			entries[n_entries].value = bundle_entry_value (bkv_desc, entry, &strings);
+			n_entries++;
+		}
+	}
+
+	bones = (BundleBone *) malloc (sizeof (BundleBone) * (bkv_desc->n_bones + 1));
+	for (g = 0; g < bkv_desc->n_bones; g++) {
+		bones[g].name = bundle_strings_add (&strings, bkv_desc->bones[g].name);
+		bones[g].parent = bundle_ref (bkv_desc->bones[g].parent, bkv_desc->n_bones);
+		bones[g].transform = bundle_ref (bkv_desc->bones[g].transform, bkv_desc->n_transforms);
+		bones[g].inv_transform = bundle_ref (bkv_desc->bones[g].inv_transform, bkv_desc->n_transforms);
+	}
+
+	/* Primero los arreglos grandes, sus registros guardan dónde quedaron */
+	vertex_records = (BundleVertex *) malloc (sizeof (BundleVertex) * (num_vertex + 1));
+	memset (vertex_records, 0, sizeof (BundleVertex) * (num_vertex + 1));
+	for (g = 0; g < num_vertex; g++) {
+		vertex_records[g].num = vertex[g].num;
+		vertex_records[g].encoding = vertex[g].encoding;
+		vertex_records[g].scale = vertex[g].scale;
+		memcpy (vertex_records[g].min, vertex[g].min, sizeof (vertex[g].min));
+		memcpy (vertex_records[g].max, vertex[g].max, sizeof (vertex[g].max));
+
+		vertex_records[g].vertex = bundle_put (&writer, vertex[g].vertex, sizeof (float) * vertex[g].num);
+		vertex_records[g].normal = bundle_put (&writer, vertex[g].normal, sizeof (float) * vertex[g].num);
+		vertex_records[g].raw = bundle_put (&writer, vertex[g].raw, (size_t) encoding_element_size (vertex[g].encoding) * vertex[g].num);
+	}
+
+	mesh_records = (BundleMesh *) malloc (sizeof (BundleMesh) * (num_meshes + 1));
+	memset (mesh_records, 0, sizeof (BundleMesh) * (num_meshes + 1));
+	for (g = 0; g < num_meshes; g++) {
+		mesh_records[g].id = mesh[g].id;
+		mesh_records[g].name = bundle_strings_add (&strings, mesh[g].name);
+		mesh_records[g].vertex_data_id = mesh[g].vertex_data_id;
+		mesh_records[g].renderable = mesh[g].renderable;
+		mesh_records[g].material = mesh[g].material;
+		mesh_records[g].back_face_culling = mesh[g].back_face_culling;
+		mesh_records[g].max_influences = mesh[g].max_influences;
+		mesh_records[g].instance_of = mesh[g].instance_of;
+		mesh_records[g].transform = bundle_ref (mesh[g].transform, bkv_desc->n_transforms);
+		memcpy (mesh_records[g].min, mesh[g].min, sizeof (mesh[g].min));
+		memcpy (mesh_records[g].max, mesh[g].max, sizeof (mesh[g].max));
+
+		if (!bundle_mesh_indices_ok (&mesh[g], vertex, num_vertex)) {
+			log_warn ("Mesh %s has indices out of range, dropping its faces\n", mesh[g].name);
+			continue;
+		}
+
+		mesh_records[g].num_index = mesh[g].num_index;
+		mesh_records[g].index = bundle_put (&writer, mesh[g].index, sizeof (uint32_t) * mesh[g].num_index);
+	}
+
+	shape_records = (BundleShape *) malloc (sizeof (BundleShape) * (num_shapes + 1));
+	for (g = 0; g < num_shapes; g++) {
+		shape_records[g].name = bundle_strings_add (&strings, shapes[g].name);
+		shape_records[g].mesh = shapes[g].mesh;
+		shape_records[g].vertex_data_id = shapes[g].vertex_data_id;
+		shape_records[g].count = shapes[g].count;
+
+		shape_records[g].index = bundle_put (&writer, shapes[g].index, sizeof (uint32_t) * shapes[g].count);
+		shape_records[g].dx = bundle_put (&writer, shapes[g].dx, sizeof (float) * shapes[g].count);
+		shape_records[g].dy = bundle_put (&writer, shapes[g].dy, sizeof (float) * shapes[g].count);
+		shape_records[g].dz = bundle_put (&writer, shapes[g].dz, sizeof (float) * shapes[g].count);
+	}
+
+	material_records = (BundleMaterial *) malloc (sizeof (BundleMaterial) * (model->num_materials + 1));
+	memset (material_records, 0, sizeof (BundleMaterial) * (model->num_materials + 1));
+	for (g = 0; g < model->num_materials; g++) {
+		material_records[g].name = bundle_strings_add (&strings, model->materials[g].name);
+		material_records[g].id = model->materials[g].id;
+		memcpy (material_records[g].diffuse, model->materials[g].diffuse, sizeof (model->materials[g].diffuse));
+		memcpy (material_records[g].specular, model->materials[g].specular, sizeof (model->materials[g].specular));
+		material_records[g].shininess = model->materials[g].shininess;
+		material_records[g].texture = bundle_strings_add (&strings, model->materials[g].texture);
+	}
+
+	node_records = (BundleNode *) malloc (sizeof (BundleNode) * (model->num_nodes + 1));
+	for (g = 0; g < model->num_nodes; g++) {
+		node_records[g].name = bundle_strings_add (&strings, model->nodes[g].name);
+		node_records[g].parent = model->nodes[g].parent;
+		node_records[g].transform = bundle_ref (model->nodes[g].transform, bkv_desc->n_transforms);
+		node_records[g].mesh = model->nodes[g].mesh;
+	}
+
+	bundle_put_section (&writer, &header, BUNDLE_STRINGS, strings.data, strings.len, 1);
+	bundle_put_section (&writer, &header, BUNDLE_WORDS, words, bkv_desc->n_words, sizeof (BundleWord));
+	bundle_put_section (&writer, &header, BUNDLE_TABLES, tables, bkv_desc->n_tables, sizeof (BundleTable));
+	bundle_put_section (&writer, &header, BUNDLE_ENTRIES, entries, n_entries, sizeof (BundleEntry));
+	bundle_put_section (&writer, &header, BUNDLE_TRANSFORMS, bkv_desc->transforms, bkv_desc->n_transforms, sizeof (Transform));
+	bundle_put_section (&writer, &header, BUNDLE_BONES, bones, bkv_desc->n_bones, sizeof (BundleBone));
+	bundle_put_section (&writer, &header, BUNDLE_VERTEX, vertex_records, num_vertex, sizeof (BundleVertex));
+	bundle_put_section (&writer, &header, BUNDLE_MESHES, mesh_records, num_meshes, sizeof (BundleMesh));
+	bundle_put_section (&writer, &header, BUNDLE_SHAPES, shape_records, num_shapes, sizeof (BundleShape));
+	bundle_put_section (&writer, &header, BUNDLE_MATERIALS, material_records, model->num_materials, sizeof (BundleMaterial));
+	bundle_put_section (&writer, &header, BUNDLE_NODES, node_records, model->num_nodes, sizeof (BundleNode));
+
+	header.magic = BUNDLE_MAGIC;
+	header.version = BUNDLE_VERSION;
+	header.size = writer.pos;
+	header.root_table = (bkv_desc->root_table != NULL ? bkv_desc->root_table - bkv_desc->tables : -1);
+	header.n_sections = BUNDLE_NUM_SECTIONS;
+
+	fseek (writer.fd, 0, SEEK_SET);
+	fwrite (&header, sizeof (header), 1, writer.fd);
+
+	result = 0;
+	if (ferror (writer.fd)) {
+		result = -1;
+	}
+	if (fclose (writer.fd) != 0) {
+		result = -1;
+	}
+
+	if (result == 0) {
+		log_info ("Bundle: %i vertex datas, %i meshes, %i tables, %lu bytes\n", num_vertex, num_meshes, bkv_desc->n_tables, (unsigned long) header.size);
+	}
+
+	free (strings.data);
+	free (strings.slots);
+	free (words);
+	free (tables);
+	free (entries);
+	free (bones);
+	free (vertex_records);
+	free (mesh_records);
+	free (shape_records);
+	free (material_records);
+	free (node_records);
+
+	return result;
+}
+
+/* La sección existe completa dentro del archivo y sus registros son del tamaño esperado */
+static void *bundle_section (Bundle *bundle, BundleHeader *header, int type, size_t record_size, int *error) {
+	BundleSection *section = &header->sections[type];
+
+	if (section->count == 0) return NULL;
+
+	if (section->record_size != record_size || section->offset % BUNDLE_ALIGN != 0 || section->offset > bundle->len || (uint64_t) section->count * record_size > bundle->len - section->offset) {
+		*error = 1;
+		return NULL;
+	}
+
+	return bundle->data + section->offset;
+}
+
+/* Un arreglo de count elementos en offset, NULL si no hay */
+static void *bundle_array (Bundle *bundle, uint64_t offset, uint64_t count, size_t elem, int *error) {
+	if (offset == 0) return NULL;
+
+	if (offset % BUNDLE_ALIGN != 0 || offset > bundle->len || count * elem > bundle->len - offset) {
+		*error = 1;
+		return NULL;
+	}
+
+	return bundle->data + offset;
+}
+
+static char *bundle_string (char *strings, uint32_t len, uint32_t offset, int *error) {
+	if (offset == BUNDLE_NONE) return NULL;
+
+	if (offset >= len) {
+		*error = 1;
+		return NULL;
+	}
+
+	return &strings[offset];
+}
+
+static int bundle_index_ok (int32_t index, int count) {
+	return index >= -1 && index < count;
+}
+
+/* Los índices de un arreglo se usan sin revisar (blend_shapes_apply, los exportadores),
+ * así que todos tienen que caber en el VertexData; increasing pide además orden estricto */
+static int bundle_indices_ok (uint32_t *index, uint32_t count, VertexData *vertex, int increasing) {
+	uint32_t h, limit;
+
+	limit = vertex->num / 3;
+	for (h = 0; h < count; h++) {
+		if (index[h] >= limit) return 0;
+		if (increasing && h > 0 && index[h] <= index[h - 1]) return 0;
+	}
+
+	return 1;
+}
+
+/* Los apuntadores del modelo van directo al archivo; solo los encabezados salen de la arena */
+static int bundle_load (Bundle *bundle, MMFModel *model) {
+	BKVDesc *desc = &model->desc;
+	BundleHeader *header;
+	BundleWord *words;
+	BundleTable *tables;
+	BundleEntry *entries;
+	BundleBone *bones;
+	BundleVertex *vertex_records;
+	BundleMesh *mesh_records;
+	BundleShape *shape_records;
+	BundleMaterial *material_records;
+	BundleNode *node_records;
+	TableEntry *table_entries, *entry;
+	char *strings;
+	uint32_t n_strings, n_entries;
+	int g, error;
+
+	if (bundle->len < sizeof (BundleHeader)) return -1;
+
+	header = (BundleHeader *) bundle->data;
+	if (header->magic != BUNDLE_MAGIC || header->version != BUNDLE_VERSION || header->n_sections != BUNDLE_NUM_SECTIONS || header->size != bundle->len) {
+		return -1;
+	}
+
+	error = 0;
+	strings = (char *) bundle_section (bundle, header, BUNDLE_STRINGS, 1, &error);
+	words = (BundleWord *) bundle_section (bundle, header, BUNDLE_WORDS, sizeof (BundleWord), &error);
+	tables = (BundleTable *) bundle_section (bundle, header, BUNDLE_TABLES, sizeof (BundleTable), &error);
+	entries = (BundleEntry *) bundle_section (bundle, header, BUNDLE_ENTRIES, sizeof (BundleEntry), &error);
+	desc->transforms = (Transform *) bundle_section (bundle, header, BUNDLE_TRANSFORMS, sizeof (Transform), &error);
+	bones = (BundleBone *) bundle_section (bundle, header, BUNDLE_BONES, sizeof (BundleBone), &error);
+	vertex_records = (BundleVertex *) bundle_section (bundle, header, BUNDLE_VERTEX, sizeof (BundleVertex), &error);
+	mesh_records = (BundleMesh *) bundle_section (bundle, header, BUNDLE_MESHES, sizeof (BundleMesh), &error);
+	shape_records = (BundleShape *) bundle_section (bundle, header, BUNDLE_SHAPES, sizeof (BundleShape), &error);
+	material_records = (BundleMaterial *) bundle_section (bundle, header, BUNDLE_MATERIALS, sizeof (BundleMaterial), &error);
+	node_records = (BundleNode *) bundle_section (bundle, header, BUNDLE_NODES, sizeof (BundleNode), &error);
+	if (error) return -1;
+
+	/* Toda cadena termina dentro de su sección */
+	n_strings = header->sections[BUNDLE_STRINGS].count;
+	if (n_strings > 0 && strings[n_strings - 1] != 0) return -1;
+
+	desc->n_words = header->sections[BUNDLE_WORDS].count;
+	desc->words = (DictWord *) mmf_malloc (sizeof (DictWord) * (desc->n_words + 1));
+	for (g = 0; g < desc->n_words; g++) {
+		desc->words[g].pos = words[g].pos;
+		desc->words[g].word = bundle_string (strings, n_strings, words[g].word, &error);
+	}
+
+	/* Las entradas de todas las tablas en un solo arreglo */
+	n_entries = header->sections[BUNDLE_ENTRIES].count;
+	table_entries = (TableEntry *) mmf_malloc (sizeof (TableEntry) * (n_entries + 1));
+	desc->n_tables = header->sections[BUNDLE_TABLES].count;
+	desc->tables = (Table *) mmf_malloc (sizeof (Table) * (desc->n_tables + 1));
+	for (g = 0; g < n_entries; g++) {
+		entry = &table_entries[g];
+		memset (entry, 0, sizeof (TableEntry));
+
+		entry->name_pos = entries[g].name_pos;
+		entry->name = bundle_string (strings, n_strings, entries[g].name, &error);
+		entry->type = entries[g].type;
+
+		switch (entry->type) {
+			case 0:
+			case 1:
+				entry->value.boolean = entries[g].value;
+				break;
+			case 2:
+				memcpy (&entry->value.flotante, &entries[g].value, sizeof (float));
+				break;
+			case 3:
+				entry->value.byte = entries[g].value;
+				break;
+			case 4:
+				entry->value.short_int = entries[g].value;
+				break;
+			case 5:
+				entry->value.integer = entries[g].value;
+				break;
+			case 6:
+				entry->value.string = bundle_string (strings, n_strings, entries[g].value, &error);
+				break;
+			case 7:
+				if (entries[g].value != BUNDLE_NONE && entries[g].value >= (uint32_t) desc->n_tables) error = 1;
+				entry->value.table = (entries[g].value < (uint32_t) desc->n_tables ? &desc->tables[entries[g].value] : NULL);
+				break;
+		}
+	}
+
+	for (g = 0; g < desc->n_tables; g++) {
+		if (tables[g].first_entry > n_entries || tables[g].n_entries > n_entries - tables[g].first_entry) {
+			error = 1;
+			break;
+		}
+		desc->tables[g].pos = tables[g].pos;
+		desc->tables[g].n_entries = tables[g].n_entries;
+		desc->tables[g].entries = &table_entries[tables[g].first_entry];
+	}
+
+	if (!bundle_index_ok (header->root_table, desc->n_tables)) error = 1;
+	desc->root_table = (header->root_table >= 0 && header->root_table < desc->n_tables ? &desc->tables[header->root_table] : NULL);
+
+	desc->n_transforms = header->sections[BUNDLE_TRANSFORMS].count;
+	desc->n_bones = header->sections[BUNDLE_BONES].count;
+	desc->bones = (Bone *) mmf_malloc (sizeof (Bone) * (desc->n_bones + 1));
+	for (g = 0; g < desc->n_bones; g++) {
+		desc->bones[g].name = bundle_string (strings, n_strings, bones[g].name, &error);
+		desc->bones[g].parent = bones[g].parent;
+		desc->bones[g].transform = bones[g].transform;
+		desc->bones[g].inv_transform = bones[g].inv_transform;
+
+		if (!bundle_index_ok (bones[g].parent, desc->n_bones) || !bundle_index_ok (bones[g].transform, desc->n_transforms) || !bundle_index_ok (bones[g].inv_transform, desc->n_transforms)) error = 1;
+	}
+	desc->do_endian = 0;
+
+	model->num_vertex = header->sections[BUNDLE_VERTEX].count;
+	model->vertex = (VertexData *) mmf_malloc (sizeof (VertexData) * (model->num_vertex + 1));
+	for (g = 0; g < model->num_vertex; g++) {
+		memset (&model->vertex[g], 0, sizeof (VertexData));
+		model->vertex[g].num = vertex_records[g].num;
+		model->vertex[g].encoding = vertex_records[g].encoding;
+		model->vertex[g].scale = vertex_records[g].scale;
+		memcpy (model->vertex[g].min, vertex_records[g].min, sizeof (vertex_records[g].min));
+		memcpy (model->vertex[g].max, vertex_records[g].max, sizeof (vertex_records[g].max));
+
+		if (vertex_records[g].encoding < ENCODING_NONE || vertex_records[g].encoding > UNENCODED_SHORT_SIGNED || vertex_records[g].num > INT32_MAX) error = 1;
+		model->vertex[g].vertex = (float *) bundle_array (bundle, vertex_records[g].vertex, vertex_records[g].num, sizeof (float), &error);
+		model->vertex[g].normal = (float *) bundle_array (bundle, vertex_records[g].normal, vertex_records[g].num, sizeof (float), &error);
+		if (!error) {
+			model->vertex[g].raw = bundle_array (bundle, vertex_records[g].raw, vertex_records[g].num, encoding_element_size (vertex_records[g].encoding), &error);
+		}
+
+		/* Los índices que apuntan aquí se revisan contra num, así que tiene que haber vértices */
+		if (vertex_records[g].num > 0 && model->vertex[g].vertex == NULL && model->vertex[g].raw == NULL) error = 1;
+	}
+
+	model->num_meshes = header->sections[BUNDLE_MESHES].count;
+	model->mesh = (MeshData *) mmf_malloc (sizeof (MeshData) * (model->num_meshes + 1));
+	for (g = 0; g < model->num_meshes; g++) {
+		memset (&model->mesh[g], 0, sizeof (MeshData));
+		model->mesh[g].id = mesh_records[g].id;
+		model->mesh[g].name = bundle_string (strings, n_strings, mesh_records[g].name, &error);
+		model->mesh[g].vertex_data_id = mesh_records[g].vertex_data_id;
+		model->mesh[g].renderable = mesh_records[g].renderable;
+		model->mesh[g].material = mesh_records[g].material;
+		model->mesh[g].back_face_culling = mesh_records[g].back_face_culling;
+		model->mesh[g].max_influences = mesh_records[g].max_influences;
+		model->mesh[g].instance_of = mesh_records[g].instance_of;
+		model->mesh[g].transform = mesh_records[g].transform;
+		memcpy (model->mesh[g].min, mesh_records[g].min, sizeof (mesh_records[g].min));
+		memcpy (model->mesh[g].max, mesh_records[g].max, sizeof (mesh_records[g].max));
+
+		/* Una instancia apunta a un mesh con geometría propia */
+		if (!bundle_index_ok (mesh_records[g].vertex_data_id, model->num_vertex) || !bundle_index_ok (mesh_records[g].instance_of, model->num_meshes) || !bundle_index_ok (mesh_records[g].transform, desc->n_transforms) || mesh_records[g].num_index > INT32_MAX) {
+			error = 1;
+		} else if (mesh_records[g].instance_of >= 0 && mesh_records[mesh_records[g].instance_of].instance_of >= 0) {
+			error = 1;
+		}
+
+		model->mesh[g].index = (uint32_t *) bundle_array (bundle, mesh_records[g].index, mesh_records[g].num_index, sizeof (uint32_t), &error);
+		model->mesh[g].num_index = (model->mesh[g].index != NULL ? mesh_records[g].num_index : 0);
+
+		if (!error && model->mesh[g].index != NULL) {
+			if (mesh_records[g].vertex_data_id < 0 || !bundle_indices_ok (model->mesh[g].index, model->mesh[g].num_index, &model->vertex[mesh_records[g].vertex_data_id], 0)) error = 1;
+		}
+	}
+
+	model->num_shapes = header->sections[BUNDLE_SHAPES].count;
+	model->shapes = (BlendShape *) mmf_malloc (sizeof (BlendShape) * (model->num_shapes + 1));
+	for (g = 0; g < model->num_shapes; g++) {
+		model->shapes[g].name = bundle_string (strings, n_strings, shape_records[g].name, &error);
+		model->shapes[g].mesh = shape_records[g].mesh;
+		model->shapes[g].vertex_data_id = shape_records[g].vertex_data_id;
+		model->shapes[g].count = shape_records[g].count;
+
+		if (shape_records[g].mesh < 0 || shape_records[g].mesh >= model->num_meshes || shape_records[g].vertex_data_id < 0 || shape_records[g].vertex_data_id >= model->num_vertex || shape_records[g].count > INT32_MAX) error = 1;
+
+		model->shapes[g].index = (uint32_t *) bundle_array (bundle, shape_records[g].index, shape_records[g].count, sizeof (uint32_t), &error);
+		model->shapes[g].dx = (float *) bundle_array (bundle, shape_records[g].dx, shape_records[g].count, sizeof (float), &error);
+		model->shapes[g].dy = (float *) bundle_array (bundle, shape_records[g].dy, shape_records[g].count, sizeof (float), &error);
+		model->shapes[g].dz = (float *) bundle_array (bundle, shape_records[g].dz, shape_records[g].count, sizeof (float), &error);
+		if (shape_records[g].count > 0 && (model->shapes[g].index == NULL || model->shapes[g].dx == NULL || model->shapes[g].dy == NULL || model->shapes[g].dz == NULL)) error = 1;
+
+		if (!error && !bundle_indices_ok (model->shapes[g].index, model->shapes[g].count, &model->vertex[shape_records[g].vertex_data_id], 1)) error = 1;
+	}
+
+	model->num_materials = header->sections[BUNDLE_MATERIALS].count;
+	model->materials = (Material *) mmf_malloc (sizeof (Material) * (model->num_materials + 1));
+	for (g = 0; g < model->num_materials; g++) {
+		model->materials[g].name = bundle_string (strings, n_strings, material_records[g].name, &error);
+		model->materials[g].id = material_records[g].id;
+		memcpy (model->materials[g].diffuse, material_records[g].diffuse, sizeof (material_records[g].diffuse));
+		memcpy (model->materials[g].specular, material_records[g].specular, sizeof (material_records[g].specular));
+		model->materials[g].shininess = material_records[g].shininess;
+		model->materials[g].texture = bundle_string (strings, n_strings, material_records[g].texture, &error);
+	}
+
+	model->num_nodes = header->sections[BUNDLE_NODES].count;
+	model->nodes = (SceneNode *) mmf_malloc (sizeof (SceneNode) * (model->num_nodes + 1));
+	for (g = 0; g < model->num_nodes; g++) {
+		model->nodes[g].name = bundle_string (strings, n_strings, node_records[g].name, &error);
+		model->nodes[g].parent = node_records[g].parent;
+		model->nodes[g].transform = node_records[g].transform;
+		model->nodes[g].mesh = node_records[g].mesh;
+
+		if (!bundle_index_ok (node_records[g].parent, model->num_nodes) || !bundle_index_ok (node_records[g].mesh, model->num_meshes) || !bundle_index_ok (node_records[g].transform, desc->n_transforms)) error = 1;
+	}
+
+	return (error ? -1 : 0);
+}
+
+/* Abre un modelo compilado con bundle_write. El modelo es válido hasta bundle_close,
+ * sus arreglos son de solo lectura y los encabezados salen de la arena del hilo */
+int bundle_open (Bundle *bundle, const char *path, MMFModel *model) {
+	struct stat st;
+	StatScope scope;
+#ifdef _WIN32
+	size_t pos;
+	ssize_t r;
+#endif
+	int fd;
+
+	memset (bundle, 0, sizeof (Bundle));
+	memset (model, 0, sizeof (MMFModel));
+
+	if (!host_is_little_endian ()) {
+		log_warn ("Bundles can only be opened on little-endian hosts\n");
+		return -1;
+	}
+
+	stats_begin (&scope, STAT_MODEL);
+
+	fd = open (path, O_RDONLY
+#ifdef _WIN32
+	| _O_BINARY
+#endif
+	);
+
+	if (fd < 0) {
+		stats_end (&scope, NULL, path, 0);
+		return -1;
+	}
+
+	if (fstat (fd, &st) < 0 || st.st_size < (off_t) sizeof (BundleHeader)) {
+		close (fd);
+		stats_end (&scope, NULL, path, 0);
+		return -1;
+	}
+
+	bundle->len = st.st_size;
+#ifdef _WIN32
+	/* Sin mmap: una sola lectura a la arena */
+	bundle->data = (unsigned char *) mmf_malloc (bundle->len);
+	pos = 0;
+	while (pos < bundle->len) {
+		r = read (fd, bundle->data + pos, bundle->len - pos);
+		if (r <= 0) break;
+		pos += r;
+	}
+	STATS_IO (pos, 1);
+	if (pos < bundle->len) {
+		mmf_free (bundle->data);
+		bundle->data = NULL;
+	}
+#else
+	/* Privado y de solo lectura: escribir en el modelo es un error, no un cambio al archivo */
+	bundle->data = (unsigned char *) mmap (NULL, bundle->len, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (bundle->data == MAP_FAILED) {
+		bundle->data = NULL;
+	}
+	bundle->mapped = (bundle->data != NULL);
+	STATS_IO (0, 2);
+#endif
+	close (fd);
+
+	if (bundle->data == NULL) {
+		stats_end (&scope, NULL, path, 0);
+		return -1;
+	}
+
+	if (bundle_load (bundle, model) < 0) {
+		log_warn ("%s is not a valid bundle\n", path);
+		bundle_close (bundle);
+		memset (model, 0, sizeof (MMFModel));
+		stats_end (&scope, NULL, path, 0);
+
+		return -1;
+	}
+
+	stats_end (&scope, NULL, path, model->num_vertex + model->num_meshes);
+
+	return 0;
+}
+
+/* Los encabezados del modelo se quedan en la arena, se van con ella */
+void bundle_close (Bundle *bundle) {
+	if (bundle->data == NULL) return;
+
+#ifndef _WIN32
+	if (bundle->mapped) {
+		munmap (bundle->data, bundle->len);
+	}
+#endif
+	if (!bundle->mapped) {
+		mmf_free (bundle->data);
+	}
+
+	memset (bundle, 0, sizeof (Bundle));
+}
@@ -0,0 +1,27 @@
+#ifndef __BUNDLE_H__
+#define __BUNDLE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mmf.h"
+
+/* "MMFB" leído como u32 en little endian. A diferencia del BVH, el archivo siempre es little endian */
+#define BUNDLE_MAGIC 0x42464D4D
+
+/* Sube cuando cambia el formato de cualquier registro */
+#define BUNDLE_VERSION 2
+
+/* Modelo compilado abierto: el archivo completo en memoria, mapeado si se puede */
+typedef struct {
+	unsigned char *data;
+	size_t len;
+
+	int mapped;
+} Bundle;
+
+int bundle_write (const char *path, MMFModel *model, VertexData *vertex, int num_vertex, MeshData *mesh, int num_meshes, BlendShape *shapes, int num_shapes);
+int bundle_open (Bundle *bundle, const char *path, MMFModel *model);
+void bundle_close (Bundle *bundle);
+
+#endif /* __BUNDLE_H__ */
@@ -0,0 +1,458 @@
+/*
+ * bvh.c
+ * This file is part of BKV Reader
+ *
+ * Copyright (C) 2022 - Félix Arreola Rodríguez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <float.h>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+#include "mmf.h"
+#include "pool.h"
+#include "arena.h"
+#include "bounds.h"
+#include "bvh.h"
+#include "scene.h"
+
+/* Cubetas por eje para evaluar el SAH */
+#define BVH_BINS 12
+
+/* Una hoja con más triángulos que esto se parte aunque el SAH diga que no conviene */
+#define BVH_MAX_LEAF 8
+
+#define BVH_MAX_DEPTH 64
+
+/* Subárboles con al menos estos triángulos se construyen como otra tarea del pool */
+#define BVH_TASK_MIN 8192
+
+typedef struct _BvhBuild BvhBuild;
+
+typedef struct {
+	BvhBuild *build;
+	uint32_t node;
+	uint32_t first;
+	uint32_t count;
+	int depth;
+} BvhTask;
+
+/* Cuatro flotantes por lado para ocupar un registro completo; el cuarto no se usa */
+typedef struct {
+	float min[4];
+	float max[4];
+} BvhBox;
+
+typedef struct {
+	BvhBox box;
+	uint32_t count;
+} BvhBin;
+
+/* Lo que se necesita de cada triángulo, junto para recorrerlo en orden al partir */
+typedef struct {
+	BvhBox box;
+	float centroid[4];
+	uint32_t tri;
+} BvhPrim;
+
+struct _BvhBuild {
+	BvhPrim *prims;
+	uint32_t n_prims;
+
+	/* Un nodo con k triángulos ocupa 2k - 1 lugares: su hijo izquierdo va en el siguiente y el derecho
+	 * al terminar el lugar del izquierdo. Cada subárbol tiene su rango fijo y los hilos no se estorban */
+	BvhNode *nodes;
+
+	BvhTask *tasks;
+	int n_tasks;
+	int max_tasks;
+
+	ThreadPool *pool;
+	TaskGroup *group;
+};
+
+static void bvh_build_node (BvhBuild *build, uint32_t node, uint32_t first, uint32_t count, int depth);
+
+static float box_area (const BvhBox *box) {
+	float dx, dy, dz;
+
+	dx = box->max[0] - box->min[0];
+	dy = box->max[1] - box->min[1];
+	dz = box->max[2] - box->min[2];
+
+	return dx * dy + dy * dz + dz * dx;
+}
+
+static void box_empty (BvhBox *box) {
+	int h;
+
+	for (h = 0; h < 4; h++) {
+		box->min[h] = FLT_MAX;
+		box->max[h] = -FLT_MAX;
+	}
+}
+
+static void box_grow_range (BvhBox *box, const float *min, const float *max) {
+#ifdef __SSE__
+	_mm_storeu_ps (box->min, _mm_min_ps (_mm_loadu_ps (box->min), _mm_loadu_ps (min)));
+	_mm_storeu_ps (box->max, _mm_max_ps (_mm_loadu_ps (box->max), _mm_loadu_ps (max)));
+#else
+	int h;
+
+	for (h = 0; h < 3; h++) {
+		if (min[h] < box->min[h]) box->min[h] = min[h];
+		if (max[h] > box->max[h]) box->max[h] = max[h];
+	}
+#endif
+}
+
+static void box_grow (BvhBox *box, const BvhBox *other) {
+	box_grow_range (box, other->min, other->max);
+}
+
+/* La misma cuenta al llenar las cubetas y al partir, para que no cambie de lado ningún triángulo */
+static int bvh_bin (float centroid, float start, float scale, int n_bins) {
+	int bin;
+
+	bin = (int) ((centroid - start) * scale);
+	if (bin < 0) bin = 0;
+	if (bin >= n_bins) bin = n_bins - 1;
+
+	return bin;
+}
+
+static void bvh_task_run (void *data) {
+	BvhTask *task = (BvhTask *) data;
+
+	bvh_build_node (task->build, task->node, task->first, task->count, task->depth);
+}
+
+static void bvh_build_child (BvhBuild *build, uint32_t node, uint32_t first, uint32_t count, int depth) {
+	BvhTask *task;
+	int k;
+
+	if (build->pool != NULL && count >= BVH_TASK_MIN) {
+		k = __atomic_fetch_add (&build->n_tasks, 1, __ATOMIC_RELAXED);
+		if (k < build->max_tasks) {
+			task = &build->tasks[k];
+			task->build = build;
+			task->node = node;
+			task->first = first;
+			task->count = count;
+			task->depth = depth;
+
+			pool_submit (build->pool, build->group, bvh_task_run, task);
+			return;
+		}
+	}
+
+	bvh_build_node (build, node, first, count, depth);
+}
+
+static void bvh_build_node (BvhBuild *build, uint32_t node, uint32_t first, uint32_t count, int depth) {
+	BvhNode *n = &build->nodes[node];
+	BvhPrim *prims, tmp_prim;
+	BvhBin bins[3][BVH_BINS];
+	BvhBox bounds, centroids, box;
+	float scale[3];
+	float left_area[BVH_BINS - 1];
+	uint32_t left_count[BVH_BINS - 1], right_count, tmp;
+	float cost, best_cost;
+	int axis, best_axis, best_split;
+	uint32_t g, i, j;
+	int b, n_bins;
+
+	prims = &build->prims[first];
+
+	box_empty (&bounds);
+	box_empty (&centroids);
+	for (g = 0; g < count; g++) {
+		box_grow (&bounds, &prims[g].box);
+		box_grow_range (&centroids, prims[g].centroid, prims[g].centroid);
+	}
+
+	memcpy (n->min, bounds.min, sizeof (n->min));
+	memcpy (n->max, bounds.max, sizeof (n->max));
+	n->first = first;
+	n->count = count;
+
+	if (count <= 1 || depth >= BVH_MAX_DEPTH) return;
+
+	/* Partir por el centro de cada triángulo, en la cubeta con menor área por triángulos a cada lado.
+	 * Los tres ejes se llenan en la misma pasada; los nodos chicos usan menos cubetas */
+	n_bins = (count < BVH_BINS ? count : BVH_BINS);
+	for (axis = 0; axis < 3; axis++) {
+		scale[axis] = (centroids.max[axis] > centroids.min[axis] ? n_bins / (centroids.max[axis] - centroids.min[axis]) : 0);
+		for (b = 0; b < n_bins; b++) {
+			box_empty (&bins[axis][b].box);
+			bins[axis][b].count = 0;
+		}
+	}
+
+	for (g = 0; g < count; g++) {
+		for (axis = 0; axis < 3; axis++) {
+			b = bvh_bin (prims[g].centroid[axis], centroids.min[axis], scale[axis], n_bins);
+			box_grow (&bins[axis][b].box, &prims[g].box);
+			bins[axis][b].count++;
+		}
+	}
+
+	best_axis = -1;
+	best_split = 0;
+	best_cost = FLT_MAX;
+	for (axis = 0; axis < 3; axis++) {
+		if (centroids.max[axis] <= centroids.min[axis]) continue;
+
+		box_empty (&box);
+		tmp = 0;
+		for (b = 0; b < n_bins - 1; b++) {
+			box_grow (&box, &bins[axis][b].box);
+			tmp += bins[axis][b].count;
+			left_count[b] = tmp;
+			left_area[b] = (tmp > 0 ? box_area (&box) : 0);
+		}
+
+		box_empty (&box);
+		right_count = 0;
+		for (b = n_bins - 1; b > 0; b--) {
+			box_grow (&box, &bins[axis][b].box);
+			right_count += bins[axis][b].count;
+			if (left_count[b - 1] == 0 || right_count == 0) continue;
+
+			cost = left_area[b - 1] * left_count[b - 1] + box_area (&box) * right_count;
+			if (cost < best_cost) {
+				best_cost = cost;
+				best_axis = axis;
+				best_split = b - 1;
+			}
+		}
+	}
+
+	/* Todos los centros en el mismo punto */
+	if (best_axis < 0) return;
+
+	/* Recorrer el nodo cuesta lo mismo que probar un triángulo */
+	if (count <= BVH_MAX_LEAF && best_cost + box_area (&bounds) >= box_area (&bounds) * count) return;
+
+	i = 0;
+	j = count;
+	while (i < j) {
+		if (bvh_bin (prims[i].centroid[best_axis], centroids.min[best_axis], scale[best_axis], n_bins) <= best_split) {
+			i++;
+		} else {
+			j--;
+			tmp_prim = prims[i];
+			prims[i] = prims[j];
+			prims[j] = tmp_prim;
+		}
+	}
+
+	if (i == 0 || i == count) return;
+
+	n->count = 0;
+	n->first = node + 2 * i;
+
+	bvh_build_child (build, n->first, first + i, count - i, depth + 1);
+	bvh_build_node (build, node + 1, first, i, depth + 1);
+}
+
+/* Cajas y centros de los triángulos con índices válidos */
+static void bvh_build_init (BvhBuild *build, VertexData *vertex, int num_vertex, MeshData *mesh) {
+	VertexData *v;
+	BvhPrim *prim;
+	float p[4];
+	uint32_t count, *index;
+	int g, h, k, tris;
+
+	memset (build, 0, sizeof (BvhBuild));
+
+	if (mesh->index == NULL || mesh->vertex_data_id < 0 || mesh->vertex_data_id >= num_vertex) return;
+
+	v = &vertex[mesh->vertex_data_id];
+	count = v->num / 3;
+	tris = mesh->num_index / 3;
+	if (tris == 0) return;
+
+	build->prims = (BvhPrim *) mmf_malloc (sizeof (BvhPrim) * tris);
+
+	for (g = 0; g < tris; g++) {
+		index = &mesh->index[g * 3];
+		if (index[0] >= count || index[1] >= count || index[2] >= count) continue;
+
+		prim = &build->prims[build->n_prims++];
+		box_empty (&prim->box);
+		for (k = 0; k < 3; k++) {
+			vertex_data_position (v, index[k], p);
+			p[3] = 0;
+			box_grow_range (&prim->box, p, p);
+		}
+
+		for (h = 0; h < 4; h++) {
+			prim->centroid[h] = (prim->box.min[h] + prim->box.max[h]) * 0.5f;
+		}
+		prim->tri = g;
+	}
+
+	if (build->n_prims == 0) return;
+
+	build->nodes = (BvhNode *) mmf_malloc (sizeof (BvhNode) * (2 * build->n_prims - 1));
+
+	/* La raíz y los subárboles grandes; si no alcanza, el resto se construye en el mismo hilo */
+	build->max_tasks = 2 * (build->n_prims / BVH_TASK_MIN) + 1;
+	build->tasks = (BvhTask *) mmf_malloc (sizeof (BvhTask) * build->max_tasks);
+}
+
+/* Copia el árbol en orden de profundidad y sin los huecos de los rangos */
+static uint32_t bvh_compact (BvhBuild *build, uint32_t node, BvhNode *out, uint32_t *n_out) {
+	uint32_t pos;
+
+	pos = (*n_out)++;
+	out[pos] = build->nodes[node];
+
+	if (build->nodes[node].count == 0) {
+		bvh_compact (build, node + 1, out, n_out);
+		out[pos].first = bvh_compact (build, build->nodes[node].first, out, n_out);
+	}
+
+	return pos;
+}
+
+/* Un BVH por mesh; los meshes y los subárboles grandes se construyen en paralelo.
+ * La forma del árbol no depende del número de hilos */
+int bvh_build_meshes (MeshBvh *bvh, VertexData *vertex, int num_vertex, MeshData *mesh, int num_meshes, ThreadPool *pool) {
+	BvhBuild *builds;
+	TaskGroup group;
+	uint32_t n_nodes;
+	int g, h;
+
+	memset (bvh, 0, sizeof (MeshBvh) * num_meshes);
+	builds = (BvhBuild *) mmf_malloc (sizeof (BvhBuild) * (num_meshes + 1));
+
+	pool_group_init (&group);
+	for (g = 0; g < num_meshes; g++) {
+		bvh_build_init (&builds[g], vertex, num_vertex, &mesh[g]);
+		if (builds[g].n_prims == 0) continue;
+
+		builds[g].pool = pool;
+		builds[g].group = &group;
+		builds[g].n_tasks = 1;
+		builds[g].tasks[0].build = &builds[g];
+		builds[g].tasks[0].node = 0;
+		builds[g].tasks[0].first = 0;
+		builds[g].tasks[0].count = builds[g].n_prims;
+		builds[g].tasks[0].depth = 0;
+
+		if (pool != NULL) {
+			pool_submit (pool, &group, bvh_task_run, &builds[g].tasks[0]);
+		} else {
+			bvh_task_run (&builds[g].tasks[0]);
+		}
+	}
+
+	if (pool != NULL) {
+		pool_wait (pool, &group);
+	}
+
+	for (g = 0; g < num_meshes; g++) {
+		if (builds[g].n_prims > 0) {
+			bvh[g].nodes = (BvhNode *) mmf_malloc (sizeof (BvhNode) * (2 * builds[g].n_prims - 1));
+			n_nodes = 0;
+			bvh_compact (&builds[g], 0, bvh[g].nodes, &n_nodes);
+			bvh[g].nodes = (BvhNode *) mmf_realloc (bvh[g].nodes, sizeof (BvhNode) * n_nodes);
+			bvh[g].n_nodes = n_nodes;
+
+			bvh[g].n_tris = builds[g].n_prims;
+			bvh[g].tris = (uint32_t *) mmf_malloc (sizeof (uint32_t) * bvh[g].n_tris);
+			for (h = 0; h < bvh[g].n_tris; h++) {
+				bvh[g].tris[h] = builds[g].prims[h].tri;
+			}
+		}
+
+		mmf_free (builds[g].prims);
+		mmf_free (builds[g].nodes);
+		mmf_free (builds[g].tasks);
+	}
+
+	mmf_free (builds);
+
+	return 0;
+}
+
+void bvh_free (MeshBvh *bvh, int num_meshes) {
+	int g;
+
+	for (g = 0; g < num_meshes; g++) {
+		mmf_free (bvh[g].nodes);
+		mmf_free (bvh[g].tris);
+	}
+
+	memset (bvh, 0, sizeof (MeshBvh) * num_meshes);
+}
+
+/* Por cada mesh: nombre (u16 y bytes, como en el DPACK), su caja, la cuenta de nodos y de triángulos,
+ * los nodos y los números de triángulo */
+int bvh_write (const char *path, MeshData *mesh, int num_meshes, MeshBvh *bvh) {
+	FILE *fd;
+	uint32_t u32;
+	uint16_t u16;
+	int g, h;
+
+	fd = fopen (path, "wb");
+	if (fd == NULL) {
+		return -1;
+	}
+
+	u32 = BVH_MAGIC;
+	fwrite (&u32, sizeof (u32), 1, fd);
+	u32 = num_meshes;
+	fwrite (&u32, sizeof (u32), 1, fd);
+
+	for (g = 0; g < num_meshes; g++) {
+		u16 = (mesh[g].name != NULL ? strlen (mesh[g].name) : 0);
+		fwrite (&u16, sizeof (u16), 1, fd);
+		if (u16 > 0) fwrite (mesh[g].name, 1, u16, fd);
+
+		fwrite (mesh[g].min, sizeof (float), 3, fd);
+		fwrite (mesh[g].max, sizeof (float), 3, fd);
+
+		/* Una instancia repite el árbol de su geometría */
+		h = mesh_geometry (mesh, num_meshes, g) - mesh;
+		u32 = bvh[h].n_nodes;
+		fwrite (&u32, sizeof (u32), 1, fd);
+		u32 = bvh[h].n_tris;
+		fwrite (&u32, sizeof (u32), 1, fd);
+
+		if (bvh[h].n_nodes > 0) fwrite (bvh[h].nodes, sizeof (BvhNode), bvh[h].n_nodes, fd);
+		if (bvh[h].n_tris > 0) fwrite (bvh[h].tris, sizeof (uint32_t), bvh[h].n_tris, fd);
+	}
+
+	if (ferror (fd)) {
+		fclose (fd);
+		return -1;
+	}
+
+	if (fclose (fd) != 0) {
+		return -1;
+	}
+
+	return 0;
+}
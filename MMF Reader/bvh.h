@@ -0,0 +1,35 @@
+#ifndef __BVH_H__
+#define __BVH_H__
+
+#include <stdint.h>
+
+#include "mmf.h"
+
+/* "BVH1" leído como u32 en little endian; el archivo va en el orden del host, como el DPACK */
+#define BVH_MAGIC 0x31485642
+
+typedef struct {
+	float min[3];
+	float max[3];
+
+	/* Hoja: primer elemento en tris. Nodo interno: el hijo derecho, el izquierdo es el nodo siguiente */
+	uint32_t first;
+
+	/* Triángulos de la hoja, 0 en un nodo interno */
+	uint32_t count;
+} BvhNode;
+
+typedef struct {
+	BvhNode *nodes;
+	int n_nodes;
+
+	/* Número de cada triángulo dentro del mesh (sus índices empiezan en tri * 3), en el orden de las hojas */
+	uint32_t *tris;
+	int n_tris;
+} MeshBvh;
+
+int bvh_build_meshes (MeshBvh *bvh, VertexData *vertex, int num_vertex, MeshData *mesh, int num_meshes, ThreadPool *pool);
+void bvh_free (MeshBvh *bvh, int num_meshes);
+int bvh_write (const char *path, MeshData *mesh, int num_meshes, MeshBvh *bvh);
+
+#endif /* __BVH_H__ */
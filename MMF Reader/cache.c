@@ -0,0 +1,372 @@
+/*
+ * cache.c
+ * This file is part of BKV Reader
+ *
+ * Copyright (C) 2022 - Félix Arreola Rodríguez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+
+#ifndef _WIN32
+#include <sys/ioctl.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+#endif
+
+#include "hash.h"
+#include "cache.h"
+
+/* Sube cuando cambia lo que se escribe, para no reusar salidas de una versión anterior.
+ * En la 4 las entradas dejaron de ser enlaces duros a las salidas, las anteriores pueden estar dañadas.
+ * En la 5 los nodos de las instancias del GLB llevan nombre */
+#define CACHE_VERSION 5
+
+struct _Cache {
+	char *dir;
+
+	int hits;
+	int misses;
+	int tmp_counter;
+};
+
+static int make_dirs (const char *dir) {
+	char *path;
+	int g, end;
+
+	path = strdup (dir);
+	for (g = 1; ; g++) {
+		if (path[g] != '/' && path[g] != '\\' && path[g] != 0) continue;
+
+		end = (path[g] == 0);
+		path[g] = 0;
+#ifdef _WIN32
+		mkdir (path);
+#else
+		mkdir (path, 0755);
+#endif
+		if (end) break;
+		path[g] = '/';
+	}
+
+	free (path);
+
+	return access (dir, W_OK);
+}
+
+Cache *cache_open (const char *dir) {
+	Cache *cache;
+
+	if (make_dirs (dir) < 0) {
+		fprintf (stderr, "Cache %s: %s\n", dir, strerror (errno));
+		return NULL;
+	}
+
+	cache = (Cache *) malloc (sizeof (Cache));
+	memset (cache, 0, sizeof (Cache));
+	cache->dir = strdup (dir);
+
+	return cache;
+}
+
+void cache_close (Cache *cache) {
+	if (cache == NULL) return;
+
+	free (cache->dir);
+	free (cache);
+}
+
+/* $XDG_CACHE_HOME/mmf_format o ~/.cache/mmf_format */
+char *cache_default_dir (void) {
+	const char *base, *sub;
+	char *dir;
+
+	base = getenv ("XDG_CACHE_HOME");
+	sub = "mmf_format";
+	if (base == NULL || base[0] == 0) {
+		base = getenv ("HOME");
+		sub = ".cache/mmf_format";
+	}
+#ifdef _WIN32
+	if (base == NULL || base[0] == 0) {
+		base = getenv ("LOCALAPPDATA");
+		sub = "mmf_format";
+	}
+#endif
+	if (base == NULL || base[0] == 0) {
+		base = ".";
+		sub = ".mmf_cache";
+	}
+
+	dir = (char *) malloc (strlen (base) + strlen (sub) + 2);
+	sprintf (dir, "%s/%s", base, sub);
+
+	return dir;
+}
+
+static int compare_names (const void *a, const void *b) {
+	return strcmp (*(char * const *) a, *(char * const *) b);
+}
+
+static int hash_file (const char *path, uint64_t *hash, uint64_t *size) {
+	Hash64 state;
+	unsigned char buffer[65536];
+	ssize_t r;
+	int fd;
+
+	fd = open (path, O_RDONLY
+#ifdef _WIN32
+	| _O_BINARY
+#endif
+	);
+
+	if (fd < 0) {
+		return -1;
+	}
+
+	hash64_init (&state, 0);
+	*size = 0;
+	while ((r = read (fd, buffer, sizeof (buffer))) != 0) {
+		if (r < 0) {
+			if (errno == EINTR) continue;
+			close (fd);
+			return -1;
+		}
+		hash64_update (&state, buffer, r);
+		*size += r;
+	}
+
+	close (fd);
+	*hash = hash64_final (&state);
+
+	return 0;
+}
+
+/* La llave cubre el nombre, tamaño y contenido de cada archivo de la carpeta, en orden,
+ * más las opciones que cambian la salida */
+int cache_model_key (const char *folder, const char *options, uint64_t *key) {
+	Hash64 state;
+	DIR *d;
+	struct dirent *entry;
+	struct stat st;
+	char path[8192];
+	char **names;
+	int n_names, size, g, version;
+	uint64_t file_hash, file_size;
+
+	d = opendir (folder);
+	if (d == NULL) {
+		return -1;
+	}
+
+	names = NULL;
+	n_names = size = 0;
+	while ((entry = readdir (d)) != NULL) {
+		snprintf (path, sizeof (path), "%s/%s", folder, entry->d_name);
+		if (stat (path, &st) < 0 || !S_ISREG (st.st_mode)) continue;
+
+		if (n_names == size) {
+			size = (size == 0 ? 32 : size * 2);
+			names = (char **) realloc (names, sizeof (char *) * size);
+		}
+		names[n_names++] = strdup (entry->d_name);
+	}
+	closedir (d);
+
+	qsort (names, n_names, sizeof (char *), compare_names);
+
+	version = CACHE_VERSION;
+	hash64_init (&state, 0);
+	hash64_update (&state, &version, sizeof (version));
+	hash64_update (&state, options, strlen (options) + 1);
+
+	for (g = 0; g < n_names; g++) {
+		snprintf (path, sizeof (path), "%s/%s", folder, names[g]);
+		if (hash_file (path, &file_hash, &file_size) < 0) {
+			break;
+		}
+
+		hash64_update (&state, names[g], strlen (names[g]) + 1);
+		hash64_update (&state, &file_size, sizeof (file_size));
+		hash64_update (&state, &file_hash, sizeof (file_hash));
+	}
+
+	for (size = 0; size < n_names; size++) {
+		free (names[size]);
+	}
+	free (names);
+
+	if (g < n_names) {
+		return -1;
+	}
+
+	*key = hash64_final (&state);
+
+	return 0;
+}
+
+static void cache_entry_path (Cache *cache, uint64_t key, const char *output, char *path, size_t len) {
+	const char *ext;
+
+	ext = strrchr (output, '.');
+	if (ext == NULL || strchr (ext, '/') != NULL || strchr (ext, '\\') != NULL) ext = "";
+
+	snprintf (path, len, "%s/%016llx%s", cache->dir, (unsigned long long) key, ext);
+}
+
+static int copy_file (const char *from, const char *to) {
+	unsigned char buffer[65536];
+	ssize_t r, w, pos;
+	int in, out;
+
+	in = open (from, O_RDONLY
+#ifdef _WIN32
+	| _O_BINARY
+#endif
+	);
+	if (in < 0) return -1;
+
+	out = open (to, O_WRONLY | O_CREAT | O_TRUNC
+#ifdef _WIN32
+	| _O_BINARY
+#endif
+	, 0644);
+	if (out < 0) {
+		close (in);
+		return -1;
+	}
+
+	while ((r = read (in, buffer, sizeof (buffer))) != 0) {
+		if (r < 0) {
+			if (errno == EINTR) continue;
+			break;
+		}
+
+		for (pos = 0; pos < r; pos += w) {
+			w = write (out, buffer + pos, r - pos);
+			if (w < 0 && errno == EINTR) {
+				w = 0;
+			} else if (w <= 0) {
+				r = -1;
+				break;
+			}
+		}
+		if (r < 0) break;
+	}
+
+	close (in);
+	if (close (out) < 0 || r < 0) {
+		unlink (to);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Nunca un enlace duro: quien escriba la salida en su lugar dañaría la entrada.
+ * Un reflink (Btrfs, XFS) es igual de barato y cada archivo queda independiente, si no, una copia */
+static int clone_or_copy (const char *from, const char *to) {
+#ifdef FICLONE
+	int in, out, g;
+
+	in = open (from, O_RDONLY);
+	if (in < 0) return -1;
+
+	out = open (to, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (out < 0) {
+		close (in);
+		return copy_file (from, to);
+	}
+
+	g = ioctl (out, FICLONE, in);
+	close (in);
+	close (out);
+
+	if (g == 0) return 0;
+	unlink (to);
+#endif
+
+	return copy_file (from, to);
+}
+
+static int cache_restore (Cache *cache, uint64_t key, const char *output) {
+	char path[8192];
+
+	cache_entry_path (cache, key, output, path, sizeof (path));
+
+	if (access (path, R_OK) < 0) {
+		return -1;
+	}
+
+	unlink (output);
+
+	return clone_or_copy (path, output);
+}
+
+/* Deja en "output" la salida guardada para la llave; -1 si no está */
+int cache_fetch (Cache *cache, uint64_t key, const char *output) {
+	if (cache_restore (cache, key, output) < 0) {
+		__atomic_add_fetch (&cache->misses, 1, __ATOMIC_RELAXED);
+		return -1;
+	}
+
+	__atomic_add_fetch (&cache->hits, 1, __ATOMIC_RELAXED);
+
+	return 0;
+}
+
+/* Un archivo que acompaña a la salida (el .mtl de un OBJ), con la misma llave y su extensión.
+ * No todas las salidas lo tienen, así que no cuenta como acierto ni como fallo */
+int cache_fetch_side (Cache *cache, uint64_t key, const char *output) {
+	return cache_restore (cache, key, output);
+}
+
+/* Guarda "output" bajo la llave. Se escribe a un temporal y se renombra, así otro proceso
+ * nunca ve una entrada a medias */
+int cache_store (Cache *cache, uint64_t key, const char *output) {
+	char path[8192], tmp[8192 + 64];
+	int counter;
+
+	cache_entry_path (cache, key, output, path, sizeof (path));
+
+	counter = __atomic_add_fetch (&cache->tmp_counter, 1, __ATOMIC_RELAXED);
+	snprintf (tmp, sizeof (tmp), "%s.tmp-%li-%i", path, (long) getpid (), counter);
+
+	if (clone_or_copy (output, tmp) < 0) {
+		return -1;
+	}
+
+	if (rename (tmp, path) < 0) {
+		unlink (tmp);
+		return -1;
+	}
+
+	return 0;
+}
+
+void cache_get_stats (Cache *cache, int *hits, int *misses) {
+	*hits = __atomic_load_n (&cache->hits, __ATOMIC_RELAXED);
+	*misses = __atomic_load_n (&cache->misses, __ATOMIC_RELAXED);
+}
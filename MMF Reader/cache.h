@@ -0,0 +1,19 @@
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include <stdint.h>
+
+typedef struct _Cache Cache;
+
+Cache *cache_open (const char *dir);
+void cache_close (Cache *cache);
+char *cache_default_dir (void);
+
+int cache_model_key (const char *folder, const char *options, uint64_t *key);
+int cache_fetch (Cache *cache, uint64_t key, const char *output);
+int cache_fetch_side (Cache *cache, uint64_t key, const char *output);
+int cache_store (Cache *cache, uint64_t key, const char *output);
+
+void cache_get_stats (Cache *cache, int *hits, int *misses);
+
+#endif /* __CACHE_H__ */
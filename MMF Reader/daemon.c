@@ -0,0 +1,523 @@
+/*
+ * daemon.c
+ * This file is part of BKV Reader
+ *
+ * Copyright (C) 2022 - Félix Arreola Rodríguez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "daemon.h"
+
+#ifdef _WIN32
+int daemon_run (const char *socket_path, ThreadPool *pool, Cache *cache) {
+	fprintf (stderr, "Daemon mode needs Unix domain sockets\n");
+
+	return -1;
+}
+#else
+
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "mmf.h"
+#include "batch.h"
+#include "json.h"
+
+/* Latencias guardadas para los percentiles; después se sobrescriben las más viejas */
+#define DAEMON_SAMPLES 8192
+#define DAEMON_MAX_CLIENTS 256
+#define DAEMON_MAX_LINE (1024 * 1024)
+
+typedef struct {
+	int listen_fd;
+	int running;
+
+	ThreadPool *pool;
+	Cache *cache;
+
+	pthread_mutex_t lock;
+	pthread_cond_t idle;
+
+	int clients[DAEMON_MAX_CLIENTS];
+	int n_clients;
+
+	double samples[DAEMON_SAMPLES];
+	long requests;
+} Daemon;
+
+static double now_ms (void) {
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static int compare_double (const void *a, const void *b) {
+	double da = *(const double *) a;
+	double db = *(const double *) b;
+
+	if (da < db) return -1;
+	if (da > db) return 1;
+
+	return 0;
+}
+
+static void daemon_record (Daemon *daemon, double ms) {
+	pthread_mutex_lock (&daemon->lock);
+	daemon->samples[daemon->requests % DAEMON_SAMPLES] = ms;
+	daemon->requests++;
+	pthread_mutex_unlock (&daemon->lock);
+}
+
+/* p50, p90, p99 y máximo de las últimas DAEMON_SAMPLES peticiones */
+static long daemon_percentiles (Daemon *daemon, double *p50, double *p90, double *p99, double *max) {
+	double *sorted;
+	long requests;
+	int n;
+
+	pthread_mutex_lock (&daemon->lock);
+	requests = daemon->requests;
+	n = (requests < DAEMON_SAMPLES ? requests : DAEMON_SAMPLES);
+	sorted = (double *) malloc (sizeof (double) * (n > 0 ? n : 1));
+	memcpy (sorted, daemon->samples, sizeof (double) * n);
+	pthread_mutex_unlock (&daemon->lock);
+
+	*p50 = *p90 = *p99 = *max = 0.0;
+	if (n > 0) {
+		qsort (sorted, n, sizeof (double), compare_double);
+		*p50 = sorted[(n - 1) * 50 / 100];
+		*p90 = sorted[(n - 1) * 90 / 100];
+		*p99 = sorted[(n - 1) * 99 / 100];
+		*max = sorted[n - 1];
+	}
+	free (sorted);
+
+	return requests;
+}
+
+static void daemon_error (JsonBuffer *out, const char *message) {
+	json_append (out, "{\"ok\":false,\"error\":");
+	json_append_string (out, message);
+}
+
+static void daemon_convert (Daemon *daemon, const char *request, JsonBuffer *out) {
+	char *folder, *output, *tree, *format;
+	Batch *batch;
+	int g, failed;
+
+	folder = json_object_get (request, "folder");
+	output = json_object_get (request, "output");
+	tree = json_object_get (request, "tree");
+
+	if (folder == NULL || output == NULL) {
+		daemon_error (out, "convert needs \"folder\" and \"output\"");
+	} else if (tree != NULL && strcmp (tree, "true") == 0) {
+		/* "output" es la carpeta base, como en --tree */
+		format = json_object_get (request, "format");
+
+		batch = batch_new (0);
+		batch_set_pool (batch, daemon->pool);
+		batch_add_tree (batch, folder, output, (format != NULL ? format : "obj"));
+		failed = batch_run (batch);
+
+		json_append (out, "{\"ok\":%s,\"models\":%i,\"failed\":%i", (failed == 0 ? "true" : "false"), batch_get_count (batch), failed);
+
+		batch_free (batch);
+		free (format);
+	} else {
+		g = model_convert (folder, output);
+
+		if (g < 0) {
+			daemon_error (out, "conversion failed");
+		} else {
+			json_append (out, "{\"ok\":true,\"cached\":%s", (g == 1 ? "true" : "false"));
+		}
+	}
+
+	free (folder);
+	free (output);
+	free (tree);
+}
+
+/* Resumen del modelo, sin los buffers */
+static void daemon_dump (Daemon *daemon, const char *request, JsonBuffer *out) {
+	MMFModel model;
+	char *folder;
+	int g;
+
+	folder = json_object_get (request, "folder");
+	if (folder == NULL) {
+		daemon_error (out, "dump needs \"folder\"");
+		return;
+	}
+
+	if (load_model (&model, folder) < 0) {
+		daemon_error (out, "Main desc file not found");
+		free (folder);
+		return;
+	}
+
+	json_append (out, "{\"ok\":true,\"vertexDatas\":[");
+	for (g = 0; g < model.num_vertex; g++) {
+		json_append (out, "%s{\"values\":%i,\"encoding\":%i}", (g > 0 ? "," : ""), model.vertex[g].num, model.vertex[g].encoding);
+	}
+
+	json_append (out, "],\"meshes\":[");
+	for (g = 0; g < model.num_meshes; g++) {
+		json_append (out, "%s{\"id\":%i,\"name\":", (g > 0 ? "," : ""), model.mesh[g].id);
+		json_append_string (out, model.mesh[g].name);
+		json_append (out, ",\"vertexData\":%i,\"renderable\":%s,\"material\":%i,\"indices\":%i}", model.mesh[g].vertex_data_id, (model.mesh[g].renderable ? "true" : "false"), model.mesh[g].material, model.mesh[g].num_index);
+	}
+
+	json_append (out, "],\"bones\":[");
+	for (g = 0; g < model.desc.n_bones; g++) {
+		json_append (out, "%s{\"name\":", (g > 0 ? "," : ""));
+		json_append_string (out, model.desc.bones[g].name);
+		json_append (out, ",\"parent\":%i}", model.desc.bones[g].parent);
+	}
+
+	json_append (out, "],\"transforms\":%i", model.desc.n_transforms);
+
+	model_free (&model);
+	free (folder);
+}
+
+static void daemon_list (Daemon *daemon, const char *request, JsonBuffer *out) {
+	Batch *batch;
+	char *root;
+	int g;
+
+	root = json_object_get (request, "root");
+	if (root == NULL) {
+		daemon_error (out, "list needs \"root\"");
+		return;
+	}
+
+	batch = batch_new (0);
+	batch_add_tree (batch, root, "", "obj");
+
+	json_append (out, "{\"ok\":true,\"models\":[");
+	for (g = 0; g < batch_get_count (batch); g++) {
+		if (g > 0) json_append (out, ",");
+		json_append_string (out, batch_get_folder (batch, g));
+	}
+	json_append (out, "]");
+
+	batch_free (batch);
+	free (root);
+}
+
+static void daemon_stats (Daemon *daemon, JsonBuffer *out) {
+	double p50, p90, p99, max;
+	long requests;
+	int hits, misses;
+
+	requests = daemon_percentiles (daemon, &p50, &p90, &p99, &max);
+
+	json_append (out, "{\"ok\":true,\"requests\":%li,\"p50_ms\":", requests);
+	json_append_float (out, p50);
+	json_append (out, ",\"p90_ms\":");
+	json_append_float (out, p90);
+	json_append (out, ",\"p99_ms\":");
+	json_append_float (out, p99);
+	json_append (out, ",\"max_ms\":");
+	json_append_float (out, max);
+
+	if (daemon->cache != NULL) {
+		cache_get_stats (daemon->cache, &hits, &misses);
+		json_append (out, ",\"cache_hits\":%i,\"cache_misses\":%i", hits, misses);
+	}
+}
+
+static void daemon_stop (Daemon *daemon) {
+	int g;
+
+	pthread_mutex_lock (&daemon->lock);
+	daemon->running = 0;
+
+	/* Despierta al accept y a los clientes que esperan otra línea */
+	shutdown (daemon->listen_fd, SHUT_RDWR);
+	for (g = 0; g < daemon->n_clients; g++) {
+		shutdown (daemon->clients[g], SHUT_RD);
+	}
+	pthread_mutex_unlock (&daemon->lock);
+}
+
+/* Atiende una línea; la respuesta es un objeto JSON en una línea */
+static void daemon_handle (Daemon *daemon, const char *request, JsonBuffer *out) {
+	char *cmd;
+	double start, ms;
+
+	start = now_ms ();
+	out->len = 0;
+
+	cmd = json_object_get (request, "cmd");
+	if (cmd == NULL) {
+		daemon_error (out, "missing \"cmd\"");
+	} else if (strcmp (cmd, "convert") == 0) {
+		daemon_convert (daemon, request, out);
+	} else if (strcmp (cmd, "dump") == 0) {
+		daemon_dump (daemon, request, out);
+	} else if (strcmp (cmd, "list") == 0) {
+		daemon_list (daemon, request, out);
+	} else if (strcmp (cmd, "stats") == 0) {
+		daemon_stats (daemon, out);
+	} else if (strcmp (cmd, "shutdown") == 0) {
+		json_append (out, "{\"ok\":true");
+		daemon_stop (daemon);
+	} else {
+		daemon_error (out, "unknown \"cmd\"");
+	}
+	free (cmd);
+
+	ms = now_ms () - start;
+	daemon_record (daemon, ms);
+
+	json_append (out, ",\"ms\":");
+	json_append_float (out, ms);
+	json_append (out, "}\n");
+}
+
+static int send_all (int fd, const char *data, size_t len) {
+	ssize_t w;
+
+	while (len > 0) {
+		w = send (fd, data, len, MSG_NOSIGNAL);
+		if (w < 0 && errno == EINTR) continue;
+		if (w <= 0) return -1;
+
+		data += w;
+		len -= w;
+	}
+
+	return 0;
+}
+
+typedef struct {
+	Daemon *daemon;
+	int fd;
+} DaemonClient;
+
+static void daemon_remove_client (Daemon *daemon, int fd) {
+	int g;
+
+	pthread_mutex_lock (&daemon->lock);
+	for (g = 0; g < daemon->n_clients; g++) {
+		if (daemon->clients[g] == fd) {
+			daemon->clients[g] = daemon->clients[--daemon->n_clients];
+			break;
+		}
+	}
+	if (daemon->n_clients == 0) pthread_cond_broadcast (&daemon->idle);
+	pthread_mutex_unlock (&daemon->lock);
+}
+
+static void *daemon_client_run (void *data) {
+	DaemonClient *client = (DaemonClient *) data;
+	Daemon *daemon = client->daemon;
+	JsonBuffer out;
+	char *line, *end;
+	size_t len, size;
+	ssize_t r;
+	int fd;
+
+	fd = client->fd;
+	free (client);
+
+	memset (&out, 0, sizeof (out));
+	size = 4096;
+	line = (char *) malloc (size);
+	len = 0;
+
+	while (1) {
+		/* Procesar todas las líneas completas que ya llegaron */
+		while ((end = memchr (line, '\n', len)) != NULL) {
+			*end = 0;
+			if (end > line) {
+				daemon_handle (daemon, line, &out);
+				if (send_all (fd, out.data, out.len) < 0) goto done;
+			}
+
+			len -= (end + 1 - line);
+			memmove (line, end + 1, len);
+		}
+
+		if (len + 1 >= size) {
+			if (size >= DAEMON_MAX_LINE) break;
+			size *= 2;
+			line = (char *) realloc (line, size);
+		}
+
+		r = recv (fd, line + len, size - len - 1, 0);
+		if (r < 0 && errno == EINTR) continue;
+		if (r <= 0) break;
+		len += r;
+	}
+
+done:
+	free (line);
+	free (out.data);
+
+	/* Se quita de la lista antes de cerrar, para que un accept no reuse el número mientras sigue ahí */
+	daemon_remove_client (daemon, fd);
+	close (fd);
+
+	return NULL;
+}
+
+/* Las peticiones leen y escriben archivos con los permisos del daemon: solo se atiende
+ * al mismo usuario (o a root). Sin SO_PEERCRED queda solo el modo 0600 del socket */
+static int daemon_peer_allowed (int fd) {
+#ifdef SO_PEERCRED
+	struct ucred cred;
+	socklen_t len;
+
+	len = sizeof (cred);
+	if (getsockopt (fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0) {
+		return 0;
+	}
+
+	return cred.uid == geteuid () || cred.uid == 0;
+#else
+	return 1;
+#endif
+}
+
+/* Escucha en el socket hasta recibir "shutdown". El pool y la caché se comparten entre
+ * todas las peticiones, así que solo la primera conversión paga arrancarlos */
+int daemon_run (const char *socket_path, ThreadPool *pool, Cache *cache) {
+	Daemon *daemon;
+	struct sockaddr_un addr;
+	DaemonClient *client;
+	pthread_t thread;
+	double p50, p90, p99, max;
+	long requests;
+	mode_t mask;
+	int fd, g;
+
+	if (strlen (socket_path) >= sizeof (addr.sun_path)) {
+		fprintf (stderr, "%s: socket path too long\n", socket_path);
+		return -1;
+	}
+
+	daemon = (Daemon *) malloc (sizeof (Daemon));
+	memset (daemon, 0, sizeof (Daemon));
+	daemon->pool = pool;
+	daemon->cache = cache;
+	daemon->running = 1;
+	pthread_mutex_init (&daemon->lock, NULL);
+	pthread_cond_init (&daemon->idle, NULL);
+
+	daemon->listen_fd = socket (AF_UNIX, SOCK_STREAM, 0);
+	if (daemon->listen_fd < 0) {
+		fprintf (stderr, "socket: %s\n", strerror (errno));
+		free (daemon);
+		return -1;
+	}
+
+	memset (&addr, 0, sizeof (addr));
+	addr.sun_family = AF_UNIX;
+	strcpy (addr.sun_path, socket_path);
+
+	/* Un socket viejo de una corrida anterior impide el bind */
+	unlink (socket_path);
+
+	/* El socket nace con modo 0600, sin un momento en que otro usuario pueda conectarse */
+	mask = umask (077);
+	g = bind (daemon->listen_fd, (struct sockaddr *) &addr, sizeof (addr));
+	umask (mask);
+
+	if (g < 0 || listen (daemon->listen_fd, 64) < 0) {
+		fprintf (stderr, "%s: %s\n", socket_path, strerror (errno));
+		close (daemon->listen_fd);
+		free (daemon);
+		return -1;
+	}
+
+	fprintf (stderr, "Listening on %s\n", socket_path);
+
+	while (1) {
+		fd = accept (daemon->listen_fd, NULL, NULL);
+
+		if (fd >= 0 && !daemon_peer_allowed (fd)) {
+			fprintf (stderr, "Rejected a connection from another user\n");
+			close (fd);
+			continue;
+		}
+
+		pthread_mutex_lock (&daemon->lock);
+		if (!daemon->running) {
+			pthread_mutex_unlock (&daemon->lock);
+			if (fd >= 0) close (fd);
+			break;
+		}
+
+		if (fd < 0 || daemon->n_clients == DAEMON_MAX_CLIENTS) {
+			pthread_mutex_unlock (&daemon->lock);
+			if (fd >= 0) close (fd);
+			else if (errno != EINTR && errno != ECONNABORTED) fprintf (stderr, "accept: %s\n", strerror (errno));
+			continue;
+		}
+		daemon->clients[daemon->n_clients++] = fd;
+		pthread_mutex_unlock (&daemon->lock);
+
+		client = (DaemonClient *) malloc (sizeof (DaemonClient));
+		client->daemon = daemon;
+		client->fd = fd;
+
+		if (pthread_create (&thread, NULL, daemon_client_run, client) != 0) {
+			free (client);
+			daemon_remove_client (daemon, fd);
+			close (fd);
+			continue;
+		}
+		pthread_detach (thread);
+	}
+
+	/* Esperar a que terminen las peticiones que ya estaban en curso */
+	pthread_mutex_lock (&daemon->lock);
+	while (daemon->n_clients > 0) {
+		pthread_cond_wait (&daemon->idle, &daemon->lock);
+	}
+	pthread_mutex_unlock (&daemon->lock);
+
+	close (daemon->listen_fd);
+	unlink (socket_path);
+
+	requests = daemon_percentiles (daemon, &p50, &p90, &p99, &max);
+	fprintf (stderr, "%li requests, latency p50 %.2f ms, p90 %.2f ms, p99 %.2f ms, max %.2f ms\n", requests, p50, p90, p99, max);
+
+	pthread_mutex_destroy (&daemon->lock);
+	pthread_cond_destroy (&daemon->idle);
+	free (daemon);
+
+	return 0;
+}
+#endif
@@ -0,0 +1,9 @@
+#ifndef __DAEMON_H__
+#define __DAEMON_H__
+
+#include "pool.h"
+#include "cache.h"
+
+int daemon_run (const char *socket_path, ThreadPool *pool, Cache *cache);
+
+#endif /* __DAEMON_H__ */
@@ -0,0 +1,582 @@
+/*
+ * gltf.c
+ * This file is part of BKV Reader
+ *
+ * Copyright (C) 2022 - Félix Arreola Rodríguez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "mmf.h"
+#include "json.h"
+#include "gltf.h"
+#include "log.h"
+#include "material.h"
+#include "scene.h"
+
+#define GLB_MAGIC 0x46546C67
+#define GLB_CHUNK_JSON 0x4E4F534A
+#define GLB_CHUNK_BIN 0x004E4942
+
+#define GLTF_BYTE 5120
+#define GLTF_UNSIGNED_BYTE 5121
+#define GLTF_SHORT 5122
+#define GLTF_UNSIGNED_SHORT 5123
+#define GLTF_UNSIGNED_INT 5125
+#define GLTF_FLOAT 5126
+
+#define GLTF_ARRAY_BUFFER 34962
+#define GLTF_ELEMENT_ARRAY_BUFFER 34963
+
+static void write_u32_le (FILE *fd, uint32_t num) {
+	unsigned char b[4];
+
+	b[0] = num & 0xFF;
+	b[1] = (num >> 8) & 0xFF;
+	b[2] = (num >> 16) & 0xFF;
+	b[3] = (num >> 24) & 0xFF;
+
+	fwrite (b, sizeof (b), 1, fd);
+}
+
+static void json_append_trs (JsonBuffer *json, Transform *t) {
+	float len, q[4];
+	int g;
+
+	json_append (json, ",\"translation\":[");
+	json_append_float (json, t->translation[0]);
+	json_append (json, ",");
+	json_append_float (json, t->translation[1]);
+	json_append (json, ",");
+	json_append_float (json, t->translation[2]);
+	json_append (json, "]");
+
+	/* glTF exige cuaterniones unitarios */
+	len = sqrtf (t->rotation[0] * t->rotation[0] + t->rotation[1] * t->rotation[1] + t->rotation[2] * t->rotation[2] + t->rotation[3] * t->rotation[3]);
+	if (len > 0.000001f && !isnan (len) && !isinf (len)) {
+		for (g = 0; g < 4; g++) {
+			q[g] = t->rotation[g] / len;
+		}
+
+		json_append (json, ",\"rotation\":[");
+		json_append_float (json, q[0]);
+		json_append (json, ",");
+		json_append_float (json, q[1]);
+		json_append (json, ",");
+		json_append_float (json, q[2]);
+		json_append (json, ",");
+		json_append_float (json, q[3]);
+		json_append (json, "]");
+	}
+
+	if (t->scale != 0.0) {
+		json_append (json, ",\"scale\":[");
+		json_append_float (json, t->scale);
+		json_append (json, ",");
+		json_append_float (json, t->scale);
+		json_append (json, ",");
+		json_append_float (json, t->scale);
+		json_append (json, "]");
+	}
+}
+
+static int vertex_component_type (VertexData *vertex) {
+	if (vertex->raw == NULL) return GLTF_FLOAT;
+
+	if (encoding_element_size (vertex->encoding) == 1) {
+		return encoding_is_signed (vertex->encoding) ? GLTF_BYTE : GLTF_UNSIGNED_BYTE;
+	}
+
+	return encoding_is_signed (vertex->encoding) ? GLTF_SHORT : GLTF_UNSIGNED_SHORT;
+}
+
+/* Los atributos cuantizados deben empezar en múltiplos de 4 bytes, VEC3 de bytes o shorts se rellena */
+static int vertex_stride (VertexData *vertex) {
+	if (vertex->raw == NULL) return 3 * sizeof (float);
+
+	return (3 * encoding_element_size (vertex->encoding) + 3) & ~3;
+}
+
+/* Valor tal como está guardado en el buffer, min y max de glTF no se normalizan */
+static float vertex_component (VertexData *vertex, int pos) {
+	if (vertex->raw == NULL) return vertex->vertex[pos];
+
+	switch (vertex_component_type (vertex)) {
+		case GLTF_BYTE:
+			return ((int8_t *) vertex->raw)[pos];
+		case GLTF_UNSIGNED_BYTE:
+			return ((uint8_t *) vertex->raw)[pos];
+		case GLTF_SHORT:
+			return ((int16_t *) vertex->raw)[pos];
+		case GLTF_UNSIGNED_SHORT:
+			return ((uint16_t *) vertex->raw)[pos];
+	}
+
+	return 0;
+}
+
+static void write_quantized_vertex (FILE *fd, VertexData *vertex) {
+	unsigned char buffer[8192];
+	int stride, size, count, g, used;
+
+	stride = vertex_stride (vertex);
+	size = 3 * encoding_element_size (vertex->encoding);
+	count = vertex->num / 3;
+
+	memset (buffer, 0, sizeof (buffer));
+	used = 0;
+	for (g = 0; g < count; g++) {
+		memcpy (&buffer[used], &((unsigned char *) vertex->raw)[g * size], size);
+		used += stride;
+
+		if (used + stride > sizeof (buffer)) {
+			fwrite (buffer, 1, used, fd);
+			used = 0;
+		}
+	}
+
+	if (used > 0) fwrite (buffer, 1, used, fd);
+}
+
+/* Las diferencias de un blend shape, intercaladas como las pide glTF */
+static void write_shape_values (FILE *fd, BlendShape *shape) {
+	float buffer[3 * 1024];
+	int g, used;
+
+	used = 0;
+	for (g = 0; g < shape->count; g++) {
+		buffer[used++] = shape->dx[g];
+		buffer[used++] = shape->dy[g];
+		buffer[used++] = shape->dz[g];
+
+		if (used == 3 * 1024) {
+			fwrite (buffer, sizeof (float), used, fd);
+			used = 0;
+		}
+	}
+
+	if (used > 0) fwrite (buffer, sizeof (float), used, fd);
+}
+
+int gltf_write_glb (const char *path, MMFModel *model, VertexData *vertex, int num_vertex, MeshData *mesh, int num_meshes, BlendShape *shapes, int num_shapes) {
+	BKVDesc *bkv_desc = &model->desc;
+	Material *materials = model->materials;
+	int num_materials = model->num_materials;
+	SceneNode *node;
+	FILE *fd_glb;
+	JsonBuffer json;
+	int *vertex_accessor, *index_accessor, *shape_accessor, *shape_view, *gltf_mesh, *node_index;
+	int n_views, n_accessors, n_targets, n_meshes, n_nodes;
+	uint32_t bin_len, json_len, view_len, max_index;
+	int g, h, count, first;
+	float f, min[3], max[3];
+	static const unsigned char padding[4] = {0, 0, 0, 0};
+
+	json.size = 4096;
+	json.len = 0;
+	json.data = (char *) malloc (json.size);
+	json.data[0] = 0;
+
+	vertex_accessor = (int *) malloc (sizeof (int) * (num_vertex + 1));
+	index_accessor = (int *) malloc (sizeof (int) * (num_meshes + 1));
+	shape_accessor = (int *) malloc (sizeof (int) * (num_shapes + 1));
+	shape_view = (int *) malloc (sizeof (int) * (num_shapes + 1));
+	gltf_mesh = (int *) malloc (sizeof (int) * (num_meshes + 1));
+	node_index = (int *) malloc (sizeof (int) * (model->num_nodes + 1));
+
+	json_append (&json, "{\"asset\":{\"version\":\"2.0\",\"generator\":\"BKV Reader\"}");
+
+	for (g = 0; g < num_vertex; g++) {
+		if (vertex[g].raw != NULL && vertex[g].num >= 3) {
+			/* Los flujos de bytes y shorts se exportan sin expandir */
+			json_append (&json, ",\"extensionsUsed\":[\"KHR_mesh_quantization\"],\"extensionsRequired\":[\"KHR_mesh_quantization\"]");
+			break;
+		}
+	}
+
+	/* Primera pasada: un bufferView y un accessor por cada arreglo, en el mismo orden en el que van al chunk BIN */
+	n_views = 0;
+	bin_len = 0;
+	json_append (&json, ",\"bufferViews\":[");
+	for (g = 0; g < num_vertex; g++) {
+		vertex_accessor[g] = -1;
+		if ((vertex[g].vertex == NULL && vertex[g].raw == NULL) || vertex[g].num < 3) continue;
+
+		view_len = (vertex[g].num / 3) * vertex_stride (&vertex[g]);
+		json_append (&json, "%s{\"buffer\":0,\"byteOffset\":%u,\"byteLength\":%u,\"byteStride\":%i,\"target\":%i}", (n_views > 0 ? "," : ""), bin_len, view_len, vertex_stride (&vertex[g]), GLTF_ARRAY_BUFFER);
+		vertex_accessor[g] = n_views;
+		n_views++;
+		bin_len += view_len;
+	}
+
+	for (g = 0; g < num_meshes; g++) {
+		index_accessor[g] = -1;
+		if (!mesh[g].renderable || mesh[g].index == NULL || mesh[g].num_index < 3) continue;
+		if (mesh[g].vertex_data_id < 0 || mesh[g].vertex_data_id >= num_vertex || vertex_accessor[mesh[g].vertex_data_id] < 0) {
+			log_warn ("Mesh %s references missing vertex data %i, skipping\n", mesh[g].name, mesh[g].vertex_data_id);
+			continue;
+		}
+
+		count = mesh[g].num_index - (mesh[g].num_index % 3);
+		max_index = 0;
+		for (h = 0; h < count; h++) {
+			if (mesh[g].index[h] > max_index) max_index = mesh[g].index[h];
+		}
+
+		if (max_index >= vertex[mesh[g].vertex_data_id].num / 3) {
+			log_warn ("Mesh %s has indices out of range, skipping\n", mesh[g].name);
+			continue;
+		}
+
+		view_len = count * sizeof (uint32_t);
+		json_append (&json, "%s{\"buffer\":0,\"byteOffset\":%u,\"byteLength\":%u,\"target\":%i}", (n_views > 0 ? "," : ""), bin_len, view_len, GLTF_ELEMENT_ARRAY_BUFFER);
+		index_accessor[g] = n_views;
+		n_views++;
+		bin_len += view_len;
+	}
+
+	/* Los blend shapes son accessors dispersos: un bufferView de índices y otro de diferencias.
+	 * Van después de los demás, así que sus accessors ya no tienen el número de su bufferView */
+	n_accessors = n_views;
+	for (g = 0; g < num_shapes; g++) {
+		shape_accessor[g] = shape_view[g] = -1;
+		if (shapes[g].mesh < 0 || shapes[g].mesh >= num_meshes || index_accessor[shapes[g].mesh] < 0) continue;
+		if (shapes[g].vertex_data_id != mesh[shapes[g].mesh].vertex_data_id) continue;
+
+		shape_accessor[g] = n_accessors++;
+		if (shapes[g].count == 0) continue;
+
+		json_append (&json, "%s{\"buffer\":0,\"byteOffset\":%u,\"byteLength\":%u}", (n_views > 0 ? "," : ""), bin_len, (uint32_t) (shapes[g].count * sizeof (uint32_t)));
+		bin_len += shapes[g].count * sizeof (uint32_t);
+		json_append (&json, ",{\"buffer\":0,\"byteOffset\":%u,\"byteLength\":%u}", bin_len, (uint32_t) (shapes[g].count * 3 * sizeof (float)));
+		bin_len += shapes[g].count * 3 * sizeof (float);
+
+		shape_view[g] = n_views;
+		n_views += 2;
+	}
+
+	if (n_views == 0) {
+		log_warn ("Nothing to export\n");
+		goto error_glb;
+	}
+	json_append (&json, "]");
+
+	json_append (&json, ",\"buffers\":[{\"byteLength\":%u}]", bin_len);
+
+	/* Los accessors usan el mismo índice que su bufferView */
+	json_append (&json, ",\"accessors\":[");
+	first = 1;
+	for (g = 0; g < num_vertex; g++) {
+		if (vertex_accessor[g] < 0) continue;
+
+		count = vertex[g].num / 3;
+		if (vertex[g].raw == NULL) {
+			/* Los flotantes ya traen su caja desde que se leyeron */
+			memcpy (min, vertex[g].min, sizeof (min));
+			memcpy (max, vertex[g].max, sizeof (max));
+		} else {
+			for (h = 0; h < 3; h++) {
+				min[h] = max[h] = vertex_component (&vertex[g], h);
+			}
+			for (h = 0; h < count * 3; h++) {
+				f = vertex_component (&vertex[g], h);
+				if (f < min[h % 3]) min[h % 3] = f;
+				if (f > max[h % 3]) max[h % 3] = f;
+			}
+		}
+
+		json_append (&json, "%s{\"bufferView\":%i,\"componentType\":%i,\"count\":%i,\"type\":\"VEC3\"", (first ? "" : ","), vertex_accessor[g], vertex_component_type (&vertex[g]), count);
+		if (vertex[g].raw != NULL && encoding_is_normalized (vertex[g].encoding)) {
+			json_append (&json, ",\"normalized\":true");
+		}
+		json_append (&json, ",\"min\":[");
+		json_append_float (&json, min[0]);
+		json_append (&json, ",");
+		json_append_float (&json, min[1]);
+		json_append (&json, ",");
+		json_append_float (&json, min[2]);
+		json_append (&json, "],\"max\":[");
+		json_append_float (&json, max[0]);
+		json_append (&json, ",");
+		json_append_float (&json, max[1]);
+		json_append (&json, ",");
+		json_append_float (&json, max[2]);
+		json_append (&json, "]}");
+		first = 0;
+	}
+
+	for (g = 0; g < num_meshes; g++) {
+		if (index_accessor[g] < 0) continue;
+
+		count = mesh[g].num_index - (mesh[g].num_index % 3);
+		json_append (&json, "%s{\"bufferView\":%i,\"componentType\":%i,\"count\":%i,\"type\":\"SCALAR\"}", (first ? "" : ","), index_accessor[g], GLTF_UNSIGNED_INT, count);
+		first = 0;
+	}
+
+	/* Sin bufferView el accessor empieza en ceros y el sparse pone las diferencias */
+	for (g = 0; g < num_shapes; g++) {
+		if (shape_accessor[g] < 0) continue;
+
+		count = vertex[shapes[g].vertex_data_id].num / 3;
+		for (h = 0; h < 3; h++) {
+			min[h] = max[h] = 0;
+		}
+		if (shapes[g].count == count && count > 0) {
+			min[0] = max[0] = shapes[g].dx[0];
+			min[1] = max[1] = shapes[g].dy[0];
+			min[2] = max[2] = shapes[g].dz[0];
+		}
+		for (h = 0; h < shapes[g].count; h++) {
+			if (shapes[g].dx[h] < min[0]) min[0] = shapes[g].dx[h];
+			if (shapes[g].dx[h] > max[0]) max[0] = shapes[g].dx[h];
+			if (shapes[g].dy[h] < min[1]) min[1] = shapes[g].dy[h];
+			if (shapes[g].dy[h] > max[1]) max[1] = shapes[g].dy[h];
+			if (shapes[g].dz[h] < min[2]) min[2] = shapes[g].dz[h];
+			if (shapes[g].dz[h] > max[2]) max[2] = shapes[g].dz[h];
+		}
+
+		json_append (&json, "%s{\"componentType\":%i,\"count\":%i,\"type\":\"VEC3\"", (first ? "" : ","), GLTF_FLOAT, count);
+		json_append (&json, ",\"min\":[");
+		json_append_float (&json, min[0]);
+		json_append (&json, ",");
+		json_append_float (&json, min[1]);
+		json_append (&json, ",");
+		json_append_float (&json, min[2]);
+		json_append (&json, "],\"max\":[");
+		json_append_float (&json, max[0]);
+		json_append (&json, ",");
+		json_append_float (&json, max[1]);
+		json_append (&json, ",");
+		json_append_float (&json, max[2]);
+		json_append (&json, "]");
+		if (shapes[g].count > 0) {
+			json_append (&json, ",\"sparse\":{\"count\":%i,\"indices\":{\"bufferView\":%i,\"componentType\":%i},\"values\":{\"bufferView\":%i}}", shapes[g].count, shape_view[g], GLTF_UNSIGNED_INT, shape_view[g] + 1);
+		}
+		json_append (&json, "}");
+		first = 0;
+	}
+	json_append (&json, "]");
+
+	/* Un mesh de glTF por cada MeshData */
+	n_meshes = 0;
+	for (g = 0; g < num_meshes; g++) {
+		gltf_mesh[g] = -1;
+		if (index_accessor[g] < 0) continue;
+
+		gltf_mesh[g] = n_meshes;
+
+		json_append (&json, "%s{\"name\":", (n_meshes == 0 ? ",\"meshes\":[" : ","));
+		json_append_string (&json, mesh[g].name);
+		json_append (&json, ",\"primitives\":[{\"attributes\":{\"POSITION\":%i},\"indices\":%i,\"mode\":4", vertex_accessor[mesh[g].vertex_data_id], index_accessor[g]);
+		if (mesh[g].material >= 0 && mesh[g].material < num_materials) {
+			json_append (&json, ",\"material\":%i", mesh[g].material);
+		}
+
+		/* Los blend shapes del mesh como morph targets, todos con peso 0 */
+		n_targets = 0;
+		for (h = 0; h < num_shapes; h++) {
+			if (shape_accessor[h] < 0 || shapes[h].mesh != g) continue;
+
+			json_append (&json, "%s{\"POSITION\":%i}", (n_targets == 0 ? ",\"targets\":[" : ","), shape_accessor[h]);
+			n_targets++;
+		}
+		json_append (&json, "%s}]", (n_targets > 0 ? "]" : ""));
+
+		if (n_targets > 0) {
+			json_append (&json, ",\"weights\":[");
+			for (h = 0; h < n_targets; h++) {
+				json_append (&json, "%s0", (h == 0 ? "" : ","));
+			}
+			json_append (&json, "],\"extras\":{\"targetNames\":[");
+			first = 1;
+			for (h = 0; h < num_shapes; h++) {
+				if (shape_accessor[h] < 0 || shapes[h].mesh != g) continue;
+
+				json_append (&json, "%s", (first ? "" : ","));
+				json_append_string (&json, shapes[h].name);
+				first = 0;
+			}
+			json_append (&json, "]}");
+		}
+		json_append (&json, "}");
+		n_meshes++;
+	}
+	if (n_meshes > 0) json_append (&json, "]");
+
+	/* Materiales PBR sin metal: el color difuso es el color base, el brillo da la rugosidad.
+	 * Las texturas no se incluyen en el GLB, solo se anota su nombre */
+	for (g = 0; g < num_materials; g++) {
+		json_append (&json, "%s{\"name\":", (g == 0 ? ",\"materials\":[" : ","));
+		json_append_string (&json, materials[g].name);
+		json_append (&json, ",\"pbrMetallicRoughness\":{\"baseColorFactor\":[");
+		for (h = 0; h < 4; h++) {
+			if (h > 0) json_append (&json, ",");
+			json_append_float (&json, materials[g].diffuse[h]);
+		}
+		json_append (&json, "],\"metallicFactor\":0,\"roughnessFactor\":");
+		json_append_float (&json, material_roughness (&materials[g]));
+		json_append (&json, "}");
+		if (materials[g].diffuse[3] < 1) {
+			json_append (&json, ",\"alphaMode\":\"BLEND\"");
+		}
+		if (materials[g].texture != NULL) {
+			json_append (&json, ",\"extras\":{\"texture\":");
+			json_append_string (&json, materials[g].texture);
+			json_append (&json, "}");
+		}
+		json_append (&json, "}");
+	}
+	if (num_materials > 0) json_append (&json, "]");
+
+	/* Nodos de la escena, en su orden. Una instancia usa el mesh de glTF de su geometría;
+	 * los meshes sin geometría exportada no tienen nodo */
+	n_nodes = 0;
+	for (g = 0; g < model->num_nodes; g++) {
+		node_index[g] = -1;
+		if (model->nodes[g].mesh >= 0 && gltf_mesh[mesh_geometry (mesh, num_meshes, model->nodes[g].mesh) - mesh] < 0) continue;
+
+		node_index[g] = n_nodes++;
+	}
+
+	n_nodes = 0;
+	json_append (&json, ",\"nodes\":[");
+	for (g = 0; g < model->num_nodes; g++) {
+		if (node_index[g] < 0) continue;
+		node = &model->nodes[g];
+
+		if (node->mesh >= 0) {
+			/* Cada instancia lleva el nombre de su mesh, aunque comparta la geometría de otro */
+			json_append (&json, "%s{\"mesh\":%i", (n_nodes > 0 ? "," : ""), gltf_mesh[mesh_geometry (mesh, num_meshes, node->mesh) - mesh]);
+			if (node->name != NULL) {
+				json_append (&json, ",\"name\":");
+				json_append_string (&json, node->name);
+			}
+		} else if (node->name == NULL) {
+			json_append (&json, "%s{\"name\":\"transform-%i\"", (n_nodes > 0 ? "," : ""), node->transform);
+		} else {
+			json_append (&json, "%s{\"name\":", (n_nodes > 0 ? "," : ""));
+			json_append_string (&json, node->name);
+		}
+
+		if (node->transform >= 0 && node->transform < bkv_desc->n_transforms) {
+			json_append_trs (&json, &bkv_desc->transforms[node->transform]);
+		}
+
+		first = 1;
+		for (h = 0; h < model->num_nodes; h++) {
+			if (h == g || model->nodes[h].parent != g || node_index[h] < 0) continue;
+
+			json_append (&json, "%s%i", (first ? ",\"children\":[" : ","), node_index[h]);
+			first = 0;
+		}
+		if (!first) json_append (&json, "]");
+
+		json_append (&json, "}");
+		n_nodes++;
+	}
+	json_append (&json, "]");
+
+	/* La escena contiene todos los nodos raíz */
+	json_append (&json, ",\"scene\":0,\"scenes\":[{\"nodes\":[");
+	first = 1;
+	for (g = 0; g < model->num_nodes; g++) {
+		if (node_index[g] < 0 || model->nodes[g].parent >= 0) continue;
+
+		json_append (&json, "%s%i", (first ? "" : ","), node_index[g]);
+		first = 0;
+	}
+	json_append (&json, "]}]}");
+
+	/* El chunk JSON se rellena con espacios hasta múltiplo de 4 */
+	while (json.len % 4 != 0) {
+		json_append (&json, " ");
+	}
+	json_len = json.len;
+
+	fd_glb = fopen (path, "wb");
+
+	if (fd_glb == NULL) {
+		goto error_glb;
+	}
+
+	write_u32_le (fd_glb, GLB_MAGIC);
+	write_u32_le (fd_glb, 2);
+	write_u32_le (fd_glb, 12 + 8 + json_len + 8 + bin_len);
+
+	write_u32_le (fd_glb, json_len);
+	write_u32_le (fd_glb, GLB_CHUNK_JSON);
+	fwrite (json.data, 1, json_len, fd_glb);
+
+	/* Todos los arreglos son de 4 bytes, el chunk BIN ya queda alineado.
+	 * Los decodificadores dejan los datos en el orden del host, que se asume little-endian como glTF */
+	write_u32_le (fd_glb, bin_len);
+	write_u32_le (fd_glb, GLB_CHUNK_BIN);
+	for (g = 0; g < num_vertex; g++) {
+		if (vertex_accessor[g] < 0) continue;
+
+		if (vertex[g].raw != NULL) {
+			write_quantized_vertex (fd_glb, &vertex[g]);
+		} else {
+			fwrite (vertex[g].vertex, sizeof (float), (vertex[g].num / 3) * 3, fd_glb);
+		}
+	}
+
+	for (g = 0; g < num_meshes; g++) {
+		if (index_accessor[g] < 0) continue;
+
+		count = mesh[g].num_index - (mesh[g].num_index % 3);
+		fwrite (mesh[g].index, sizeof (uint32_t), count, fd_glb);
+	}
+
+	for (g = 0; g < num_shapes; g++) {
+		if (shape_accessor[g] < 0 || shapes[g].count == 0) continue;
+
+		fwrite (shapes[g].index, sizeof (uint32_t), shapes[g].count, fd_glb);
+		write_shape_values (fd_glb, &shapes[g]);
+	}
+
+	if (bin_len % 4 != 0) {
+		fwrite (padding, 1, 4 - (bin_len % 4), fd_glb);
+	}
+
+	if (fclose (fd_glb) != 0) {
+		goto error_glb;
+	}
+
+	free (json.data);
+	free (vertex_accessor);
+	free (index_accessor);
+	free (shape_accessor);
+	free (shape_view);
+	free (gltf_mesh);
+	free (node_index);
+
+	return 0;
+error_glb:
+	free (json.data);
+	free (vertex_accessor);
+	free (index_accessor);
+	free (shape_accessor);
+	free (shape_view);
+	free (gltf_mesh);
+	free (node_index);
+
+	return -1;
+}
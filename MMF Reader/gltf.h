@@ -0,0 +1,8 @@
+#ifndef __GLTF_H__
+#define __GLTF_H__
+
+#include "mmf.h"
+
+int gltf_write_glb (const char *path, MMFModel *model, VertexData *vertex, int num_vertex, MeshData *mesh, int num_meshes, BlendShape *shapes, int num_shapes);
+
+#endif /* __GLTF_H__ */
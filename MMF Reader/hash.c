@@ -0,0 +1,164 @@
+/*
+ * hash.c
+ * This file is part of BKV Reader
+ *
+ * Copyright (C) 2022 - Félix Arreola Rodríguez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <stdint.h>
+
+#include "hash.h"
+
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+static uint64_t rotl64 (uint64_t x, int r) {
+	return (x << r) | (x >> (64 - r));
+}
+
+/* Se lee en little endian sin importar el host, para que el hash sea el mismo en todos lados */
+static uint64_t read_64 (const unsigned char *p) {
+	return (uint64_t) p[0] | ((uint64_t) p[1] << 8) | ((uint64_t) p[2] << 16) | ((uint64_t) p[3] << 24) |
+	       ((uint64_t) p[4] << 32) | ((uint64_t) p[5] << 40) | ((uint64_t) p[6] << 48) | ((uint64_t) p[7] << 56);
+}
+
+static uint32_t read_32 (const unsigned char *p) {
+	return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static uint64_t round_64 (uint64_t acc, uint64_t input) {
+	acc += input * PRIME64_2;
+	acc = rotl64 (acc, 31);
+	acc *= PRIME64_1;
+
+	return acc;
+}
+
+static uint64_t merge_round_64 (uint64_t acc, uint64_t val) {
+	acc ^= round_64 (0, val);
+	acc = acc * PRIME64_1 + PRIME64_4;
+
+	return acc;
+}
+
+void hash64_init (Hash64 *state, uint64_t seed) {
+	memset (state, 0, sizeof (Hash64));
+
+	state->seed = seed;
+	state->acc[0] = seed + PRIME64_1 + PRIME64_2;
+	state->acc[1] = seed + PRIME64_2;
+	state->acc[2] = seed;
+	state->acc[3] = seed - PRIME64_1;
+}
+
+static void hash64_stripe (Hash64 *state, const unsigned char *p) {
+	state->acc[0] = round_64 (state->acc[0], read_64 (p));
+	state->acc[1] = round_64 (state->acc[1], read_64 (p + 8));
+	state->acc[2] = round_64 (state->acc[2], read_64 (p + 16));
+	state->acc[3] = round_64 (state->acc[3], read_64 (p + 24));
+}
+
+void hash64_update (Hash64 *state, const void *data, size_t len) {
+	const unsigned char *p = (const unsigned char *) data;
+	size_t fill;
+
+	state->total += len;
+
+	if (state->buffered > 0) {
+		fill = 32 - state->buffered;
+		if (fill > len) fill = len;
+
+		memcpy (state->buffer + state->buffered, p, fill);
+		state->buffered += fill;
+		p += fill;
+		len -= fill;
+
+		if (state->buffered < 32) return;
+
+		hash64_stripe (state, state->buffer);
+		state->buffered = 0;
+	}
+
+	while (len >= 32) {
+		hash64_stripe (state, p);
+		p += 32;
+		len -= 32;
+	}
+
+	if (len > 0) {
+		memcpy (state->buffer, p, len);
+		state->buffered = len;
+	}
+}
+
+uint64_t hash64_final (Hash64 *state) {
+	const unsigned char *p, *end;
+	uint64_t h;
+
+	if (state->total >= 32) {
+		h = rotl64 (state->acc[0], 1) + rotl64 (state->acc[1], 7) + rotl64 (state->acc[2], 12) + rotl64 (state->acc[3], 18);
+		h = merge_round_64 (h, state->acc[0]);
+		h = merge_round_64 (h, state->acc[1]);
+		h = merge_round_64 (h, state->acc[2]);
+		h = merge_round_64 (h, state->acc[3]);
+	} else {
+		h = state->seed + PRIME64_5;
+	}
+
+	h += state->total;
+
+	p = state->buffer;
+	end = p + state->buffered;
+
+	while (p + 8 <= end) {
+		h ^= round_64 (0, read_64 (p));
+		h = rotl64 (h, 27) * PRIME64_1 + PRIME64_4;
+		p += 8;
+	}
+
+	if (p + 4 <= end) {
+		h ^= (uint64_t) read_32 (p) * PRIME64_1;
+		h = rotl64 (h, 23) * PRIME64_2 + PRIME64_3;
+		p += 4;
+	}
+
+	while (p < end) {
+		h ^= (*p) * PRIME64_5;
+		h = rotl64 (h, 11) * PRIME64_1;
+		p++;
+	}
+
+	h ^= h >> 33;
+	h *= PRIME64_2;
+	h ^= h >> 29;
+	h *= PRIME64_3;
+	h ^= h >> 32;
+
+	return h;
+}
+
+uint64_t hash64 (const void *data, size_t len, uint64_t seed) {
+	Hash64 state;
+
+	hash64_init (&state, seed);
+	hash64_update (&state, data, len);
+
+	return hash64_final (&state);
+}
@@ -0,0 +1,22 @@
+#ifndef __HASH_H__
+#define __HASH_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* XXH64 por partes, para archivos que no se quieren tener completos en memoria */
+typedef struct {
+	uint64_t total;
+	uint64_t acc[4];
+	unsigned char buffer[32];
+	int buffered;
+	uint64_t seed;
+} Hash64;
+
+void hash64_init (Hash64 *state, uint64_t seed);
+void hash64_update (Hash64 *state, const void *data, size_t len);
+uint64_t hash64_final (Hash64 *state);
+
+uint64_t hash64 (const void *data, size_t len, uint64_t seed);
+
+#endif /* __HASH_H__ */
@@ -0,0 +1,227 @@
+/*
+ * json.c
+ * This file is part of BKV Reader
+ *
+ * Copyright (C) 2022 - Félix Arreola Rodríguez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <math.h>
+#include <ctype.h>
+
+#include "json.h"
+
+void json_append (JsonBuffer *json, const char *format, ...) {
+	va_list ap;
+	int n;
+
+	while (1) {
+		va_start (ap, format);
+		n = vsnprintf (&json->data[json->len], json->size - json->len, format, ap);
+		va_end (ap);
+
+		if (n < 0) return;
+
+		if (json->len + n < json->size) {
+			json->len += n;
+			return;
+		}
+
+		json->size = (json->size + n + 1) * 2;
+		json->data = (char *) realloc (json->data, json->size);
+	}
+}
+
+void json_append_string (JsonBuffer *json, const char *str) {
+	const unsigned char *p;
+
+	json_append (json, "\"");
+	for (p = (const unsigned char *) str; p != NULL && *p != 0; p++) {
+		if (*p == '"' || *p == '\\') {
+			json_append (json, "\\%c", *p);
+		} else if (*p < 0x20) {
+			json_append (json, "\\u%04x", *p);
+		} else {
+			json_append (json, "%c", *p);
+		}
+	}
+	json_append (json, "\"");
+}
+
+void json_append_float (JsonBuffer *json, float f) {
+	char buffer[64];
+	char *p;
+
+	if (isnan (f) || isinf (f)) f = 0.0;
+
+	snprintf (buffer, sizeof (buffer), "%.9g", f);
+
+	/* gtk_init aplica el locale del usuario, y JSON siempre usa punto decimal */
+	for (p = buffer; *p != 0; p++) {
+		if (*p == ',') *p = '.';
+	}
+
+	json_append (json, "%s", buffer);
+}
+
+static const char *json_skip_space (const char *p) {
+	while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') p++;
+
+	return p;
+}
+
+/* Lee una cadena desde la comilla inicial; regresa dónde termina o NULL */
+static const char *json_parse_string (const char *p, char **value) {
+	JsonBuffer out;
+	unsigned int code;
+	int g;
+
+	memset (&out, 0, sizeof (out));
+	json_append (&out, "%s", "");
+
+	for (p++; *p != '"'; p++) {
+		if (*p == 0) {
+			free (out.data);
+			return NULL;
+		}
+
+		if (*p != '\\') {
+			json_append (&out, "%c", *p);
+			continue;
+		}
+
+		p++;
+		switch (*p) {
+			case 'n': json_append (&out, "\n"); break;
+			case 't': json_append (&out, "\t"); break;
+			case 'r': json_append (&out, "\r"); break;
+			case 'b': json_append (&out, "\b"); break;
+			case 'f': json_append (&out, "\f"); break;
+			case 'u':
+				/* Exactamente 4 dígitos; sscanf aceptaría menos y se saltaría el fin de la cadena */
+				for (g = 1; g <= 4; g++) {
+					if (!isxdigit ((unsigned char) p[g])) {
+						free (out.data);
+						return NULL;
+					}
+				}
+				sscanf (p + 1, "%4x", &code);
+				/* Las rutas que llegan aquí son UTF-8; solo se reconstruye el BMP */
+				if (code < 0x80) {
+					json_append (&out, "%c", code);
+				} else if (code < 0x800) {
+					json_append (&out, "%c%c", 0xC0 | (code >> 6), 0x80 | (code & 0x3F));
+				} else {
+					json_append (&out, "%c%c%c", 0xE0 | (code >> 12), 0x80 | ((code >> 6) & 0x3F), 0x80 | (code & 0x3F));
+				}
+				p += 4;
+				break;
+			case 0:
+				free (out.data);
+				return NULL;
+			default:
+				json_append (&out, "%c", *p);
+		}
+	}
+
+	if (value != NULL) {
+		*value = out.data;
+	} else {
+		free (out.data);
+	}
+
+	return p + 1;
+}
+
+/* Salta cualquier valor, incluyendo objetos y arreglos anidados */
+static const char *json_skip_value (const char *p, char **value) {
+	const char *start;
+	int depth;
+
+	p = json_skip_space (p);
+	if (*p == '"') {
+		return json_parse_string (p, value);
+	}
+
+	start = p;
+	depth = 0;
+	while (*p != 0) {
+		if (*p == '"') {
+			p = json_parse_string (p, NULL);
+			if (p == NULL) return NULL;
+			continue;
+		}
+
+		if (*p == '{' || *p == '[') {
+			depth++;
+		} else if (*p == '}' || *p == ']') {
+			if (depth == 0) break;
+			depth--;
+		} else if (*p == ',' && depth == 0) {
+			break;
+		}
+		p++;
+	}
+
+	if (value != NULL) {
+		while (p > start && (p[-1] == ' ' || p[-1] == '\t' || p[-1] == '\r' || p[-1] == '\n')) p--;
+
+		*value = (char *) malloc (p - start + 1);
+		memcpy (*value, start, p - start);
+		(*value)[p - start] = 0;
+	}
+
+	return p;
+}
+
+/* Busca un miembro del objeto de primer nivel. Las cadenas se regresan sin comillas ni escapes,
+ * los demás valores con su texto tal cual. NULL si no está */
+char *json_object_get (const char *json, const char *key) {
+	const char *p;
+	char *name, *value;
+
+	p = json_skip_space (json);
+	if (*p != '{') return NULL;
+	p++;
+
+	while (1) {
+		p = json_skip_space (p);
+		if (*p != '"') return NULL;
+
+		p = json_parse_string (p, &name);
+		if (p == NULL) return NULL;
+
+		p = json_skip_space (p);
+		if (*p != ':') {
+			free (name);
+			return NULL;
+		}
+
+		value = NULL;
+		p = json_skip_value (p + 1, (strcmp (name, key) == 0 ? &value : NULL));
+		free (name);
+
+		if (value != NULL) return value;
+		if (p == NULL) return NULL;
+
+		p = json_skip_space (p);
+		if (*p != ',') return NULL;
+		p++;
+	}
+}
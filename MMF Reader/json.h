@@ -0,0 +1,18 @@
+#ifndef __JSON_H__
+#define __JSON_H__
+
+#include <stddef.h>
+
+typedef struct {
+	char *data;
+	size_t len;
+	size_t size;
+} JsonBuffer;
+
+void json_append (JsonBuffer *json, const char *format, ...);
+void json_append_string (JsonBuffer *json, const char *str);
+void json_append_float (JsonBuffer *json, float f);
+
+char *json_object_get (const char *json, const char *key);
+
+#endif /* __JSON_H__ */
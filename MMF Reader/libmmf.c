@@ -0,0 +1,368 @@
+/*
+ * libmmf.c
+ * This file is part of BKV Reader
+ *
+ * Copyright (C) 2022 - Félix Arreola Rodríguez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "mmf.h"
+#include "libmmf.h"
+#include "loader.h"
+#include "arena.h"
+#include "log.h"
+#include "blend.h"
+#include "scene.h"
+#include "bundle.h"
+
+struct _MMFContext {
+	/* Todo lo del modelo abierto, incluyendo el DPACK leído, sale de aquí */
+	Arena *arena;
+
+	MMFModel model;
+	int loaded;
+
+	Preload pack;
+
+	/* Modelo compilado abierto; el modelo apunta a su mapeo */
+	Bundle bundle;
+};
+
+MMFContext *mmf_context_create (void) {
+	MMFContext *context;
+
+	context = (MMFContext *) malloc (sizeof (MMFContext));
+	memset (context, 0, sizeof (MMFContext));
+
+	context->arena = arena_new (0);
+
+	return context;
+}
+
+void mmf_context_destroy (MMFContext *context) {
+	if (context == NULL) return;
+
+	arena_destroy (context->arena);
+	free (context);
+}
+
+/* Nada se libera uno por uno: la siguiente apertura reusa la arena completa */
+void mmf_close (MMFContext *context) {
+	bundle_close (&context->bundle);
+	memset (&context->model, 0, sizeof (MMFModel));
+	memset (&context->pack, 0, sizeof (Preload));
+	context->loaded = 0;
+
+	arena_reset (context->arena);
+}
+
+static int mmf_context_load (MMFContext *context, const char *folder, Preload *preload) {
+	Arena *prev_arena;
+	Preload *prev_preload;
+	int g;
+
+	prev_arena = arena_get_current ();
+	prev_preload = preload_get_current ();
+	arena_set_current (context->arena);
+	preload_set_current (preload);
+
+	g = load_model (&context->model, (char *) folder);
+
+	preload_set_current (prev_preload);
+	arena_set_current (prev_arena);
+
+	context->loaded = (g == 0);
+
+	return g;
+}
+
+int mmf_open_folder (MMFContext *context, const char *folder) {
+	mmf_close (context);
+
+	return mmf_context_load (context, folder, NULL);
+}
+
+/* Lee el DPACK completo y lo parte en archivos virtuales "<dpack>/<nombre>", sin extraerlos */
+static int mmf_read_dpack (MMFContext *context, const char *dpack_path) {
+	struct stat st;
+	unsigned char *data, *p, *end;
+	char path[8192];
+	uint32_t magic, len;
+	uint16_t count, name_len;
+	uint32_t *lens;
+	size_t pos;
+	ssize_t r;
+	int fd, g;
+
+	fd = open (dpack_path, O_RDONLY
+#ifdef _WIN32
+	| _O_BINARY
+#endif
+	);
+
+	if (fd < 0) {
+		return -1;
+	}
+
+	if (fstat (fd, &st) < 0 || st.st_size < 6) {
+		close (fd);
+		return -1;
+	}
+
+	data = (unsigned char *) mmf_malloc (st.st_size);
+	pos = 0;
+	while (pos < (size_t) st.st_size) {
+		r = read (fd, data + pos, st.st_size - pos);
+		if (r <= 0) break;
+		pos += r;
+	}
+	close (fd);
+
+	if (pos < (size_t) st.st_size) {
+		return -1;
+	}
+
+	end = data + st.st_size;
+	memcpy (&magic, data, 4);
+	memcpy (&count, data + 4, 2);
+	p = data + 6;
+
+	if (magic != DPACK_MAGIC || p + 4 * (size_t) count > end) {
+		log_error ("Magic code failed\n");
+		return -1;
+	}
+
+	lens = (uint32_t *) mmf_malloc (sizeof (uint32_t) * (count + 1));
+	for (g = 0; g < count; g++) {
+		memcpy (&lens[g], p, 4);
+		p += 4;
+	}
+
+	/* Primero todos los nombres, luego los datos en el mismo orden */
+	preload_init (&context->pack);
+	for (g = 0; g < count; g++) {
+		if (p + 2 > end) return -1;
+		memcpy (&name_len, p, 2);
+		p += 2;
+
+		if (p + name_len > end) return -1;
+		snprintf (path, sizeof (path), "%s/%.*s", dpack_path, (int) name_len, (char *) p);
+		p += name_len;
+
+		preload_add (&context->pack, path);
+	}
+
+	for (g = 0; g < count; g++) {
+		len = lens[g];
+		if (len > (size_t) (end - p)) {
+			log_error ("DPACK truncated at %s\n", context->pack.files[g].path);
+			return -1;
+		}
+
+		context->pack.files[g].data = p;
+		context->pack.files[g].len = len;
+		context->pack.files[g].done = 1;
+		context->pack.files[g].borrowed = 1;
+		p += len;
+	}
+
+	return 0;
+}
+
+int mmf_open_dpack (MMFContext *context, const char *dpack_path) {
+	Arena *prev_arena;
+	int g;
+
+	mmf_close (context);
+
+	prev_arena = arena_get_current ();
+	arena_set_current (context->arena);
+	g = mmf_read_dpack (context, dpack_path);
+	arena_set_current (prev_arena);
+
+	if (g < 0) {
+		mmf_close (context);
+		return -1;
+	}
+
+	return mmf_context_load (context, dpack_path, &context->pack);
+}
+
+/* Un modelo compilado (.mmfb) no se decodifica: se mapea y se usa como está */
+int mmf_open_bundle (MMFContext *context, const char *bundle_path) {
+	Arena *prev_arena;
+	int g;
+
+	mmf_close (context);
+
+	prev_arena = arena_get_current ();
+	arena_set_current (context->arena);
+	g = bundle_open (&context->bundle, bundle_path, &context->model);
+	arena_set_current (prev_arena);
+
+	if (g < 0) {
+		mmf_close (context);
+		return -1;
+	}
+
+	context->loaded = 1;
+
+	return 0;
+}
+
+const MMFModel *mmf_get_model (MMFContext *context) {
+	return (context->loaded ? &context->model : NULL);
+}
+
+int mmf_get_mesh_count (MMFContext *context) {
+	return (context->loaded ? context->model.num_meshes : 0);
+}
+
+const MeshData *mmf_get_mesh (MMFContext *context, int mesh) {
+	if (mesh < 0 || mesh >= mmf_get_mesh_count (context)) return NULL;
+
+	return &context->model.mesh[mesh];
+}
+
+/* Una instancia devuelve los índices de su geometría */
+const uint32_t *mmf_get_indices (MMFContext *context, int mesh, int *count) {
+	const MeshData *m;
+
+	m = mmf_get_mesh (context, mesh);
+	if (m != NULL) m = mesh_geometry (context->model.mesh, context->model.num_meshes, mesh);
+	if (count != NULL) *count = (m != NULL ? m->num_index : 0);
+
+	return (m != NULL ? m->index : NULL);
+}
+
+int mmf_get_vertex_data_count (MMFContext *context) {
+	return (context->loaded ? context->model.num_vertex : 0);
+}
+
+const VertexData *mmf_get_vertex_data (MMFContext *context, int vertex_data) {
+	if (vertex_data < 0 || vertex_data >= mmf_get_vertex_data_count (context)) return NULL;
+
+	return &context->model.vertex[vertex_data];
+}
+
+/* NULL si el VertexData se quedó cuantizado; entonces están en "raw" */
+const float *mmf_get_vertices (MMFContext *context, int vertex_data, int *count) {
+	const VertexData *v;
+
+	v = mmf_get_vertex_data (context, vertex_data);
+	if (count != NULL) *count = (v != NULL && v->vertex != NULL ? v->num : 0);
+
+	return (v != NULL ? v->vertex : NULL);
+}
+
+int mmf_get_blend_shape_count (MMFContext *context) {
+	return (context->loaded ? context->model.num_shapes : 0);
+}
+
+const BlendShape *mmf_get_blend_shape (MMFContext *context, int shape) {
+	if (shape < 0 || shape >= mmf_get_blend_shape_count (context)) return NULL;
+
+	return &context->model.shapes[shape];
+}
+
+/* Vértices del VertexData con los blend shapes aplicados. weights lleva un peso por blend shape
+ * del modelo y out espacio para num flotantes del VertexData; sirve también si está cuantizado */
+int mmf_apply_blend_shapes (MMFContext *context, int vertex_data, const float *weights, float *out) {
+	const VertexData *v;
+
+	v = mmf_get_vertex_data (context, vertex_data);
+	if (v == NULL) return -1;
+
+	blend_shapes_apply ((VertexData *) v, vertex_data, context->model.shapes, context->model.num_shapes, weights, out);
+
+	return 0;
+}
+
+int mmf_get_material_count (MMFContext *context) {
+	return (context->loaded ? context->model.num_materials : 0);
+}
+
+/* MeshData.material es el índice que se pasa aquí, -1 si el mesh no tiene */
+const Material *mmf_get_material (MMFContext *context, int material) {
+	if (material < 0 || material >= mmf_get_material_count (context)) return NULL;
+
+	return &context->model.materials[material];
+}
+
+int mmf_get_bone_count (MMFContext *context) {
+	return (context->loaded ? context->model.desc.n_bones : 0);
+}
+
+const Bone *mmf_get_bone (MMFContext *context, int bone) {
+	if (bone < 0 || bone >= mmf_get_bone_count (context)) return NULL;
+
+	return &context->model.desc.bones[bone];
+}
+
+int mmf_get_transform_count (MMFContext *context) {
+	return (context->loaded ? context->model.desc.n_transforms : 0);
+}
+
+const Transform *mmf_get_transform (MMFContext *context, int transform) {
+	if (transform < 0 || transform >= mmf_get_transform_count (context)) return NULL;
+
+	return &context->model.desc.transforms[transform];
+}
+
+int mmf_get_node_count (MMFContext *context) {
+	return (context->loaded ? context->model.num_nodes : 0);
+}
+
+const SceneNode *mmf_get_node (MMFContext *context, int node) {
+	if (node < 0 || node >= mmf_get_node_count (context)) return NULL;
+
+	return &context->model.nodes[node];
+}
+
+int mmf_export (MMFContext *context, const char *file_path) {
+	Arena *prev_arena;
+	int g;
+
+	if (!context->loaded) return -1;
+
+	/* La exportación solo lee el modelo (también el mapeo de un modelo compilado);
+	 * lo que necesita aparte sale de la arena del contexto */
+	prev_arena = arena_get_current ();
+	arena_set_current (context->arena);
+
+	g = export_model (&context->model, file_path);
+
+	arena_set_current (prev_arena);
+
+	return g;
+}
+
+size_t mmf_context_get_capacity (MMFContext *context) {
+	return arena_get_capacity (context->arena);
+}
+
+int mmf_context_get_system_allocs (MMFContext *context) {
+	return arena_get_system_allocs (context->arena);
+}
@@ -0,0 +1,53 @@
+#ifndef __LIBMMF_H__
+#define __LIBMMF_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mmf.h"
+
+/* Un contexto guarda el modelo abierto y la memoria para leerlo. Al abrir otro modelo
+ * la memoria se reusa, así que los punteros del modelo anterior dejan de ser válidos.
+ * Un contexto se usa desde un solo hilo a la vez */
+typedef struct _MMFContext MMFContext;
+
+MMFContext *mmf_context_create (void);
+void mmf_context_destroy (MMFContext *context);
+
+int mmf_open_folder (MMFContext *context, const char *folder);
+int mmf_open_dpack (MMFContext *context, const char *dpack_path);
+int mmf_open_bundle (MMFContext *context, const char *bundle_path);
+void mmf_close (MMFContext *context);
+
+const MMFModel *mmf_get_model (MMFContext *context);
+
+int mmf_get_mesh_count (MMFContext *context);
+const MeshData *mmf_get_mesh (MMFContext *context, int mesh);
+const uint32_t *mmf_get_indices (MMFContext *context, int mesh, int *count);
+
+int mmf_get_vertex_data_count (MMFContext *context);
+const VertexData *mmf_get_vertex_data (MMFContext *context, int vertex_data);
+const float *mmf_get_vertices (MMFContext *context, int vertex_data, int *count);
+
+int mmf_get_blend_shape_count (MMFContext *context);
+const BlendShape *mmf_get_blend_shape (MMFContext *context, int shape);
+int mmf_apply_blend_shapes (MMFContext *context, int vertex_data, const float *weights, float *out);
+
+int mmf_get_material_count (MMFContext *context);
+const Material *mmf_get_material (MMFContext *context, int material);
+
+int mmf_get_bone_count (MMFContext *context);
+const Bone *mmf_get_bone (MMFContext *context, int bone);
+
+int mmf_get_transform_count (MMFContext *context);
+const Transform *mmf_get_transform (MMFContext *context, int transform);
+
+int mmf_get_node_count (MMFContext *context);
+const SceneNode *mmf_get_node (MMFContext *context, int node);
+
+int mmf_export (MMFContext *context, const char *file_path);
+
+size_t mmf_context_get_capacity (MMFContext *context);
+int mmf_context_get_system_allocs (MMFContext *context);
+
+#endif /* __LIBMMF_H__ */
@@ -0,0 +1,565 @@
+/*
+ * loader.c
+ * This file is part of BKV Reader
+ *
+ * Copyright (C) 2022 - Félix Arreola Rodríguez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#if defined (__linux__) && defined (__has_include)
+#if __has_include (<linux/io_uring.h>)
+#define HAVE_IO_URING 1
+#endif
+#endif
+
+#ifdef HAVE_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+#include "loader.h"
+#include "arena.h"
+#include "stats.h"
+
+/* Precarga del modelo que se está leyendo en este hilo */
+static __thread Preload *current_preload = NULL;
+
+/* Lee el archivo completo con una sola llamada; regresa 0 o el errno */
+static int read_whole_file (const char *path, unsigned char **data, size_t *len) {
+	struct stat st;
+	ssize_t r;
+	size_t pos;
+	int fd, calls;
+
+	*data = NULL;
+	*len = 0;
+
+	fd = open (path, O_RDONLY
+#ifdef _WIN32
+	| _O_BINARY
+#endif
+	);
+
+	if (fd < 0) {
+		r = errno;
+		STATS_IO (0, 1);
+		return r;
+	}
+
+	if (fstat (fd, &st) < 0) {
+		r = errno;
+		close (fd);
+		return r;
+	}
+
+	/* Nunca NULL, para distinguir un archivo vacío de uno que falta */
+	*data = (unsigned char *) mmf_malloc (st.st_size > 0 ? st.st_size : 1);
+	if (*data == NULL) {
+		close (fd);
+		return ENOMEM;
+	}
+
+	pos = 0;
+	calls = 3;
+	while (pos < (size_t) st.st_size) {
+		r = read (fd, *data + pos, st.st_size - pos);
+		calls++;
+		if (r < 0 && errno == EINTR) continue;
+		if (r <= 0) break;
+		pos += r;
+	}
+
+	close (fd);
+	*len = pos;
+
+	STATS_IO (pos, calls);
+
+	return 0;
+}
+
+void preload_init (Preload *preload) {
+	memset (preload, 0, sizeof (Preload));
+}
+
+void preload_add (Preload *preload, const char *path) {
+	PreloadFile *file;
+
+	if (preload->n_files == preload->size) {
+		preload->size = (preload->size == 0 ? 16 : preload->size * 2);
+		preload->files = (PreloadFile *) mmf_realloc (preload->files, sizeof (PreloadFile) * preload->size);
+	}
+
+	file = &preload->files[preload->n_files];
+	memset (file, 0, sizeof (PreloadFile));
+	file->path = mmf_strdup (path);
+
+	preload->n_files++;
+}
+
+static void preload_file_run (void *data) {
+	PreloadFile *file = (PreloadFile *) data;
+	Arena *prev_arena;
+	StatScope scope;
+
+	/* Un hilo que ayuda mientras espera puede tener la arena de otro modelo */
+	prev_arena = arena_get_current ();
+	arena_set_current (NULL);
+
+	stats_begin (&scope, STAT_PRELOAD);
+	file->error = read_whole_file (file->path, &file->data, &file->len);
+	file->done = 1;
+	stats_end (&scope, NULL, file->path, file->len);
+
+	arena_set_current (prev_arena);
+}
+
+#ifdef HAVE_IO_URING
+#define URING_ENTRIES 64
+
+/* Resultado de una entrada sin respuesta: no se llegó a enviar, o el envío falló antes */
+#define URING_NOT_RUN INT_MIN
+
+typedef struct {
+	int fd;
+
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+
+	void *sq_ptr, *cq_ptr;
+	size_t sq_size, cq_size, sqes_size;
+	unsigned entries;
+
+	/* Cola local: el kernel solo ve las entradas cuando se publica al enviar */
+	unsigned local_tail;
+} Uring;
+
+static int uring_setup (Uring *ring) {
+	struct io_uring_params params;
+
+	memset (ring, 0, sizeof (Uring));
+	memset (&params, 0, sizeof (params));
+
+	ring->fd = syscall (__NR_io_uring_setup, URING_ENTRIES, &params);
+	STATS_IO (0, 1);
+	if (ring->fd < 0) {
+		return -1;
+	}
+
+	ring->entries = params.sq_entries;
+	ring->sq_size = params.sq_off.array + params.sq_entries * sizeof (unsigned);
+	ring->cq_size = params.cq_off.cqes + params.cq_entries * sizeof (struct io_uring_cqe);
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cq_size > ring->sq_size) ring->sq_size = ring->cq_size;
+		ring->cq_size = 0;
+	}
+
+	ring->sq_ptr = mmap (NULL, ring->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (ring->sq_ptr == MAP_FAILED) {
+		close (ring->fd);
+		return -1;
+	}
+
+	if (ring->cq_size == 0) {
+		ring->cq_ptr = ring->sq_ptr;
+	} else {
+		ring->cq_ptr = mmap (NULL, ring->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+		if (ring->cq_ptr == MAP_FAILED) {
+			munmap (ring->sq_ptr, ring->sq_size);
+			close (ring->fd);
+			return -1;
+		}
+	}
+
+	ring->sqes_size = params.sq_entries * sizeof (struct io_uring_sqe);
+	ring->sqes = (struct io_uring_sqe *) mmap (NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		if (ring->cq_size != 0) munmap (ring->cq_ptr, ring->cq_size);
+		munmap (ring->sq_ptr, ring->sq_size);
+		close (ring->fd);
+		return -1;
+	}
+
+	ring->sq_head = (unsigned *) ((char *) ring->sq_ptr + params.sq_off.head);
+	ring->sq_tail = (unsigned *) ((char *) ring->sq_ptr + params.sq_off.tail);
+	ring->sq_mask = (unsigned *) ((char *) ring->sq_ptr + params.sq_off.ring_mask);
+	ring->sq_array = (unsigned *) ((char *) ring->sq_ptr + params.sq_off.array);
+
+	ring->cq_head = (unsigned *) ((char *) ring->cq_ptr + params.cq_off.head);
+	ring->cq_tail = (unsigned *) ((char *) ring->cq_ptr + params.cq_off.tail);
+	ring->cq_mask = (unsigned *) ((char *) ring->cq_ptr + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *) ((char *) ring->cq_ptr + params.cq_off.cqes);
+
+	ring->local_tail = *ring->sq_tail;
+
+	return 0;
+}
+
+static void uring_close (Uring *ring) {
+	munmap (ring->sqes, ring->sqes_size);
+	if (ring->cq_size != 0) munmap (ring->cq_ptr, ring->cq_size);
+	munmap (ring->sq_ptr, ring->sq_size);
+	close (ring->fd);
+}
+
+/* Siguiente entrada libre; hay lugar porque nunca se encolan más de "entries" a la vez.
+ * La cola del kernel no avanza aquí, el que llama todavía tiene que llenar la entrada */
+static struct io_uring_sqe *uring_get_sqe (Uring *ring) {
+	struct io_uring_sqe *sqe;
+	unsigned index;
+
+	index = ring->local_tail & *ring->sq_mask;
+	ring->local_tail++;
+
+	sqe = &ring->sqes[index];
+	memset (sqe, 0, sizeof (struct io_uring_sqe));
+	ring->sq_array[index] = index;
+
+	return sqe;
+}
+
+/* Envía lo encolado, espera todas las respuestas y guarda el resultado de cada una según su user_data.
+ * Si el envío falla todavía se esperan las que el kernel ya aceptó, porque escriben en memoria del
+ * que llama; las que no se enviaron se quedan con el URING_NOT_RUN que puso el que llama */
+static int uring_submit_and_wait (Uring *ring, int count, int *results) {
+	struct io_uring_cqe *cqe;
+	unsigned head;
+	int r, reaped, submitted, to_submit, pending, failed;
+
+	/* Todas las entradas ya están llenas, se publican de una vez */
+	__atomic_store_n (ring->sq_tail, ring->local_tail, __ATOMIC_RELEASE);
+
+	reaped = 0;
+	submitted = 0;
+	failed = 0;
+	while (reaped < (failed ? submitted : count)) {
+		/* Si el kernel acepta menos de las pedidas no espera, y las que faltan se vuelven a enviar */
+		to_submit = (failed ? 0 : count - submitted);
+		pending = (failed ? submitted : count) - reaped;
+		r = syscall (__NR_io_uring_enter, ring->fd, to_submit, pending, IORING_ENTER_GETEVENTS, NULL, 0);
+		STATS_IO (0, 1);
+		if (r < 0) {
+			if (errno == EINTR) continue;
+
+			/* Sin poder esperar ya no hay forma de saber cuándo terminan */
+			if (failed) break;
+			failed = 1;
+			continue;
+		}
+
+		if (to_submit > 0) {
+			if (r == 0) failed = 1;
+			submitted += r;
+		}
+
+		head = *ring->cq_head;
+		while (head != __atomic_load_n (ring->cq_tail, __ATOMIC_ACQUIRE)) {
+			cqe = &ring->cqes[head & *ring->cq_mask];
+			results[cqe->user_data] = cqe->res;
+			head++;
+			reaped++;
+		}
+		__atomic_store_n (ring->cq_head, head, __ATOMIC_RELEASE);
+	}
+
+	return (failed ? -1 : 0);
+}
+
+/* Dos viajes al kernel por bloque de archivos: abrir y statx juntos, y después todas las lecturas */
+static int preload_uring_chunk (Uring *ring, PreloadFile *files, int count) {
+	struct io_uring_sqe *sqe;
+	struct statx st[URING_ENTRIES / 2];
+	int fds[URING_ENTRIES];
+	int results[URING_ENTRIES];
+	int g, n, failed;
+	ssize_t r;
+	size_t size;
+
+	/* Abrir y pedir el tamaño de todos por ruta, sin esperar entre ellos */
+	for (g = 0; g < count; g++) {
+		sqe = uring_get_sqe (ring);
+		sqe->opcode = IORING_OP_OPENAT;
+		sqe->fd = AT_FDCWD;
+		sqe->addr = (unsigned long) files[g].path;
+		sqe->open_flags = O_RDONLY;
+		sqe->user_data = g;
+
+		sqe = uring_get_sqe (ring);
+		sqe->opcode = IORING_OP_STATX;
+		sqe->fd = AT_FDCWD;
+		sqe->addr = (unsigned long) files[g].path;
+		sqe->len = STATX_SIZE;
+		sqe->off = (unsigned long) &st[g];
+		sqe->user_data = count + g;
+	}
+
+	for (g = 0; g < count * 2; g++) {
+		results[g] = URING_NOT_RUN;
+	}
+
+	if (uring_submit_and_wait (ring, count * 2, results) < 0) {
+		/* Todo el bloque queda para los hilos, sin los archivos que sí se alcanzaron a abrir */
+		for (g = 0; g < count; g++) {
+			if (results[g] >= 0) close (results[g]);
+		}
+		return -1;
+	}
+
+	for (g = 0; g < count; g++) {
+		fds[g] = results[g];
+
+		if (results[g] == -EINVAL || results[count + g] == -EINVAL) {
+			/* Kernel sin soporte de la operación, se queda pendiente para los hilos */
+			if (fds[g] >= 0) close (fds[g]);
+			fds[g] = -1;
+		} else if (fds[g] < 0 || results[count + g] < 0) {
+			if (fds[g] >= 0) close (fds[g]);
+			files[g].error = (fds[g] < 0 ? -fds[g] : -results[count + g]);
+			files[g].done = 1;
+			fds[g] = -1;
+		}
+	}
+
+	n = 0;
+	for (g = 0; g < count; g++) {
+		if (fds[g] < 0) continue;
+
+		size = st[g].stx_size;
+		files[g].data = (unsigned char *) mmf_malloc (size > 0 ? size : 1);
+		files[g].len = size;
+
+		sqe = uring_get_sqe (ring);
+		sqe->opcode = IORING_OP_READ;
+		sqe->fd = fds[g];
+		sqe->addr = (unsigned long) files[g].data;
+		sqe->len = size;
+		sqe->off = 0;
+		sqe->user_data = g;
+		n++;
+	}
+
+	for (g = 0; g < count; g++) {
+		results[g] = URING_NOT_RUN;
+	}
+
+	/* Aunque falle, las lecturas que terminaron sirven; el resto se lee con los hilos */
+	failed = (n > 0 && uring_submit_and_wait (ring, n, results) < 0);
+
+	for (g = 0; g < count; g++) {
+		if (fds[g] < 0) continue;
+
+		if (results[g] == URING_NOT_RUN || results[g] == -EINVAL) {
+			/* No se envió o el kernel no la admite, se vuelve a leer por la vía normal */
+			mmf_free (files[g].data);
+			files[g].data = NULL;
+			files[g].len = 0;
+		} else if (results[g] < 0) {
+			mmf_free (files[g].data);
+			files[g].data = NULL;
+			files[g].len = 0;
+			files[g].error = -results[g];
+			files[g].done = 1;
+		} else {
+			/* Una lectura corta se completa aquí */
+			size = results[g];
+			while (size < files[g].len) {
+				r = pread (fds[g], files[g].data + size, files[g].len - size, size);
+				STATS_IO (0, 1);
+				if (r < 0 && errno == EINTR) continue;
+				if (r <= 0) break;
+				size += r;
+			}
+			files[g].len = size;
+			files[g].done = 1;
+			STATS_IO (size, 0);
+		}
+
+		close (fds[g]);
+		STATS_IO (0, 1);
+	}
+
+	return (failed ? -1 : 0);
+}
+
+static int preload_uring (Preload *preload) {
+	Uring ring;
+	int g, count;
+
+	if (uring_setup (&ring) < 0) {
+		return -1;
+	}
+
+	/* Cada archivo ocupa dos entradas en la primera fase */
+	for (g = 0; g < preload->n_files; g += count) {
+		count = preload->n_files - g;
+		if (count > (int) ring.entries / 2) count = ring.entries / 2;
+		if (count > URING_ENTRIES / 2) count = URING_ENTRIES / 2;
+
+		/* Si el anillo falla, lo que falte se lee con los hilos */
+		if (preload_uring_chunk (&ring, &preload->files[g], count) < 0) break;
+	}
+
+	uring_close (&ring);
+
+	return 0;
+}
+#endif
+
+/* Lee todos los archivos de la precarga. Con PRELOAD_AUTO se intenta io_uring y lo que no
+ * se pudo leer así se reparte en el pool, o se lee en serie si no hay pool */
+int preload_run (Preload *preload, int method, ThreadPool *pool) {
+	TaskGroup group;
+	StatScope scope;
+	int g, used;
+
+	used = PRELOAD_THREADS;
+
+#ifdef HAVE_IO_URING
+	if (method == PRELOAD_AUTO) {
+		stats_begin (&scope, STAT_PRELOAD);
+		if (preload_uring (preload) == 0) {
+			used = PRELOAD_AUTO;
+		}
+		stats_end (&scope, NULL, NULL, preload->n_files);
+	}
+#endif
+
+	pool_group_init (&group);
+	for (g = 0; g < preload->n_files; g++) {
+		if (preload->files[g].done) continue;
+
+		if (pool != NULL) {
+			pool_submit (pool, &group, preload_file_run, &preload->files[g]);
+		} else {
+			preload_file_run (&preload->files[g]);
+		}
+	}
+
+	if (pool != NULL) {
+		pool_wait (pool, &group);
+	}
+
+	return used;
+}
+
+void preload_free (Preload *preload) {
+	int g;
+
+	for (g = 0; g < preload->n_files; g++) {
+		mmf_free (preload->files[g].path);
+		if (!preload->files[g].borrowed) mmf_free (preload->files[g].data);
+	}
+
+	mmf_free (preload->files);
+	memset (preload, 0, sizeof (Preload));
+}
+
+void preload_set_current (Preload *preload) {
+	current_preload = preload;
+}
+
+Preload *preload_get_current (void) {
+	return current_preload;
+}
+
+static PreloadFile *preload_find (Preload *preload, const char *path) {
+	int g;
+
+	for (g = 0; g < preload->n_files; g++) {
+		if (strcmp (preload->files[g].path, path) == 0) {
+			return &preload->files[g];
+		}
+	}
+
+	return NULL;
+}
+
+int stream_open (MMFStream *stream, const char *path) {
+	PreloadFile *file;
+
+	memset (stream, 0, sizeof (MMFStream));
+
+	file = NULL;
+	if (current_preload != NULL) {
+		file = preload_find (current_preload, path);
+	}
+
+	if (file != NULL && file->done) {
+		/* El buffer pertenece a la precarga */
+		if (file->error != 0) {
+			errno = file->error;
+			return -1;
+		}
+
+		stream->data = file->data;
+		stream->len = file->len;
+
+		return 0;
+	}
+
+	errno = read_whole_file (path, &stream->data, &stream->len);
+	if (errno != 0) {
+		return -1;
+	}
+	stream->owned = 1;
+
+	return 0;
+}
+
+int stream_read (MMFStream *stream, void *buffer, int bytes) {
+	size_t left;
+
+	if (bytes <= 0) return 0;
+
+	left = stream->len - stream->pos;
+	if ((size_t) bytes > left) bytes = left;
+
+	memcpy (buffer, stream->data + stream->pos, bytes);
+	stream->pos += bytes;
+
+	return bytes;
+}
+
+size_t stream_size (MMFStream *stream) {
+	return stream->len;
+}
+
+void stream_seek (MMFStream *stream, size_t pos) {
+	stream->pos = (pos > stream->len ? stream->len : pos);
+}
+
+void stream_close (MMFStream *stream) {
+	if (stream->owned) mmf_free (stream->data);
+
+	memset (stream, 0, sizeof (MMFStream));
+}
@@ -0,0 +1,55 @@
+#ifndef __LOADER_H__
+#define __LOADER_H__
+
+#include <stddef.h>
+
+#include "pool.h"
+
+typedef struct {
+	char *path;
+	unsigned char *data;
+	size_t len;
+
+	/* 0 o el errno de la lectura */
+	int error;
+	int done;
+
+	/* Los datos son de otro (el DPACK completo), no se liberan con la precarga */
+	int borrowed;
+} PreloadFile;
+
+typedef struct {
+	PreloadFile *files;
+	int n_files;
+	int size;
+} Preload;
+
+enum {
+	PRELOAD_NONE = 0,
+	PRELOAD_AUTO,
+	PRELOAD_THREADS
+};
+
+/* Archivo leído completo en memoria, de la precarga o con una sola lectura */
+typedef struct {
+	unsigned char *data;
+	size_t len;
+	size_t pos;
+	int owned;
+} MMFStream;
+
+void preload_init (Preload *preload);
+void preload_add (Preload *preload, const char *path);
+int preload_run (Preload *preload, int method, ThreadPool *pool);
+void preload_free (Preload *preload);
+
+void preload_set_current (Preload *preload);
+Preload *preload_get_current (void);
+
+int stream_open (MMFStream *stream, const char *path);
+int stream_read (MMFStream *stream, void *buffer, int bytes);
+size_t stream_size (MMFStream *stream);
+void stream_seek (MMFStream *stream, size_t pos);
+void stream_close (MMFStream *stream);
+
+#endif /* __LOADER_H__ */
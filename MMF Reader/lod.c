@@ -0,0 +1,662 @@
+/*
+ * lod.c
+ * This file is part of BKV Reader
+ *
+ * Copyright (C) 2022 - Félix Arreola Rodríguez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "mmf.h"
+#include "pool.h"
+#include "arena.h"
+#include "bounds.h"
+#include "optimize.h"
+#include "lod.h"
+
+#define LOD_NONE 0xFFFFFFFF
+
+/* Peso de los planos que sujetan los bordes abiertos, frente al de las caras */
+#define LOD_BORDER_WEIGHT 10.0
+
+/* Coseno mínimo entre la normal de un triángulo antes y después de mover su vértice */
+#define LOD_FLIP_COS 0.2f
+
+/* Matriz simétrica de 4x4: xx xy xz xw yy yz yw zz zw ww */
+typedef struct {
+	double q[10];
+} Quadric;
+
+/* Mover el vértice from encima de to */
+typedef struct {
+	float cost;
+	uint32_t from, to;
+
+	/* Versiones de los dos vértices al calcular el costo */
+	uint32_t stamp_from, stamp_to;
+
+	/* 1 si es la dirección contraria de una que no se pudo */
+	int reverse;
+} LodCollapse;
+
+typedef struct {
+	float *pos;
+	uint32_t n_verts;
+
+	uint32_t *tris;
+	uint8_t *dead;
+	uint32_t n_tris, alive;
+
+	/* Esquinas (tri * 3 + k) de cada vértice como lista ligada */
+	uint32_t *head;
+	uint32_t *next;
+
+	Quadric *quadric;
+	uint8_t *removed;
+	uint32_t *stamp;
+
+	/* Marcas para no repetir vecinos, válidas solo con el gen actual */
+	uint32_t *mark;
+	uint32_t gen;
+
+	LodCollapse *heap;
+	int heap_len, heap_size;
+} LodMesh;
+
+typedef struct {
+	VertexData *vertex;
+	int num_vertex;
+	MeshData *mesh;
+	int index;
+
+	int levels;
+	float ratio;
+	MeshLod *lods;
+
+	Arena *arena;
+} LodTask;
+
+static void quadric_add_plane (Quadric *quadric, const double *n, double d, double w) {
+	double *q = quadric->q;
+
+	q[0] += w * n[0] * n[0];
+	q[1] += w * n[0] * n[1];
+	q[2] += w * n[0] * n[2];
+	q[3] += w * n[0] * d;
+	q[4] += w * n[1] * n[1];
+	q[5] += w * n[1] * n[2];
+	q[6] += w * n[1] * d;
+	q[7] += w * n[2] * n[2];
+	q[8] += w * n[2] * d;
+	q[9] += w * d * d;
+}
+
+/* Error de a + b en el punto p */
+static double quadric_eval (const Quadric *a, const Quadric *b, const float *p) {
+	double q[10], x, y, z;
+	int h;
+
+	for (h = 0; h < 10; h++) {
+		q[h] = a->q[h] + b->q[h];
+	}
+
+	x = p[0];
+	y = p[1];
+	z = p[2];
+
+	return q[0] * x * x + 2 * q[1] * x * y + 2 * q[2] * x * z + 2 * q[3] * x
+	     + q[4] * y * y + 2 * q[5] * y * z + 2 * q[6] * y
+	     + q[7] * z * z + 2 * q[8] * z
+	     + q[9];
+}
+
+/* Normal sin normalizar; su longitud es el doble del área */
+static void triangle_normal (const float *a, const float *b, const float *c, double *n) {
+	double e1[3], e2[3];
+	int h;
+
+	for (h = 0; h < 3; h++) {
+		e1[h] = (double) b[h] - a[h];
+		e2[h] = (double) c[h] - a[h];
+	}
+
+	n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+	n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+	n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+}
+
+/* Empates por número de vértice, para que el resultado sea siempre el mismo */
+static int collapse_less (const LodCollapse *a, const LodCollapse *b) {
+	if (a->cost != b->cost) return a->cost < b->cost;
+	if (a->from != b->from) return a->from < b->from;
+	return a->to < b->to;
+}
+
+static void heap_push (LodMesh *m, const LodCollapse *collapse) {
+	LodCollapse tmp;
+	int pos, parent;
+
+	if (m->heap_len == m->heap_size) {
+		m->heap_size = m->heap_size * 2 + 64;
+		m->heap = (LodCollapse *) mmf_realloc (m->heap, sizeof (LodCollapse) * m->heap_size);
+	}
+
+	pos = m->heap_len++;
+	m->heap[pos] = *collapse;
+	while (pos > 0) {
+		parent = (pos - 1) / 2;
+		if (!collapse_less (&m->heap[pos], &m->heap[parent])) break;
+
+		tmp = m->heap[pos];
+		m->heap[pos] = m->heap[parent];
+		m->heap[parent] = tmp;
+		pos = parent;
+	}
+}
+
+static int heap_pop (LodMesh *m, LodCollapse *collapse) {
+	LodCollapse tmp;
+	int pos, child;
+
+	if (m->heap_len == 0) return 0;
+
+	*collapse = m->heap[0];
+	m->heap_len--;
+	m->heap[0] = m->heap[m->heap_len];
+
+	pos = 0;
+	while (1) {
+		child = pos * 2 + 1;
+		if (child >= m->heap_len) break;
+		if (child + 1 < m->heap_len && collapse_less (&m->heap[child + 1], &m->heap[child])) child++;
+		if (!collapse_less (&m->heap[child], &m->heap[pos])) break;
+
+		tmp = m->heap[pos];
+		m->heap[pos] = m->heap[child];
+		m->heap[child] = tmp;
+		pos = child;
+	}
+
+	return 1;
+}
+
+static void lod_push_collapse (LodMesh *m, uint32_t from, uint32_t to, double cost, int reverse) {
+	LodCollapse collapse;
+
+	collapse.cost = (float) (cost > 0 ? cost : 0);
+	collapse.from = from;
+	collapse.to = to;
+	collapse.stamp_from = m->stamp[from];
+	collapse.stamp_to = m->stamp[to];
+	collapse.reverse = reverse;
+	heap_push (m, &collapse);
+}
+
+/* Solo entra la dirección más barata de la arista; la otra se prueba si esta no se puede */
+static void lod_push_edge (LodMesh *m, uint32_t a, uint32_t b) {
+	double cost_ab, cost_ba;
+
+	cost_ab = quadric_eval (&m->quadric[a], &m->quadric[b], &m->pos[b * 3]);
+	cost_ba = quadric_eval (&m->quadric[a], &m->quadric[b], &m->pos[a * 3]);
+
+	if (cost_ab < cost_ba || (cost_ab == cost_ba && a < b)) {
+		lod_push_collapse (m, a, b, cost_ab, 0);
+	} else {
+		lod_push_collapse (m, b, a, cost_ba, 0);
+	}
+}
+
+/* Las aristas de v, una vez por vecino. Con only_greater solo hacia vecinos mayores,
+ * para la carga inicial donde cada arista se ve desde sus dos extremos */
+static void lod_push_vertex (LodMesh *m, uint32_t v, int only_greater) {
+	uint32_t c, t, n;
+	int k;
+
+	m->gen += 2;
+	for (c = m->head[v]; c != LOD_NONE; c = m->next[c]) {
+		t = c / 3;
+		if (m->dead[t]) continue;
+
+		for (k = 1; k < 3; k++) {
+			n = m->tris[t * 3 + (c % 3 + k) % 3];
+			if (m->mark[n] == m->gen || (only_greater && n < v)) continue;
+
+			m->mark[n] = m->gen;
+			lod_push_edge (m, v, n);
+		}
+	}
+}
+
+/* Mover from a to no debe voltear ni aplastar triángulos, ni dejar
+ * una arista compartida por más de dos caras */
+static int lod_collapse_valid (LodMesh *m, uint32_t from, uint32_t to) {
+	uint32_t c, t, v, shared, edge_tris;
+	uint32_t *tri;
+	double n_old[3], n_new[3], dot, len_old, len_new;
+	const float *p[3];
+	int k;
+
+	m->gen += 2;
+	edge_tris = 0;
+	for (c = m->head[from]; c != LOD_NONE; c = m->next[c]) {
+		t = c / 3;
+		if (m->dead[t]) continue;
+
+		tri = &m->tris[t * 3];
+		for (k = 0; k < 3; k++) {
+			if (tri[k] != from) m->mark[tri[k]] = m->gen;
+		}
+
+		if (tri[0] == to || tri[1] == to || tri[2] == to) {
+			edge_tris++;
+			continue;
+		}
+
+		for (k = 0; k < 3; k++) {
+			p[k] = &m->pos[tri[k] * 3];
+		}
+		triangle_normal (p[0], p[1], p[2], n_old);
+
+		p[c % 3] = &m->pos[to * 3];
+		triangle_normal (p[0], p[1], p[2], n_new);
+
+		dot = n_old[0] * n_new[0] + n_old[1] * n_new[1] + n_old[2] * n_new[2];
+		len_old = sqrt (n_old[0] * n_old[0] + n_old[1] * n_old[1] + n_old[2] * n_old[2]);
+		len_new = sqrt (n_new[0] * n_new[0] + n_new[1] * n_new[1] + n_new[2] * n_new[2]);
+		if (len_new <= 0 || dot <= LOD_FLIP_COS * len_old * len_new) return 0;
+	}
+
+	/* Los vecinos comunes deben ser solo los terceros vértices de las caras de la arista */
+	shared = 0;
+	for (c = m->head[to]; c != LOD_NONE; c = m->next[c]) {
+		t = c / 3;
+		if (m->dead[t]) continue;
+
+		for (k = 1; k < 3; k++) {
+			v = m->tris[t * 3 + (c % 3 + k) % 3];
+			if (v != from && m->mark[v] == m->gen) {
+				m->mark[v] = m->gen + 1;
+				shared++;
+			}
+		}
+	}
+
+	return shared == edge_tris;
+}
+
+static void lod_collapse (LodMesh *m, uint32_t from, uint32_t to) {
+	uint32_t c, t, last, prev, next;
+	uint32_t *tri;
+	int h;
+
+	/* Las esquinas de from pasan a to; los triángulos que tenían a los dos desaparecen */
+	last = LOD_NONE;
+	for (c = m->head[from]; c != LOD_NONE; c = m->next[c]) {
+		last = c;
+		t = c / 3;
+		if (m->dead[t]) continue;
+
+		tri = &m->tris[t * 3];
+		if (tri[0] == to || tri[1] == to || tri[2] == to) {
+			m->dead[t] = 1;
+			m->alive--;
+		} else {
+			m->tris[c] = to;
+		}
+	}
+
+	if (last != LOD_NONE) {
+		m->next[last] = m->head[to];
+		m->head[to] = m->head[from];
+	}
+	m->head[from] = LOD_NONE;
+
+	/* Sacar de la lista de to las esquinas de triángulos muertos */
+	prev = LOD_NONE;
+	for (c = m->head[to]; c != LOD_NONE; c = next) {
+		next = m->next[c];
+		if (!m->dead[c / 3]) {
+			prev = c;
+		} else if (prev == LOD_NONE) {
+			m->head[to] = next;
+		} else {
+			m->next[prev] = next;
+		}
+	}
+
+	for (h = 0; h < 10; h++) {
+		m->quadric[to].q[h] += m->quadric[from].q[h];
+	}
+	m->removed[from] = 1;
+	m->stamp[to]++;
+
+	lod_push_vertex (m, to, 0);
+}
+
+/* Cuádricas de las caras, pesadas por su área, y de los bordes abiertos */
+static void lod_init_quadrics (LodMesh *m) {
+	uint32_t t, c, u, v, count;
+	uint32_t *tri;
+	double n[3], edge[3], plane[3], len;
+	int k, h;
+
+	memset (m->quadric, 0, sizeof (Quadric) * m->n_verts);
+
+	for (t = 0; t < m->n_tris; t++) {
+		tri = &m->tris[t * 3];
+		triangle_normal (&m->pos[tri[0] * 3], &m->pos[tri[1] * 3], &m->pos[tri[2] * 3], n);
+		len = sqrt (n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+		if (len <= 0) continue;
+
+		for (h = 0; h < 3; h++) {
+			n[h] /= len;
+		}
+
+		for (k = 0; k < 3; k++) {
+			quadric_add_plane (&m->quadric[tri[k]], n, -(n[0] * m->pos[tri[0] * 3] + n[1] * m->pos[tri[0] * 3 + 1] + n[2] * m->pos[tri[0] * 3 + 2]), len * 0.5);
+		}
+
+		/* Una arista que solo usa este triángulo es borde: un plano perpendicular a la cara la sujeta */
+		for (k = 0; k < 3; k++) {
+			u = tri[k];
+			v = tri[(k + 1) % 3];
+
+			count = 0;
+			for (c = m->head[u]; c != LOD_NONE; c = m->next[c]) {
+				if (m->tris[(c / 3) * 3] == v || m->tris[(c / 3) * 3 + 1] == v || m->tris[(c / 3) * 3 + 2] == v) count++;
+			}
+			if (count != 1) continue;
+
+			for (h = 0; h < 3; h++) {
+				edge[h] = (double) m->pos[v * 3 + h] - m->pos[u * 3 + h];
+			}
+
+			plane[0] = edge[1] * n[2] - edge[2] * n[1];
+			plane[1] = edge[2] * n[0] - edge[0] * n[2];
+			plane[2] = edge[0] * n[1] - edge[1] * n[0];
+			len = sqrt (plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+			if (len <= 0) continue;
+
+			for (h = 0; h < 3; h++) {
+				plane[h] /= len;
+			}
+
+			len = -(plane[0] * m->pos[u * 3] + plane[1] * m->pos[u * 3 + 1] + plane[2] * m->pos[u * 3 + 2]);
+			quadric_add_plane (&m->quadric[u], plane, len, (edge[0] * edge[0] + edge[1] * edge[1] + edge[2] * edge[2]) * LOD_BORDER_WEIGHT);
+			quadric_add_plane (&m->quadric[v], plane, len, (edge[0] * edge[0] + edge[1] * edge[1] + edge[2] * edge[2]) * LOD_BORDER_WEIGHT);
+		}
+	}
+}
+
+/* Simplifica un mesh hasta target triángulos colapsando aristas sobre uno de sus extremos,
+ * así los vértices que quedan son los originales. El resultado lleva su propio VertexData
+ * con solo los vértices que usa, en el mismo formato que el de entrada */
+static void lod_simplify (VertexData *src, MeshData *src_mesh, uint32_t target, VertexData *out_vertex, MeshData *out_mesh, int id) {
+	LodMesh m;
+	LodCollapse collapse;
+	uint32_t *local, *order, *renum, *out_order;
+	uint32_t count, t, v, used, idx[3];
+	unsigned char *from, *to;
+	size_t elem;
+	int g, k;
+
+	memcpy (out_mesh, src_mesh, sizeof (MeshData));
+	out_mesh->index = NULL;
+	out_mesh->num_index = 0;
+	out_mesh->vertex_data_id = -1;
+	memset (out_vertex, 0, sizeof (VertexData));
+
+	if (src == NULL || src_mesh->index == NULL || src_mesh->num_index < 3 || (src->vertex == NULL && src->raw == NULL)) return;
+
+	memset (&m, 0, sizeof (m));
+	count = src->num / 3;
+
+	/* Numeración local, solo con los vértices del mesh */
+	local = (uint32_t *) mmf_malloc (sizeof (uint32_t) * (count + 1));
+	memset (local, 0xFF, sizeof (uint32_t) * (count + 1));
+	order = (uint32_t *) mmf_malloc (sizeof (uint32_t) * (src_mesh->num_index + 1));
+	m.tris = (uint32_t *) mmf_malloc (sizeof (uint32_t) * (src_mesh->num_index + 1));
+
+	for (g = 0; g + 2 < src_mesh->num_index; g = g + 3) {
+		for (k = 0; k < 3; k++) {
+			idx[k] = src_mesh->index[g + k];
+		}
+
+		/* Los triángulos fuera de rango o degenerados no se conservan */
+		if (idx[0] >= count || idx[1] >= count || idx[2] >= count) continue;
+		if (idx[0] == idx[1] || idx[1] == idx[2] || idx[0] == idx[2]) continue;
+
+		for (k = 0; k < 3; k++) {
+			if (local[idx[k]] == LOD_NONE) {
+				local[idx[k]] = m.n_verts;
+				order[m.n_verts] = idx[k];
+				m.n_verts++;
+			}
+			m.tris[m.n_tris * 3 + k] = local[idx[k]];
+		}
+		m.n_tris++;
+	}
+	mmf_free (local);
+	m.alive = m.n_tris;
+
+	m.pos = (float *) mmf_malloc (sizeof (float) * 3 * (m.n_verts + 1));
+	for (v = 0; v < m.n_verts; v++) {
+		vertex_data_position (src, order[v], &m.pos[v * 3]);
+	}
+
+	m.dead = (uint8_t *) mmf_malloc (m.n_tris + 1);
+	memset (m.dead, 0, m.n_tris + 1);
+	m.head = (uint32_t *) mmf_malloc (sizeof (uint32_t) * (m.n_verts + 1));
+	memset (m.head, 0xFF, sizeof (uint32_t) * (m.n_verts + 1));
+	m.next = (uint32_t *) mmf_malloc (sizeof (uint32_t) * (m.n_tris * 3 + 1));
+	m.quadric = (Quadric *) mmf_malloc (sizeof (Quadric) * (m.n_verts + 1));
+	m.removed = (uint8_t *) mmf_malloc (m.n_verts + 1);
+	memset (m.removed, 0, m.n_verts + 1);
+	m.stamp = (uint32_t *) mmf_malloc (sizeof (uint32_t) * (m.n_verts + 1));
+	memset (m.stamp, 0, sizeof (uint32_t) * (m.n_verts + 1));
+	m.mark = (uint32_t *) mmf_malloc (sizeof (uint32_t) * (m.n_verts + 1));
+	memset (m.mark, 0, sizeof (uint32_t) * (m.n_verts + 1));
+
+	for (t = 0; t < m.n_tris * 3; t++) {
+		m.next[t] = m.head[m.tris[t]];
+		m.head[m.tris[t]] = t;
+	}
+
+	lod_init_quadrics (&m);
+
+	for (v = 0; v < m.n_verts; v++) {
+		lod_push_vertex (&m, v, 1);
+	}
+
+	/* Siempre el colapso más barato; los que quedaron viejos se descartan al salir */
+	while (m.alive > target && heap_pop (&m, &collapse)) {
+		if (m.removed[collapse.from] || m.removed[collapse.to]) continue;
+		if (m.stamp[collapse.from] != collapse.stamp_from || m.stamp[collapse.to] != collapse.stamp_to) continue;
+		if (!lod_collapse_valid (&m, collapse.from, collapse.to)) {
+			/* La dirección contraria vuelve a la fila con su propio costo */
+			if (!collapse.reverse) {
+				lod_push_collapse (&m, collapse.to, collapse.from, quadric_eval (&m.quadric[collapse.from], &m.quadric[collapse.to], &m.pos[collapse.from * 3]), 1);
+			}
+			continue;
+		}
+
+		lod_collapse (&m, collapse.from, collapse.to);
+	}
+
+	/* Los triángulos que quedan, en su orden original, con los vértices en orden de primera aparición */
+	renum = (uint32_t *) mmf_malloc (sizeof (uint32_t) * (m.n_verts + 1));
+	memset (renum, 0xFF, sizeof (uint32_t) * (m.n_verts + 1));
+	out_order = (uint32_t *) mmf_malloc (sizeof (uint32_t) * (m.n_verts + 1));
+	out_mesh->index = (uint32_t *) mmf_malloc (sizeof (uint32_t) * (m.alive * 3 + 1));
+
+	used = 0;
+	for (t = 0; t < m.n_tris; t++) {
+		if (m.dead[t]) continue;
+
+		for (k = 0; k < 3; k++) {
+			v = m.tris[t * 3 + k];
+			if (renum[v] == LOD_NONE) {
+				renum[v] = used;
+				out_order[used] = order[v];
+				used++;
+			}
+			out_mesh->index[out_mesh->num_index++] = renum[v];
+		}
+	}
+
+	out_mesh->vertex_data_id = id;
+	out_vertex->num = used * 3;
+	out_vertex->encoding = src->encoding;
+	out_vertex->scale = src->scale;
+
+	elem = vertex_element_size (src);
+	to = (unsigned char *) mmf_malloc (elem * used + 1);
+	if (src->raw != NULL) {
+		out_vertex->raw = to;
+	} else {
+		out_vertex->vertex = (float *) to;
+	}
+
+	from = vertex_bytes (src);
+	for (v = 0; v < used; v++) {
+		memcpy (&to[v * elem], &from[out_order[v] * elem], elem);
+	}
+
+	vertex_data_bounds (out_vertex);
+
+	mmf_free (out_order);
+	mmf_free (renum);
+	mmf_free (m.heap);
+	mmf_free (m.mark);
+	mmf_free (m.stamp);
+	mmf_free (m.removed);
+	mmf_free (m.quadric);
+	mmf_free (m.next);
+	mmf_free (m.head);
+	mmf_free (m.dead);
+	mmf_free (m.pos);
+	mmf_free (m.tris);
+	mmf_free (order);
+}
+
+/* Toda la cadena de un mesh: cada nivel sale del anterior */
+static void lod_task_run (void *data) {
+	LodTask *task = (LodTask *) data;
+	VertexData *src;
+	MeshData *src_mesh;
+	Arena *prev_arena;
+	uint32_t tris, target;
+	int level;
+
+	prev_arena = arena_get_current ();
+	arena_set_current (task->arena);
+
+	src_mesh = task->mesh;
+	src = NULL;
+	if (src_mesh->vertex_data_id >= 0 && src_mesh->vertex_data_id < task->num_vertex) {
+		src = &task->vertex[src_mesh->vertex_data_id];
+	}
+
+	tris = (src_mesh->index != NULL && src_mesh->num_index > 0 ? src_mesh->num_index / 3 : 0);
+	for (level = 0; level < task->levels; level++) {
+		target = (uint32_t) (tris * pow (task->ratio, level + 1));
+		if (target < 1) target = 1;
+
+		lod_simplify (src, src_mesh, target, &task->lods[level].vertex[task->index], &task->lods[level].mesh[task->index], task->index);
+
+		src = &task->lods[level].vertex[task->index];
+		src_mesh = &task->lods[level].mesh[task->index];
+	}
+
+	arena_set_current (prev_arena);
+}
+
+/* Genera levels niveles de detalle; el nivel N tiene cerca de ratio^N de los triángulos.
+ * Cada mesh se simplifica en su propia tarea, así que el resultado no depende de los hilos */
+int build_lods (VertexData *vertex, int num_vertex, MeshData *mesh, int num_meshes, int levels, float ratio, MeshLod *lods, ThreadPool *pool) {
+	LodTask *tasks;
+	TaskGroup group;
+	int g, h;
+
+	for (h = 0; h < levels; h++) {
+		lods[h].vertex = (VertexData *) mmf_malloc (sizeof (VertexData) * (num_meshes + 1));
+		memset (lods[h].vertex, 0, sizeof (VertexData) * (num_meshes + 1));
+		lods[h].mesh = (MeshData *) mmf_malloc (sizeof (MeshData) * (num_meshes + 1));
+		memset (lods[h].mesh, 0, sizeof (MeshData) * (num_meshes + 1));
+		lods[h].num_vertex = num_meshes;
+		lods[h].num_meshes = num_meshes;
+		lods[h].triangles = 0;
+	}
+
+	tasks = (LodTask *) mmf_malloc (sizeof (LodTask) * (num_meshes + 1));
+
+	pool_group_init (&group);
+	for (g = 0; g < num_meshes; g++) {
+		tasks[g].vertex = vertex;
+		tasks[g].num_vertex = num_vertex;
+		tasks[g].mesh = &mesh[g];
+		tasks[g].index = g;
+		tasks[g].levels = levels;
+		tasks[g].ratio = ratio;
+		tasks[g].lods = lods;
+		tasks[g].arena = arena_get_current ();
+
+		if (pool != NULL && num_meshes > 1) {
+			pool_submit (pool, &group, lod_task_run, &tasks[g]);
+		} else {
+			lod_task_run (&tasks[g]);
+		}
+	}
+
+	if (pool != NULL && num_meshes > 1) {
+		pool_wait (pool, &group);
+	}
+
+	mmf_free (tasks);
+
+	for (h = 0; h < levels; h++) {
+		for (g = 0; g < num_meshes; g++) {
+			lods[h].triangles += lods[h].mesh[g].num_index / 3;
+		}
+
+		compute_mesh_bounds (lods[h].vertex, lods[h].num_vertex, lods[h].mesh, lods[h].num_meshes, pool);
+	}
+
+	return 0;
+}
+
+/* Los nombres de los meshes son los del modelo, no se liberan aquí */
+void lod_free (MeshLod *lods, int levels) {
+	int g, h;
+
+	for (h = 0; h < levels; h++) {
+		for (g = 0; g < lods[h].num_vertex; g++) {
+			mmf_free (lods[h].vertex[g].vertex);
+			mmf_free (lods[h].vertex[g].raw);
+			mmf_free (lods[h].vertex[g].normal);
+		}
+		mmf_free (lods[h].vertex);
+
+		for (g = 0; g < lods[h].num_meshes; g++) {
+			mmf_free (lods[h].mesh[g].index);
+		}
+		mmf_free (lods[h].mesh);
+	}
+}
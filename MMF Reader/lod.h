@@ -0,0 +1,20 @@
+#ifndef __LOD_H__
+#define __LOD_H__
+
+#include "mmf.h"
+
+/* Un nivel de detalle del modelo: cada mesh con su propio VertexData, con el mismo número */
+typedef struct {
+	VertexData *vertex;
+	int num_vertex;
+
+	MeshData *mesh;
+	int num_meshes;
+
+	int triangles;
+} MeshLod;
+
+int build_lods (VertexData *vertex, int num_vertex, MeshData *mesh, int num_meshes, int levels, float ratio, MeshLod *lods, ThreadPool *pool);
+void lod_free (MeshLod *lods, int levels);
+
+#endif /* __LOD_H__ */
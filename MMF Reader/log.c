@@ -0,0 +1,286 @@
+/*
+ * log.c
+ * This file is part of BKV Reader
+ *
+ * Copyright (C) 2022 - Félix Arreola Rodríguez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdarg.h>
+#include <unistd.h>
+
+#include <pthread.h>
+
+#include "log.h"
+
+/* Cada hilo escribe en su anillo sin candados; un solo hilo los vacía a la salida.
+ * Así un hilo que decodifica nunca espera a la terminal, salvo con su anillo lleno */
+#define LOG_RING_SIZE 65536
+
+typedef struct _LogRing {
+	char *data;
+
+	/* El hilo dueño avanza tail, el que vacía avanza head */
+	unsigned int head __attribute__ ((aligned (64)));
+	unsigned int tail __attribute__ ((aligned (64)));
+
+	/* El hilo terminó; se libera ya vacío */
+	int dead;
+
+	struct _LogRing *next;
+} LogRing;
+
+int log_level = LOG_INFO;
+
+static FILE *log_out = NULL;
+static int log_running = 0;
+static int log_stop = 0;
+
+static pthread_t flusher;
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t log_cond = PTHREAD_COND_INITIALIZER;
+static pthread_key_t log_key;
+
+static LogRing *rings = NULL;
+static __thread LogRing *current_ring = NULL;
+
+static const char *level_names[] = {
+	"error",
+	"warn",
+	"info",
+	"debug",
+	"trace"
+};
+
+static void log_ring_exit (void *data) {
+	LogRing *ring = (LogRing *) data;
+
+	__atomic_store_n (&ring->dead, 1, __ATOMIC_RELEASE);
+}
+
+static LogRing *log_get_ring (void) {
+	LogRing *ring, **p;
+
+	if (current_ring != NULL) return current_ring;
+
+	ring = (LogRing *) malloc (sizeof (LogRing));
+	memset (ring, 0, sizeof (LogRing));
+	ring->data = (char *) malloc (LOG_RING_SIZE);
+
+	/* Al final de la lista: en cada vuelta se vacían primero los hilos más viejos,
+	 * así lo que el hilo principal escribe antes de repartir trabajo sale antes */
+	pthread_mutex_lock (&log_lock);
+	p = &rings;
+	while (*p != NULL) p = &(*p)->next;
+	*p = ring;
+	pthread_mutex_unlock (&log_lock);
+
+	pthread_setspecific (log_key, ring);
+	current_ring = ring;
+
+	return ring;
+}
+
+/* Escribe lo que tiene el anillo hasta el último fin de línea, para no mezclar
+ * medias líneas de dos hilos. Todo si "all" o si el anillo se llenó sin un solo fin de línea. Con log_lock */
+static int log_drain_ring (LogRing *ring, int all) {
+	unsigned int head, tail, len, full, start, first;
+
+	head = ring->head;
+	tail = __atomic_load_n (&ring->tail, __ATOMIC_ACQUIRE);
+	len = full = tail - head;
+	if (len == 0) return 0;
+
+	if (!all) {
+		while (len > 0 && ring->data[(head + len - 1) & (LOG_RING_SIZE - 1)] != '\n') len--;
+		if (len == 0 && full == LOG_RING_SIZE) len = full;
+		if (len == 0) return 0;
+	}
+
+	start = head & (LOG_RING_SIZE - 1);
+	first = LOG_RING_SIZE - start;
+	if (first > len) first = len;
+
+	fwrite (&ring->data[start], 1, first, log_out);
+	if (len > first) fwrite (ring->data, 1, len - first, log_out);
+
+	__atomic_store_n (&ring->head, head + len, __ATOMIC_RELEASE);
+
+	return 1;
+}
+
+static int log_drain (int all) {
+	LogRing **p, *ring;
+	int wrote;
+
+	wrote = 0;
+	p = &rings;
+	while (*p != NULL) {
+		ring = *p;
+		wrote |= log_drain_ring (ring, all || __atomic_load_n (&ring->dead, __ATOMIC_ACQUIRE));
+
+		if (__atomic_load_n (&ring->dead, __ATOMIC_ACQUIRE) && ring->head == __atomic_load_n (&ring->tail, __ATOMIC_ACQUIRE)) {
+			*p = ring->next;
+			free (ring->data);
+			free (ring);
+			continue;
+		}
+		p = &ring->next;
+	}
+
+	if (wrote) fflush (log_out);
+
+	return wrote;
+}
+
+static void *log_flusher (void *data) {
+	struct timespec ts;
+
+	pthread_mutex_lock (&log_lock);
+	while (!log_stop) {
+		if (log_drain (0)) continue;
+
+		/* Sin nada que escribir, revisar otra vez en 2 ms o cuando un anillo se llene */
+		clock_gettime (CLOCK_REALTIME, &ts);
+		ts.tv_nsec += 2000000;
+		if (ts.tv_nsec >= 1000000000) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000;
+		}
+		pthread_cond_timedwait (&log_cond, &log_lock, &ts);
+	}
+
+	log_drain (1);
+	pthread_mutex_unlock (&log_lock);
+
+	return NULL;
+}
+
+/* Sin log_init (por ejemplo desde la biblioteca) cada mensaje se escribe directo a stdout */
+void log_init (FILE *out) {
+	if (log_running) return;
+
+	log_out = out;
+	log_stop = 0;
+	pthread_key_create (&log_key, log_ring_exit);
+
+	if (pthread_create (&flusher, NULL, log_flusher, NULL) == 0) {
+		__atomic_store_n (&log_running, 1, __ATOMIC_RELEASE);
+	}
+}
+
+void log_shutdown (void) {
+	if (!log_running) return;
+
+	pthread_mutex_lock (&log_lock);
+	log_stop = 1;
+	pthread_cond_signal (&log_cond);
+	pthread_mutex_unlock (&log_lock);
+
+	pthread_join (flusher, NULL);
+	__atomic_store_n (&log_running, 0, __ATOMIC_RELEASE);
+}
+
+/* Escribe ya todo lo pendiente de todos los hilos */
+void log_flush (void) {
+	if (!__atomic_load_n (&log_running, __ATOMIC_ACQUIRE)) {
+		fflush (stdout);
+		return;
+	}
+
+	pthread_mutex_lock (&log_lock);
+	log_drain (1);
+	pthread_mutex_unlock (&log_lock);
+}
+
+void log_set_level (int level) {
+	if (level < LOG_ERROR) level = LOG_ERROR;
+	if (level > LOG_TRACE) level = LOG_TRACE;
+
+	log_level = level;
+}
+
+/* -1 si el nombre no es un nivel */
+int log_level_from_name (const char *name) {
+	int g;
+
+	for (g = LOG_ERROR; g <= LOG_TRACE; g++) {
+		if (strcasecmp (name, level_names[g]) == 0) return g;
+	}
+
+	return -1;
+}
+
+static void log_ring_put (LogRing *ring, const char *text, size_t len) {
+	unsigned int tail, space, start, first;
+	size_t part;
+
+	while (len > 0) {
+		tail = ring->tail;
+		space = LOG_RING_SIZE - (tail - __atomic_load_n (&ring->head, __ATOMIC_ACQUIRE));
+
+		if (space == 0) {
+			/* Lleno: despertar al que vacía y esperarlo */
+			pthread_mutex_lock (&log_lock);
+			pthread_cond_signal (&log_cond);
+			pthread_mutex_unlock (&log_lock);
+			usleep (50);
+			continue;
+		}
+
+		part = (len < space ? len : space);
+		start = tail & (LOG_RING_SIZE - 1);
+		first = LOG_RING_SIZE - start;
+		if (first > part) first = part;
+
+		memcpy (&ring->data[start], text, first);
+		if (part > first) memcpy (ring->data, text + first, part - first);
+
+		__atomic_store_n (&ring->tail, tail + part, __ATOMIC_RELEASE);
+		text += part;
+		len -= part;
+	}
+}
+
+void log_write (int level, const char *format, ...) {
+	char line[1024], *text;
+	va_list ap;
+	int n;
+
+	va_start (ap, format);
+	n = vsnprintf (line, sizeof (line), format, ap);
+	va_end (ap);
+	if (n < 0) return;
+
+	text = line;
+	if ((size_t) n >= sizeof (line)) {
+		text = (char *) malloc (n + 1);
+		va_start (ap, format);
+		vsnprintf (text, n + 1, format, ap);
+		va_end (ap);
+	}
+
+	if (__atomic_load_n (&log_running, __ATOMIC_ACQUIRE)) {
+		log_ring_put (log_get_ring (), text, n);
+	} else {
+		fwrite (text, 1, n, stdout);
+	}
+
+	if (text != line) free (text);
+}
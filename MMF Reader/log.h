@@ -0,0 +1,40 @@
+#ifndef __LOG_H__
+#define __LOG_H__
+
+#include <stdio.h>
+
+enum {
+	LOG_ERROR = 0,
+	LOG_WARN,
+	LOG_INFO,
+	LOG_DEBUG,
+	LOG_TRACE
+};
+
+/* Nivel más alto que se compila; con -DLOG_MAX_LEVEL=LOG_INFO los mensajes de depuración desaparecen */
+#ifndef LOG_MAX_LEVEL
+#define LOG_MAX_LEVEL LOG_TRACE
+#endif
+
+extern int log_level;
+
+#define log_enabled(level) ((level) <= LOG_MAX_LEVEL && (level) <= log_level)
+
+#define LOG(level, ...) do { if (log_enabled (level)) log_write ((level), __VA_ARGS__); } while (0)
+
+#define log_error(...) LOG (LOG_ERROR, __VA_ARGS__)
+#define log_warn(...) LOG (LOG_WARN, __VA_ARGS__)
+#define log_info(...) LOG (LOG_INFO, __VA_ARGS__)
+#define log_debug(...) LOG (LOG_DEBUG, __VA_ARGS__)
+#define log_trace(...) LOG (LOG_TRACE, __VA_ARGS__)
+
+void log_init (FILE *out);
+void log_shutdown (void);
+void log_flush (void);
+
+void log_set_level (int level);
+int log_level_from_name (const char *name);
+
+void log_write (int level, const char *format, ...) __attribute__ ((format (printf, 2, 3)));
+
+#endif /* __LOG_H__ */
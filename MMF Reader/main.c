@@ -0,0 +1,304 @@
+/*
+ * main.c
+ * This file is part of BKV Reader
+ *
+ * Copyright (C) 2022 - Félix Arreola Rodríguez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "mmf.h"
+#include "libmmf.h"
+#include "batch.h"
+#include "pool.h"
+#include "loader.h"
+#include "cache.h"
+#include "daemon.h"
+#include "streaming.h"
+#include "material.h"
+#include "stats.h"
+#include "log.h"
+#include "ui.h"
+
+int tree = 0;
+int jobs = 0;
+
+/* La interfaz abre un modelo a la vez; el contexto reusa su memoria entre modelos */
+MMFContext *context = NULL;
+
+/* Con caché o streaming la ruta se pide antes, para no leer el modelo si no hace falta */
+static int convert_model_direct (char *folder) {
+	char *file_path;
+	int g;
+
+	file_path = ui_save_file ();
+	if (file_path == NULL || file_path[0] == 0) {
+		ui_show_message_warning ("Will skip obj file save");
+
+		free (file_path);
+		return 0;
+	}
+
+	g = model_convert (folder, file_path);
+
+	if (g == 1) {
+		ui_show_message_info ("File restored from cache");
+		g = 0;
+	} else if (g == -1) {
+		ui_show_message_error ("Main desc file not found");
+	} else if (g < 0) {
+		ui_show_message_error ("Can't open the file for saving");
+	} else if (has_extension (file_path, ".glb")) {
+		ui_show_message_info ("GLB File Saved");
+	} else if (has_extension (file_path, ".mmfb")) {
+		ui_show_message_info ("Bundle File Saved");
+	} else {
+		ui_show_message_info ("OBJ File Saved");
+	}
+
+	free (file_path);
+
+	return g;
+}
+
+int convert_model (char *folder) {
+	char *file_path;
+	int g;
+
+	if ((cache != NULL || stream_budget > 0) && !has_extension (folder, ".dpack") && !has_extension (folder, ".mmfb")) {
+		return convert_model_direct (folder);
+	}
+
+	if (has_extension (folder, ".dpack")) {
+		g = mmf_open_dpack (context, folder);
+	} else if (has_extension (folder, ".mmfb")) {
+		g = mmf_open_bundle (context, folder);
+	} else {
+		g = mmf_open_folder (context, folder);
+	}
+
+	if (g < 0) {
+		ui_show_message_error ("Main desc file not found");
+
+		return -1;
+	}
+
+	/* Tratar de generar un obj */
+	file_path = ui_save_file ();
+
+	if (file_path == NULL || file_path[0] == 0) {
+		ui_show_message_warning ("Will skip obj file save");
+
+		free (file_path);
+		mmf_close (context);
+		return 0;
+	}
+
+	g = mmf_export (context, file_path);
+
+	if (g < 0) {
+		ui_show_message_error ("Can't open the file for saving");
+	} else if (has_extension (file_path, ".glb")) {
+		ui_show_message_info ("GLB File Saved");
+	} else if (has_extension (file_path, ".mmfb")) {
+		ui_show_message_info ("Bundle File Saved");
+	} else {
+		ui_show_message_info ("OBJ File Saved");
+	}
+
+	free (file_path);
+	mmf_close (context);
+
+	return g;
+}
+
+/* Recorre los árboles de carpetas y convierte todos los modelos en paralelo */
+int convert_trees (char *folder) {
+	Batch *batch;
+	char *file_path, *ext;
+	int failed;
+
+	batch = batch_new (jobs);
+
+	do {
+		/* La ruta de salida de la raíz sin extensión es la carpeta de salida de sus modelos */
+		file_path = ui_save_file ();
+		if (file_path != NULL && file_path[0] != 0) {
+			ext = strrchr (file_path, '.');
+			if (ext != NULL && strchr (ext, '/') == NULL && strchr (ext, '\\') == NULL) {
+				*ext = 0;
+				ext++;
+			} else {
+				ext = "obj";
+			}
+
+			batch_add_tree (batch, folder, file_path, ext);
+		}
+		free (file_path);
+		free (folder);
+	} while ((folder = ui_get_mmf_directory ()) != NULL);
+
+	failed = batch_run (batch);
+	batch_free (batch);
+
+	return failed;
+}
+
+int main (int argc, char *argv[]) {
+	char *folder, *cache_dir, *daemon_path;
+	int g, failed;
+
+	ui_init (&argc, &argv);
+
+	cache_dir = NULL;
+	daemon_path = NULL;
+	for (g = 1; g < argc; g++) {
+		if (strcmp (argv[g], "--keep-quantized") == 0) {
+			keep_quantized = 1;
+		} else if (strcmp (argv[g], "--compact") == 0) {
+			compact = 1;
+		} else if (strcmp (argv[g], "--optimize-cache") == 0) {
+			optimize_cache = 1;
+		} else if (strcmp (argv[g], "--no-normals") == 0) {
+			generate_normals = 0;
+		} else if (strcmp (argv[g], "--bvh") == 0) {
+			write_bvh = 1;
+		} else if (strncmp (argv[g], "--lod=", 6) == 0) {
+			lod_levels = atoi (&argv[g][6]);
+		} else if (strncmp (argv[g], "--lod-ratio=", 12) == 0) {
+			lod_ratio = strtod (&argv[g][12], NULL);
+		} else if (strcmp (argv[g], "--tree") == 0) {
+			tree = 1;
+		} else if (strncmp (argv[g], "--jobs=", 7) == 0) {
+			jobs = atoi (&argv[g][7]);
+		} else if (strcmp (argv[g], "--preload") == 0) {
+			preload_method = PRELOAD_AUTO;
+		} else if (strcmp (argv[g], "--preload=threads") == 0) {
+			preload_method = PRELOAD_THREADS;
+		} else if (strcmp (argv[g], "--cache") == 0) {
+			free (cache_dir);
+			cache_dir = cache_default_dir ();
+		} else if (strncmp (argv[g], "--cache=", 8) == 0) {
+			free (cache_dir);
+			cache_dir = strdup (&argv[g][8]);
+		} else if (strncmp (argv[g], "--daemon=", 9) == 0) {
+			daemon_path = &argv[g][9];
+		} else if (strcmp (argv[g], "--stream") == 0) {
+			stream_budget = (size_t) STREAM_DEFAULT_BUDGET * 1024 * 1024;
+		} else if (strncmp (argv[g], "--stream=", 9) == 0) {
+			stream_budget = (size_t) atol (&argv[g][9]) * 1024 * 1024;
+		} else if (strncmp (argv[g], "--log=", 6) == 0) {
+			if (log_level_from_name (&argv[g][6]) < 0) {
+				fprintf (stderr, "Unknown log level: %s\n", &argv[g][6]);
+				return EXIT_FAILURE;
+			}
+			log_set_level (log_level_from_name (&argv[g][6]));
+		} else if (strcmp (argv[g], "--stats=json") == 0) {
+			stats_enable ();
+		} else if (strcmp (argv[g], "--weld") == 0) {
+			weld = 1;
+		} else if (strncmp (argv[g], "--weld=", 7) == 0) {
+			weld = 1;
+			weld_tolerance = strtod (&argv[g][7], NULL);
+		}
+	}
+
+	/* Los mensajes de los hilos del pool se juntan en un solo hilo que escribe */
+	log_init (stdout);
+
+	if (cache_dir != NULL) {
+		cache = cache_open (cache_dir);
+		free (cache_dir);
+	}
+
+	if (daemon_path != NULL) {
+		/* Un solo proceso para todas las peticiones: el pool y la caché quedan calientes */
+		load_pool = pool_create (jobs);
+		failed = daemon_run (daemon_path, load_pool, cache);
+
+		pool_destroy (load_pool);
+		load_pool = NULL;
+		cache_close (cache);
+		material_catalog_clear ();
+
+		stats_write_json (stderr);
+		log_shutdown ();
+
+		return (failed < 0 ? EXIT_FAILURE : 0);
+	}
+
+	folder = ui_get_mmf_directory ();
+
+	if (folder == NULL) {
+		ui_show_message_error ("Canceled");
+		log_shutdown ();
+
+		return 0;
+	}
+
+	//char *folder = "/home/gatuno/Puffles/penguin_mmf";
+
+	if (tree && ui_is_batch ()) {
+		failed = convert_trees (folder);
+		cache_close (cache);
+		material_catalog_clear ();
+
+		stats_write_json (stderr);
+		log_shutdown ();
+
+		return (failed > 0 ? EXIT_FAILURE : 0);
+	}
+
+	if (jobs != 1) {
+		load_pool = pool_create (jobs);
+	}
+
+	context = mmf_context_create ();
+
+	/* En modo por lotes se procesan todas las carpetas en el mismo proceso */
+	failed = 0;
+	do {
+		if (convert_model (folder) < 0) {
+			failed++;
+		}
+		free (folder);
+	} while (ui_is_batch () && (folder = ui_get_mmf_directory ()) != NULL);
+
+	if (load_pool != NULL) {
+		pool_destroy (load_pool);
+		load_pool = NULL;
+	}
+
+	mmf_context_destroy (context);
+	context = NULL;
+
+	cache_close (cache);
+	cache = NULL;
+	material_catalog_clear ();
+
+	stats_write_json (stderr);
+	log_shutdown ();
+
+	if (failed > 0) {
+		return (ui_is_batch () ? EXIT_FAILURE : -1);
+	}
+
+	return 0;
+}
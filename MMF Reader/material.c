@@ -0,0 +1,497 @@
+/*
+ * material.c
+ * This file is part of BKV Reader
+ *
+ * Copyright (C) 2022 - Félix Arreola Rodríguez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <math.h>
+
+#include <pthread.h>
+
+#include "mmf.h"
+#include "loader.h"
+#include "arena.h"
+#include "hash.h"
+#include "stats.h"
+#include "log.h"
+#include "material.h"
+
+/* Materiales ya decodificados de todo el proceso, por el hash del Color-N.bkv.
+ * Los modelos de un catálogo repiten los mismos colores */
+#define MATERIAL_CATALOG_MAX 4096
+
+typedef struct {
+	uint64_t hash;
+	size_t len;
+
+	/* Copia del Color-N.bkv, el hash solo no basta para dar dos colores por iguales */
+	unsigned char *data;
+
+	/* Sin id; name es NULL si el BKV no tiene nombre */
+	Material material;
+} CatalogEntry;
+
+static pthread_mutex_t catalog_lock = PTHREAD_MUTEX_INITIALIZER;
+static CatalogEntry *catalog = NULL;
+static int catalog_count = 0;
+static int catalog_size = 0;
+
+static const char *diffuse_keys[] = {"diffuse", "color", "diffuseColor", "baseColor", "albedo", "_Color", NULL};
+static const char *specular_keys[] = {"specular", "specularColor", "_SpecColor", NULL};
+static const char *smoothness_keys[] = {"smoothness", "glossiness", "_Glossiness", NULL};
+static const char *alpha_keys[] = {"alpha", "opacity", NULL};
+static const char *texture_keys[] = {"texture", "diffuseMap", "map", "_MainTex", NULL};
+
+static TableEntry *table_find (Table *table, const char *key) {
+	int g;
+
+	for (g = 0; g < table->n_entries; g++) {
+		if (table->entries[g].name_pos & 0x8000) continue;
+
+		if (table->entries[g].name != NULL && strcmp (table->entries[g].name, key) == 0) {
+			return &table->entries[g];
+		}
+	}
+
+	return NULL;
+}
+
+static TableEntry *table_find_any (Table *table, const char **keys) {
+	TableEntry *entry;
+	int g;
+
+	for (g = 0; keys[g] != NULL; g++) {
+		entry = table_find (table, keys[g]);
+		if (entry != NULL) return entry;
+	}
+
+	return NULL;
+}
+
+static TableEntry *table_find_index (Table *table, int pos) {
+	int g;
+
+	for (g = 0; g < table->n_entries; g++) {
+		if ((table->entries[g].name_pos & 0x8000) && table->entries[g].name_pos - 0x8000 == pos) {
+			return &table->entries[g];
+		}
+	}
+
+	return NULL;
+}
+
+/* 1 si es flotante, 2 si es entero, 0 si no es un número */
+static int entry_number (TableEntry *entry, float *value) {
+	switch (entry->type) {
+		case 2: /* TYPE_FLOAT */
+			*value = entry->value.flotante;
+			return 1;
+		case 3: /* Type Byte */
+			*value = entry->value.byte;
+			return 2;
+		case 4: /* Type Short */
+			*value = entry->value.short_int;
+			return 2;
+		case 5: /* Type INT */
+			*value = entry->value.integer;
+			return 2;
+	}
+
+	return 0;
+}
+
+static float clamp_unit (float value) {
+	if (value < 0) return 0;
+	if (value > 1) return 1;
+
+	return value;
+}
+
+/* Un color es un número (gris) o una tabla de 3 o 4 números, por índice o con r g b a.
+ * Los enteros van de 0 a 255 */
+static int decode_color (TableEntry *entry, float *color, int components) {
+	static const char *names[] = {"r", "g", "b", "a"};
+	TableEntry *e;
+	float value, tmp[4];
+	int g, n, kind;
+
+	kind = entry_number (entry, &value);
+	if (kind != 0) {
+		value = clamp_unit (kind == 2 ? value / 255.0f : value);
+		color[0] = color[1] = color[2] = value;
+		return 1;
+	}
+
+	if (entry->type != 7 || entry->value.table == NULL) return 0;
+
+	memcpy (tmp, color, sizeof (float) * components);
+	n = 0;
+	for (g = 0; g < components; g++) {
+		e = table_find_index (entry->value.table, g);
+		if (e == NULL) e = table_find (entry->value.table, names[g]);
+		if (e == NULL || (kind = entry_number (e, &value)) == 0) continue;
+
+		tmp[g] = clamp_unit (kind == 2 ? value / 255.0f : value);
+		n++;
+	}
+
+	if (n < 3) return 0;
+	memcpy (color, tmp, sizeof (float) * components);
+
+	return 1;
+}
+
+/* Las cadenas quedan apuntando al BKV */
+static void material_decode (Table *root, Material *material) {
+	TableEntry *entry;
+	float value, r;
+
+	memset (material, 0, sizeof (Material));
+	material->diffuse[0] = material->diffuse[1] = material->diffuse[2] = material->diffuse[3] = 1;
+
+	entry = table_find (root, "name");
+	if (entry != NULL && entry->type == 6 && entry->value.string != NULL && entry->value.string[0] != 0) {
+		material->name = entry->value.string;
+	}
+
+	entry = table_find_any (root, diffuse_keys);
+	if (entry != NULL) decode_color (entry, material->diffuse, 4);
+
+	entry = table_find_any (root, specular_keys);
+	if (entry != NULL) decode_color (entry, material->specular, 3);
+
+	entry = table_find (root, "shininess");
+	if (entry != NULL && entry_number (entry, &value) != 0) {
+		material->shininess = (value < 0 ? 0 : (value > 1000 ? 1000 : value));
+	} else {
+		/* Suavidad de 0 a 1: rugosidad 1 - s, y el exponente que le corresponde */
+		entry = table_find_any (root, smoothness_keys);
+		if (entry != NULL && entry_number (entry, &value) == 1) {
+			r = 1 - clamp_unit (value);
+			material->shininess = (r > 0.045f ? 2 / (r * r) - 2 : 1000);
+		}
+	}
+
+	entry = table_find_any (root, alpha_keys);
+	if (entry != NULL && entry_number (entry, &value) == 1) {
+		material->diffuse[3] = clamp_unit (value);
+	} else {
+		entry = table_find (root, "transparency");
+		if (entry != NULL && entry_number (entry, &value) == 1) material->diffuse[3] = 1 - clamp_unit (value);
+	}
+
+	entry = table_find_any (root, texture_keys);
+	if (entry != NULL && entry->type == 6 && entry->value.string != NULL && entry->value.string[0] != 0) {
+		material->texture = entry->value.string;
+	}
+}
+
+static char *material_strdup (const char *str) {
+	return (str != NULL ? mmf_strdup (str) : NULL);
+}
+
+static CatalogEntry *catalog_find (uint64_t hash, size_t len, const unsigned char *data) {
+	int g;
+
+	for (g = 0; g < catalog_count; g++) {
+		if (catalog[g].hash == hash && catalog[g].len == len && memcmp (catalog[g].data, data, len) == 0) return &catalog[g];
+	}
+
+	return NULL;
+}
+
+/* La copia del catálogo sale de malloc, no de la arena del modelo.
+ * data pasa a ser del catálogo, o se libera si la entrada no entra */
+static void catalog_insert (uint64_t hash, size_t len, unsigned char *data, Material *material) {
+	CatalogEntry *entry;
+
+	pthread_mutex_lock (&catalog_lock);
+	if (catalog_count < MATERIAL_CATALOG_MAX && catalog_find (hash, len, data) == NULL) {
+		if (catalog_count == catalog_size) {
+			catalog_size = (catalog_size == 0 ? 64 : catalog_size * 2);
+			catalog = (CatalogEntry *) realloc (catalog, sizeof (CatalogEntry) * catalog_size);
+		}
+
+		if (catalog != NULL) {
+			entry = &catalog[catalog_count++];
+			entry->hash = hash;
+			entry->len = len;
+			entry->data = data;
+			data = NULL;
+			entry->material = *material;
+			entry->material.name = (material->name != NULL ? strdup (material->name) : NULL);
+			entry->material.texture = (material->texture != NULL ? strdup (material->texture) : NULL);
+		}
+	}
+	pthread_mutex_unlock (&catalog_lock);
+
+	free (data);
+}
+
+/* 1 si vino del catálogo, 0 si se decodificó, -1 si no está o no es un BKV */
+static int material_read (char *folder, int id, Material *material) {
+	CatalogEntry *entry;
+	BKVDesc bkv;
+	MMFStream stream;
+	StatScope scope;
+	Material decoded;
+	unsigned char *data;
+	char filename[64], path[8192];
+	uint64_t hash;
+	size_t len;
+	int g;
+
+	snprintf (filename, sizeof (filename), "Color-%i.bkv", id);
+	snprintf (path, sizeof (path), "%s/%s", folder, filename);
+
+	stats_begin (&scope, STAT_DESC);
+	if (stream_open (&stream, path) < 0) {
+		stats_end (&scope, folder, filename, 0);
+		return -1;
+	}
+
+	len = stream_size (&stream);
+	hash = hash64 (stream.data, len, 0);
+
+	pthread_mutex_lock (&catalog_lock);
+	entry = catalog_find (hash, len, stream.data);
+	if (entry != NULL) {
+		*material = entry->material;
+		material->name = material_strdup (entry->material.name);
+		material->texture = material_strdup (entry->material.texture);
+	}
+	pthread_mutex_unlock (&catalog_lock);
+
+	if (entry != NULL) {
+		stream_close (&stream);
+		stats_end (&scope, folder, filename, 0);
+		return 1;
+	}
+
+	/* read_bkv_stream cierra el stream, la copia para el catálogo se hace antes */
+	data = (unsigned char *) malloc (len > 0 ? len : 1);
+	if (data != NULL) memcpy (data, stream.data, len);
+
+	g = read_bkv_stream (&bkv, &stream);
+	stats_end (&scope, folder, filename, (g == 0 ? bkv.n_tables : 0));
+
+	if (g < 0 || bkv.n_tables == 0) {
+		free (data);
+		bkv_free (&bkv);
+		return -1;
+	}
+
+	if (log_enabled (LOG_DEBUG)) {
+		log_debug ("Color-%i: Valores tabla raíz:\n", id);
+
+		log_debug ("{\n");
+		print_table (&bkv.tables[0], "\t");
+		log_debug ("}\n");
+	}
+
+	material_decode (&bkv.tables[0], &decoded);
+	if (data != NULL) catalog_insert (hash, len, data, &decoded);
+
+	*material = decoded;
+	material->name = material_strdup (decoded.name);
+	material->texture = material_strdup (decoded.texture);
+
+	bkv_free (&bkv);
+
+	return 0;
+}
+
+/* Nombre válido para un MTL: sin espacios y sin repetir otro de la tabla */
+static void material_set_name (Material *materials, int g) {
+	char buffer[256];
+	char *p;
+	int h;
+
+	if (materials[g].name == NULL) {
+		snprintf (buffer, sizeof (buffer), "Color-%i", materials[g].id);
+		materials[g].name = mmf_strdup (buffer);
+	}
+
+	for (p = materials[g].name; *p != 0; p++) {
+		if (isspace ((unsigned char) *p)) *p = '_';
+	}
+
+	for (h = 0; h < g; h++) {
+		if (strcmp (materials[h].name, materials[g].name) == 0) break;
+	}
+
+	if (h < g) {
+		snprintf (buffer, sizeof (buffer), "%s-%i", materials[g].name, materials[g].id);
+		mmf_free (materials[g].name);
+		materials[g].name = mmf_strdup (buffer);
+	}
+}
+
+/* Lee una vez cada Color-N.bkv de ids (los "material" de los meshes, -1 para ninguno).
+ * Cada ids[g] queda como el índice del material en la tabla, o -1 si el archivo no está */
+int materials_load (char *folder, int *ids, int n, Material **materials) {
+	Material *table;
+	int *distinct, *index;
+	int g, h, count, loaded, shared, prev_endian;
+
+	*materials = NULL;
+
+	distinct = (int *) mmf_malloc (sizeof (int) * (n + 1));
+	count = 0;
+	for (g = 0; g < n; g++) {
+		if (ids[g] < 0) continue;
+
+		for (h = 0; h < count; h++) {
+			if (distinct[h] == ids[g]) break;
+		}
+		if (h == count) distinct[count++] = ids[g];
+	}
+
+	if (count == 0) {
+		mmf_free (distinct);
+		return 0;
+	}
+
+	/* El Color-N puede venir en otro orden de bytes que el modelo */
+	prev_endian = do_endian;
+
+	table = (Material *) mmf_malloc (sizeof (Material) * count);
+	index = (int *) mmf_malloc (sizeof (int) * count);
+	loaded = shared = 0;
+	for (h = 0; h < count; h++) {
+		index[h] = -1;
+
+		g = material_read (folder, distinct[h], &table[loaded]);
+		if (g < 0) continue;
+
+		if (g == 1) shared++;
+		table[loaded].id = distinct[h];
+		material_set_name (table, loaded);
+		index[h] = loaded++;
+	}
+
+	do_endian = prev_endian;
+
+	for (g = 0; g < n; g++) {
+		if (ids[g] < 0) continue;
+
+		for (h = 0; distinct[h] != ids[g]; h++);
+		ids[g] = index[h];
+	}
+
+	mmf_free (index);
+	mmf_free (distinct);
+
+	if (loaded == 0) {
+		mmf_free (table);
+		return 0;
+	}
+
+	log_debug ("Materials: %i, %i from the catalog\n", loaded, shared);
+
+	*materials = table;
+
+	return loaded;
+}
+
+void materials_free (Material *materials, int num_materials) {
+	int g;
+
+	for (g = 0; g < num_materials; g++) {
+		mmf_free (materials[g].name);
+		mmf_free (materials[g].texture);
+	}
+	mmf_free (materials);
+}
+
+/* Rugosidad de glTF para el exponente especular de Phong */
+float material_roughness (Material *material) {
+	return sqrtf (2.0f / (material->shininess + 2.0f));
+}
+
+/* El .mtl de un OBJ: el mismo nombre con otra extensión */
+void materials_mtl_path (const char *obj_path, char *path, size_t len) {
+	const char *ext, *base;
+
+	base = materials_path_basename (obj_path);
+	ext = strrchr (base, '.');
+	if (ext == NULL) ext = base + strlen (base);
+
+	snprintf (path, len, "%.*s.mtl", (int) (ext - obj_path), obj_path);
+}
+
+const char *materials_path_basename (const char *path) {
+	const char *p;
+
+	p = strrchr (path, '/');
+#ifdef _WIN32
+	if (strrchr (path, '\\') > p) p = strrchr (path, '\\');
+#endif
+
+	return (p != NULL ? p + 1 : path);
+}
+
+int materials_write_mtl (const char *path, Material *materials, int num_materials) {
+	FILE *fd;
+	Material *m;
+	int g;
+
+	fd = fopen (path, "wb");
+	if (fd == NULL) {
+		return -1;
+	}
+
+	for (g = 0; g < num_materials; g++) {
+		m = &materials[g];
+
+		fprintf (fd, "%snewmtl %s\n", (g > 0 ? "\n" : ""), m->name);
+		fprintf (fd, "Kd %.6f %.6f %.6f\n", m->diffuse[0], m->diffuse[1], m->diffuse[2]);
+		fprintf (fd, "Ks %.6f %.6f %.6f\n", m->specular[0], m->specular[1], m->specular[2]);
+		fprintf (fd, "Ns %.6f\n", m->shininess);
+		fprintf (fd, "d %.6f\n", m->diffuse[3]);
+		fprintf (fd, "illum 2\n");
+		if (m->texture != NULL) {
+			fprintf (fd, "map_Kd %s\n", m->texture);
+		}
+	}
+
+	if (fclose (fd) != 0) {
+		return -1;
+	}
+
+	return 0;
+}
+
+void material_catalog_clear (void) {
+	int g;
+
+	pthread_mutex_lock (&catalog_lock);
+	for (g = 0; g < catalog_count; g++) {
+		free (catalog[g].data);
+		free (catalog[g].material.name);
+		free (catalog[g].material.texture);
+	}
+	free (catalog);
+	catalog = NULL;
+	catalog_count = catalog_size = 0;
+	pthread_mutex_unlock (&catalog_lock);
+}
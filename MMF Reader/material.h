@@ -0,0 +1,14 @@
+#ifndef __MATERIAL_H__
+#define __MATERIAL_H__
+
+#include "mmf.h"
+
+int materials_load (char *folder, int *ids, int n, Material **materials);
+void materials_free (Material *materials, int num_materials);
+void materials_mtl_path (const char *obj_path, char *path, size_t len);
+const char *materials_path_basename (const char *path);
+int materials_write_mtl (const char *path, Material *materials, int num_materials);
+float material_roughness (Material *material);
+void material_catalog_clear (void);
+
+#endif /* __MATERIAL_H__ */
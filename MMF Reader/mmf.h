@@ -0,0 +1,255 @@
+/*
+ * mmf.h
+ * This file is part of BKV Reader
+ *
+ * Copyright (C) 2022 - Félix Arreola Rodríguez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __MMF_H__
+#define __MMF_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pool.h"
+#include "loader.h"
+#include "cache.h"
+
+typedef struct {
+	uint16_t pos;
+	char *word;
+} DictWord;
+
+typedef struct _Table Table;
+
+typedef struct {
+	uint32_t name_pos;
+	char *name;
+
+	uint8_t type;
+
+	union {
+		uint8_t boolean;
+		uint8_t byte;
+		float flotante;
+		uint16_t short_int;
+		uint32_t integer;
+		char *string;
+
+		Table *table;
+	} value;
+} TableEntry;
+
+struct _Table {
+	uint16_t pos;
+	int n_entries;
+	TableEntry *entries;
+};
+
+typedef struct {
+	float translation[3];
+
+	float rotation[4];
+
+	float scale;
+} Transform;
+
+typedef struct {
+	char *name;
+	int parent;
+	int transform;
+	int inv_transform;
+} Bone;
+
+typedef struct {
+	int n_words;
+	DictWord *words;
+
+	int n_tables;
+	Table *tables;
+
+	Table *root_table;
+
+	int n_transforms;
+	Transform *transforms;
+
+	int n_bones;
+	Bone *bones;
+
+	int do_endian;
+} BKVDesc;
+
+typedef struct {
+	int id;
+	char *name;
+	int vertex_data_id;
+	int renderable;
+	/* El "material" del desc (el N de Color-N.bkv) hasta materials_load, luego su índice o -1 */
+	int material;
+	int back_face_culling;
+	int max_influences;
+
+	/* Otro mesh con el mismo index-N y VertexData: este no tiene índices propios y usa los de aquel */
+	int instance_of;
+	/* "transform" opcional del desc: la transformación bajo la que se coloca, o -1 */
+	int transform;
+
+	uint32_t *index;
+	int num_index;
+
+	/* Caja de los vértices que usa */
+	float min[3];
+	float max[3];
+} MeshData;
+
+typedef struct {
+	float *vertex;
+	int num;
+
+	/* Normal por vértice, normalizada; NULL hasta compute_normals */
+	float *normal;
+
+	/* Caja de todos los vértices, ya divididos si están cuantizados */
+	float min[3];
+	float max[3];
+
+	/* Flujo original sin expandir a float (modo cuantizado) */
+	void *raw;
+	int encoding;
+	float scale;
+} VertexData;
+
+/* Blend shape guardado como diferencias contra el VertexData de su mesh base,
+ * solo de los vértices que se mueven, cada componente en su arreglo */
+typedef struct {
+	char *name;
+	int mesh;
+	int vertex_data_id;
+
+	int count;
+	uint32_t *index;
+	float *dx;
+	float *dy;
+	float *dz;
+} BlendShape;
+
+/* Material de un Color-N.bkv ya decodificado; MeshData.material es su índice en la tabla del modelo */
+typedef struct {
+	char *name;
+	int id;
+
+	float diffuse[4];
+	float specular[3];
+	float shininess;
+
+	char *texture;
+} Material;
+
+/* Nodo de la escena: una instancia de un mesh, un hueso o una transformación que ningún hueso usa */
+typedef struct {
+	char *name;
+	int parent;
+	int transform;
+	int mesh;
+} SceneNode;
+
+typedef struct {
+	BKVDesc desc;
+
+	VertexData *vertex;
+	int num_vertex;
+
+	MeshData *mesh;
+	int num_meshes;
+
+	BlendShape *shapes;
+	int num_shapes;
+
+	Material *materials;
+	int num_materials;
+
+	SceneNode *nodes;
+	int num_nodes;
+} MMFModel;
+
+enum {
+	ENCODING_NONE = 0,
+	ENCODING_BYTE = 1,
+	ENCODING_BYTE_SIGNED = 2,
+	ENCODING_SHORT = 3,
+	ENCODING_SHORT_SIGNED = 4,
+	UNENCODED_BYTE = 5,
+	UNENCODED_BYTE_SIGNED = 6,
+	UNENCODED_SHORT = 7,
+	UNENCODED_SHORT_SIGNED = 8
+};
+
+/* Firma al inicio de un DPACK, en el orden del host */
+#define DPACK_MAGIC 1146110283
+
+/* Opciones de conversión, comunes a todo el proceso.
+ * keep_quantized solo afecta a los vertexData con "encoding" en el desc; los modelos originales
+ * guardan flotantes y no cambian */
+extern int keep_quantized;
+extern int compact;
+extern int weld;
+extern float weld_tolerance;
+extern int optimize_cache;
+extern int generate_normals;
+extern int write_bvh;
+extern int lod_levels;
+extern float lod_ratio;
+extern int preload_method;
+extern Cache *cache;
+extern ThreadPool *load_pool;
+extern size_t stream_budget;
+
+/* Orden de bytes del modelo que lee este hilo */
+extern __thread int do_endian;
+
+int read_bkv_stream (BKVDesc *bkv_desc, MMFStream *stream);
+int read_bkv (BKVDesc *bkv_desc, char *folder, char *filename);
+void print_table (Table *table, char *tab);
+void bkv_free (BKVDesc *bkv_desc);
+Table *get_key_as_table (Table *table, char *key);
+Table *get_index_as_table (Table *table, int pos);
+uint32_t get_key_as_int (Table *table, char *key);
+uint8_t get_key_as_boolean (Table *table, char *key);
+char *get_key_as_string (Table *table, char *key);
+int get_num_values (Table *table);
+void read_vertex_data (Table *table, char *folder, VertexData *vertex_data);
+void load_mesh_header (MeshData *mesh, Table *table);
+void load_mesh_data (MeshData *mesh, Table *table, char *folder);
+void read_indices (char *folder, char *filename, uint32_t **index_arr, int *num);
+int read_vector_of_numbers (float **array, MMFStream *stream, int encoding);
+void load_vertex_or_mesh (Table *table, char *folder, VertexData *vertex, MeshData *mesh);
+
+int encoding_element_size (int encoding);
+int encoding_is_signed (int encoding);
+int encoding_is_normalized (int encoding);
+float encoding_divisor (int encoding);
+void vertex_data_expand (VertexData *vertex_data);
+
+int has_extension (const char *path, const char *ext);
+int load_model (MMFModel *model, char *folder);
+int export_model (MMFModel *model, const char *file_path);
+void model_free (MMFModel *model);
+void load_model_set_pool (ThreadPool *pool);
+int model_cache_fetch (char *folder, const char *file_path, uint64_t *key);
+void model_cache_store (uint64_t key, const char *file_path);
+int model_convert (char *folder, const char *file_path);
+
+#endif /* __MMF_H__ */
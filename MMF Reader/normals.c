@@ -0,0 +1,295 @@
+/*
+ * normals.c
+ * This file is part of BKV Reader
+ *
+ * Copyright (C) 2022 - Félix Arreola Rodríguez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "mmf.h"
+#include "pool.h"
+#include "arena.h"
+#include "normals.h"
+
+/* Triángulos por bloque */
+#define NORMALS_CHUNK 4096
+
+/* Acumuladores parciales; el bloque N siempre va al acumulador N % NORMALS_PARTIALS.
+ * Es fijo para que el resultado no cambie con el número de hilos */
+#define NORMALS_PARTIALS 4
+
+/* Vértices por tarea al sumar los acumuladores */
+#define NORMALS_REDUCE 16384
+
+/* Cuatro triángulos a la vez, un carril por triángulo */
+typedef float v4f __attribute__ ((vector_size (16)));
+
+typedef struct {
+	uint32_t *index;
+	int first, last;
+
+	float *pos;
+	uint32_t count;
+
+	/* Primer vértice de su VertexData dentro de cada acumulador */
+	size_t base;
+} NormalChunk;
+
+typedef struct {
+	NormalChunk *chunks;
+	int n_chunks;
+	int n_partials;
+
+	/* n_partials acumuladores de total vértices cada uno */
+	float *acc;
+	size_t total;
+} NormalJob;
+
+typedef struct {
+	NormalJob *job;
+	int partial;
+} NormalPartial;
+
+typedef struct {
+	NormalJob *job;
+	VertexData *vertex;
+	size_t base;
+	int first, last;
+} NormalReduce;
+
+/* Suma la normal de cada cara, sin normalizar: su longitud es el doble del área */
+static void normals_accumulate (float *acc, NormalChunk *chunk) {
+	v4f ax, ay, az, e1x, e1y, e1z, e2x, e2y, e2z, nx, ny, nz;
+	uint32_t tri[4][3];
+	int valid[4];
+	float *p;
+	int g, h, k;
+
+	for (g = chunk->first; g < chunk->last; g = g + 4) {
+		for (h = 0; h < 4; h++) {
+			valid[h] = 0;
+			if (g + h < chunk->last) {
+				for (k = 0; k < 3; k++) {
+					tri[h][k] = chunk->index[(g + h) * 3 + k];
+				}
+				valid[h] = (tri[h][0] < chunk->count && tri[h][1] < chunk->count && tri[h][2] < chunk->count);
+			}
+
+			/* Los carriles sobrantes usan un triángulo vacío */
+			if (!valid[h]) {
+				tri[h][0] = tri[h][1] = tri[h][2] = 0;
+			}
+
+			ax[h] = chunk->pos[tri[h][0] * 3];
+			ay[h] = chunk->pos[tri[h][0] * 3 + 1];
+			az[h] = chunk->pos[tri[h][0] * 3 + 2];
+			e1x[h] = chunk->pos[tri[h][1] * 3];
+			e1y[h] = chunk->pos[tri[h][1] * 3 + 1];
+			e1z[h] = chunk->pos[tri[h][1] * 3 + 2];
+			e2x[h] = chunk->pos[tri[h][2] * 3];
+			e2y[h] = chunk->pos[tri[h][2] * 3 + 1];
+			e2z[h] = chunk->pos[tri[h][2] * 3 + 2];
+		}
+
+		e1x -= ax;
+		e1y -= ay;
+		e1z -= az;
+		e2x -= ax;
+		e2y -= ay;
+		e2z -= az;
+
+		nx = e1y * e2z - e1z * e2y;
+		ny = e1z * e2x - e1x * e2z;
+		nz = e1x * e2y - e1y * e2x;
+
+		for (h = 0; h < 4; h++) {
+			if (!valid[h]) continue;
+
+			for (k = 0; k < 3; k++) {
+				p = &acc[(chunk->base + tri[h][k]) * 3];
+				p[0] += nx[h];
+				p[1] += ny[h];
+				p[2] += nz[h];
+			}
+		}
+	}
+}
+
+static void normals_partial_run (void *data) {
+	NormalPartial *task = (NormalPartial *) data;
+	NormalJob *job = task->job;
+	float *acc;
+	int g;
+
+	acc = &job->acc[task->partial * job->total * 3];
+	memset (acc, 0, sizeof (float) * job->total * 3);
+
+	for (g = task->partial; g < job->n_chunks; g = g + job->n_partials) {
+		normals_accumulate (acc, &job->chunks[g]);
+	}
+}
+
+/* Los acumuladores se suman siempre en el mismo orden */
+static void normals_reduce_run (void *data) {
+	NormalReduce *task = (NormalReduce *) data;
+	NormalJob *job = task->job;
+	float x, y, z, len, *src;
+	int g, h;
+
+	for (g = task->first; g < task->last; g++) {
+		x = y = z = 0;
+		for (h = 0; h < job->n_partials; h++) {
+			src = &job->acc[(h * job->total + task->base + g) * 3];
+			x += src[0];
+			y += src[1];
+			z += src[2];
+		}
+
+		len = sqrtf (x * x + y * y + z * z);
+		if (len > 0) {
+			x /= len;
+			y /= len;
+			z /= len;
+		}
+
+		task->vertex->normal[g * 3] = x;
+		task->vertex->normal[g * 3 + 1] = y;
+		task->vertex->normal[g * 3 + 2] = z;
+	}
+}
+
+/* Normales por vértice, promedio de las caras que lo usan pesado por su área.
+ * Necesita los vértices ya expandidos a float */
+int compute_normals (VertexData *vertex, int num_vertex, MeshData *mesh, int num_meshes, ThreadPool *pool) {
+	NormalJob job;
+	NormalPartial *partials;
+	NormalReduce *reduces;
+	TaskGroup group;
+	size_t *vertex_base;
+	int n_reduces, count, tris;
+	int g, h;
+
+	vertex_base = (size_t *) mmf_malloc (sizeof (size_t) * (num_vertex + 1));
+
+	memset (&job, 0, sizeof (job));
+	n_reduces = 0;
+	for (g = 0; g < num_vertex; g++) {
+		mmf_free (vertex[g].normal);
+		vertex[g].normal = NULL;
+
+		vertex_base[g] = job.total;
+		count = (vertex[g].vertex != NULL ? vertex[g].num / 3 : 0);
+		if (count == 0) continue;
+
+		vertex[g].normal = (float *) mmf_malloc (sizeof (float) * count * 3);
+		job.total += count;
+		n_reduces += (count + NORMALS_REDUCE - 1) / NORMALS_REDUCE;
+	}
+
+	if (job.total == 0) {
+		mmf_free (vertex_base);
+		return 0;
+	}
+
+	/* Partir los triángulos de cada mesh en bloques */
+	for (g = 0; g < num_meshes; g++) {
+		if (mesh[g].index == NULL || mesh[g].vertex_data_id < 0 || mesh[g].vertex_data_id >= num_vertex || vertex[mesh[g].vertex_data_id].normal == NULL) continue;
+
+		tris = mesh[g].num_index / 3;
+		job.n_chunks += (tris + NORMALS_CHUNK - 1) / NORMALS_CHUNK;
+	}
+
+	job.chunks = (NormalChunk *) mmf_malloc (sizeof (NormalChunk) * (job.n_chunks + 1));
+	job.n_chunks = 0;
+	for (g = 0; g < num_meshes; g++) {
+		if (mesh[g].index == NULL || mesh[g].vertex_data_id < 0 || mesh[g].vertex_data_id >= num_vertex || vertex[mesh[g].vertex_data_id].normal == NULL) continue;
+
+		tris = mesh[g].num_index / 3;
+		for (h = 0; h < tris; h = h + NORMALS_CHUNK) {
+			job.chunks[job.n_chunks].index = mesh[g].index;
+			job.chunks[job.n_chunks].first = h;
+			job.chunks[job.n_chunks].last = (h + NORMALS_CHUNK < tris ? h + NORMALS_CHUNK : tris);
+			job.chunks[job.n_chunks].pos = vertex[mesh[g].vertex_data_id].vertex;
+			job.chunks[job.n_chunks].count = vertex[mesh[g].vertex_data_id].num / 3;
+			job.chunks[job.n_chunks].base = vertex_base[mesh[g].vertex_data_id];
+			job.n_chunks++;
+		}
+	}
+
+	job.n_partials = (job.n_chunks < NORMALS_PARTIALS ? job.n_chunks : NORMALS_PARTIALS);
+	if (job.n_partials < 1) job.n_partials = 1;
+	job.acc = (float *) mmf_malloc (sizeof (float) * job.total * 3 * job.n_partials);
+
+	partials = (NormalPartial *) mmf_malloc (sizeof (NormalPartial) * job.n_partials);
+	pool_group_init (&group);
+	for (g = 0; g < job.n_partials; g++) {
+		partials[g].job = &job;
+		partials[g].partial = g;
+
+		if (pool != NULL && job.n_partials > 1) {
+			pool_submit (pool, &group, normals_partial_run, &partials[g]);
+		} else {
+			normals_partial_run (&partials[g]);
+		}
+	}
+
+	if (pool != NULL && job.n_partials > 1) {
+		pool_wait (pool, &group);
+	}
+
+	/* Sumar y normalizar, por rangos de vértices de cada VertexData */
+	reduces = (NormalReduce *) mmf_malloc (sizeof (NormalReduce) * n_reduces);
+	n_reduces = 0;
+	for (g = 0; g < num_vertex; g++) {
+		if (vertex[g].normal == NULL) continue;
+
+		count = vertex[g].num / 3;
+		for (h = 0; h < count; h = h + NORMALS_REDUCE) {
+			reduces[n_reduces].job = &job;
+			reduces[n_reduces].vertex = &vertex[g];
+			reduces[n_reduces].base = vertex_base[g];
+			reduces[n_reduces].first = h;
+			reduces[n_reduces].last = (h + NORMALS_REDUCE < count ? h + NORMALS_REDUCE : count);
+			n_reduces++;
+		}
+	}
+
+	pool_group_init (&group);
+	for (g = 0; g < n_reduces; g++) {
+		if (pool != NULL && n_reduces > 1) {
+			pool_submit (pool, &group, normals_reduce_run, &reduces[g]);
+		} else {
+			normals_reduce_run (&reduces[g]);
+		}
+	}
+
+	if (pool != NULL && n_reduces > 1) {
+		pool_wait (pool, &group);
+	}
+
+	mmf_free (reduces);
+	mmf_free (partials);
+	mmf_free (job.acc);
+	mmf_free (job.chunks);
+	mmf_free (vertex_base);
+
+	return 0;
+}
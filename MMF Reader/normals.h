@@ -0,0 +1,8 @@
+#ifndef __NORMALS_H__
+#define __NORMALS_H__
+
+#include "mmf.h"
+
+int compute_normals (VertexData *vertex, int num_vertex, MeshData *mesh, int num_meshes, ThreadPool *pool);
+
+#endif /* __NORMALS_H__ */
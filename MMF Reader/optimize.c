@@ -0,0 +1,616 @@
+/*
+ * optimize.c
+ * This file is part of BKV Reader
+ *
+ * Copyright (C) 2022 - Félix Arreola Rodríguez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "mmf.h"
+#include "optimize.h"
+#include "log.h"
+#include "arena.h"
+
+#define REMAP_NONE 0xFFFFFFFF
+
+/* Bytes que ocupa un vértice (3 componentes) del VertexData */
+size_t vertex_element_size (VertexData *vertex) {
+	if (vertex->raw != NULL) {
+		return 3 * encoding_element_size (vertex->encoding);
+	}
+
+	return 3 * sizeof (float);
+}
+
+unsigned char *vertex_bytes (VertexData *vertex) {
+	if (vertex->raw != NULL) {
+		return (unsigned char *) vertex->raw;
+	}
+
+	return (unsigned char *) vertex->vertex;
+}
+
+int compact_meshes (VertexData **vertex, int *num_vertex, MeshData *mesh, int num_meshes, CompactStats *stats) {
+	VertexData *src, *dst, *s, *d;
+	uint32_t *remap, *order;
+	uint32_t old, used;
+	int max_count, count, n_dst;
+	size_t elem;
+	unsigned char *from, *to;
+	int g, h;
+
+	src = *vertex;
+
+	memset (stats, 0, sizeof (CompactStats));
+
+	max_count = 0;
+	for (g = 0; g < *num_vertex; g++) {
+		count = src[g].num / 3;
+		if (count > max_count) max_count = count;
+
+		stats->vertex_before += count;
+		stats->bytes_before += count * vertex_element_size (&src[g]);
+	}
+
+	/* La tabla de remapeo se llena una sola vez, y para cada mesh solo se limpian las entradas que usó */
+	remap = (uint32_t *) mmf_malloc (sizeof (uint32_t) * (max_count + 1));
+	order = (uint32_t *) mmf_malloc (sizeof (uint32_t) * (max_count + 1));
+	memset (remap, 0xFF, sizeof (uint32_t) * (max_count + 1));
+
+	dst = (VertexData *) mmf_malloc (sizeof (VertexData) * (num_meshes + 1));
+	n_dst = 0;
+
+	for (g = 0; g < num_meshes; g++) {
+		if (!mesh[g].renderable || mesh[g].index == NULL || mesh[g].num_index <= 0 || mesh[g].vertex_data_id < 0 || mesh[g].vertex_data_id >= *num_vertex) {
+			mesh[g].vertex_data_id = -1;
+			continue;
+		}
+
+		/* Sin su VertexData los índices apuntarían a vértices de otro mesh, las caras se descartan */
+		s = &src[mesh[g].vertex_data_id];
+		if (s->vertex == NULL && s->raw == NULL) {
+			mesh[g].vertex_data_id = -1;
+			mesh[g].num_index = 0;
+			continue;
+		}
+
+		count = s->num / 3;
+		for (h = 0; h < mesh[g].num_index; h++) {
+			if (mesh[g].index[h] >= count) break;
+		}
+
+		if (h < mesh[g].num_index) {
+			log_warn ("Mesh %s has indices out of range, dropping its faces\n", mesh[g].name);
+			mesh[g].vertex_data_id = -1;
+			mesh[g].num_index = 0;
+			continue;
+		}
+
+		elem = vertex_element_size (s);
+		stats->bytes_per_mesh_before += count * elem;
+
+		/* Numerar los vértices en orden de primera aparición y reescribir los índices */
+		used = 0;
+		for (h = 0; h < mesh[g].num_index; h++) {
+			old = mesh[g].index[h];
+
+			if (remap[old] == REMAP_NONE) {
+				remap[old] = used;
+				order[used] = old;
+				used++;
+			}
+
+			mesh[g].index[h] = remap[old];
+		}
+
+		d = &dst[n_dst];
+		memset (d, 0, sizeof (VertexData));
+		d->num = used * 3;
+		d->encoding = s->encoding;
+		d->scale = s->scale;
+
+		to = (unsigned char *) mmf_malloc (elem * used);
+		if (s->raw != NULL) {
+			d->raw = to;
+		} else {
+			d->vertex = (float *) to;
+		}
+
+		from = vertex_bytes (s);
+		for (h = 0; h < used; h++) {
+			memcpy (&to[h * elem], &from[order[h] * elem], elem);
+			remap[order[h]] = REMAP_NONE;
+		}
+
+		stats->vertex_after += used;
+		stats->bytes_after += used * elem;
+
+		mesh[g].vertex_data_id = n_dst;
+		n_dst++;
+	}
+
+	for (g = 0; g < *num_vertex; g++) {
+		mmf_free (src[g].vertex);
+		mmf_free (src[g].raw);
+	}
+	mmf_free (src);
+	mmf_free (remap);
+	mmf_free (order);
+
+	*vertex = dst;
+	*num_vertex = n_dst;
+
+	return 0;
+}
+
+typedef struct {
+	int32_t cell[3];
+	uint32_t id;
+} WeldEntry;
+
+#define WELD_EMPTY 0xFFFFFFFF
+
+static void weld_cell (float *p, float tolerance, int32_t *cell) {
+	double c;
+	uint32_t u;
+	float f;
+	int g;
+
+	for (g = 0; g < 3; g++) {
+		if (tolerance <= 0.0) {
+			/* Soldadura exacta: la celda es el patrón de bits, con -0 igual a 0 */
+			f = p[g];
+			if (f == 0.0) f = 0.0;
+			memcpy (&u, &f, sizeof (u));
+			cell[g] = (int32_t) u;
+			continue;
+		}
+
+		c = floor ((double) p[g] / tolerance);
+		if (c > 2147483647.0) c = 2147483647.0;
+		if (c < -2147483647.0) c = -2147483647.0;
+		cell[g] = (int32_t) c;
+	}
+}
+
+static uint32_t weld_hash (int32_t *cell) {
+	return ((uint32_t) cell[0] * 73856093u) ^ ((uint32_t) cell[1] * 19349663u) ^ ((uint32_t) cell[2] * 83492791u);
+}
+
+/* Busca un vértice ya soldado a menos de tolerance (por componente) en la celda dada */
+static uint32_t weld_find (WeldEntry *table, uint32_t mask, int32_t *cell, float *out, float *p, float tolerance) {
+	uint32_t pos;
+	float *q;
+
+	pos = weld_hash (cell) & mask;
+	while (table[pos].id != WELD_EMPTY) {
+		if (table[pos].cell[0] == cell[0] && table[pos].cell[1] == cell[1] && table[pos].cell[2] == cell[2]) {
+			q = &out[table[pos].id * 3];
+
+			if (tolerance <= 0.0) return table[pos].id;
+
+			if (fabsf (q[0] - p[0]) <= tolerance && fabsf (q[1] - p[1]) <= tolerance && fabsf (q[2] - p[2]) <= tolerance) {
+				return table[pos].id;
+			}
+		}
+		pos = (pos + 1) & mask;
+	}
+
+	return WELD_EMPTY;
+}
+
+int weld_vertices (VertexData **vertex, int *num_vertex, MeshData *mesh, int num_meshes, float tolerance, WeldStats *stats) {
+	VertexData *src, *dst;
+	WeldEntry *table;
+	uint32_t *remap, *base;
+	uint32_t size, mask, pos, found, used, total, count;
+	int32_t cell[3], near[3];
+	float *out, *p;
+	int g, h, dx, dy, dz;
+
+	src = *vertex;
+
+	memset (stats, 0, sizeof (WeldStats));
+
+	/* La soldadura compara posiciones reales, los flujos cuantizados se expanden */
+	total = 0;
+	base = (uint32_t *) mmf_malloc (sizeof (uint32_t) * (*num_vertex + 1));
+	for (g = 0; g < *num_vertex; g++) {
+		vertex_data_expand (&src[g]);
+		base[g] = total;
+		if (src[g].vertex != NULL) total += src[g].num / 3;
+	}
+	stats->vertex_before = total;
+
+	/* Tabla con direccionamiento abierto, al menos el doble de entradas que vértices */
+	size = 16;
+	while (size < total * 2) size = size * 2;
+	mask = size - 1;
+
+	table = (WeldEntry *) mmf_malloc (sizeof (WeldEntry) * size);
+	memset (table, 0xFF, sizeof (WeldEntry) * size);
+
+	remap = (uint32_t *) mmf_malloc (sizeof (uint32_t) * (total + 1));
+	out = (float *) mmf_malloc (sizeof (float) * 3 * (total + 1));
+	used = 0;
+
+	for (g = 0; g < *num_vertex; g++) {
+		if (src[g].vertex == NULL) continue;
+
+		count = src[g].num / 3;
+		for (h = 0; h < count; h++) {
+			p = &src[g].vertex[h * 3];
+			weld_cell (p, tolerance, cell);
+
+			found = WELD_EMPTY;
+			if (tolerance <= 0.0) {
+				found = weld_find (table, mask, cell, out, p, tolerance);
+			} else {
+				/* Un vértice dentro de la tolerancia puede caer en cualquiera de las 27 celdas vecinas */
+				for (dx = -1; dx <= 1 && found == WELD_EMPTY; dx++) {
+					for (dy = -1; dy <= 1 && found == WELD_EMPTY; dy++) {
+						for (dz = -1; dz <= 1 && found == WELD_EMPTY; dz++) {
+							near[0] = cell[0] + dx;
+							near[1] = cell[1] + dy;
+							near[2] = cell[2] + dz;
+							found = weld_find (table, mask, near, out, p, tolerance);
+						}
+					}
+				}
+			}
+
+			if (found == WELD_EMPTY) {
+				found = used;
+				memcpy (&out[used * 3], p, sizeof (float) * 3);
+
+				pos = weld_hash (cell) & mask;
+				while (table[pos].id != WELD_EMPTY) {
+					pos = (pos + 1) & mask;
+				}
+				memcpy (table[pos].cell, cell, sizeof (cell));
+				table[pos].id = used;
+				used++;
+			}
+
+			remap[base[g] + h] = found;
+		}
+	}
+
+	/* Todos los meshes pasan a apuntar al único VertexData soldado, los que no se pueden remapear pierden sus caras */
+	for (g = 0; g < num_meshes; g++) {
+		if (mesh[g].vertex_data_id < 0 || mesh[g].vertex_data_id >= *num_vertex || src[mesh[g].vertex_data_id].vertex == NULL) {
+			mesh[g].vertex_data_id = -1;
+			mesh[g].num_index = 0;
+			continue;
+		}
+
+		count = src[mesh[g].vertex_data_id].num / 3;
+		for (h = 0; h < mesh[g].num_index; h++) {
+			if (mesh[g].index[h] >= count) break;
+		}
+
+		if (h < mesh[g].num_index) {
+			log_warn ("Mesh %s has indices out of range, dropping its faces\n", mesh[g].name);
+			mesh[g].vertex_data_id = -1;
+			mesh[g].num_index = 0;
+			continue;
+		}
+
+		for (h = 0; h < mesh[g].num_index; h++) {
+			mesh[g].index[h] = remap[base[mesh[g].vertex_data_id] + mesh[g].index[h]];
+		}
+		mesh[g].vertex_data_id = 0;
+	}
+
+	for (g = 0; g < *num_vertex; g++) {
+		mmf_free (src[g].vertex);
+	}
+	mmf_free (src);
+	mmf_free (base);
+	mmf_free (remap);
+	mmf_free (table);
+
+	dst = (VertexData *) mmf_malloc (sizeof (VertexData));
+	memset (dst, 0, sizeof (VertexData));
+	dst->vertex = (float *) mmf_realloc (out, sizeof (float) * 3 * (used + 1));
+	dst->num = used * 3;
+	dst->encoding = ENCODING_NONE;
+	dst->scale = 1.0;
+
+	stats->vertex_after = used;
+
+	*vertex = dst;
+	*num_vertex = 1;
+
+	return 0;
+}
+
+/* Fallos de una caché FIFO de VERTEX_CACHE_SIZE entradas al dibujar los triángulos en orden */
+static int count_cache_misses (uint32_t *index, int num_index, uint32_t *cache_time, int num_vertex_count) {
+	int g, misses, time;
+
+	for (g = 0; g < num_vertex_count; g++) {
+		cache_time[g] = 0;
+	}
+
+	misses = 0;
+	time = VERTEX_CACHE_SIZE + 1;
+	for (g = 0; g < num_index; g++) {
+		/* Un vértice sigue en la caché si entró hace menos de VERTEX_CACHE_SIZE fallos */
+		if (time - cache_time[index[g]] > VERTEX_CACHE_SIZE) {
+			cache_time[index[g]] = time;
+			time++;
+			misses++;
+		}
+	}
+
+	return misses;
+}
+
+/* Algoritmo Tipsify (Sander, Nehab, Barczak 2007), reordena los triángulos de un mesh */
+static void tipsify (uint32_t *index, int num_tris, int count, uint32_t *out) {
+	uint32_t *adj_offset, *adj, *live, *cache_time, *dead_end, *candidates;
+	unsigned char *emitted;
+	int g, h, k, t, v, f, best, priority, p;
+	int time, cursor, dead_top, n_candidates, n_out;
+
+	adj_offset = (uint32_t *) mmf_malloc (sizeof (uint32_t) * (count + 1));
+	live = (uint32_t *) mmf_malloc (sizeof (uint32_t) * (count + 1));
+	cache_time = (uint32_t *) mmf_malloc (sizeof (uint32_t) * (count + 1));
+	adj = (uint32_t *) mmf_malloc (sizeof (uint32_t) * (num_tris * 3 + 1));
+	dead_end = (uint32_t *) mmf_malloc (sizeof (uint32_t) * (num_tris * 3 + 1));
+	candidates = (uint32_t *) mmf_malloc (sizeof (uint32_t) * (num_tris * 3 + 1));
+	emitted = (unsigned char *) mmf_malloc (num_tris + 1);
+
+	/* Lista de adyacencia vértice -> triángulos */
+	memset (live, 0, sizeof (uint32_t) * (count + 1));
+	memset (cache_time, 0, sizeof (uint32_t) * (count + 1));
+	memset (emitted, 0, num_tris + 1);
+	for (g = 0; g < num_tris * 3; g++) {
+		live[index[g]]++;
+	}
+
+	adj_offset[0] = 0;
+	for (g = 0; g < count; g++) {
+		adj_offset[g + 1] = adj_offset[g] + live[g];
+	}
+
+	memset (cache_time, 0, sizeof (uint32_t) * (count + 1));
+	for (g = 0; g < num_tris * 3; g++) {
+		v = index[g];
+		adj[adj_offset[v] + cache_time[v]] = g / 3;
+		cache_time[v]++;
+	}
+	memset (cache_time, 0, sizeof (uint32_t) * (count + 1));
+
+	time = VERTEX_CACHE_SIZE + 1;
+	cursor = 0;
+	dead_top = 0;
+	n_out = 0;
+	f = 0;
+
+	while (f >= 0) {
+		n_candidates = 0;
+
+		for (h = adj_offset[f]; h < adj_offset[f + 1]; h++) {
+			t = adj[h];
+			if (emitted[t]) continue;
+
+			for (k = 0; k < 3; k++) {
+				v = index[t * 3 + k];
+				out[n_out++] = v;
+				dead_end[dead_top++] = v;
+				candidates[n_candidates++] = v;
+				live[v]--;
+
+				if (time - cache_time[v] > VERTEX_CACHE_SIZE) {
+					cache_time[v] = time;
+					time++;
+				}
+			}
+			emitted[t] = 1;
+		}
+
+		/* Elegir el siguiente vértice: el que siga en caché y tenga triángulos pendientes */
+		best = -1;
+		priority = -1;
+		for (h = 0; h < n_candidates; h++) {
+			v = candidates[h];
+			if (live[v] == 0) continue;
+
+			p = 0;
+			if (time - cache_time[v] + 2 * live[v] <= VERTEX_CACHE_SIZE) {
+				p = time - cache_time[v];
+			}
+
+			if (p > priority) {
+				priority = p;
+				best = v;
+			}
+		}
+
+		if (best == -1) {
+			/* Callejón sin salida: regresar por la pila de vértices recientes, o avanzar el cursor */
+			while (dead_top > 0) {
+				v = dead_end[--dead_top];
+				if (live[v] > 0) {
+					best = v;
+					break;
+				}
+			}
+
+			while (best == -1 && cursor < count) {
+				if (live[cursor] > 0) {
+					best = cursor;
+				}
+				cursor++;
+			}
+		}
+
+		f = best;
+	}
+
+	mmf_free (adj_offset);
+	mmf_free (adj);
+	mmf_free (live);
+	mmf_free (cache_time);
+	mmf_free (dead_end);
+	mmf_free (candidates);
+	mmf_free (emitted);
+}
+
+static int mesh_indices_valid (MeshData *mesh, VertexData *vertex, int num_vertex) {
+	int h, count;
+
+	if (!mesh->renderable || mesh->index == NULL || mesh->num_index < 3) return 0;
+	if (mesh->vertex_data_id < 0 || mesh->vertex_data_id >= num_vertex) return 0;
+
+	count = vertex[mesh->vertex_data_id].num / 3;
+	for (h = 0; h < mesh->num_index; h++) {
+		if (mesh->index[h] >= count) return 0;
+	}
+
+	return 1;
+}
+
+int optimize_vertex_cache (VertexData *vertex, int num_vertex, MeshData *mesh, int num_meshes, CacheStats *stats) {
+	uint32_t *out, *remap, *order, *scratch;
+	int g, h, m, num_tris, count, max_count, used;
+	size_t elem;
+	unsigned char *from, *to;
+
+	memset (stats, 0, sizeof (CacheStats));
+
+	max_count = 0;
+	for (g = 0; g < num_vertex; g++) {
+		if (vertex[g].num / 3 > max_count) max_count = vertex[g].num / 3;
+	}
+
+	scratch = (uint32_t *) mmf_malloc (sizeof (uint32_t) * (max_count + 1));
+
+	/* Primero el orden de los triángulos de cada mesh */
+	for (m = 0; m < num_meshes; m++) {
+		if (!mesh_indices_valid (&mesh[m], vertex, num_vertex)) continue;
+
+		count = vertex[mesh[m].vertex_data_id].num / 3;
+		num_tris = mesh[m].num_index / 3;
+
+		out = (uint32_t *) mmf_malloc (sizeof (uint32_t) * mesh[m].num_index);
+		tipsify (mesh[m].index, num_tris, count, out);
+
+		/* Los índices sobrantes (que no forman triángulo) se dejan al final */
+		for (h = num_tris * 3; h < mesh[m].num_index; h++) {
+			out[h] = mesh[m].index[h];
+		}
+
+		stats->triangles += num_tris;
+		g = count_cache_misses (mesh[m].index, num_tris * 3, scratch, count);
+		h = count_cache_misses (out, num_tris * 3, scratch, count);
+		stats->misses_before += g;
+		stats->misses_after += h;
+
+		log_debug ("Mesh %s: ACMR %.3f -> %.3f\n", mesh[m].name, (float) g / num_tris, (float) h / num_tris);
+
+		mmf_free (mesh[m].index);
+		mesh[m].index = out;
+	}
+
+	mmf_free (scratch);
+
+	/* Luego los vértices, en el orden en que se usan, para leer la memoria de forma secuencial */
+	for (g = 0; g < num_vertex; g++) {
+		if (vertex[g].vertex == NULL && vertex[g].raw == NULL) continue;
+
+		count = vertex[g].num / 3;
+
+		/* Un mesh con índices fuera de rango no se puede remapear, y al mover los vértices quedaría apuntando a otros */
+		for (m = 0; m < num_meshes; m++) {
+			if (mesh[m].vertex_data_id != g || mesh[m].index == NULL) continue;
+
+			for (h = 0; h < mesh[m].num_index; h++) {
+				if (mesh[m].index[h] >= count) break;
+			}
+
+			if (h < mesh[m].num_index) break;
+		}
+
+		if (m < num_meshes) {
+			log_warn ("Mesh %s has indices out of range, keeping the vertex order of vertex data %i\n", mesh[m].name, g);
+			continue;
+		}
+
+		remap = (uint32_t *) mmf_malloc (sizeof (uint32_t) * (count + 1));
+		order = (uint32_t *) mmf_malloc (sizeof (uint32_t) * (count + 1));
+		memset (remap, 0xFF, sizeof (uint32_t) * (count + 1));
+
+		used = 0;
+		for (m = 0; m < num_meshes; m++) {
+			if (mesh[m].vertex_data_id != g || !mesh_indices_valid (&mesh[m], vertex, num_vertex)) continue;
+
+			for (h = 0; h < mesh[m].num_index; h++) {
+				if (remap[mesh[m].index[h]] == REMAP_NONE) {
+					remap[mesh[m].index[h]] = used;
+					order[used] = mesh[m].index[h];
+					used++;
+				}
+			}
+		}
+
+		/* Los vértices que ningún mesh usa se quedan al final */
+		for (h = 0; h < count; h++) {
+			if (remap[h] == REMAP_NONE) {
+				remap[h] = used;
+				order[used] = h;
+				used++;
+			}
+		}
+
+		for (m = 0; m < num_meshes; m++) {
+			if (mesh[m].vertex_data_id != g || mesh[m].index == NULL) continue;
+
+			for (h = 0; h < mesh[m].num_index; h++) {
+				mesh[m].index[h] = remap[mesh[m].index[h]];
+			}
+		}
+
+		elem = vertex_element_size (&vertex[g]);
+		from = vertex_bytes (&vertex[g]);
+		to = (unsigned char *) mmf_malloc (elem * (count + 1));
+		for (h = 0; h < count; h++) {
+			memcpy (&to[h * elem], &from[order[h] * elem], elem);
+		}
+
+		/* Si num no es múltiplo de 3, el componente sobrante no pertenece a ningún vértice */
+		vertex[g].num = count * 3;
+		if (vertex[g].raw != NULL) {
+			mmf_free (vertex[g].raw);
+			vertex[g].raw = to;
+		} else {
+			mmf_free (vertex[g].vertex);
+			vertex[g].vertex = (float *) to;
+		}
+
+		mmf_free (remap);
+		mmf_free (order);
+	}
+
+	return 0;
+}
@@ -0,0 +1,41 @@
+#ifndef __OPTIMIZE_H__
+#define __OPTIMIZE_H__
+
+#include "mmf.h"
+
+typedef struct {
+	int vertex_before;
+	int vertex_after;
+
+	/* Bytes de vértices en memoria antes y después */
+	size_t bytes_before;
+	size_t bytes_after;
+
+	/* Bytes que arrastraría exportar cada mesh por separado con su VertexData completo */
+	size_t bytes_per_mesh_before;
+} CompactStats;
+
+typedef struct {
+	int vertex_before;
+	int vertex_after;
+} WeldStats;
+
+typedef struct {
+	int triangles;
+	int misses_before;
+	int misses_after;
+} CacheStats;
+
+#define VERTEX_CACHE_SIZE 16
+
+/* Bytes de un vértice y su flujo, cuantizado o expandido */
+size_t vertex_element_size (VertexData *vertex);
+unsigned char *vertex_bytes (VertexData *vertex);
+
+int compact_meshes (VertexData **vertex, int *num_vertex, MeshData *mesh, int num_meshes, CompactStats *stats);
+
+int weld_vertices (VertexData **vertex, int *num_vertex, MeshData *mesh, int num_meshes, float tolerance, WeldStats *stats);
+
+int optimize_vertex_cache (VertexData *vertex, int num_vertex, MeshData *mesh, int num_meshes, CacheStats *stats);
+
+#endif /* __OPTIMIZE_H__ */
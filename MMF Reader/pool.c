@@ -0,0 +1,314 @@
+/*
+ * pool.c
+ * This file is part of BKV Reader
+ *
+ * Copyright (C) 2022 - Félix Arreola Rodríguez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <pthread.h>
+
+#include "pool.h"
+#include "log.h"
+
+typedef struct {
+	PoolTask func;
+	void *data;
+	TaskGroup *group;
+} Task;
+
+/* Cola doble de cada hilo: el dueño mete y saca por la cola, los demás roban por la cabeza */
+typedef struct {
+	pthread_mutex_t lock;
+
+	Task *tasks;
+	int head;
+	int count;
+	int size;
+} WorkQueue;
+
+struct _ThreadPool {
+	/* Una cola por hilo pedido; si alguno no arrancó, su cola la vacían los demás robando */
+	int n_threads;
+	int n_started;
+	pthread_t *threads;
+	WorkQueue *queues;
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int queued;
+	int next_queue;
+	int stop;
+};
+
+typedef struct {
+	ThreadPool *pool;
+	int id;
+} WorkerStart;
+
+static __thread ThreadPool *worker_pool = NULL;
+static __thread int worker_id = -1;
+
+static void queue_push (WorkQueue *queue, Task *task) {
+	Task *tasks;
+	int g;
+
+	pthread_mutex_lock (&queue->lock);
+	if (queue->count == queue->size) {
+		tasks = (Task *) malloc (sizeof (Task) * queue->size * 2);
+		for (g = 0; g < queue->count; g++) {
+			tasks[g] = queue->tasks[(queue->head + g) % queue->size];
+		}
+		free (queue->tasks);
+		queue->tasks = tasks;
+		queue->head = 0;
+		queue->size = queue->size * 2;
+	}
+
+	queue->tasks[(queue->head + queue->count) % queue->size] = *task;
+	queue->count++;
+	pthread_mutex_unlock (&queue->lock);
+}
+
+static int queue_pop_tail (WorkQueue *queue, Task *task) {
+	int found;
+
+	found = 0;
+	pthread_mutex_lock (&queue->lock);
+	if (queue->count > 0) {
+		queue->count--;
+		*task = queue->tasks[(queue->head + queue->count) % queue->size];
+		found = 1;
+	}
+	pthread_mutex_unlock (&queue->lock);
+
+	return found;
+}
+
+static int queue_steal_head (WorkQueue *queue, Task *task) {
+	int found;
+
+	found = 0;
+	pthread_mutex_lock (&queue->lock);
+	if (queue->count > 0) {
+		*task = queue->tasks[queue->head];
+		queue->head = (queue->head + 1) % queue->size;
+		queue->count--;
+		found = 1;
+	}
+	pthread_mutex_unlock (&queue->lock);
+
+	return found;
+}
+
+/* Ejecuta una tarea, de la cola propia si hay, si no, robada de otro hilo */
+static int pool_run_one (ThreadPool *pool, int id) {
+	Task task;
+	int g, found;
+
+	found = 0;
+	if (id >= 0) {
+		found = queue_pop_tail (&pool->queues[id], &task);
+	}
+
+	for (g = 1; !found && g <= pool->n_threads; g++) {
+		found = queue_steal_head (&pool->queues[(id + g + pool->n_threads) % pool->n_threads], &task);
+	}
+
+	if (!found) return 0;
+
+	pthread_mutex_lock (&pool->lock);
+	pool->queued--;
+	pthread_mutex_unlock (&pool->lock);
+
+	task.func (task.data);
+
+	pthread_mutex_lock (&pool->lock);
+	task.group->pending--;
+	if (task.group->pending == 0) {
+		pthread_cond_broadcast (&pool->cond);
+	}
+	pthread_mutex_unlock (&pool->lock);
+
+	return 1;
+}
+
+static void *pool_worker (void *data) {
+	WorkerStart *start = (WorkerStart *) data;
+	ThreadPool *pool;
+
+	pool = start->pool;
+	worker_pool = pool;
+	worker_id = start->id;
+	free (start);
+
+	while (1) {
+		if (pool_run_one (pool, worker_id)) continue;
+
+		pthread_mutex_lock (&pool->lock);
+		while (pool->queued == 0 && !pool->stop) {
+			pthread_cond_wait (&pool->cond, &pool->lock);
+		}
+
+		if (pool->stop && pool->queued == 0) {
+			pthread_mutex_unlock (&pool->lock);
+			break;
+		}
+		pthread_mutex_unlock (&pool->lock);
+	}
+
+	return NULL;
+}
+
+int pool_default_threads (void) {
+	long n;
+
+#ifdef _SC_NPROCESSORS_ONLN
+	n = sysconf (_SC_NPROCESSORS_ONLN);
+#else
+	n = 1;
+#endif
+
+	if (n < 1) n = 1;
+
+	return (int) n;
+}
+
+ThreadPool *pool_create (int threads) {
+	ThreadPool *pool;
+	WorkerStart *start;
+	int g;
+
+	if (threads < 1) threads = pool_default_threads ();
+
+	pool = (ThreadPool *) malloc (sizeof (ThreadPool));
+	memset (pool, 0, sizeof (ThreadPool));
+
+	pool->n_threads = threads;
+	pthread_mutex_init (&pool->lock, NULL);
+	pthread_cond_init (&pool->cond, NULL);
+
+	pool->queues = (WorkQueue *) malloc (sizeof (WorkQueue) * threads);
+	for (g = 0; g < threads; g++) {
+		pthread_mutex_init (&pool->queues[g].lock, NULL);
+		pool->queues[g].size = 16;
+		pool->queues[g].head = 0;
+		pool->queues[g].count = 0;
+		pool->queues[g].tasks = (Task *) malloc (sizeof (Task) * pool->queues[g].size);
+	}
+
+	pool->threads = (pthread_t *) malloc (sizeof (pthread_t) * threads);
+	for (g = 0; g < threads; g++) {
+		start = (WorkerStart *) malloc (sizeof (WorkerStart));
+		start->pool = pool;
+		start->id = g;
+		if (pthread_create (&pool->threads[pool->n_started], NULL, pool_worker, start) != 0) {
+			free (start);
+			continue;
+		}
+		pool->n_started++;
+	}
+
+	/* Sin ningún hilo, pool_wait ejecuta todas las tareas en el hilo que espera */
+	if (pool->n_started < threads) {
+		log_warn ("Could only start %i of %i worker threads\n", pool->n_started, threads);
+	}
+
+	return pool;
+}
+
+void pool_destroy (ThreadPool *pool) {
+	int g;
+
+	pthread_mutex_lock (&pool->lock);
+	pool->stop = 1;
+	pthread_cond_broadcast (&pool->cond);
+	pthread_mutex_unlock (&pool->lock);
+
+	for (g = 0; g < pool->n_started; g++) {
+		pthread_join (pool->threads[g], NULL);
+	}
+
+	for (g = 0; g < pool->n_threads; g++) {
+		pthread_mutex_destroy (&pool->queues[g].lock);
+		free (pool->queues[g].tasks);
+	}
+
+	pthread_mutex_destroy (&pool->lock);
+	pthread_cond_destroy (&pool->cond);
+	free (pool->queues);
+	free (pool->threads);
+	free (pool);
+}
+
+void pool_group_init (TaskGroup *group) {
+	group->pending = 0;
+}
+
+void pool_submit (ThreadPool *pool, TaskGroup *group, PoolTask func, void *data) {
+	Task task;
+	int id;
+
+	task.func = func;
+	task.data = data;
+	task.group = group;
+
+	pthread_mutex_lock (&pool->lock);
+	group->pending++;
+	pool->queued++;
+	if (worker_pool == pool) {
+		/* Las subtareas de un hilo van a su propia cola */
+		id = worker_id;
+	} else {
+		id = pool->next_queue;
+		pool->next_queue = (pool->next_queue + 1) % pool->n_threads;
+	}
+	pthread_mutex_unlock (&pool->lock);
+
+	queue_push (&pool->queues[id], &task);
+
+	pthread_mutex_lock (&pool->lock);
+	pthread_cond_broadcast (&pool->cond);
+	pthread_mutex_unlock (&pool->lock);
+}
+
+/* Mientras el grupo no termine, el hilo que espera también ejecuta tareas */
+void pool_wait (ThreadPool *pool, TaskGroup *group) {
+	int id;
+
+	id = (worker_pool == pool ? worker_id : -1);
+
+	while (1) {
+		pthread_mutex_lock (&pool->lock);
+		if (group->pending == 0) {
+			pthread_mutex_unlock (&pool->lock);
+			return;
+		}
+		pthread_mutex_unlock (&pool->lock);
+
+		if (pool_run_one (pool, id)) continue;
+
+		pthread_mutex_lock (&pool->lock);
+		if (group->pending > 0 && pool->queued == 0) {
+			pthread_cond_wait (&pool->cond, &pool->lock);
+		}
+		pthread_mutex_unlock (&pool->lock);
+	}
+}
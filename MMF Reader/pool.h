@@ -0,0 +1,20 @@
+#ifndef __POOL_H__
+#define __POOL_H__
+
+typedef void (*PoolTask) (void *data);
+
+typedef struct _ThreadPool ThreadPool;
+
+typedef struct {
+	int pending;
+} TaskGroup;
+
+ThreadPool *pool_create (int threads);
+void pool_destroy (ThreadPool *pool);
+int pool_default_threads (void);
+
+void pool_group_init (TaskGroup *group);
+void pool_submit (ThreadPool *pool, TaskGroup *group, PoolTask func, void *data);
+void pool_wait (ThreadPool *pool, TaskGroup *group);
+
+#endif /* __POOL_H__ */
@@ -0,0 +1,158 @@
+/*
+ * scene.c
+ * This file is part of BKV Reader
+ *
+ * Copyright (C) 2022 - Félix Arreola Rodríguez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mmf.h"
+#include "arena.h"
+#include "log.h"
+#include "scene.h"
+
+/* El primer mesh anterior que lee el mismo index-N con el mismo VertexData, o -1 */
+int mesh_find_instance (Table *meshes_tables, int g) {
+	Table *t, *other;
+	uint32_t id, vert;
+	int h;
+
+	t = get_index_as_table (meshes_tables, g);
+	if (t == NULL || get_key_as_boolean (t, "nonrendered")) return -1;
+
+	id = get_key_as_int (t, "id");
+	vert = get_key_as_int (t, "vert");
+
+	for (h = 0; h < g; h++) {
+		other = get_index_as_table (meshes_tables, h);
+		if (other == NULL || get_key_as_boolean (other, "nonrendered")) continue;
+
+		if (get_key_as_int (other, "id") == id && get_key_as_int (other, "vert") == vert) return h;
+	}
+
+	return -1;
+}
+
+/* El mesh que tiene los índices y el VertexData de g */
+MeshData *mesh_geometry (MeshData *mesh, int num_meshes, int g) {
+	if (mesh[g].instance_of >= 0 && mesh[g].instance_of < num_meshes) {
+		return &mesh[mesh[g].instance_of];
+	}
+
+	return &mesh[g];
+}
+
+static int bone_is_root (BKVDesc *bkv_desc, int g) {
+	int parent;
+
+	parent = bkv_desc->bones[g].parent;
+
+	return (parent < 0 || parent >= bkv_desc->n_bones || parent == g);
+}
+
+/* Nodos en el orden del GLB: las instancias de los meshes, los huesos y al final las
+ * transformaciones que ningún hueso usa. Una instancia con "transform" cuelga del nodo
+ * que tiene esa transformación; las demás son raíces */
+int build_scene (MMFModel *model) {
+	BKVDesc *desc = &model->desc;
+	SceneNode *node;
+	MeshData *geometry;
+	int *transform_node;
+	int g, h, n, instances, first_bone;
+
+	model->nodes = NULL;
+	model->num_nodes = 0;
+
+	n = desc->n_bones + desc->n_transforms;
+	for (g = 0; g < model->num_meshes; g++) {
+		geometry = mesh_geometry (model->mesh, model->num_meshes, g);
+		if (model->mesh[g].renderable && geometry->index != NULL) n++;
+	}
+	if (n == 0) return 0;
+
+	model->nodes = (SceneNode *) mmf_malloc (sizeof (SceneNode) * n);
+	transform_node = (int *) mmf_malloc (sizeof (int) * (desc->n_transforms + 1));
+	for (g = 0; g < desc->n_transforms; g++) {
+		transform_node[g] = -1;
+	}
+
+	instances = 0;
+	for (g = 0; g < model->num_meshes; g++) {
+		geometry = mesh_geometry (model->mesh, model->num_meshes, g);
+		if (!model->mesh[g].renderable || geometry->index == NULL) continue;
+
+		if (geometry != &model->mesh[g]) {
+			/* La instancia comparte la caja de su geometría */
+			memcpy (model->mesh[g].min, geometry->min, sizeof (geometry->min));
+			memcpy (model->mesh[g].max, geometry->max, sizeof (geometry->max));
+			instances++;
+		}
+
+		node = &model->nodes[model->num_nodes++];
+		node->name = model->mesh[g].name;
+		node->parent = -1;
+		node->transform = -1;
+		node->mesh = g;
+	}
+
+	first_bone = model->num_nodes;
+	for (g = 0; g < desc->n_bones; g++) {
+		node = &model->nodes[model->num_nodes++];
+		node->name = desc->bones[g].name;
+		node->parent = (bone_is_root (desc, g) ? -1 : first_bone + desc->bones[g].parent);
+		node->transform = -1;
+		node->mesh = -1;
+
+		h = desc->bones[g].transform;
+		if (h >= 0 && h < desc->n_transforms) {
+			node->transform = h;
+			if (transform_node[h] < 0) transform_node[h] = first_bone + g;
+		}
+	}
+
+	for (g = 0; g < desc->n_transforms; g++) {
+		if (transform_node[g] >= 0) continue;
+
+		node = &model->nodes[model->num_nodes];
+		node->name = NULL;
+		node->parent = -1;
+		node->transform = g;
+		node->mesh = -1;
+		transform_node[g] = model->num_nodes++;
+	}
+
+	for (g = 0; g < first_bone; g++) {
+		h = model->mesh[model->nodes[g].mesh].transform;
+		if (h >= 0 && h < desc->n_transforms) {
+			model->nodes[g].parent = transform_node[h];
+		}
+	}
+
+	mmf_free (transform_node);
+
+	if (instances > 0) {
+		log_info ("Scene: %i nodes, %i mesh instances share geometry\n", model->num_nodes, instances);
+	}
+
+	return model->num_nodes;
+}
+
+void scene_free (SceneNode *nodes) {
+	mmf_free (nodes);
+}
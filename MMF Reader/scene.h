@@ -0,0 +1,11 @@
+#ifndef __SCENE_H__
+#define __SCENE_H__
+
+#include "mmf.h"
+
+int mesh_find_instance (Table *meshes_tables, int g);
+int build_scene (MMFModel *model);
+MeshData *mesh_geometry (MeshData *mesh, int num_meshes, int g);
+void scene_free (SceneNode *nodes);
+
+#endif /* __SCENE_H__ */
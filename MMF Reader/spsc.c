@@ -0,0 +1,99 @@
+/*
+ * spsc.c
+ * This file is part of BKV Reader
+ *
+ * Copyright (C) 2022 - Félix Arreola Rodríguez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+
+#include "spsc.h"
+
+/* Primero se cede el CPU, y si la espera sigue se duerme un poco */
+static void spsc_backoff (int *spins) {
+	if (*spins < 64) {
+		sched_yield ();
+		(*spins)++;
+	} else {
+		usleep (50);
+	}
+}
+
+void spsc_init (SpscQueue *queue, unsigned int capacity) {
+	unsigned int size;
+
+	/* Potencia de 2 para usar una máscara en lugar de módulo */
+	size = 2;
+	while (size < capacity) size *= 2;
+
+	memset (queue, 0, sizeof (SpscQueue));
+	queue->slots = (void **) malloc (sizeof (void *) * size);
+	queue->mask = size - 1;
+}
+
+void spsc_free (SpscQueue *queue) {
+	free (queue->slots);
+	queue->slots = NULL;
+}
+
+void spsc_push (SpscQueue *queue, void *item) {
+	unsigned int tail;
+	int spins;
+
+	tail = queue->tail;
+	spins = 0;
+
+	/* Llena: esperar a que el consumidor avance */
+	while (tail - __atomic_load_n (&queue->head, __ATOMIC_ACQUIRE) > queue->mask) {
+		spsc_backoff (&spins);
+	}
+
+	queue->slots[tail & queue->mask] = item;
+	__atomic_store_n (&queue->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/* NULL cuando la cola está cerrada y vacía */
+void *spsc_pop (SpscQueue *queue) {
+	unsigned int head;
+	void *item;
+	int spins;
+
+	head = queue->head;
+	spins = 0;
+
+	while (head == __atomic_load_n (&queue->tail, __ATOMIC_ACQUIRE)) {
+		if (__atomic_load_n (&queue->closed, __ATOMIC_ACQUIRE)) {
+			/* Lo que se metió antes de cerrar ya es visible */
+			if (head == __atomic_load_n (&queue->tail, __ATOMIC_ACQUIRE)) return NULL;
+			break;
+		}
+		spsc_backoff (&spins);
+	}
+
+	item = queue->slots[head & queue->mask];
+	__atomic_store_n (&queue->head, head + 1, __ATOMIC_RELEASE);
+
+	return item;
+}
+
+/* Solo el productor, después de su último spsc_push */
+void spsc_close (SpscQueue *queue) {
+	__atomic_store_n (&queue->closed, 1, __ATOMIC_RELEASE);
+}
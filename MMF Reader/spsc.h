@@ -0,0 +1,22 @@
+#ifndef __SPSC_H__
+#define __SPSC_H__
+
+/* Cola acotada de un solo productor y un solo consumidor, sin candados.
+ * Lo que se mete pasa a ser del consumidor */
+typedef struct {
+	void **slots;
+	unsigned int mask;
+
+	/* Cada índice en su propia línea de caché, los escribe un solo hilo */
+	unsigned int head __attribute__ ((aligned (64)));
+	unsigned int tail __attribute__ ((aligned (64)));
+	int closed __attribute__ ((aligned (64)));
+} SpscQueue;
+
+void spsc_init (SpscQueue *queue, unsigned int capacity);
+void spsc_free (SpscQueue *queue);
+void spsc_push (SpscQueue *queue, void *item);
+void *spsc_pop (SpscQueue *queue);
+void spsc_close (SpscQueue *queue);
+
+#endif /* __SPSC_H__ */
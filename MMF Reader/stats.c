@@ -0,0 +1,285 @@
+/*
+ * stats.c
+ * This file is part of BKV Reader
+ *
+ * Copyright (C) 2022 - Félix Arreola Rodríguez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <pthread.h>
+
+#include "stats.h"
+#include "json.h"
+
+/* Más archivos que esto solo se cuentan en las etapas */
+#define STATS_MAX_FILES 65536
+
+typedef struct {
+	uint64_t ns;
+	uint64_t calls;
+	uint64_t bytes;
+	uint64_t syscalls;
+	uint64_t allocs;
+	uint64_t elements;
+} StatCounter;
+
+/* Solo el dueño escribe; el reporte lee con cargas atómicas */
+typedef struct _StatThread {
+	StatCounter stages[STAT_NUM];
+
+	uint64_t bytes;
+	uint64_t syscalls;
+	uint64_t allocs;
+
+	struct _StatThread *next;
+} StatThread;
+
+typedef struct {
+	int stage;
+	char *name;
+	StatCounter counter;
+} StatFile;
+
+static const char *stage_names[STAT_NUM] = {
+	"model",
+	"desc",
+	"preload",
+	"transform",
+	"skeleton",
+	"vertex",
+	"index",
+	"blend",
+	"postprocess",
+	"scene",
+	"normals",
+	"bvh",
+	"lod",
+	"export"
+};
+
+int stats_enabled = 0;
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t stats_key;
+static uint64_t stats_start;
+
+static StatThread *threads = NULL;
+
+/* Lo de los hilos que ya terminaron */
+static StatCounter retired[STAT_NUM];
+
+static StatFile *files = NULL;
+static int n_files = 0;
+static int files_size = 0;
+static int files_dropped = 0;
+
+static __thread StatThread *current_thread = NULL;
+
+static uint64_t now_ns (void) {
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void counter_add (StatCounter *to, const StatCounter *from) {
+	to->ns += __atomic_load_n (&from->ns, __ATOMIC_RELAXED);
+	to->calls += __atomic_load_n (&from->calls, __ATOMIC_RELAXED);
+	to->bytes += __atomic_load_n (&from->bytes, __ATOMIC_RELAXED);
+	to->syscalls += __atomic_load_n (&from->syscalls, __ATOMIC_RELAXED);
+	to->allocs += __atomic_load_n (&from->allocs, __ATOMIC_RELAXED);
+	to->elements += __atomic_load_n (&from->elements, __ATOMIC_RELAXED);
+}
+
+static void stats_thread_exit (void *data) {
+	StatThread *thread = (StatThread *) data;
+	StatThread **p;
+	int g;
+
+	pthread_mutex_lock (&stats_lock);
+	for (g = 0; g < STAT_NUM; g++) {
+		counter_add (&retired[g], &thread->stages[g]);
+	}
+
+	for (p = &threads; *p != NULL; p = &(*p)->next) {
+		if (*p == thread) {
+			*p = thread->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock (&stats_lock);
+
+	free (thread);
+}
+
+void stats_enable (void) {
+	pthread_key_create (&stats_key, stats_thread_exit);
+	stats_start = now_ns ();
+	stats_enabled = 1;
+}
+
+static StatThread *stats_get_thread (void) {
+	StatThread *thread;
+
+	if (current_thread != NULL) return current_thread;
+
+	thread = (StatThread *) malloc (sizeof (StatThread));
+	memset (thread, 0, sizeof (StatThread));
+
+	pthread_mutex_lock (&stats_lock);
+	thread->next = threads;
+	threads = thread;
+	pthread_mutex_unlock (&stats_lock);
+
+	pthread_setspecific (stats_key, thread);
+	current_thread = thread;
+
+	return thread;
+}
+
+static void add_relaxed (uint64_t *counter, uint64_t value) {
+	__atomic_store_n (counter, *counter + value, __ATOMIC_RELAXED);
+}
+
+void stats_count_io (uint64_t bytes, uint64_t syscalls) {
+	StatThread *thread;
+
+	thread = stats_get_thread ();
+	thread->bytes += bytes;
+	thread->syscalls += syscalls;
+}
+
+void stats_count_alloc (void) {
+	stats_get_thread ()->allocs++;
+}
+
+void stats_begin (StatScope *scope, int stage) {
+	StatThread *thread;
+
+	scope->stage = stage;
+	if (!stats_enabled) return;
+
+	thread = stats_get_thread ();
+	scope->bytes = thread->bytes;
+	scope->syscalls = thread->syscalls;
+	scope->allocs = thread->allocs;
+	scope->start = now_ns ();
+}
+
+/* Suma la medición a su etapa, y si trae nombre la guarda también por archivo.
+ * Las etapas anidadas se cuentan completas en cada nivel */
+void stats_end (StatScope *scope, const char *folder, const char *name, uint64_t elements) {
+	StatThread *thread;
+	StatCounter delta, *counter;
+	StatFile *file;
+	size_t len;
+
+	if (!stats_enabled) return;
+
+	thread = stats_get_thread ();
+
+	delta.ns = now_ns () - scope->start;
+	delta.calls = 1;
+	delta.bytes = thread->bytes - scope->bytes;
+	delta.syscalls = thread->syscalls - scope->syscalls;
+	delta.allocs = thread->allocs - scope->allocs;
+	delta.elements = elements;
+
+	counter = &thread->stages[scope->stage];
+	add_relaxed (&counter->ns, delta.ns);
+	add_relaxed (&counter->calls, delta.calls);
+	add_relaxed (&counter->bytes, delta.bytes);
+	add_relaxed (&counter->syscalls, delta.syscalls);
+	add_relaxed (&counter->allocs, delta.allocs);
+	add_relaxed (&counter->elements, delta.elements);
+
+	if (name == NULL) return;
+
+	pthread_mutex_lock (&stats_lock);
+	if (n_files == STATS_MAX_FILES) {
+		files_dropped++;
+	} else {
+		if (n_files == files_size) {
+			files_size = (files_size == 0 ? 256 : files_size * 2);
+			files = (StatFile *) realloc (files, sizeof (StatFile) * files_size);
+		}
+
+		file = &files[n_files++];
+		file->stage = scope->stage;
+		file->counter = delta;
+
+		len = strlen (name) + (folder != NULL ? strlen (folder) + 1 : 0) + 1;
+		file->name = (char *) malloc (len);
+		if (folder != NULL) {
+			snprintf (file->name, len, "%s/%s", folder, name);
+		} else {
+			snprintf (file->name, len, "%s", name);
+		}
+	}
+	pthread_mutex_unlock (&stats_lock);
+}
+
+static void json_append_counter (JsonBuffer *json, const StatCounter *counter) {
+	json_append (json, "\"ms\":%.3f,\"calls\":%llu,\"bytes\":%llu,\"syscalls\":%llu,\"allocs\":%llu,\"elements\":%llu",
+	             counter->ns / 1000000.0, (unsigned long long) counter->calls, (unsigned long long) counter->bytes,
+	             (unsigned long long) counter->syscalls, (unsigned long long) counter->allocs, (unsigned long long) counter->elements);
+}
+
+void stats_write_json (FILE *out) {
+	JsonBuffer json;
+	StatCounter totals[STAT_NUM];
+	StatThread *thread;
+	int g;
+
+	if (!stats_enabled) return;
+
+	memset (&json, 0, sizeof (json));
+
+	pthread_mutex_lock (&stats_lock);
+	memcpy (totals, retired, sizeof (totals));
+	for (thread = threads; thread != NULL; thread = thread->next) {
+		for (g = 0; g < STAT_NUM; g++) {
+			counter_add (&totals[g], &thread->stages[g]);
+		}
+	}
+
+	json_append (&json, "{\"wall_ms\":%.3f,\"stages\":{", (now_ns () - stats_start) / 1000000.0);
+	for (g = 0; g < STAT_NUM; g++) {
+		json_append (&json, "%s\"%s\":{", (g > 0 ? "," : ""), stage_names[g]);
+		json_append_counter (&json, &totals[g]);
+		json_append (&json, "}");
+	}
+
+	json_append (&json, "},\"files\":[");
+	for (g = 0; g < n_files; g++) {
+		json_append (&json, "%s{\"stage\":\"%s\",\"name\":", (g > 0 ? "," : ""), stage_names[files[g].stage]);
+		json_append_string (&json, files[g].name);
+		json_append (&json, ",");
+		json_append_counter (&json, &files[g].counter);
+		json_append (&json, "}");
+	}
+	json_append (&json, "],\"files_dropped\":%i}\n", files_dropped);
+	pthread_mutex_unlock (&stats_lock);
+
+	fwrite (json.data, 1, json.len, out);
+	fflush (out);
+	free (json.data);
+}
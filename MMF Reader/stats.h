@@ -0,0 +1,52 @@
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* Etapas de la conversión que se miden por separado */
+enum {
+	STAT_MODEL = 0,
+	STAT_DESC,
+	STAT_PRELOAD,
+	STAT_TRANSFORM,
+	STAT_SKELETON,
+	STAT_VERTEX,
+	STAT_INDEX,
+	STAT_BLEND,
+	STAT_POSTPROCESS,
+	STAT_SCENE,
+	STAT_NORMALS,
+	STAT_BVH,
+	STAT_LOD,
+	STAT_EXPORT,
+
+	STAT_NUM
+};
+
+/* Una medición en curso; los contadores son del hilo que la abrió */
+typedef struct {
+	int stage;
+	uint64_t start;
+
+	uint64_t bytes;
+	uint64_t syscalls;
+	uint64_t allocs;
+} StatScope;
+
+extern int stats_enabled;
+
+/* Cuesta una comparación cuando las estadísticas están apagadas */
+#define STATS_IO(bytes, syscalls) do { if (stats_enabled) stats_count_io ((bytes), (syscalls)); } while (0)
+#define STATS_ALLOC() do { if (stats_enabled) stats_count_alloc (); } while (0)
+
+void stats_enable (void);
+void stats_count_io (uint64_t bytes, uint64_t syscalls);
+void stats_count_alloc (void);
+
+void stats_begin (StatScope *scope, int stage);
+void stats_end (StatScope *scope, const char *folder, const char *name, uint64_t elements);
+
+void stats_write_json (FILE *out);
+
+#endif /* __STATS_H__ */
@@ -0,0 +1,367 @@
+/*
+ * streaming.c
+ * This file is part of BKV Reader
+ *
+ * Copyright (C) 2022 - Félix Arreola Rodríguez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <unistd.h>
+#include <pthread.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+#include "mmf.h"
+#include "loader.h"
+#include "arena.h"
+#include "json.h"
+#include "spsc.h"
+#include "stats.h"
+#include "log.h"
+#include "blend.h"
+#include "material.h"
+#include "streaming.h"
+
+/* Un VertexData decodificado ocupa a lo más 4 veces su archivo (bytes a float),
+ * y los índices con RLE se estiman igual */
+#define STREAM_EXPANSION 4
+
+/* Elementos en cada cola entre etapas; el presupuesto limita los bytes */
+#define STREAM_QUEUE 16
+
+typedef struct {
+	Table *table;
+	int is_mesh;
+
+	/* Etapa 1: el archivo leído. Etapa 2: decodificado. Etapa 3: el texto del OBJ */
+	Preload preload;
+	VertexData vertex;
+	MeshData mesh;
+	JsonBuffer text;
+
+	size_t estimate;
+} StreamItem;
+
+typedef struct {
+	char *folder;
+	int do_endian;
+	size_t budget;
+
+	StreamItem *items;
+	int n_items;
+	int num_vertex;
+	int *vertex_base;
+
+	/* El índice del material de cada mesh, o -1 */
+	Material *materials;
+	int num_materials;
+	int *mesh_material;
+
+	/* Bytes estimados entre la lectura y la escritura */
+	size_t in_flight;
+	size_t peak_in_flight;
+
+	SpscQueue to_decode;
+	SpscQueue to_transform;
+	SpscQueue to_write;
+} StreamPipeline;
+
+static size_t file_size (const char *path) {
+	struct stat st;
+
+	if (stat (path, &st) < 0) return 0;
+
+	return (size_t) st.st_size;
+}
+
+static void stream_item_path (StreamPipeline *pipe, StreamItem *item, char *path, size_t len) {
+	snprintf (path, len, "%s/%s-%i", pipe->folder, (item->is_mesh ? "index" : "vertex"), get_key_as_int (item->table, "id"));
+}
+
+/* Etapa 1: lee cada archivo completo, sin pasar del presupuesto salvo con un solo elemento */
+static void *stream_io_stage (void *data) {
+	StreamPipeline *pipe = (StreamPipeline *) data;
+	StreamItem *item;
+	char path[8192];
+	size_t in_flight;
+	int g;
+
+	for (g = 0; g < pipe->n_items; g++) {
+		item = &pipe->items[g];
+
+		while ((in_flight = __atomic_load_n (&pipe->in_flight, __ATOMIC_ACQUIRE)) > 0 && in_flight + item->estimate > pipe->budget) {
+			usleep (100);
+		}
+		in_flight = __atomic_add_fetch (&pipe->in_flight, item->estimate, __ATOMIC_ACQ_REL);
+		if (in_flight > pipe->peak_in_flight) pipe->peak_in_flight = in_flight;
+
+		stream_item_path (pipe, item, path, sizeof (path));
+		preload_init (&item->preload);
+		preload_add (&item->preload, path);
+		preload_run (&item->preload, PRELOAD_THREADS, NULL);
+
+		spsc_push (&pipe->to_decode, item);
+	}
+
+	spsc_close (&pipe->to_decode);
+
+	return NULL;
+}
+
+/* Etapa 2: decodifica desde los bytes ya leídos y los suelta */
+static void *stream_decode_stage (void *data) {
+	StreamPipeline *pipe = (StreamPipeline *) data;
+	StreamItem *item;
+
+	do_endian = pipe->do_endian;
+
+	while ((item = (StreamItem *) spsc_pop (&pipe->to_decode)) != NULL) {
+		preload_set_current (&item->preload);
+
+		load_vertex_or_mesh (item->table, pipe->folder, (item->is_mesh ? NULL : &item->vertex), (item->is_mesh ? &item->mesh : NULL));
+
+		preload_set_current (NULL);
+		preload_free (&item->preload);
+
+		spsc_push (&pipe->to_transform, item);
+	}
+
+	spsc_close (&pipe->to_transform);
+
+	return NULL;
+}
+
+/* Etapa 3: expande a flotantes y da formato; los índices son relativos al VertexData del mesh */
+static void *stream_transform_stage (void *data) {
+	StreamPipeline *pipe = (StreamPipeline *) data;
+	StreamItem *item;
+	VertexData *vertex;
+	MeshData *mesh;
+	uint32_t t32;
+	int h, k;
+
+	do_endian = pipe->do_endian;
+
+	k = 0;
+	while ((item = (StreamItem *) spsc_pop (&pipe->to_transform)) != NULL) {
+		if (item->is_mesh) {
+			mesh = &item->mesh;
+
+			json_append (&item->text, "# g %s\n", mesh->name);
+			if (pipe->num_materials > 0) {
+				h = pipe->mesh_material[item - pipe->items - pipe->num_vertex];
+				json_append (&item->text, "usemtl %s\n", (h >= 0 ? pipe->materials[h].name : "None"));
+			}
+			t32 = 1;
+			if (mesh->vertex_data_id >= 0 && mesh->vertex_data_id < pipe->num_vertex) {
+				t32 += pipe->vertex_base[mesh->vertex_data_id];
+			}
+			for (h = 0; h + 2 < mesh->num_index; h = h + 3) {
+				json_append (&item->text, "f %i//1 %i//1 %i//1\n", mesh->index[h] + t32, mesh->index[h + 1] + t32, mesh->index[h + 2] + t32);
+			}
+
+			mmf_free (mesh->index);
+			mesh->index = NULL;
+		} else {
+			vertex = &item->vertex;
+
+			/* El OBJ solo admite flotantes */
+			vertex_data_expand (vertex);
+
+			pipe->vertex_base[k] = (k == 0 ? 0 : pipe->vertex_base[k - 1] + pipe->items[k - 1].vertex.num / 3);
+			for (h = 0; h + 2 < vertex->num; h = h + 3) {
+				json_append (&item->text, "v %.7f %.7f %.7f\n", vertex->vertex[h], vertex->vertex[h + 1], vertex->vertex[h + 2]);
+			}
+
+			mmf_free (vertex->vertex);
+			mmf_free (vertex->raw);
+			vertex->vertex = NULL;
+			vertex->raw = NULL;
+		}
+		k++;
+
+		spsc_push (&pipe->to_write, item);
+	}
+
+	spsc_close (&pipe->to_write);
+
+	return NULL;
+}
+
+long streaming_peak_rss_kb (void) {
+#ifndef _WIN32
+	struct rusage usage;
+
+	if (getrusage (RUSAGE_SELF, &usage) == 0) {
+		return usage.ru_maxrss;
+	}
+#endif
+
+	return -1;
+}
+
+/* Igual que obj_write después de load_model, pero sin tener el modelo completo en memoria.
+ * Lectura, decodificación, formato y escritura corren cada una en su hilo, y los elementos
+ * pasan en orden de una a otra; este hilo es el que escribe */
+int streaming_convert (char *folder, const char *file_path, size_t budget) {
+	StreamPipeline pipe;
+	BKVDesc desc;
+	Table *vertex_table, *meshes_tables, *t;
+	StreamItem *item;
+	FILE *fd_obj;
+	pthread_t io_thread, decode_thread, transform_thread;
+	char path[8192];
+	int num_meshes, written, failed;
+	int g;
+	StatScope model_scope, scope;
+
+	stats_begin (&model_scope, STAT_MODEL);
+
+	stats_begin (&scope, STAT_DESC);
+	g = read_bkv (&desc, folder, "desc");
+	stats_end (&scope, folder, "desc", desc.n_tables);
+
+	if (g < 0 || desc.n_tables == 0) {
+		bkv_free (&desc);
+		stats_end (&model_scope, NULL, folder, 0);
+		return -1;
+	}
+
+	memset (&pipe, 0, sizeof (pipe));
+	pipe.folder = folder;
+	pipe.do_endian = desc.do_endian;
+	pipe.budget = budget;
+
+	vertex_table = get_key_as_table (&desc.tables[0], "vertexDatas");
+	meshes_tables = get_key_as_table (&desc.tables[0], "meshes");
+
+	pipe.num_vertex = (vertex_table != NULL ? get_num_values (vertex_table) : 0);
+	num_meshes = (meshes_tables != NULL ? get_num_values (meshes_tables) : 0);
+
+	/* Los blend shapes se comparan contra su base, hace falta el modelo completo */
+	for (g = 0; g < num_meshes; g++) {
+		if (is_blend_shape_name (get_key_as_string (get_index_as_table (meshes_tables, g), "name"))) {
+			log_info ("%s has blend shapes, not streaming\n", folder);
+			bkv_free (&desc);
+			stats_end (&model_scope, NULL, folder, 0);
+			return 1;
+		}
+	}
+
+	/* Los Color-N.bkv son pequeños, se leen antes de empezar; el .mtl va junto al OBJ */
+	pipe.mesh_material = (int *) malloc (sizeof (int) * (num_meshes + 1));
+	for (g = 0; g < num_meshes; g++) {
+		t = get_index_as_table (meshes_tables, g);
+		pipe.mesh_material[g] = (get_key_as_boolean (t, "nonrendered") ? -1 : (int) get_key_as_int (t, "material"));
+	}
+	pipe.num_materials = materials_load (folder, pipe.mesh_material, num_meshes, &pipe.materials);
+
+	if (pipe.num_materials > 0) {
+		materials_mtl_path (file_path, path, sizeof (path));
+		fd_obj = (materials_write_mtl (path, pipe.materials, pipe.num_materials) == 0 ? fopen (file_path, "wb") : NULL);
+	} else {
+		fd_obj = fopen (file_path, "wb");
+	}
+
+	if (fd_obj == NULL) {
+		materials_free (pipe.materials, pipe.num_materials);
+		free (pipe.mesh_material);
+		bkv_free (&desc);
+		stats_end (&model_scope, NULL, folder, 0);
+		return -2;
+	}
+
+	if (pipe.num_materials > 0) {
+		fprintf (fd_obj, "mtllib %s\n", materials_path_basename (path));
+	}
+
+	pipe.n_items = pipe.num_vertex + num_meshes;
+	pipe.items = (StreamItem *) malloc (sizeof (StreamItem) * (pipe.n_items + 1));
+	memset (pipe.items, 0, sizeof (StreamItem) * (pipe.n_items + 1));
+	pipe.vertex_base = (int *) malloc (sizeof (int) * (pipe.num_vertex + 1));
+
+	for (g = 0; g < pipe.n_items; g++) {
+		item = &pipe.items[g];
+		item->is_mesh = (g >= pipe.num_vertex);
+		item->table = (item->is_mesh ? get_index_as_table (meshes_tables, g - pipe.num_vertex) : get_index_as_table (vertex_table, g));
+
+		stream_item_path (&pipe, item, path, sizeof (path));
+		item->estimate = file_size (path) * STREAM_EXPANSION;
+	}
+
+	spsc_init (&pipe.to_decode, STREAM_QUEUE);
+	spsc_init (&pipe.to_transform, STREAM_QUEUE);
+	spsc_init (&pipe.to_write, STREAM_QUEUE);
+
+	pthread_create (&io_thread, NULL, stream_io_stage, &pipe);
+	pthread_create (&decode_thread, NULL, stream_decode_stage, &pipe);
+	pthread_create (&transform_thread, NULL, stream_transform_stage, &pipe);
+
+	/* Etapa 4: escribir en orden, y liberar el lugar en el presupuesto */
+	written = failed = 0;
+	while ((item = (StreamItem *) spsc_pop (&pipe.to_write)) != NULL) {
+		if (written == pipe.num_vertex) {
+			fprintf (fd_obj, "vn 0 0 0\nusemtl None\ns 1\n");
+		}
+
+		if (item->text.len > 0 && fwrite (item->text.data, 1, item->text.len, fd_obj) != item->text.len) {
+			failed = 1;
+		}
+		free (item->text.data);
+		memset (&item->text, 0, sizeof (JsonBuffer));
+
+		__atomic_sub_fetch (&pipe.in_flight, item->estimate, __ATOMIC_ACQ_REL);
+		written++;
+	}
+
+	/* Sin meshes, la cabecera de las caras va al final */
+	if (written == pipe.num_vertex) {
+		fprintf (fd_obj, "vn 0 0 0\nusemtl None\ns 1\n");
+	}
+
+	pthread_join (io_thread, NULL);
+	pthread_join (decode_thread, NULL);
+	pthread_join (transform_thread, NULL);
+
+	spsc_free (&pipe.to_decode);
+	spsc_free (&pipe.to_transform);
+	spsc_free (&pipe.to_write);
+
+	free (pipe.vertex_base);
+	free (pipe.items);
+	materials_free (pipe.materials, pipe.num_materials);
+	free (pipe.mesh_material);
+	bkv_free (&desc);
+
+	stats_end (&model_scope, NULL, folder, pipe.n_items);
+
+	log_info ("Streaming: budget %lu KB, peak in flight %lu KB, peak RSS %li KB\n", (unsigned long) (budget / 1024), (unsigned long) (pipe.peak_in_flight / 1024), streaming_peak_rss_kb ());
+
+	if (fclose (fd_obj) != 0 || failed) {
+		return -2;
+	}
+
+	return 0;
+}
@@ -0,0 +1,13 @@
+#ifndef __STREAMING_H__
+#define __STREAMING_H__
+
+#include <stddef.h>
+
+/* Presupuesto por omisión de --stream, en MB */
+#define STREAM_DEFAULT_BUDGET 64
+
+/* 0 si se convirtió, 1 si el modelo necesita la ruta normal, -1 si no se pudo leer y -2 si no se pudo escribir */
+int streaming_convert (char *folder, const char *file_path, size_t budget);
+long streaming_peak_rss_kb (void);
+
+#endif /* __STREAMING_H__ */
@@ -0,0 +1,613 @@
+/*
+ * synth.c
+ * This file is part of BKV Reader
+ *
+ * Copyright (C) 2022 - Félix Arreola Rodríguez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+
+#include "mmf.h"
+#include "synth.h"
+
+/* Modelos sintéticos para medir el lector sin los archivos reales.
+ * Los valores multi-byte de transform, skeleton, vertex e index van en el orden pedido;
+ * las tablas del desc siempre en el del host, igual que las lee read_bkv */
+
+typedef struct {
+	unsigned char *data;
+	size_t len;
+	size_t size;
+
+	int swap;
+} SynthBuffer;
+
+static void buffer_put (SynthBuffer *buffer, const void *data, size_t len) {
+	if (buffer->len + len > buffer->size) {
+		buffer->size = (buffer->size + len) * 2;
+		buffer->data = (unsigned char *) realloc (buffer->data, buffer->size);
+	}
+
+	memcpy (buffer->data + buffer->len, data, len);
+	buffer->len += len;
+}
+
+static void buffer_put_u8 (SynthBuffer *buffer, uint8_t value) {
+	buffer_put (buffer, &value, 1);
+}
+
+static void buffer_put_u16 (SynthBuffer *buffer, uint16_t value) {
+	if (buffer->swap) value = (uint16_t) ((value >> 8) | (value << 8));
+
+	buffer_put (buffer, &value, 2);
+}
+
+static void buffer_put_u32 (SynthBuffer *buffer, uint32_t value) {
+	if (buffer->swap) value = __builtin_bswap32 (value);
+
+	buffer_put (buffer, &value, 4);
+}
+
+static void buffer_put_float (SynthBuffer *buffer, float value) {
+	uint32_t u32;
+
+	memcpy (&u32, &value, 4);
+	buffer_put_u32 (buffer, u32);
+}
+
+static int buffer_save (SynthBuffer *buffer, const char *folder, const char *name) {
+	char path[8192];
+	FILE *fd;
+	int r;
+
+	snprintf (path, sizeof (path), "%s/%s", folder, name);
+	fd = fopen (path, "wb");
+	if (fd == NULL) return -1;
+
+	r = (fwrite (buffer->data, 1, buffer->len, fd) == buffer->len ? 0 : -1);
+	if (fclose (fd) != 0) r = -1;
+
+	free (buffer->data);
+	memset (buffer, 0, sizeof (SynthBuffer));
+
+	return r;
+}
+
+/* Un desc: cadenas sin repetir y las tablas, con sus posiciones calculadas antes de escribirlas */
+typedef struct {
+	SynthBuffer strings;
+	SynthBuffer tables;
+} SynthBKV;
+
+static uint16_t bkv_string (SynthBKV *bkv, const char *word) {
+	size_t pos;
+
+	for (pos = 0; pos < bkv->strings.len; pos += strlen ((char *) &bkv->strings.data[pos]) + 1) {
+		if (strcmp ((char *) &bkv->strings.data[pos], word) == 0) return (uint16_t) pos;
+	}
+
+	buffer_put (&bkv->strings, word, strlen (word) + 1);
+
+	return (uint16_t) pos;
+}
+
+static void bkv_entry (SynthBKV *bkv, const char *name, int array_index, uint8_t type) {
+	uint16_t key;
+
+	key = (name != NULL ? bkv_string (bkv, name) : (uint16_t) (0x8000 | array_index));
+	buffer_put (&bkv->tables, &key, 2);
+	buffer_put (&bkv->tables, &type, 1);
+}
+
+static void bkv_table (SynthBKV *bkv, uint16_t entries) {
+	buffer_put (&bkv->tables, &entries, 2);
+}
+
+static void bkv_int (SynthBKV *bkv, const char *name, uint32_t value) {
+	bkv_entry (bkv, name, 0, 5);
+	buffer_put (&bkv->tables, &value, 4);
+}
+
+static void bkv_byte (SynthBKV *bkv, const char *name, uint8_t value) {
+	bkv_entry (bkv, name, 0, 3);
+	buffer_put (&bkv->tables, &value, 1);
+}
+
+static void bkv_float (SynthBKV *bkv, const char *name, float value) {
+	bkv_entry (bkv, name, 0, 2);
+	buffer_put (&bkv->tables, &value, 4);
+}
+
+static void bkv_str (SynthBKV *bkv, const char *name, const char *value) {
+	uint16_t pos;
+
+	bkv_entry (bkv, name, 0, 6);
+	pos = bkv_string (bkv, value);
+	buffer_put (&bkv->tables, &pos, 2);
+}
+
+static void bkv_ref (SynthBKV *bkv, const char *name, int array_index, uint16_t table_pos) {
+	bkv_entry (bkv, name, array_index, 7);
+	buffer_put (&bkv->tables, &table_pos, 2);
+}
+
+static int bkv_save (SynthBKV *bkv, const char *folder, const char *name, int big_endian) {
+	SynthBuffer out;
+	uint32_t t32;
+
+	memset (&out, 0, sizeof (out));
+
+	/* Con la firma al revés el lector voltea los demás archivos */
+	buffer_put (&out, (big_endian ? "VKB$" : "$BKV"), 4);
+	buffer_put_u8 (&out, 0);
+	buffer_put_u8 (&out, 0);
+
+	t32 = bkv->strings.len;
+	buffer_put (&out, &t32, 4);
+	buffer_put (&out, bkv->strings.data, bkv->strings.len);
+
+	t32 = 0;
+	buffer_put (&out, &t32, 4);
+
+	t32 = bkv->tables.len;
+	buffer_put (&out, &t32, 4);
+	buffer_put (&out, bkv->tables.data, bkv->tables.len);
+
+	free (bkv->strings.data);
+	free (bkv->tables.data);
+
+	return buffer_save (&out, folder, name);
+}
+
+static int clamp_int (double value, int min, int max) {
+	if (value < min) return min;
+	if (value > max) return max;
+
+	return (int) lround (value);
+}
+
+/* Una superficie ondulada en [0, 1] x [0, 1], con altura en [-1, 1] */
+static void synth_vertex (SynthBuffer *out, int grid, int encoding, int offset) {
+	double coords[3];
+	int x, y, c;
+
+	for (y = 0; y < grid; y++) {
+		for (x = 0; x < grid; x++) {
+			coords[0] = (double) x / (grid > 1 ? grid - 1 : 1);
+			coords[1] = (double) y / (grid > 1 ? grid - 1 : 1);
+			coords[2] = sin (x * 0.37 + y * 0.21 + offset) * 0.8;
+
+			for (c = 0; c < 3; c++) {
+				switch (encoding) {
+					case ENCODING_NONE:
+						buffer_put_float (out, (float) (coords[c] + (c == 0 ? offset : 0)));
+						break;
+					case ENCODING_BYTE:
+						buffer_put_u8 (out, clamp_int ((coords[c] + (c == 2 ? 1.0 : 0.0)) / (c == 2 ? 2.0 : 1.0) * 255.0, 0, 255));
+						break;
+					case ENCODING_BYTE_SIGNED:
+						buffer_put_u8 (out, (uint8_t) (int8_t) clamp_int (coords[c] * 127.0, -127, 127));
+						break;
+					case ENCODING_SHORT:
+						buffer_put_u16 (out, clamp_int ((coords[c] + (c == 2 ? 1.0 : 0.0)) / (c == 2 ? 2.0 : 1.0) * 65535.0, 0, 65535));
+						break;
+					case ENCODING_SHORT_SIGNED:
+						buffer_put_u16 (out, (uint16_t) (int16_t) clamp_int (coords[c] * 32767.0, -32767, 32767));
+						break;
+					case UNENCODED_BYTE:
+						buffer_put_u8 (out, clamp_int ((coords[c] + 1.0) * 100.0, 0, 255));
+						break;
+					case UNENCODED_BYTE_SIGNED:
+						buffer_put_u8 (out, (uint8_t) (int8_t) clamp_int (coords[c] * 100.0, -127, 127));
+						break;
+					case UNENCODED_SHORT:
+						buffer_put_u16 (out, clamp_int ((coords[c] + 1.0) * 1000.0, 0, 65535));
+						break;
+					case UNENCODED_SHORT_SIGNED:
+						buffer_put_u16 (out, (uint16_t) (int16_t) clamp_int (coords[c] * 1000.0, -32767, 32767));
+						break;
+				}
+			}
+		}
+	}
+}
+
+static void index_put (SynthBuffer *out, int wide, uint32_t value) {
+	if (wide) {
+		buffer_put_u32 (out, value);
+	} else {
+		buffer_put_u16 (out, (uint16_t) value);
+	}
+}
+
+/* Corridas de valores consecutivos como RLE (marca, inicio, cantidad) si se pide y valen la pena,
+ * lo demás en bloques literales (marca 0, cantidad, valores) */
+static void synth_index_encode (SynthBuffer *out, const uint32_t *index, int count, int wide, int rle) {
+	uint32_t max_chunk;
+	int g, h, run, literal;
+
+	max_chunk = (wide ? 0x7FFFFFFF : 0xFFFF);
+
+	buffer_put_u8 (out, (uint8_t) wide);
+	index_put (out, wide, count);
+	buffer_put_u8 (out, 1);
+
+	g = 0;
+	while (g < count) {
+		run = 1;
+		while (rle && g + run < count && index[g + run] == index[g] + run && (uint32_t) run < max_chunk) run++;
+
+		if (rle && run >= 3) {
+			buffer_put_u8 (out, 1);
+			index_put (out, wide, index[g]);
+			index_put (out, wide, run);
+			g += run;
+			continue;
+		}
+
+		/* Hasta donde empiece la siguiente corrida */
+		literal = 0;
+		for (h = g; h < count && (uint32_t) literal < max_chunk; h++, literal++) {
+			if (rle && h + 2 < count && index[h + 1] == index[h] + 1 && index[h + 2] == index[h] + 2) break;
+		}
+		if (literal == 0) literal = 1;
+
+		buffer_put_u8 (out, 0);
+		index_put (out, wide, literal);
+		for (h = 0; h < literal; h++) {
+			index_put (out, wide, index[g + h]);
+		}
+		g += literal;
+	}
+}
+
+/* Los meshes literales son la malla completa en triángulos, en desorden; los RLE recorren cada fila
+ * con índices seguidos, como los de un mesh sin vértices compartidos */
+static int synth_index (uint32_t **index, int grid, int rle, uint32_t *seed) {
+	uint32_t a, tmp[3];
+	int x, y, count, g, h, n_tris;
+
+	*index = (uint32_t *) malloc (sizeof (uint32_t) * 6 * (size_t) grid * grid + 3);
+	count = 0;
+
+	if (rle) {
+		for (y = 0; y < grid; y++) {
+			for (x = 0; x + 2 < grid; x += 3) {
+				a = y * grid + x;
+				(*index)[count++] = a;
+				(*index)[count++] = a + 1;
+				(*index)[count++] = a + 2;
+			}
+		}
+
+		return count;
+	}
+
+	for (y = 0; y + 1 < grid; y++) {
+		for (x = 0; x + 1 < grid; x++) {
+			a = y * grid + x;
+			(*index)[count++] = a;
+			(*index)[count++] = a + 1;
+			(*index)[count++] = a + grid;
+			(*index)[count++] = a + 1;
+			(*index)[count++] = a + grid + 1;
+			(*index)[count++] = a + grid;
+		}
+	}
+
+	/* Barajar los triángulos, así no hay corridas por accidente */
+	n_tris = count / 3;
+	for (g = n_tris - 1; g > 0; g--) {
+		*seed = *seed * 1103515245u + 12345u;
+		h = (*seed >> 8) % (g + 1);
+
+		memcpy (tmp, &(*index)[g * 3], sizeof (tmp));
+		memcpy (&(*index)[g * 3], &(*index)[h * 3], sizeof (tmp));
+		memcpy (&(*index)[h * 3], tmp, sizeof (tmp));
+	}
+
+	return count;
+}
+
+static int synth_transform (const char *folder, int count, int big_endian) {
+	SynthBuffer out;
+	int g;
+
+	memset (&out, 0, sizeof (out));
+	out.swap = big_endian;
+
+	buffer_put_u8 (&out, ENCODING_SHORT_SIGNED);
+	buffer_put_u16 (&out, count);
+	for (g = 0; g < count; g++) {
+		buffer_put_float (&out, g * 0.5);
+		buffer_put_float (&out, 0.0);
+		buffer_put_float (&out, -g * 0.25);
+
+		/* Cuaternión identidad */
+		buffer_put_u16 (&out, 0);
+		buffer_put_u16 (&out, 0);
+		buffer_put_u16 (&out, 0);
+		buffer_put_u16 (&out, 32767);
+
+		buffer_put_float (&out, 1.0);
+	}
+
+	return buffer_save (&out, folder, "transform");
+}
+
+/* Una cadena de huesos, cada uno hijo del anterior */
+static int synth_skeleton (const char *folder, int bones, int big_endian) {
+	SynthBuffer out;
+	char name[32];
+	int g;
+
+	memset (&out, 0, sizeof (out));
+	out.swap = big_endian;
+
+	buffer_put_u8 (&out, bones);
+	for (g = 0; g < bones; g++) {
+		snprintf (name, sizeof (name), "bone%i", g);
+		buffer_put_u16 (&out, strlen (name));
+		buffer_put (&out, name, strlen (name));
+
+		buffer_put_u8 (&out, (g == 0 ? 255 : g - 1));
+		if (g + 1 < bones) {
+			buffer_put_u8 (&out, 1);
+			buffer_put_u8 (&out, g + 1);
+		} else {
+			buffer_put_u8 (&out, 0);
+		}
+
+		buffer_put_u16 (&out, g);
+		buffer_put_u16 (&out, g);
+	}
+
+	return buffer_save (&out, folder, "skeleton");
+}
+
+void synth_default_options (SynthOptions *options) {
+	memset (options, 0, sizeof (SynthOptions));
+
+	options->vertex_datas = 9;
+	options->meshes = 18;
+	options->grid = 64;
+	options->encoding = -1;
+	options->big_endian = 0;
+	options->index_mode = SYNTH_INDEX_MIXED;
+	options->seed = 1;
+}
+
+int synth_model (const char *folder, const SynthOptions *options) {
+	SynthBKV bkv;
+	SynthBuffer out;
+	char name[64];
+	uint32_t *index, seed;
+	uint16_t vertex_list, mesh_list, first_vertex, first_mesh, pos;
+	int n_vertex, n_meshes, encoding, count, wide, rle, bones;
+	int g;
+
+	n_vertex = options->vertex_datas;
+	n_meshes = options->meshes;
+	if (n_vertex < 1) n_vertex = 1;
+	if (n_vertex > SYNTH_MAX_ENTRIES) n_vertex = SYNTH_MAX_ENTRIES;
+	if (n_meshes < 0) n_meshes = 0;
+	if (n_meshes > SYNTH_MAX_ENTRIES) n_meshes = SYNTH_MAX_ENTRIES;
+
+#ifdef _WIN32
+	mkdir (folder);
+#else
+	mkdir (folder, 0755);
+#endif
+
+	/* Posiciones de cada tabla: raíz, lista de VertexData, lista de meshes, y luego cada uno */
+	vertex_list = 2 + 2 * 5;
+	mesh_list = vertex_list + 2 + n_vertex * 5;
+	first_vertex = mesh_list + 2 + n_meshes * 5;
+	first_mesh = first_vertex;
+	for (g = 0; g < n_vertex; g++) {
+		encoding = (options->encoding < 0 ? g % 9 : options->encoding);
+		first_mesh += 2 + 7 + (encoding != ENCODING_NONE ? 4 : 0);
+	}
+
+	memset (&bkv, 0, sizeof (bkv));
+
+	bkv_table (&bkv, 2);
+	bkv_ref (&bkv, "vertexDatas", 0, vertex_list);
+	bkv_ref (&bkv, "meshes", 0, mesh_list);
+
+	bkv_table (&bkv, n_vertex);
+	pos = first_vertex;
+	for (g = 0; g < n_vertex; g++) {
+		bkv_ref (&bkv, NULL, g, pos);
+		encoding = (options->encoding < 0 ? g % 9 : options->encoding);
+		pos += 2 + 7 + (encoding != ENCODING_NONE ? 4 : 0);
+	}
+
+	bkv_table (&bkv, n_meshes);
+	for (g = 0; g < n_meshes; g++) {
+		bkv_ref (&bkv, NULL, g, first_mesh + g * (2 + 7 + 5 + 7 + 7));
+	}
+
+	for (g = 0; g < n_vertex; g++) {
+		encoding = (options->encoding < 0 ? g % 9 : options->encoding);
+
+		bkv_table (&bkv, (encoding != ENCODING_NONE ? 2 : 1));
+		bkv_int (&bkv, "id", g);
+		if (encoding != ENCODING_NONE) bkv_byte (&bkv, "encoding", encoding);
+	}
+
+	for (g = 0; g < n_meshes; g++) {
+		snprintf (name, sizeof (name), "mesh%i", g);
+
+		bkv_table (&bkv, 4);
+		bkv_int (&bkv, "id", g);
+		bkv_str (&bkv, "name", name);
+		bkv_int (&bkv, "vert", g % n_vertex);
+		bkv_int (&bkv, "material", 0);
+	}
+
+	if (bkv.tables.len > 0xFFFF || bkv.strings.len >= 0x8000) {
+		free (bkv.strings.data);
+		free (bkv.tables.data);
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (bkv_save (&bkv, folder, "desc", options->big_endian) < 0) return -1;
+
+	/* Un material, como los Color-N.bkv de los modelos reales */
+	memset (&bkv, 0, sizeof (bkv));
+	bkv_table (&bkv, 2);
+	bkv_str (&bkv, "name", "synthetic");
+	bkv_float (&bkv, "diffuse", 0.5);
+	if (bkv_save (&bkv, folder, "Color-0.bkv", options->big_endian) < 0) return -1;
+
+	bones = 4;
+	if (synth_transform (folder, bones, options->big_endian) < 0) return -1;
+	if (synth_skeleton (folder, bones, options->big_endian) < 0) return -1;
+
+	for (g = 0; g < n_vertex; g++) {
+		encoding = (options->encoding < 0 ? g % 9 : options->encoding);
+
+		memset (&out, 0, sizeof (out));
+		out.swap = options->big_endian;
+		synth_vertex (&out, options->grid, encoding, g);
+
+		snprintf (name, sizeof (name), "vertex-%i", g);
+		if (buffer_save (&out, folder, name) < 0) return -1;
+	}
+
+	seed = options->seed;
+	wide = ((uint32_t) options->grid * options->grid > 0xFFFF);
+	for (g = 0; g < n_meshes; g++) {
+		rle = (options->index_mode == SYNTH_INDEX_RLE || (options->index_mode == SYNTH_INDEX_MIXED && (g % 2) == 1));
+
+		count = synth_index (&index, options->grid, rle, &seed);
+
+		memset (&out, 0, sizeof (out));
+		out.swap = options->big_endian;
+		synth_index_encode (&out, index, count, wide, rle);
+		free (index);
+
+		snprintf (name, sizeof (name), "index-%i", g);
+		if (buffer_save (&out, folder, name) < 0) return -1;
+	}
+
+	return 0;
+}
+
+static int compare_names (const void *a, const void *b) {
+	return strcmp (*(char * const *) a, *(char * const *) b);
+}
+
+/* Todos los archivos de la carpeta en un DPACK: cantidad, tamaños, nombres y los datos */
+int synth_dpack (const char *folder, const char *dpack_path) {
+	SynthBuffer out;
+	DIR *d;
+	struct dirent *entry;
+	struct stat st;
+	FILE *fd;
+	char path[8192], **names;
+	unsigned char buffer[65536];
+	uint32_t t32;
+	uint16_t t16;
+	size_t r;
+	int n_names, size, g, failed;
+
+	d = opendir (folder);
+	if (d == NULL) return -1;
+
+	names = NULL;
+	n_names = size = 0;
+	while ((entry = readdir (d)) != NULL) {
+		snprintf (path, sizeof (path), "%s/%s", folder, entry->d_name);
+		if (stat (path, &st) < 0 || !S_ISREG (st.st_mode)) continue;
+
+		if (n_names == size) {
+			size = (size == 0 ? 32 : size * 2);
+			names = (char **) realloc (names, sizeof (char *) * size);
+		}
+		names[n_names++] = strdup (entry->d_name);
+	}
+	closedir (d);
+
+	qsort (names, n_names, sizeof (char *), compare_names);
+
+	memset (&out, 0, sizeof (out));
+	t32 = DPACK_MAGIC;
+	buffer_put (&out, &t32, 4);
+	t16 = n_names;
+	buffer_put (&out, &t16, 2);
+
+	for (g = 0; g < n_names; g++) {
+		snprintf (path, sizeof (path), "%s/%s", folder, names[g]);
+		stat (path, &st);
+		t32 = st.st_size;
+		buffer_put (&out, &t32, 4);
+	}
+
+	for (g = 0; g < n_names; g++) {
+		t16 = strlen (names[g]);
+		buffer_put (&out, &t16, 2);
+		buffer_put (&out, names[g], t16);
+	}
+
+	failed = 0;
+	for (g = 0; g < n_names && !failed; g++) {
+		snprintf (path, sizeof (path), "%s/%s", folder, names[g]);
+		fd = fopen (path, "rb");
+		if (fd == NULL) {
+			failed = 1;
+			break;
+		}
+
+		while ((r = fread (buffer, 1, sizeof (buffer), fd)) > 0) {
+			buffer_put (&out, buffer, r);
+		}
+		fclose (fd);
+	}
+
+	for (g = 0; g < n_names; g++) {
+		free (names[g]);
+	}
+	free (names);
+
+	if (failed) {
+		free (out.data);
+		return -1;
+	}
+
+	fd = fopen (dpack_path, "wb");
+	if (fd == NULL) {
+		free (out.data);
+		return -1;
+	}
+
+	failed = (fwrite (out.data, 1, out.len, fd) != out.len);
+	if (fclose (fd) != 0) failed = 1;
+	free (out.data);
+
+	return (failed ? -1 : 0);
+}
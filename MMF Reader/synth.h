@@ -0,0 +1,35 @@
+#ifndef __SYNTH_H__
+#define __SYNTH_H__
+
+#include <stdint.h>
+
+enum {
+	SYNTH_INDEX_LITERAL = 0,
+	SYNTH_INDEX_RLE,
+	SYNTH_INDEX_MIXED
+};
+
+typedef struct {
+	/* Cuántos VertexData y meshes; como las tablas del desc usan posiciones de 16 bits,
+	 * cada uno se limita a SYNTH_MAX_ENTRIES */
+	int vertex_datas;
+	int meshes;
+
+	/* Vértices por lado de la malla de cada VertexData */
+	int grid;
+
+	/* ENCODING_* para todos, o -1 para que el VertexData N use la codificación N % 9 */
+	int encoding;
+
+	int big_endian;
+	int index_mode;
+	uint32_t seed;
+} SynthOptions;
+
+#define SYNTH_MAX_ENTRIES 1024
+
+void synth_default_options (SynthOptions *options);
+int synth_model (const char *folder, const SynthOptions *options);
+int synth_dpack (const char *folder, const char *dpack_path);
+
+#endif /* __SYNTH_H__ */
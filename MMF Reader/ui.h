@@ -7,5 +7,6 @@ void ui_show_message_error (const char *message);
 void ui_show_message_warning (const char *message);
 void ui_show_message_info (const char *message);
 char *ui_save_file (void);
+int ui_is_batch (void);
 
 #endif /* __UI_H__ */
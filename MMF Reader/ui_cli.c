@@ -0,0 +1,132 @@
+/*
+ * ui_cli.c
+ * This file is part of BKV Reader
+ *
+ * Copyright (C) 2022 - Félix Arreola Rodríguez
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+/* Interfaz sin ventanas: las carpetas y la ruta de salida vienen de la línea de comandos */
+
+static int cli_argc = 0;
+static char **cli_argv = NULL;
+static int cli_next = 1;
+static int cli_given = 0;
+
+static const char *output_dir = ".";
+static const char *output_format = "obj";
+static char *current_folder = NULL;
+
+void ui_init (int *argc, char ***argv) {
+	int g;
+
+	cli_argc = *argc;
+	cli_argv = *argv;
+
+	for (g = 1; g < cli_argc; g++) {
+		if ((strcmp (cli_argv[g], "-o") == 0 || strcmp (cli_argv[g], "--output") == 0) && g + 1 < cli_argc) {
+			output_dir = cli_argv[g + 1];
+			g++;
+		} else if (strncmp (cli_argv[g], "--output=", 9) == 0) {
+			output_dir = &cli_argv[g][9];
+		} else if (strncmp (cli_argv[g], "--format=", 9) == 0) {
+			output_format = &cli_argv[g][9];
+		}
+	}
+}
+
+char *ui_get_mmf_directory (void) {
+	while (cli_next < cli_argc) {
+		if (strcmp (cli_argv[cli_next], "-o") == 0 || strcmp (cli_argv[cli_next], "--output") == 0) {
+			/* Saltar también el valor */
+			cli_next += 2;
+			continue;
+		}
+
+		if (cli_argv[cli_next][0] == '-') {
+			cli_next++;
+			continue;
+		}
+
+		free (current_folder);
+		current_folder = strdup (cli_argv[cli_next]);
+		cli_next++;
+		cli_given++;
+
+		return strdup (current_folder);
+	}
+
+	if (cli_given == 0) {
+		fprintf (stderr, "Usage: %s [options] [-o output_dir] [--format=obj|glb|mmfb] mmf_folder...\n", cli_argv[0]);
+	}
+
+	return NULL;
+}
+
+void ui_show_message_error (const char *message) {
+	fprintf (stderr, "%s: Error: %s\n", (current_folder != NULL ? current_folder : cli_argv[0]), message);
+}
+
+void ui_show_message_warning (const char *message) {
+	fprintf (stderr, "%s: Warning: %s\n", (current_folder != NULL ? current_folder : cli_argv[0]), message);
+}
+
+void ui_show_message_info (const char *message) {
+	fprintf (stderr, "%s: %s\n", (current_folder != NULL ? current_folder : cli_argv[0]), message);
+}
+
+char *ui_save_file (void) {
+	char *path, *base, *name;
+	size_t len;
+
+	if (current_folder == NULL) return NULL;
+
+	/* El archivo de salida se llama como la carpeta del modelo */
+	base = strdup (current_folder);
+	len = strlen (base);
+	while (len > 1 && (base[len - 1] == '/' || base[len - 1] == '\\')) {
+		base[--len] = 0;
+	}
+
+	name = strrchr (base, '/');
+	if (strrchr (base, '\\') > name) name = strrchr (base, '\\');
+	name = (name == NULL ? base : name + 1);
+
+	/* Un DPACK se llama como el modelo más ".dpack", un modelo compilado más ".mmfb" */
+	len = strlen (name);
+	if (len > 6 && strcasecmp (&name[len - 6], ".dpack") == 0) {
+		name[len - 6] = 0;
+	} else if (len > 5 && strcasecmp (&name[len - 5], ".mmfb") == 0) {
+		name[len - 5] = 0;
+	}
+
+	len = strlen (output_dir) + strlen (name) + strlen (output_format) + 3;
+	path = (char *) malloc (len);
+	snprintf (path, len, "%s/%s.%s", output_dir, name, output_format);
+
+	free (base);
+
+	return path;
+}
+
+int ui_is_batch (void) {
+	return 1;
+}
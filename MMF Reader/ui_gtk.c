@@ -75,6 +75,16 @@ char *ui_save_file (void) {
 	gtk_file_filter_add_pattern (filter, "*.obj");
 	gtk_file_chooser_add_filter (GTK_FILE_CHOOSER (folder_open), filter);
 	
+	filter = gtk_file_filter_new ();
+	gtk_file_filter_set_name (filter, "Binary glTF file (*.glb)");
+	gtk_file_filter_add_pattern (filter, "*.glb");
+	gtk_file_chooser_add_filter (GTK_FILE_CHOOSER (folder_open), filter);
+	
+	filter = gtk_file_filter_new ();
+	gtk_file_filter_set_name (filter, "Compiled MMF bundle (*.mmfb)");
+	gtk_file_filter_add_pattern (filter, "*.mmfb");
+	gtk_file_chooser_add_filter (GTK_FILE_CHOOSER (folder_open), filter);
+	
 	filter = gtk_file_filter_new ();
 	gtk_file_filter_set_name (filter, "All files");
 	gtk_file_filter_add_pattern (filter, "*");
@@ -95,3 +105,6 @@ char *ui_save_file (void) {
 	return path_b;
 }
 
+int ui_is_batch (void) {
+	return 0;
+}
@@ -73,7 +73,7 @@ char *ui_save_file (void) {
 
 	ofn.lStructSize = sizeof(ofn);
 	ofn.hwndOwner = NULL;
-	ofn.lpstrFilter = (LPCWSTR)"Wavefront OBJ file (*.obj)\0*.obj\0All Files (*.*)\0*.*\0";
+	ofn.lpstrFilter = (LPCWSTR)"Wavefront OBJ file (*.obj)\0*.obj\0Binary glTF file (*.glb)\0*.glb\0Compiled MMF bundle (*.mmfb)\0*.mmfb\0All Files (*.*)\0*.*\0";
 	ofn.lpstrFile = szFileName;
 	ofn.nMaxFile = MAX_PATH;
 	ofn.Flags = OFN_EXPLORER | OFN_FILEMUSTEXIST | OFN_HIDEREADONLY;
@@ -83,3 +83,7 @@ char *ui_save_file (void) {
 
 	return strdup (szFileName);
 }
+
+int ui_is_batch (void) {
+	return 0;
+}